@@ -2,16 +2,17 @@
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
-#include <dirent.h>
 #include <ctime>
 #include <algorithm>
+#include <limits.h>
 #include <sys/stat.h>
 #include <sys/statfs.h>
-#include <sys/statvfs.h>
 #include <sys/mount.h>
 
 #include "SDCard.h"
 #include "utils.hpp"
+#include "vfs.h"
+#include "timefmt.h"
 
 #define LOCAL_DBG_EN			(0)
 
@@ -21,11 +22,74 @@
 #define LOCAL_DBG(fmt, ...)
 #endif
 
+static int parseRecordName(const char *name, RecordDesc &desc);
+static bool sortListByTime(const RecordDesc &t1, const RecordDesc &t2);
+static void toAudioRecordName(const char *videoDesc, char *audioDesc, size_t len);
+static uint64_t findNonce(const std::vector<SegIndexEntry> &entries, uint8_t trackMask);
+
+static int openDirectoryAt(int parentFd, const char *name, bool isCreated) {
+	if (parentFd == -1) {
+		errno = EBADF;
+		return -1;
+	}
+
+	if (isCreated) {
+		getFileSystem().mkdirat(parentFd, name, S_IRWXU | S_IRWXG | S_IRWXO);
+	}
+
+	return getFileSystem().openat(parentFd, name, O_RDONLY | O_DIRECTORY);
+}
+
+/* Day folder holds only records, they're unlinked relative to it. Anything else falls back to removeAll() */
+static void removeDirectoryAt(int parentFd, const char *name, const std::string &pathToDirectory) {
+	std::vector<std::string> names;
+	bool hasDirectories = false;
+
+	int fd = openDirectoryAt(parentFd, name, false);
+	if (fd == -1) {
+		if (errno != ENOENT) {
+			getFileSystem().removeAll(pathToDirectory.c_str());
+		}
+		return;
+	}
+
+	getFileSystem().visitDirectoryAt(fd, [&](const char *entry, bool isDirectory) {
+		if (isDirectory) {
+			hasDirectories = true;
+		}
+		else {
+			names.emplace_back(entry);
+		}
+	});
+
+	for (auto &entry : names) {
+		getFileSystem().unlinkat(fd, entry.c_str(), 0);
+	}
+	getFileSystem().close(fd);
+
+	if (hasDirectories || getFileSystem().unlinkat(parentFd, name, AT_REMOVEDIR) != 0) {
+		getFileSystem().removeAll(pathToDirectory.c_str());
+	}
+}
+
 
 SDCard::SDCard(std::string hardDrive) {
-	mPOSIXMutex = PTHREAD_MUTEX_INITIALIZER;
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	/* Playlist queries take it on a catalog miss, also from a caller already in ENTRY_ATOMIC() */
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&mPOSIXMutex, &attr);
+	pthread_mutexattr_destroy(&attr);
 
 	this->hardDrive.assign(hardDrive);
+	this->ioScheduler = std::make_shared<IOScheduler>();
+	memset(&mCardProfile, 0, sizeof(mCardProfile));
+
+	for (auto &folder : mDayFolders) {
+		folder.dateTime[0] = '\0';
+		folder.videoFd = folder.audioFd = -1;
+		folder.lastUsed = 0;
+	}
 
 	struct statfs fsStat;
     /* Query the f_type field to determine if the filesystem is mounted */
@@ -43,6 +107,7 @@ SDCard::~SDCard() {
 	if (mState == eState::Mounted) {
 		setOperation(eOperations::Unmount);
 	}
+	closeDirectories();
 	pthread_mutex_destroy(&mPOSIXMutex);
 }
 
@@ -79,15 +144,38 @@ int SDCard::setOperation(eOperations oper) {
 	break;
 
 	case eOperations::Unmount: {
+		closeDirectories();
 		ret = (umount2(mountPoint.c_str(), MNT_FORCE | MNT_DETACH) != -1) ? SDCARD_RETURN_SUCCESS : SDCARD_UNMOUNT_FAILURE;
 	}
 	break;
 
 	case eOperations::Format: {
-		std::string fmtCmd = SDCARD_FORMAT_COMMAND + std::string(" ") + hardDrive;
-		LOCAL_DBG("SD Card fmt by command: %s\n", fmtCmd.c_str());
+		LOCAL_DBG("SD Card quick format %s\n", hardDrive.c_str());
+
+		/*  A detached mount stays live while files of it are opened, its writes would land over
+			the new FAT: recorders and staging migrations let go of the card first.
+		*/
+		lockPOSIXMutex();
+		closeCurrentSession(*this);
+		unLockPOSIXMutex();
+		if (mStagingTier) {
+			mStagingTier->discardAll();
+		}
+		closeDirectories();
 		umount2(mountPoint.c_str(), MNT_FORCE | MNT_DETACH);
-		ret = (system(fmtCmd.c_str()) == 0 ? SDCARD_RETURN_SUCCESS : SDCARD_FORMAT_FAILURE); /* The program will wait for this complete */
+		clearSegmentIndexes();
+		clearMotionBitmaps();
+		mStorageSummary.reset();
+
+		/* Format runs in background, SD Card stays InProcess until it's completed (see getFormatProgress()) */
+		int formatRet = mFormatter.start(hardDrive);
+		if (formatRet == FATFORMAT_RETURN_BUSY) {
+			LOCAL_DBG("SD Card %s is still in use, not formatted\n", hardDrive.c_str());
+		}
+		ret = (formatRet == FATFORMAT_RETURN_SUCCESS) ? SDCARD_RETURN_SUCCESS : SDCARD_FORMAT_FAILURE;
+		if (ret == SDCARD_RETURN_SUCCESS) {
+			mState = eState::InProcess;
+		}
 	}
 	break;
 	
@@ -101,7 +189,7 @@ int SDCard::setOperation(eOperations oper) {
 bool SDCard::isInserted() {
 #if 1
 	struct stat fStat;
-	bool ret = (stat(hardDrive.c_str(), &fStat) != -1) ? true : false;
+	bool ret = (getFileSystem().stat(hardDrive.c_str(), &fStat) != -1) ? true : false;
 #else
 	bool ret = access(hardDrive.c_str(), R_OK) == 0 ? true : false;
 #endif
@@ -111,10 +199,10 @@ bool SDCard::isInserted() {
 
 bool SDCard::hasMountPoint() {
 	bool ret = false;
-	struct statvfs statvFs;
+	FsInfo fsInfo;
 
-	if (statvfs(mountPoint.c_str(), &statvFs) == 0) {
-		if (statvFs.f_fsid != 0) {
+	if (getFileSystem().statfs(mountPoint.c_str(), fsInfo) == 0) {
+		if (fsInfo.fsid != 0) {
 			ret = true;
 		}
 	}
@@ -123,263 +211,1203 @@ bool SDCard::hasMountPoint() {
 }
 
 bool SDCard::isVFatFmt() {
-	struct statfs fStatfs;
+	FsInfo fsInfo;
 	bool ret = false;
 
-    if (statfs(mountPoint.c_str(), &fStatfs) != -1) {
-		ret = (fStatfs.f_type == 0x4D44) ? true : false; /* REFERENCE https://man7.org/linux/man-pages/man2/statfs.2.html */
+    if (getFileSystem().statfs(mountPoint.c_str(), fsInfo) != -1) {
+		ret = (fsInfo.type == VFS_MSDOS_SUPER_MAGIC) ? true : false; /* REFERENCE https://man7.org/linux/man-pages/man2/statfs.2.html */
     }
 
 	return ret;
 }
 
 void SDCard::updateCapacity() {
-	struct statfs fStatfs;
+	FsInfo fsInfo;
 
 	memset(&mCapacity, 0, sizeof(mCapacity));
 
-	if (statfs(mountPoint.c_str(), &fStatfs) != -1) {
-		size_t blockSize = (uint64_t)fStatfs.f_bsize;
-		mCapacity.total  = (uint64_t)blockSize * (uint64_t)fStatfs.f_blocks;
-		mCapacity.free   = (uint64_t)blockSize * (uint64_t)fStatfs.f_bfree;
-		mCapacity.used   = (uint64_t)blockSize * ((uint64_t)fStatfs.f_blocks - (uint64_t)fStatfs.f_bfree);
+	IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::Metadata);
+
+	if (getFileSystem().statfs(mountPoint.c_str(), fsInfo) != -1) {
+		mCapacity.total  = fsInfo.total;
+		mCapacity.free   = fsInfo.free;
+		mCapacity.used   = fsInfo.total - fsInfo.free;
+	}
+}
+
+int SDCard::getFormatProgress() {
+	if (mFormatter.isRunning()) {
+		return mFormatter.getProgress();
 	}
+
+	return (mFormatter.wait() == FATFORMAT_RETURN_SUCCESS) ? 100 : SDCARD_FORMAT_FAILURE;
 }
 
 int SDCard::getTotalSessionRecords() {
 	int counts = 0;
 
-	DIR *dir = opendir(mountPoint.c_str());
-    if (!dir) {
-        return 0;
-    }
+	lockPOSIXMutex();
+	if (openDirectories(false) == 0) {
+		IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::Metadata);
+		getFileSystem().visitDirectoryAt(mRootFd, [&](const char *, bool isDirectory) {
+			if (isDirectory) {
+				++counts;
+			}
+		});
+	}
+	unLockPOSIXMutex();
+
+	return counts;
+}
 
-    struct dirent *ent;
+void SDCard::eraseRecord(const char *dateTime, const char *videoDesc) {
+	char audioDesc[NAME_MAX + 1];
+	bool isVideoRecord = (strstr(videoDesc, FILE_VIDEO_RECORD_EXTENSION) != nullptr);
 
-    while ((ent = readdir(dir)) != NULL) {
-        if (ent->d_type == DT_DIR && strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0) {
-            ++counts;
-        }
-    }
-    closedir(dir);
+	if (isVideoRecord) {
+		toAudioRecordName(videoDesc, audioDesc, sizeof(audioDesc));
+	}
 
-	return counts;
+	LOCAL_DBG("Erase file video %s/video/%s/%s\n", mountPoint.c_str(), dateTime, videoDesc);
+
+	DayFolder *folder = getDayFolder(dateTime, false);
+	std::string pathToDay = std::string("/") + dateTime + "/";
+	RecordDesc desc;
+	int tmpSuffix = parseRecordName(videoDesc, desc);
+
+	/* Only completed records were added to the summary, sizes are read before files are gone */
+	if (tmpSuffix == 0) {
+		struct stat fStat;
+		const struct {
+			uint8_t trackMask;
+			int dirFd;
+			const char *name;
+			std::string pathToRecord;
+		} tracks[] = {
+			{ RECORD_TRACK_VIDEO, folder ? folder->videoFd : -1, videoDesc, mountPoint + "/video" + pathToDay + videoDesc },
+			{ RECORD_TRACK_AUDIO, folder ? folder->audioFd : -1, audioDesc, mountPoint + "/audio" + pathToDay + audioDesc },
+		};
+
+		IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::Background);
+		for (auto &track : tracks) {
+			/* Record still in RAM staging tier isn't in the day folder */
+			bool isFound = (track.dirFd != -1 && getFileSystem().fstatat(track.dirFd, track.name, &fStat) == 0) ||
+						   (mStagingTier && getFileSystem().stat(locateRecord(track.pathToRecord).c_str(), &fStat) == 0);
+			if (isFound) {
+				RecordDesc trackDesc = desc;
+				trackDesc.sizeInBytes = (uint32_t)fStat.st_size;
+				trackDesc.trackMask = track.trackMask;
+				getStorageSummary()->removeRecord(dateTime, trackDesc);
+			}
+		}
+	}
+
+	if (mStagingTier) {
+		mStagingTier->discard(mountPoint + "/video" + pathToDay + videoDesc);
+		if (isVideoRecord) {
+			mStagingTier->discard(mountPoint + "/audio" + pathToDay + audioDesc);
+		}
+	}
+
+	if (folder != nullptr) {
+		IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::Background);
+		getFileSystem().unlinkat(folder->videoFd, videoDesc, 0);
+		if (isVideoRecord && folder->audioFd != -1) {
+			getFileSystem().unlinkat(folder->audioFd, audioDesc, 0);
+		}
+	}
+
+	if (tmpSuffix >= 0) {
+		getSegmentIndex(dateTime)->append(SegmentIndex::eEntry::Remove, desc);
+	}
 }
 
-void SDCard::eraseRecord(std::string dateTime, std::string videoDesc) {
-	std::string pathToVideoLists = mountPoint + std::string("/video/") + dateTime;
-	std::string pathToAudioLists = mountPoint + std::string("/audio/") + dateTime;
-	std::string audioDesc = videoDesc;
+void SDCard::eraseFolder(const char *dateTime) {
+	std::string pathToDay = std::string("/") + dateTime;
 
-	audioDesc.replace(audioDesc.find(FILE_VIDEO_RECORD_EXTENSION), 
-						strlen(FILE_VIDEO_RECORD_EXTENSION), 
-						FILE_AUDIO_RECORD_EXTENSION); /* Change extension ".h264" to ".g711" */
+	LOCAL_DBG("Erase folder video %s/video%s\n", mountPoint.c_str(), pathToDay.c_str());
+	LOCAL_DBG("Erase folder audio %s/audio%s\n", mountPoint.c_str(), pathToDay.c_str());
 
-	LOCAL_DBG("Erase file video %s\n", std::string(pathToVideoLists + "/" + videoDesc).c_str());
-	LOCAL_DBG("Erase file audio %s\n", std::string(pathToVideoLists + "/" + audioDesc).c_str());
+	dropDayFolder(dateTime);
+	openDirectories(false);
 
-	remove(std::string(pathToVideoLists + "/" + videoDesc).c_str());
-	remove(std::string(pathToVideoLists + "/" + audioDesc).c_str());
+	IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::Background);
+	removeDirectoryAt(mVideoFd, dateTime, mountPoint + "/video" + pathToDay);
+	removeDirectoryAt(mAudioFd, dateTime, mountPoint + "/audio" + pathToDay);
+	getFileSystem().removeAll(std::string(mountPoint + SEGINDEX_DIRECTORY + pathToDay).c_str());
+
+	auto indexes = std::make_shared<SegmentIndexMap>(*std::atomic_load(&mSegmentIndexes));
+	indexes->erase(dateTime);
+	std::atomic_store(&mSegmentIndexes, std::shared_ptr<const SegmentIndexMap>(indexes));
+	eraseMotionBitmap(dateTime);
+	getStorageSummary()->eraseDay(dateTime);
 }
 
-void SDCard::eraseFolder(std::string dateTime) {
-	std::string pathToVideoLists = mountPoint + std::string("/video/") + dateTime;
-	std::string pathToAudioLists = mountPoint + std::string("/audio/") + dateTime;
+void SDCard::enableStaging(std::string pathToStaging, uint64_t capacityInBytes, uint64_t reserveInBytes) {
+	mStagingTier = std::make_shared<StagingTier>(pathToStaging, mountPoint, capacityInBytes, reserveInBytes);
+	mStagingTier->ioScheduler = ioScheduler;
 
-	LOCAL_DBG("Erase folder video %s\n", pathToVideoLists.c_str());
-	LOCAL_DBG("Erase folder audio %s\n", pathToAudioLists.c_str());
+	/* Migrate records left in staging tier by previous run */
+	mStagingTier->recover();
+}
 
-	std::string cmd = "rm -rf ";
-	std::system(std::string(cmd + pathToVideoLists).c_str());
-	std::system(std::string(cmd + pathToAudioLists).c_str());
+std::string SDCard::locateRecord(std::string pathOnSDCard) {
+	return mStagingTier ? mStagingTier->locate(pathOnSDCard) : pathOnSDCard;
 }
 
-std::vector<RecordDesc> SDCard::getAllPlaylists(std::string dateTime, eQryPlaylist type) {
-	std::vector<RecordDesc> listRecords;
+std::shared_ptr<SegmentReader> SDCard::openSegmentReader(std::string dateTime, const RecordDesc &desc) {
+	char recordName[NAME_MAX + 1];
+
+	formatRecordName(desc, recordName, sizeof(recordName));
+	std::string pathToVideo = locateRecord(mountPoint + "/video/" + dateTime + "/" + recordName + FILE_VIDEO_RECORD_EXTENSION);
+	std::string pathToAudio = locateRecord(mountPoint + "/audio/" + dateTime + "/" + recordName + FILE_AUDIO_RECORD_EXTENSION);
+
+	/* Records in RAM staging tier don't touch SD Card */
+	bool isStaged = (pathToVideo.compare(0, mountPoint.size(), mountPoint) != 0);
+	auto reader = std::make_shared<SegmentReader>(desc, pathToVideo, pathToAudio, isStaged ? nullptr : ioScheduler);
+	reader->cipher = mCipher;
+
+	/* Silent spans the audio recorder didn't write, keyframes of the video, nonces and ranges scrub flagged */
+	std::vector<SegIndexEntry> entries;
+	auto index = findSegmentIndex(dateTime);
+	if (index) {
+		index->loadChunks(entries, desc.startTimestamp);
+		for (auto &range : index->getCorruptedRanges(desc.startTimestamp)) {
+			if (range.trackMask & RECORD_TRACK_VIDEO) {
+				reader->corruptedRanges.push_back(range.chunk);
+			}
+		}
+	}
+	reader->videoNonce = findNonce(entries, RECORD_TRACK_VIDEO);
+	reader->audioNonce = findNonce(entries, RECORD_TRACK_AUDIO);
+	for (auto &entry : entries) {
+		if ((SegmentIndex::eEntry)entry.kind == SegmentIndex::eEntry::Gap && (entry.trackMask & RECORD_TRACK_AUDIO)) {
+			reader->audioGaps.push_back(entry.chunk);
+		}
+		else if ((SegmentIndex::eEntry)entry.kind == SegmentIndex::eEntry::Keyframe && (entry.trackMask & RECORD_TRACK_VIDEO)) {
+			reader->keyframes.push_back(entry.chunk);
+		}
+	}
+	if (reader->open() != PLAYBACK_RETURN_SUCCESS) {
+		LOCAL_DBG("Open record %s failure\n", pathToVideo.c_str());
+		return nullptr;
+	}
+
+	return reader;
+}
+
+void SDCard::enableThumbnails(uint32_t intervalInSecs) {
+	mThumbnailInterval = std::max(intervalInSecs, 1u);
+}
+
+void SDCard::enableSilenceSkip(SilenceDetector::eLaw law, uint8_t threshold) {
+	mIsSilenceSkipped = true;
+	mSilenceLaw = law;
+	mSilenceThreshold = threshold;
+}
+
+void SDCard::enableResume(uint32_t maxGapInSecs) {
+	mResumeMaxGap = std::max(maxGapInSecs, 1u);
+}
+
+void SDCard::enableEncryption(const uint8_t key[AESCTR_KEY_SIZE]) {
+	mCipher = key ? std::make_shared<AesCtr>(key) : nullptr;
+}
+
+std::vector<ThumbnailDesc> SDCard::getThumbnails(std::string dateTime, uint32_t stepInSecs) {
+	std::vector<ThumbnailDesc> thumbnails, selected;
+	ThumbnailTrack track(mountPoint + SEGINDEX_DIRECTORY "/" + dateTime);
+
+	track.ioScheduler = ioScheduler;
+	if (track.load(thumbnails) != THUMBNAIL_RETURN_SUCCESS || stepInSecs == 0) {
+		return thumbnails;
+	}
+
+	for (auto &desc : thumbnails) {
+		if (selected.empty() || desc.timestamp >= selected.back().timestamp + stepInSecs) {
+			selected.push_back(desc);
+		}
+	}
+
+	return selected;
+}
+
+int SDCard::readThumbnail(std::string dateTime, const ThumbnailDesc &desc, std::vector<uint8_t> &data) {
+	ThumbnailTrack track(mountPoint + SEGINDEX_DIRECTORY "/" + dateTime);
+
+	track.ioScheduler = ioScheduler;
+	return track.read(desc, data);
+}
+
+std::vector<DaySummary> SDCard::getDaySummaries() {
+	std::vector<DaySummary> summaries;
 
+	lockPOSIXMutex();
 	if (mState == eState::Mounted) {
-		qryPlayList(listRecords, dateTime, type);
+		std::vector<std::string> days = getRecordDays();
+		auto summary = getStorageSummary();
+
+		for (auto &day : days) {
+			if (!summary->hasDay(day)) {
+				std::vector<RecordDesc> records, trackRecords;
+				scanPlayList(records, trackRecords, day);
+				summarizeDay(day, trackRecords);
+			}
+		}
+
+		/* Day folder removed behind the recorder's back */
+		for (auto &it : summary->getDays()) {
+			if (std::binary_search(days.begin(), days.end(), std::string(it.dateTime))) {
+				summaries.push_back(it);
+			}
+			else {
+				summary->eraseDay(it.dateTime);
+			}
+		}
+	}
+	unLockPOSIXMutex();
+
+	return summaries;
+}
+
+std::vector<MotionInterval> SDCard::getMotionIntervals(uint32_t fromTimestamp, uint32_t toTimestamp) {
+	std::vector<MotionInterval> intervals;
+	std::string firstDay = getDateString(fromTimestamp);
+	std::string lastDay = getDateString(toTimestamp - 1);
+
+	for (auto &day : getRecordDays()) {
+		if (day < firstDay || day > lastDay) {
+			continue;
+		}
+
+		auto bitmap = getMotionBitmap(day);
+		if (bitmap == nullptr) {
+			continue;
+		}
+
+		/* Merge an event across midnight */
+		for (auto &interval : bitmap->getIntervals(fromTimestamp, toTimestamp)) {
+			if (!intervals.empty() && intervals.back().endTimestamp == interval.startTimestamp) {
+				intervals.back().endTimestamp = interval.endTimestamp;
+			}
+			else {
+				intervals.push_back(interval);
+			}
+		}
+	}
+
+	return intervals;
+}
+
+uint32_t SDCard::findNextMotion(uint32_t timestamp) {
+	std::string firstDay = getDateString(timestamp);
+
+	for (auto &day : getRecordDays()) {
+		if (day < firstDay) {
+			continue;
+		}
+
+		auto bitmap = getMotionBitmap(day);
+		uint32_t next = (bitmap != nullptr) ? bitmap->findNext(timestamp) : MOTION_NO_EVENT;
+		if (next != MOTION_NO_EVENT) {
+			return next;
+		}
+	}
+
+	return MOTION_NO_EVENT;
+}
+
+std::vector<std::string> SDCard::getRecordDays() {
+	std::vector<std::string> days;
+
+	lockPOSIXMutex();
+	if (openDirectories(false) == 0) {
+		IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::Metadata);
+		getFileSystem().visitDirectoryAt(mVideoFd, [&](const char *name, bool isDirectory) {
+			if (isDirectory) {
+				days.emplace_back(name);
+			}
+		});
+	}
+	unLockPOSIXMutex();
+
+	std::sort(days.begin(), days.end());
+
+	return days;
+}
+
+int SDCard::scrub(std::string dateTime, ScrubReport &report, unsigned nbThreads) {
+	std::vector<ScrubJob> jobs;
+
+	memset(&report, 0, sizeof(report));
+
+	lockPOSIXMutex();
+	if (mState != eState::Mounted) {
+		unLockPOSIXMutex();
+		return SDCARD_STORAGE_FAILURE;
+	}
+
+	std::vector<std::string> days;
+	if (dateTime.empty()) {
+		days = getRecordDays();
+	}
+	else {
+		days.push_back(dateTime);
+	}
+
+	for (auto &day : days) {
+		if (ensureSegmentIndex(day)) {
+			collectScrubJobs(day, *getSegmentIndex(day), jobs);
+		}
+	}
+	unLockPOSIXMutex();
+
+	Scrubber::verify(jobs, report, nbThreads, ioScheduler.get());
+
+	lockPOSIXMutex();
+	for (auto &job : jobs) {
+		if (job.corrupted.empty() || mState != eState::Mounted) {
+			continue;
+		}
+
+		auto index = getSegmentIndex(job.dateTime);
+		auto flagged = index->getCorruptedRanges(job.startTimestamp);
+
+		for (auto &chunk : job.corrupted) {
+			bool isFlagged = std::any_of(flagged.begin(), flagged.end(), [&](const TrackChunk &range) {
+				return range.trackMask == job.trackMask && range.chunk.offset == chunk.offset;
+			});
+
+			if (!isFlagged) {
+				index->appendChunk(SegmentIndex::eEntry::Corrupted, job.trackMask, chunk);
+			}
+		}
+	}
+	unLockPOSIXMutex();
+
+	return SDCARD_RETURN_SUCCESS;
+}
+
+int SDCard::verify(std::string dateTime, ScrubReport &report, std::vector<ScrubJob> &jobs, unsigned nbThreads) {
+	memset(&report, 0, sizeof(report));
+	jobs.clear();
+
+	if (mState != eState::Mounted) {
+		return SDCARD_STORAGE_FAILURE;
+	}
+
+	std::vector<std::string> days;
+	if (dateTime.empty()) {
+		days = getRecordDays();
+	}
+	else {
+		days.push_back(dateTime);
+	}
+
+	/* Standalone indexes, the catalog (and interrupted records in it) are left untouched */
+	for (auto &day : days) {
+		SegmentIndex index(mountPoint + SEGINDEX_DIRECTORY "/" + day);
+		index.ioScheduler = ioScheduler;
+		if (index.load(true) == SEGINDEX_RETURN_SUCCESS) {
+			collectScrubJobs(day, index, jobs);
+		}
+	}
+
+	Scrubber::verify(jobs, report, nbThreads, ioScheduler.get());
+
+	return SDCARD_RETURN_SUCCESS;
+}
+
+void SDCard::collectScrubJobs(std::string dateTime, SegmentIndex &index, std::vector<ScrubJob> &jobs) {
+	std::vector<TrackChunk> chunks;
+
+	index.loadChunks(chunks);
+
+	std::sort(chunks.begin(), chunks.end(), [](const TrackChunk &t1, const TrackChunk &t2) {
+		if (t1.chunk.startTimestamp != t2.chunk.startTimestamp) {
+			return t1.chunk.startTimestamp < t2.chunk.startTimestamp;
+		}
+		if (t1.trackMask != t2.trackMask) {
+			return t1.trackMask < t2.trackMask;
+		}
+		return t1.chunk.offset < t2.chunk.offset;
+	});
+
+	auto itChunk = chunks.begin();
+	char recordName[NAME_MAX + 1];
+	for (auto &desc : index.getRecords()) {
+		static const struct {
+			uint8_t trackMask;
+			const char *folder;
+			const char *extension;
+		} tracks[] = {
+			{ RECORD_TRACK_VIDEO, "/video/", FILE_VIDEO_RECORD_EXTENSION },
+			{ RECORD_TRACK_AUDIO, "/audio/", FILE_AUDIO_RECORD_EXTENSION },
+		};
+
+		while (itChunk != chunks.end() && itChunk->chunk.startTimestamp < desc.startTimestamp) {
+			++itChunk;
+		}
+		formatRecordName(desc, recordName, sizeof(recordName));
+
+		for (auto &track : tracks) {
+			ScrubJob job;
+			job.dateTime = dateTime;
+			job.trackMask = track.trackMask;
+			job.startTimestamp = desc.startTimestamp;
+			job.path = locateRecord(mountPoint + track.folder + dateTime + "/" + recordName + track.extension);
+
+			while (itChunk != chunks.end() && 
+				   itChunk->chunk.startTimestamp == desc.startTimestamp && 
+				   itChunk->trackMask == track.trackMask) 
+			{
+				job.chunks.push_back(itChunk->chunk);
+				++itChunk;
+			}
+
+			if (!job.chunks.empty()) {
+				jobs.emplace_back(std::move(job));
+			}
+		}
+	}
+}
+
+std::vector<TrackChunk> SDCard::getCorruptedRanges(std::string dateTime, uint32_t startTimestamp) {
+	auto index = findSegmentIndex(dateTime);
+	return index ? index->getCorruptedRanges(startTimestamp) : std::vector<TrackChunk>();
+}
+
+std::shared_ptr<SegmentIndex> SDCard::findSegmentIndex(std::string dateTime) {
+	auto indexes = std::atomic_load(&mSegmentIndexes);
+
+	auto it = indexes->find(dateTime);
+	return (it != indexes->end()) ? it->second : nullptr;
+}
+
+std::shared_ptr<SegmentIndex> SDCard::getSegmentIndex(std::string dateTime) {
+	auto index = findSegmentIndex(dateTime);
+	if (index) {
+		return index;
+	}
+
+	index = std::make_shared<SegmentIndex>(mountPoint + SEGINDEX_DIRECTORY "/" + dateTime);
+	index->ioScheduler = ioScheduler;
+	index->load();
+
+	/* Copy on write, readers holding the previous map aren't disturbed */
+	auto indexes = std::make_shared<SegmentIndexMap>(*std::atomic_load(&mSegmentIndexes));
+	(*indexes)[dateTime] = index;
+	std::atomic_store(&mSegmentIndexes, std::shared_ptr<const SegmentIndexMap>(indexes));
+
+	return index;
+}
+
+void SDCard::clearSegmentIndexes() {
+	std::atomic_store(&mSegmentIndexes, std::make_shared<const SegmentIndexMap>());
+}
+
+int SDCard::openDirectories(bool isCreated) {
+	if (mState != eState::Mounted) {
+		return -1;
+	}
+
+	/* Reopened lazily once the card is mounted again */
+	if (mRootFd == -1) {
+		mRootFd = getFileSystem().open(mountPoint.c_str(), O_RDONLY | O_DIRECTORY);
+	}
+	if (mVideoFd == -1) {
+		mVideoFd = openDirectoryAt(mRootFd, "video", isCreated);
+	}
+	if (mAudioFd == -1) {
+		mAudioFd = openDirectoryAt(mRootFd, "audio", isCreated);
+	}
+
+	return (mVideoFd != -1 && mAudioFd != -1) ? 0 : -1;
+}
+
+void SDCard::closeDirectories() {
+	for (auto &folder : mDayFolders) {
+		dropDayFolder(folder.dateTime);
+	}
+
+	for (int *fd : { &mAudioFd, &mVideoFd, &mRootFd }) {
+		if (*fd != -1) {
+			getFileSystem().close(*fd);
+			*fd = -1;
+		}
+	}
+}
+
+SDCard::DayFolder *SDCard::getDayFolder(const char *dateTime, bool isCreated) {
+	DayFolder *folder = nullptr, *victim = &mDayFolders[0];
+
+	if (strlen(dateTime) > TIMEFMT_DATE_LENGTH || openDirectories(isCreated) != 0) {
+		return nullptr;
+	}
+
+	for (auto &it : mDayFolders) {
+		if (it.videoFd != -1 && strcmp(it.dateTime, dateTime) == 0) {
+			folder = &it;
+			break;
+		}
+		if (it.lastUsed < victim->lastUsed) {
+			victim = &it;
+		}
+	}
+
+	if (folder == nullptr) {
+		int videoFd = openDirectoryAt(mVideoFd, dateTime, isCreated);
+		if (videoFd == -1) {
+			return nullptr;
+		}
+
+		dropDayFolder(victim->dateTime);
+		folder = victim;
+		snprintf(folder->dateTime, sizeof(folder->dateTime), "%s", dateTime);
+		folder->videoFd = videoFd;
+	}
+
+	/* Audio folder may be missing while video one isn't, e.g. it's created later */
+	if (folder->audioFd == -1) {
+		folder->audioFd = openDirectoryAt(mAudioFd, dateTime, isCreated);
+	}
+	folder->lastUsed = ++mDayFolderTick;
+
+	return folder;
+}
+
+void SDCard::dropDayFolder(const char *dateTime) {
+	for (auto &folder : mDayFolders) {
+		if (folder.dateTime[0] == '\0' || strcmp(folder.dateTime, dateTime) != 0) {
+			continue;
+		}
+
+		if (folder.videoFd != -1) {
+			getFileSystem().close(folder.videoFd);
+		}
+		if (folder.audioFd != -1) {
+			getFileSystem().close(folder.audioFd);
+		}
+		folder.dateTime[0] = '\0';
+		folder.videoFd = folder.audioFd = -1;
+		folder.lastUsed = 0;
+	}
+}
+
+std::shared_ptr<MotionBitmap> SDCard::getMotionBitmap(std::string dateTime) {
+	auto bitmaps = std::atomic_load(&mMotionBitmaps);
+	auto it = bitmaps->find(dateTime);
+	if (it != bitmaps->end()) {
+		return it->second;
 	}
 
+	time_t midnight = getMidnightTimestamp(dateTime);
+	if (midnight == -1) {
+		return nullptr;
+	}
+
+	/* Only a day not loaded yet waits for the recording pipeline, another caller may have loaded it meanwhile */
+	lockPOSIXMutex();
+	bitmaps = std::atomic_load(&mMotionBitmaps);
+	it = bitmaps->find(dateTime);
+	if (it != bitmaps->end()) {
+		unLockPOSIXMutex();
+		return it->second;
+	}
+
+	auto bitmap = std::make_shared<MotionBitmap>(mountPoint + SEGINDEX_DIRECTORY "/" + dateTime, (uint32_t)midnight);
+	bitmap->ioScheduler = ioScheduler;
+	if (bitmap->load() == MOTION_RETURN_MISSING) {
+		bitmap->rebuild(getSegmentIndex(dateTime)->getRecords());
+	}
+
+	/* Copy on write, readers holding the previous map aren't disturbed */
+	auto updated = std::make_shared<MotionBitmapMap>(*bitmaps);
+	(*updated)[dateTime] = bitmap;
+	std::atomic_store(&mMotionBitmaps, std::shared_ptr<const MotionBitmapMap>(updated));
+	unLockPOSIXMutex();
+
+	return bitmap;
+}
+
+void SDCard::eraseMotionBitmap(std::string dateTime) {
+	auto bitmaps = std::make_shared<MotionBitmapMap>(*std::atomic_load(&mMotionBitmaps));
+	bitmaps->erase(dateTime);
+	std::atomic_store(&mMotionBitmaps, std::shared_ptr<const MotionBitmapMap>(bitmaps));
+}
+
+void SDCard::clearMotionBitmaps() {
+	std::atomic_store(&mMotionBitmaps, std::make_shared<const MotionBitmapMap>());
+}
+
+std::shared_ptr<StorageSummary> SDCard::getStorageSummary() {
+	if (mStorageSummary) {
+		return mStorageSummary;
+	}
+
+	/* Days of a missing or corrupted summary are summed again by getDaySummaries() */
+	mStorageSummary = std::make_shared<StorageSummary>(mountPoint + SEGINDEX_DIRECTORY);
+	mStorageSummary->ioScheduler = ioScheduler;
+	mStorageSummary->load();
+
+	return mStorageSummary;
+}
+
+void SDCard::loadSegmentIndexes() {
+	std::string pathToIndexes = mountPoint + SEGINDEX_DIRECTORY;
+
+	clearSegmentIndexes();
+	clearMotionBitmaps();
+	mStorageSummary.reset();
+
+	std::vector<DirEntry> entries;
+	if (getFileSystem().listDirectory(pathToIndexes.c_str(), entries) != 0) {
+		return;
+	}
+
+	for (auto &ent : entries) {
+		if (ent.isDirectory) {
+			getSegmentIndex(ent.name);
+		}
+	}
+}
+
+void SDCard::loadCardProfile() {
+	std::string pathToIndexes = mountPoint + SEGINDEX_DIRECTORY;
+	FsInfo info;
+
+	memset(&info, 0, sizeof(info));
+	getFileSystem().statfs(mountPoint.c_str(), info);
+	std::string id = CardProfiler::readCardId(hardDrive, info.fsid);
+
+	int ret = CardProfiler::load(pathToIndexes, id, mCardProfile);
+	if (ret != CARDPROFILE_RETURN_SUCCESS) {
+		LOCAL_DBG("Profile SD Card %s\n", id.c_str());
+		IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::Background);
+		ret = CardProfiler::measure(pathToIndexes, id, mCardProfile);
+		if (ret == CARDPROFILE_RETURN_SUCCESS) {
+			CardProfiler::save(pathToIndexes, mCardProfile);
+		}
+	}
+
+	/* Card too full or failing to be profiled, next mount tries again */
+	if (ret != CARDPROFILE_RETURN_SUCCESS) {
+		memset(&mCardProfile, 0, sizeof(mCardProfile));
+		mWritePolicy = CardProfiler::getDefaultPolicy();
+		return;
+	}
+
+	mWritePolicy = CardProfiler::toWritePolicy(mCardProfile);
+	LOCAL_DBG("Write policy: flush %u, sync %u s, prealloc %u, max %u bps, duration %d s\n", mWritePolicy.flushSize,
+			  mWritePolicy.syncIntervalInSecs, mWritePolicy.preallocSize, mWritePolicy.maxBitrate, mWritePolicy.durationInSecs);
+	setStreamBitrate(mStreamBitrate);
+}
+
+const CardProfile &SDCard::getCardProfile() {
+	return mCardProfile;
+}
+
+const WritePolicy &SDCard::getWritePolicy() {
+	return mWritePolicy;
+}
+
+void SDCard::setStreamBitrate(uint32_t bitsPerSec) {
+	mStreamBitrate = bitsPerSec;
+
+	if (!isBitrateSustained()) {
+		printf("[SDCARD] WARNING: %s sustains %u kbps, streams need %u kbps\n", hardDrive.c_str(), 
+			   mWritePolicy.maxBitrate / 1000, mStreamBitrate / 1000);
+	}
+}
+
+bool SDCard::isBitrateSustained() {
+	return mWritePolicy.maxBitrate == 0 || mStreamBitrate <= mWritePolicy.maxBitrate;
+}
+
+bool SDCard::ensureSegmentIndex(std::string dateTime) {
+	/* Dates come from the application, a day without video folder isn't indexed nor summarized */
+	if (!isDateString(dateTime) || getDayFolder(dateTime.c_str(), false) == nullptr) {
+		return false;
+	}
+
+	auto index = getSegmentIndex(dateTime);
+
+	/* Fall back to directory scan only when the journal is missing, corrupted or has records interrupted */
+	if (index->isValid() && !index->hasInterruptedRecords(Recorder::startTimestamp)) {
+		return true;
+	}
+
+	std::vector<RecordDesc> records, trackRecords;
+	scanPlayList(records, trackRecords, dateTime);
+
+	/* A record can be in both tiers if migration was interrupted before unlinking staged copy */
+	std::sort(records.begin(), records.end(), sortListByTime);
+	records.erase(std::unique(records.begin(), records.end(), [](const RecordDesc &t1, const RecordDesc &t2) {
+		return t1.startTimestamp == t2.startTimestamp;
+	}), records.end());
+	createDirectory(std::string(mountPoint + SEGINDEX_DIRECTORY).c_str());
+
+	LOCAL_DBG("Rebuild segment index %s with %ld records\n", dateTime.c_str(), records.size());
+	index->rebuild(records);
+
+	/* Records recovered by the scan were never closed, nor added to the summary */
+	summarizeDay(dateTime, trackRecords);
+
+	return true;
+}
+
+void SDCard::summarizeDay(std::string dateTime, std::vector<RecordDesc> &trackRecords) {
+	/* Same as segment index, a track record may be in both tiers */
+	std::sort(trackRecords.begin(), trackRecords.end(), [](const RecordDesc &t1, const RecordDesc &t2) {
+		return (t1.startTimestamp != t2.startTimestamp) ? t1.startTimestamp < t2.startTimestamp : t1.trackMask < t2.trackMask;
+	});
+	trackRecords.erase(std::unique(trackRecords.begin(), trackRecords.end(), [](const RecordDesc &t1, const RecordDesc &t2) {
+		return t1.startTimestamp == t2.startTimestamp && t1.trackMask == t2.trackMask;
+	}), trackRecords.end());
+
+	getStorageSummary()->rebuildDay(dateTime, trackRecords);
+}
+
+bool SDCard::findResumableRecord(Recorder::eOption option, int durationInSecs, RecordDesc &desc, uint32_t chunkOffsets[2],
+								 uint64_t nonces[2], ChunkDesc &lastKeyframe)
+{
+	char videoDesc[NAME_MAX + 1], audioDesc[NAME_MAX + 1], name[NAME_MAX + 1];
+	uint32_t now = getCurrentEpochTimestamp();
+	struct stat fStat;
+
+	DayFolder *folder = getDayFolder(currentSession.c_str(), false);
+	auto index = getSegmentIndex(currentSession);
+	if (folder == nullptr || folder->audioFd == -1 || !index->isValid()) {
+		return false;
+	}
+
+	IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::Metadata);
+
+	/* Newest interrupted record of the day */
+	desc.startTimestamp = 0;
+	getFileSystem().visitDirectoryAt(folder->videoFd, [&](const char *entry, bool) {
+		RecordDesc interrupted;
+		if (parseRecordName(entry, interrupted) > 0 && interrupted.startTimestamp > desc.startTimestamp) {
+			desc = interrupted;
+			snprintf(videoDesc, sizeof(videoDesc), "%s", entry);
+		}
+	});
+	if (desc.startTimestamp == 0) {
+		return false;
+	}
+
+	/* Same kind, named the way the recorder names it, left opened in the journal shortly ago */
+	formatRecordName(desc, name, sizeof(name));
+	strncat(name, FILE_VIDEO_RECORD_EXTENSION RECORD_TEMPORARY_SUFFIX, sizeof(name) - strlen(name) - 1);
+	bool isMotion = (desc.flags & RECORD_FLAG_MOTION) != 0;
+	if (isMotion != (option == Recorder::eOption::Motion) ||
+		strcmp(name, videoDesc) != 0 ||
+		desc.endTimestamp < desc.startTimestamp || now < desc.endTimestamp ||
+		now - desc.endTimestamp > mResumeMaxGap ||
+		now - desc.startTimestamp >= (uint32_t)durationInSecs ||
+		!index->isInterrupted(desc.startTimestamp))
+	{
+		return false;
+	}
+
+	toAudioRecordName(videoDesc, audioDesc, sizeof(audioDesc));
+	if (getFileSystem().fstatat(folder->audioFd, audioDesc, &fStat) != 0) {
+		return false;
+	}
+
+	/* Last chunk journaled per track, bytes before it aren't read again */
+	std::vector<SegIndexEntry> entries;
+	ChunkDesc lastChunks[2];
+	bool hasChunks[2] = { false, false };
+	index->loadChunks(entries, desc.startTimestamp);
+	for (auto &it : entries) {
+		int id = (it.trackMask == RECORD_TRACK_VIDEO) ? 0 : 1;
+		if ((SegmentIndex::eEntry)it.kind == SegmentIndex::eEntry::Chunk && (!hasChunks[id] || it.chunk.offset > lastChunks[id].offset)) {
+			lastChunks[id] = it.chunk;
+			hasChunks[id] = true;
+		}
+	}
+
+	/* Encrypted record goes on with the key stream it was written with */
+	nonces[0] = findNonce(entries, RECORD_TRACK_VIDEO);
+	nonces[1] = findNonce(entries, RECORD_TRACK_AUDIO);
+	if (mCipher && (nonces[0] == 0 || nonces[1] == 0)) {
+		return false;
+	}
+
+	if (Recorder::trimInterrupted(folder->videoFd, videoDesc, Recorder::eType::Video, hasChunks[0] ? &lastChunks[0] : nullptr,
+								  mCipher.get(), nonces[0]) != RECORD_RETURN_SUCCESS ||
+		Recorder::trimInterrupted(folder->audioFd, audioDesc, Recorder::eType::Audio, hasChunks[1] ? &lastChunks[1] : nullptr,
+								  mCipher.get(), nonces[1]) != RECORD_RETURN_SUCCESS)
+	{
+		return false;
+	}
+
+	for (int id = 0; id < 2; ++id) {
+		chunkOffsets[id] = hasChunks[id] ? lastChunks[id].offset + lastChunks[id].length : 0;
+	}
+
+	/* Last keyframe still in the trimmed video, frame numbers go on from it. A keyframe journaled
+	   after an earlier resume replaces the ones at or beyond its offset */
+	struct stat videoStat;
+	std::vector<ChunkDesc> keyframes;
+	lastKeyframe.offset = UINT32_MAX;
+	if (getFileSystem().fstatat(folder->videoFd, videoDesc, &videoStat) == 0) {
+		for (auto &it : entries) {
+			if ((SegmentIndex::eEntry)it.kind != SegmentIndex::eEntry::Keyframe) {
+				continue;
+			}
+			while (!keyframes.empty() && keyframes.back().offset >= it.chunk.offset) {
+				keyframes.pop_back();
+			}
+			keyframes.push_back(it.chunk);
+		}
+		while (!keyframes.empty() && keyframes.back().offset >= (uint64_t)videoStat.st_size) {
+			keyframes.pop_back();
+		}
+		if (!keyframes.empty()) {
+			lastKeyframe = keyframes.back();
+		}
+	}
+	LOCAL_DBG("Resume record %s, interrupted for %u s\n", videoDesc, now - desc.endTimestamp);
+
+	return true;
+}
+
+std::vector<RecordDesc> SDCard::getAllPlaylists(std::string dateTime, eQryPlaylist type) {
+	std::vector<RecordDesc> listRecords;
+
+	getPlaylistPage(listRecords, dateTime, type);
+
 	return listRecords;
 }
 
-static std::string findOldestRecord(std::string pathToList) {
-	DIR *dir = opendir(pathToList.c_str());
-	if (dir == nullptr) {
-		LOCAL_DBG("SD Card opens failure, error: %s", strerror(errno));
-		return "";
+size_t SDCard::getPlaylistPage(std::vector<RecordDesc> &page,
+							   std::string dateTime,
+							   eQryPlaylist type,
+							   uint32_t beforeTimestamp,
+							   size_t maxRecords)
+{
+	page.clear();
+
+	if (mState == eState::Mounted && maxRecords > 0) {
+		qryPlayList(page, dateTime, type, beforeTimestamp, maxRecords);
 	}
 
-	struct dirent *ent;
+	return page.size();
+}
+
+std::string SDCard::formatRecordName(const RecordDesc &desc) {
+	char name[NAME_MAX + 1];
+
+	formatRecordName(desc, name, sizeof(name));
+	return std::string(name);
+}
+
+void SDCard::formatRecordName(const RecordDesc &desc, char *name, size_t len) {
+	char dateTime[TIMEFMT_COMPACT_LENGTH + 1];
+
+	formatCompact(desc.startTimestamp, dateTime, sizeof(dateTime));
+	snprintf(name, len, "%s_%u_%u%s", dateTime, desc.startTimestamp, desc.endTimestamp, (desc.flags & RECORD_FLAG_MOTION) ? "_mdt" : "");
+}
+
+std::string SDCard::formatRecordTime(uint32_t timestamp) {
+	char dateTime[TIMEFMT_DATETIME_LENGTH + 1];
+
+	formatDateTime(timestamp, dateTime, sizeof(dateTime));
+	return std::string(dateTime);
+}
+
+static bool findOldestRecord(int dirFd, char *oldest, size_t len) {
 	uint32_t oldestTimestamp = UINT32_MAX;
-	std::string oldestString = "";
+	struct stat fStat;
 
 	/* Query to find oldest file record */
-	while ((ent = readdir(dir)) != NULL) {
-		if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0) {
-			std::string fileDesc(ent->d_name, strlen(ent->d_name));
-
-			uint32_t u32 = getBirthTimestamp(std::string(pathToList + "/" + fileDesc).c_str());
-			if (oldestTimestamp > u32) {
-				oldestTimestamp = u32;
-				oldestString = fileDesc;
-			}
+	int ret = getFileSystem().visitDirectoryAt(dirFd, [&](const char *name, bool) {
+		uint32_t u32 = (getFileSystem().fstatat(dirFd, name, &fStat) == 0) ? (uint32_t)fStat.st_ctime : 0;
+		if (oldestTimestamp > u32 || oldest[0] == '\0') {
+			oldestTimestamp = u32;
+			snprintf(oldest, len, "%s", name);
 		}
+	});
+	if (ret != 0) {
+		LOCAL_DBG("SD Card opens failure, error: %s", strerror(errno));
 	}
 
-	return oldestString;
+	return oldest[0] != '\0';
 }
 
 void SDCard::eraseOldestRecords(std::string dateTime) {
-	std::string pathToVideoLists = mountPoint + std::string("/video") + (dateTime.empty() ? "" : ("/" + dateTime));
-	std::string pathToAudioLists = mountPoint + std::string("/audio") + (dateTime.empty() ? "" : ("/" + dateTime));
+	char oldest[NAME_MAX + 1] = { 0 };
+	int dirFd = -1;
 
-	std::string oldest = findOldestRecord(pathToVideoLists);
+	lockPOSIXMutex();
+	if (dateTime.empty()) {
+		dirFd = (openDirectories(false) == 0) ? mVideoFd : -1;
+	}
+	else {
+		DayFolder *folder = getDayFolder(dateTime.c_str(), false);
+		dirFd = (folder != nullptr) ? folder->videoFd : -1;
+	}
+
+	bool isFound = false;
+	if (dirFd != -1) {
+		IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::Background);
+		isFound = findOldestRecord(dirFd, oldest, sizeof(oldest));
+	}
 
 	/* Erase oldest folder if it has found */
-	if (oldest.empty() == false) {
-		LOCAL_DBG("%s is oldest -> Must be DELETED\n", oldest.c_str());
+	if (isFound) {
+		LOCAL_DBG("%s is oldest -> Must be DELETED\n", oldest);
 
 		if (dateTime.empty()) {
-			eraseRecord(dateTime, oldest);
+			eraseFolder(oldest);
 		}
 		else {
-			eraseFolder(oldest);
+			eraseRecord(dateTime.c_str(), oldest);
 		}
 	}
+	unLockPOSIXMutex();
 }
 
-static bool sortListByTime(RecordDesc &t1, RecordDesc &t2) {
-	if (t1.sortTime.hou != t2.sortTime.hou) {
-		return t1.sortTime.hou > t2.sortTime.hou;
+void SDCard::eraseRecordDay(std::string dateTime) {
+	if (!isDateString(dateTime)) {
+		return;
 	}
 
-	if (t1.sortTime.min != t2.sortTime.min) {
-		return t1.sortTime.min > t2.sortTime.min;
-	}
+	lockPOSIXMutex();
+	eraseFolder(dateTime.c_str());
+	unLockPOSIXMutex();
+}
 
-	return (t1.sortTime.sec > t2.sortTime.sec);
+static bool sortListByTime(const RecordDesc &t1, const RecordDesc &t2) {
+	return t1.startTimestamp > t2.startTimestamp; /* Newest first */
 }
 
-static RecordDesc parseRecordDesc(std::vector<std::string> strings, SDCard::eQryPlaylist type) {
-	RecordDesc recordDesc;
-	std::tm tmStart, tmStop;
-	std::string fname;
+/*  Parse "<DateTime>_<Start>_<Stop>[_mdt].h264[.tmp]" in place, without any allocation.
+	Return the offset of ".tmp" suffix in name (0 if it's not temporary) or -1 if name is invalid.
+*/
+static int parseRecordName(const char *name, RecordDesc &desc) {
+	const char *p = name;
+	char *end = nullptr;
 
-	switch (type) {
-	case SDCard::eQryPlaylist::Full: {
-		if (IS_FULL_RECORD(strings.size()) == false) {
-			return recordDesc;
+	for (int i = 0; i < 14; ++i, ++p) {
+		if (*p < '0' || *p > '9') {
+			return -1;
 		}
 	}
-	break;
+	if (*p++ != '_') {
+		return -1;
+	}
 
-	case SDCard::eQryPlaylist::Motion: {
-		if (IS_MOTION_RECORD(strings.size()) == false) {
-			return recordDesc;
-		}
+	desc.startTimestamp = (uint32_t)strtoul(p, &end, 10);
+	if (end == p || *end != '_') {
+		return -1;
 	}
-	break;
+	p = end + 1;
 
-	default:
-	break;
+	desc.endTimestamp = (uint32_t)strtoul(p, &end, 10);
+	if (end == p) {
+		return -1;
+	}
+	p = end;
+
+	desc.flags = 0;
+	desc.type = (uint8_t)SDCard::eQryPlaylist::Full;
+	if (strncmp(p, "_mdt", 4) == 0) {
+		desc.flags |= RECORD_FLAG_MOTION;
+		desc.type = (uint8_t)SDCard::eQryPlaylist::Motion;
+		p += 4;
 	}
 
-	epochToUTCTime(stoi(strings[1]), tmStart);
-	epochToUTCTime(stoi(strings[2]), tmStop);
-	recordDesc.sortTime.hou = tmStart.tm_hour;
-	recordDesc.sortTime.min = tmStart.tm_min;
-	recordDesc.sortTime.sec = tmStart.tm_sec;
+	if (strncmp(p, FILE_VIDEO_RECORD_EXTENSION, strlen(FILE_VIDEO_RECORD_EXTENSION)) != 0) {
+		return -1;
+	}
+	p += strlen(FILE_VIDEO_RECORD_EXTENSION);
 
-	std::string sfmt = (type == SDCard::eQryPlaylist::Motion) ? "%s_%s_%s_mdt" : "%s_%s_%s";
-	
-	/* Remove extension to get stop timestamp */
-	size_t pos = strings[2].find(".");
-	if (pos != std::string::npos) {
-		strings[2].erase(pos);
+	if (*p == '\0') {
+		return 0;
 	}
 
-	recordDesc.type				= (uint8_t)type;
-	recordDesc.fileName 		= sprintfString(sfmt, strings[0].c_str(), strings[1].c_str(), strings[2].c_str());
-	recordDesc.beginTime 		= sprintfString("%d.%02d.%02d %02d:%02d:%02d", tmStart.tm_year, tmStart.tm_mon, tmStart.tm_mday, tmStart.tm_hour, tmStart.tm_min, tmStart.tm_sec);
-	recordDesc.endTime 			= sprintfString("%d.%02d.%02d %02d:%02d:%02d", tmStop.tm_year, tmStop.tm_mon, tmStop.tm_mday, tmStop.tm_hour, tmStop.tm_min, tmStop.tm_sec);
-	recordDesc.durationInSecs 	= stoi(strings[2]) - stoi(strings[1]);
+	return (strcmp(p, RECORD_TEMPORARY_SUFFIX) == 0) ? (int)(p - name) : -1;
+}
 
-	return recordDesc;
+static bool isTypeMatched(const RecordDesc &desc, SDCard::eQryPlaylist type) {
+	switch (type) {
+	case SDCard::eQryPlaylist::Full: return (desc.flags & RECORD_FLAG_MOTION) == 0;
+	case SDCard::eQryPlaylist::Motion: return (desc.flags & RECORD_FLAG_MOTION) != 0;
+	default: return true;
+	}
 }
 
-static bool isExisted(std::string pathToFolder, std::string desc) {
-	return (access(std::string(pathToFolder + "/" + desc).c_str(), F_OK) == 0);
+/* Change extension ".h264" to ".g711" of video record name */
+static void toAudioRecordName(const char *videoDesc, char *audioDesc, size_t len) {
+	const char *ext = strstr(videoDesc, FILE_VIDEO_RECORD_EXTENSION);
+	int prefix = (int)(ext - videoDesc);
+
+	snprintf(audioDesc, len, "%.*s%s%s", prefix, videoDesc, FILE_AUDIO_RECORD_EXTENSION, ext + strlen(FILE_VIDEO_RECORD_EXTENSION));
+}
+
+/* Journaled nonce of one track of a record, 0 if none */
+static uint64_t findNonce(const std::vector<SegIndexEntry> &entries, uint8_t trackMask) {
+	for (auto &entry : entries) {
+		if ((SegmentIndex::eEntry)entry.kind == SegmentIndex::eEntry::Nonce && entry.trackMask == trackMask) {
+			return ((uint64_t)entry.chunk.offset << 32) | entry.chunk.length;
+		}
+	}
+
+	return 0;
 }
 
-void SDCard::qryPlayList(std::vector<RecordDesc> &listRecords, std::string dateTime, eQryPlaylist type) {
-	std::string pathToVideoLists = mountPoint + std::string("/video/") + dateTime;
-	std::string pathToAudioLists = mountPoint + std::string("/audio/") + dateTime;
+void SDCard::scanPlayList(std::vector<RecordDesc> &listRecords, std::vector<RecordDesc> &trackRecords, std::string dateTime) {
+	DayFolder *folder = getDayFolder(dateTime.c_str(), false);
+	int videoFd = (folder != nullptr) ? folder->videoFd : -1;
+	int audioFd = (folder != nullptr) ? folder->audioFd : -1;
+	int stagedVideoFd = -1, stagedAudioFd = -1;
+
+	/* Records still waiting in RAM staging tier, its folders aren't kept opened */
+	if (mStagingTier) {
+		stagedVideoFd = getFileSystem().open(std::string(mStagingTier->pathToStaging + "/video/" + dateTime).c_str(), O_RDONLY | O_DIRECTORY);
+		stagedAudioFd = getFileSystem().open(std::string(mStagingTier->pathToStaging + "/audio/" + dateTime).c_str(), O_RDONLY | O_DIRECTORY);
+	}
+
+	if (videoFd != -1) {
+		scanPlayList(listRecords, trackRecords, videoFd, audioFd, stagedAudioFd, false);
+	}
+	if (stagedVideoFd != -1) {
+		scanPlayList(listRecords, trackRecords, stagedVideoFd, stagedAudioFd, audioFd, true);
+	}
+
+	for (int fd : { stagedVideoFd, stagedAudioFd }) {
+		if (fd != -1) {
+			getFileSystem().close(fd);
+		}
+	}
+}
+
+void SDCard::scanPlayList(std::vector<RecordDesc> &listRecords, std::vector<RecordDesc> &trackRecords, int videoFd, int audioFd, int otherAudioFd, bool isStaged) {
+	std::vector<std::pair<std::string, int>> interrupted;	/* Video name, audio folder */
+	char audioDesc[NAME_MAX + 1];
+	struct stat videoStat, audioStat;
+
+	IOScheduler::Ticket ticket(isStaged ? nullptr : ioScheduler.get(), IOScheduler::eClass::Metadata);
+	int ret = getFileSystem().visitDirectoryAt(videoFd, [&](const char *name, bool) {
+		RecordDesc desc;
+
+		int tmpSuffix = parseRecordName(name, desc);
+		if (tmpSuffix < 0) {
+			return;
+		}
+
+		/* Record is recording now -> Ignore it */
+		if (desc.startTimestamp == Recorder::startTimestamp) {
+			return;
+		}
+
+		/* Interrupted record in RAM staging tier is recovered after migration to SD Card */
+		if (tmpSuffix > 0 && isStaged) {
+			return;
+		}
+
+		toAudioRecordName(name, audioDesc, sizeof(audioDesc));
+
+		/* Audio & video are migrated independently, audio may still be in the other tier */
+		int audioDirFd = audioFd;
+		if (audioDirFd == -1 || getFileSystem().fstatat(audioDirFd, audioDesc, &audioStat) != 0) {
+			audioDirFd = otherAudioFd;
+		}
+
+		/* Video record exist but audio not exist -> Ignore it */
+		if (audioDirFd == -1 || 
+			getFileSystem().fstatat(audioDirFd, audioDesc, &audioStat) != 0 || 
+			getFileSystem().fstatat(videoFd, name, &videoStat) != 0)
+		{
+			return;
+		}
 
-	LOCAL_DBG("Path to video lists: %s\n", pathToVideoLists.c_str());
-	LOCAL_DBG("Path to audio lists: %s\n", pathToVideoLists.c_str());
+		/* Recovery record temporary to valid record if it's not recording (once the listing is done) */
+		if (tmpSuffix > 0) {
+			interrupted.emplace_back(name, audioDirFd);
+			desc.flags |= RECORD_FLAG_RECOVERED;
+		}
 
-	DIR *dir = opendir(pathToVideoLists.c_str());
-	if (dir == nullptr) {
+		desc.reserved = 0;
+		desc.sizeInBytes = (uint32_t)videoStat.st_size;
+		desc.trackMask = RECORD_TRACK_VIDEO;
+		trackRecords.push_back(desc);
+		desc.sizeInBytes = (uint32_t)audioStat.st_size;
+		desc.trackMask = RECORD_TRACK_AUDIO;
+		trackRecords.push_back(desc);
+
+		desc.sizeInBytes = (uint32_t)(videoStat.st_size + audioStat.st_size);
+		desc.trackMask = RECORD_TRACK_VIDEO | RECORD_TRACK_AUDIO;
+		listRecords.push_back(desc);
+	});
+	if (ret != 0) {
 		LOCAL_DBG("SD Card opens failure, error: %s", strerror(errno));
 		return;
 	}
 
-	struct dirent *ent;
-	while ((ent = readdir(dir)) != NULL) {
-		if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0) {
+	char videoRename[NAME_MAX + 1], audioRename[NAME_MAX + 1];
+	int suffixLength = (int)strlen(RECORD_TEMPORARY_SUFFIX);
 
-			/* Get audio & video records description */
-			std::string videoDesc(ent->d_name, strlen(ent->d_name));
+	for (auto &record : interrupted) {
+		const char *videoDesc = record.first.c_str();
 
-			auto strings = splitString(videoDesc, '_');
-			if (!IS_FORMAT_PARSED_VALID(strings.size())) {
-				continue;
-			}
+		toAudioRecordName(videoDesc, audioDesc, sizeof(audioDesc));
+		snprintf(videoRename, sizeof(videoRename), "%.*s", (int)strlen(videoDesc) - suffixLength, videoDesc);
+		snprintf(audioRename, sizeof(audioRename), "%.*s", (int)strlen(audioDesc) - suffixLength, audioDesc);
 
-			std::string audioDesc = videoDesc;
-			audioDesc.replace(audioDesc.find(FILE_VIDEO_RECORD_EXTENSION), 
-							  strlen(FILE_VIDEO_RECORD_EXTENSION), 
-							  FILE_AUDIO_RECORD_EXTENSION); /* Change extension ".h264" to ".g711" */
+		LOCAL_DBG("Rename %s to %s\n", videoDesc, videoRename);
 
-			/* Video record exist but audio not exist -> Ignore it */
-			if (isExisted(pathToAudioLists, audioDesc) == false) {
-				continue;
-			}
+		getFileSystem().renameat(videoFd, videoDesc, videoFd, videoRename);
+		getFileSystem().renameat(record.second, audioDesc, record.second, audioRename);
+	}
+}
 
-			/* Recovery record temporary to valid record if it's not recording (TODO: Remove ".tmp") */
-			if (std::stoul(strings[1]) == Recorder::startTimestamp) {
-				continue;
-			}
+void SDCard::qryPlayList(std::vector<RecordDesc> &listRecords, std::string dateTime, eQryPlaylist type, uint32_t beforeTimestamp, size_t maxRecords) {
+	auto index = findSegmentIndex(dateTime);
+	auto snapshot = index ? index->getSnapshot() : nullptr;
 
-			size_t pos = videoDesc.find(RECORD_TEMPORARY_SUFFIX);
-			if (pos != std::string::npos) {
-				std::string oldVideoDesc = videoDesc;
-				std::string oldAudioDesc = audioDesc;
+	/* Only a day not loaded yet or a journal to rebuild waits for the recording pipeline */
+	if (!snapshot || !snapshot->isValid || snapshot->hasInterruptedRecords) {
+		lockPOSIXMutex();
+		bool isRecorded = ensureSegmentIndex(dateTime);
+		snapshot = isRecorded ? getSegmentIndex(dateTime)->getSnapshot() : nullptr;
+		unLockPOSIXMutex();
+	}
+	if (!snapshot) {
+		return;
+	}
 
-				videoDesc.erase(pos, strlen(RECORD_TEMPORARY_SUFFIX));
-				audioDesc.erase(audioDesc.find(RECORD_TEMPORARY_SUFFIX), strlen(RECORD_TEMPORARY_SUFFIX));
+	for (auto &desc : snapshot->records) {
+		if (desc.startTimestamp >= beforeTimestamp || !isTypeMatched(desc, type)) {
+			continue;
+		}
 
-				LOCAL_DBG("Rename %s to %s\n", 
-									std::string(pathToVideoLists + "/" + oldVideoDesc).c_str(),
-									std::string(pathToVideoLists + "/" + videoDesc).c_str());
+		/* Video record exist but audio not exist -> Ignore it */
+		if ((desc.trackMask & (RECORD_TRACK_VIDEO | RECORD_TRACK_AUDIO)) != (RECORD_TRACK_VIDEO | RECORD_TRACK_AUDIO)) {
+			continue;
+		}
 
-				rename(std::string(pathToVideoLists + "/" + oldVideoDesc).c_str(), std::string(pathToVideoLists + "/" + videoDesc).c_str());
-				rename(std::string(pathToAudioLists + "/" + oldAudioDesc).c_str(), std::string(pathToAudioLists + "/" + audioDesc).c_str());
-			}
+		/* Minimum 10 Seconds */
+		if (desc.endTimestamp < desc.startTimestamp || desc.endTimestamp - desc.startTimestamp < 10) {
+			continue;
+		}
 
-			auto descParsed = parseRecordDesc(strings, type);
-			if (descParsed.durationInSecs >= 10) { /* Minimum 10 Seconds */
-				listRecords.emplace_back(descParsed);
-			}
+		/* Keep only the newest "maxRecords" records */
+		if (listRecords.size() < maxRecords) {
+			listRecords.push_back(desc);
+			std::push_heap(listRecords.begin(), listRecords.end(), sortListByTime);
+		}
+		else if (sortListByTime(desc, listRecords.front())) {
+			std::pop_heap(listRecords.begin(), listRecords.end(), sortListByTime);
+			listRecords.back() = desc;
+			std::push_heap(listRecords.begin(), listRecords.end(), sortListByTime);
 		}
 	}
 
-	if (listRecords.size()) {
-		sort(listRecords.begin(), listRecords.end(), sortListByTime);
-	}
-	closedir(dir);
+	std::sort_heap(listRecords.begin(), listRecords.end(), sortListByTime);
 }
 
 void SDCard::ENTRY_ATOMIC(SDCard &sdCard) {
@@ -398,9 +1426,21 @@ bool SDCard::isSDCardMounted(SDCard &sdCard) {
 			sdCard.setOperation(eOperations::Unmount);
 		}
 		sdCard.eStatus = eState::Removed;
+		sdCard.closeDirectories();
+		sdCard.clearSegmentIndexes();
+		sdCard.clearMotionBitmaps();
+		sdCard.mStorageSummary.reset();
+		sdCard.mWritePolicy = CardProfiler::getDefaultPolicy();
+		return false;
+	}
+
+	/* Don't mount while quick format is writing the card */
+	if (sdCard.mFormatter.isRunning()) {
+		sdCard.eStatus = eState::InProcess;
 		return false;
 	}
 
+	bool wasMounted = (sdCard.eStatus == eState::Mounted);
 	sdCard.eStatus = eState::Inserted;
 
 	if (sdCard.hasMountPoint()) {
@@ -413,6 +1453,11 @@ bool SDCard::isSDCardMounted(SDCard &sdCard) {
 	}
 
 	if (sdCard.eStatus == eState::Mounted) {
+		if (!wasMounted) {
+			sdCard.closeDirectories();
+			sdCard.loadSegmentIndexes();
+			sdCard.loadCardProfile();
+		}
 		sdCard.updateCapacity();
 		ret = true;
 	}
@@ -420,7 +1465,7 @@ bool SDCard::isSDCardMounted(SDCard &sdCard) {
 	return ret;
 }
 
-void SDCard::openSessionRecord(SDCard &sdCard, Recorder::eOption option) {
+void SDCard::openSessionRecord(SDCard &sdCard, Recorder::eOption option, int durationInSecs) {
 	/* Do nothing if current session record is existed */
 	if (sdCard.currentSession.empty() == false) {
 		return;
@@ -428,20 +1473,64 @@ void SDCard::openSessionRecord(SDCard &sdCard, Recorder::eOption option) {
 
 	sdCard.currentSession = getTodayDateString();
 
-	/* Create parent directories (Video and audio) */
-	std::string parentVideoDirectory = sdCard.mountPoint + "/video";
-	std::string parentAudioDirectory = sdCard.mountPoint + "/audio";
-	createDirectory(parentVideoDirectory.c_str());
-	createDirectory(parentAudioDirectory.c_str());
+	/* Create parent directories (Video and audio) and child directories (Current datetime), they stay opened */
+	if (sdCard.getDayFolder(sdCard.currentSession.c_str(), true) == nullptr) {
+		LOCAL_DBG("Create folders of %s failure, error: %s\n", sdCard.currentSession.c_str(), strerror(errno));
+	}
+	std::string videoRecordsTodayPath = sdCard.mountPoint + "/video/" + sdCard.currentSession;
+	std::string audioRecordsTodayPath = sdCard.mountPoint + "/audio/" + sdCard.currentSession;
 
-	/* Create child directories (Current datetime) */
-	std::string videoRecordsTodayPath = parentVideoDirectory + "/" + sdCard.currentSession;
-	std::string audioRecordsTodayPath = parentAudioDirectory + "/" + sdCard.currentSession;
-	createDirectory(videoRecordsTodayPath.c_str());
-	createDirectory(audioRecordsTodayPath.c_str());
+	if (durationInSecs == SDCARD_DURATION_AUTO) {
+		durationInSecs = sdCard.mWritePolicy.durationInSecs;
+	}
 
-	sdCard.videoRecorder = std::make_shared<Recorder>(videoRecordsTodayPath, Recorder::eType::Video, option);
-	sdCard.audioRecorder = std::make_shared<Recorder>(audioRecordsTodayPath, Recorder::eType::Audio, option);
+	/* Resumed record is the one recording, neither index rebuild nor playlist query recovers it */
+	RecordDesc resumed;
+	uint32_t chunkOffsets[2];
+	uint64_t nonces[2];
+	ChunkDesc lastKeyframe;
+	bool isResumed = (sdCard.mResumeMaxGap != 0 && sdCard.findResumableRecord(option, durationInSecs, resumed, chunkOffsets, nonces, lastKeyframe));
+	if (isResumed) {
+		Recorder::startTimestamp = resumed.startTimestamp;
+	}
+
+	/* Create segment index of today */
+	sdCard.ensureSegmentIndex(sdCard.currentSession);
+
+	sdCard.videoRecorder = Recorder::create(videoRecordsTodayPath, Recorder::eType::Video, option, durationInSecs);
+	sdCard.audioRecorder = Recorder::create(audioRecordsTodayPath, Recorder::eType::Audio, option, durationInSecs);
+	sdCard.videoRecorder->writePolicy = sdCard.mWritePolicy;
+	sdCard.audioRecorder->writePolicy = sdCard.mWritePolicy;
+	sdCard.videoRecorder->segmentIndex = sdCard.getSegmentIndex(sdCard.currentSession);
+	sdCard.audioRecorder->segmentIndex = sdCard.getSegmentIndex(sdCard.currentSession);
+	sdCard.videoRecorder->stagingTier = sdCard.mStagingTier;
+	sdCard.audioRecorder->stagingTier = sdCard.mStagingTier;
+	sdCard.videoRecorder->ioScheduler = sdCard.ioScheduler;
+	sdCard.audioRecorder->ioScheduler = sdCard.ioScheduler;
+	sdCard.videoRecorder->cipher = sdCard.mCipher;
+	sdCard.audioRecorder->cipher = sdCard.mCipher;
+	sdCard.videoRecorder->storageSummary = sdCard.getStorageSummary();
+	sdCard.audioRecorder->storageSummary = sdCard.getStorageSummary();
+
+	if (isResumed) {
+		sdCard.videoRecorder->resumeRecord(resumed, chunkOffsets[0], nonces[0], (lastKeyframe.offset != UINT32_MAX) ? &lastKeyframe : nullptr);
+		sdCard.audioRecorder->resumeRecord(resumed, chunkOffsets[1], nonces[1]);
+	}
+
+	if (sdCard.mIsSilenceSkipped) {
+		sdCard.audioRecorder->silenceDetector = std::make_shared<SilenceDetector>(sdCard.mSilenceLaw, sdCard.mSilenceThreshold);
+	}
+
+	if (option == Recorder::eOption::Motion) {
+		sdCard.videoRecorder->motionBitmap = sdCard.getMotionBitmap(sdCard.currentSession);
+	}
+
+	/* Thumbnails are plaintext keyframes */
+	if (sdCard.mThumbnailInterval != 0 && !sdCard.mCipher) {
+		std::string pathToIndex = sdCard.mountPoint + SEGINDEX_DIRECTORY "/" + sdCard.currentSession;
+		sdCard.videoRecorder->thumbnailTrack = std::make_shared<ThumbnailTrack>(pathToIndex, sdCard.mThumbnailInterval);
+		sdCard.videoRecorder->thumbnailTrack->ioScheduler = sdCard.ioScheduler;
+	}
 }
 
 void SDCard::closeCurrentSession(SDCard &sdCard) {
@@ -453,12 +1542,36 @@ void SDCard::closeCurrentSession(SDCard &sdCard) {
 	sdCard.currentSession.clear();
 	sdCard.videoRecorder->getStop();
 	sdCard.audioRecorder->getStop();
+	Recorder::startTimestamp = 0;	/* Also a resumed record that never started */
 	sdCard.videoRecorder.reset();
 	sdCard.audioRecorder.reset();
 }
 
+int SDCard::storageSamples(std::shared_ptr<Recorder> rec, FrameRef frame) {
+	if (!frame) {
+		return SDCARD_STORAGE_FAILURE;
+	}
+
+	/* Record ends where its last frame was captured rather than when it's written */
+	if (frame.pts != 0 && frame.pts / 1000 > Recorder::endTimestamp) {
+		Recorder::endTimestamp = (uint32_t)(frame.pts / 1000);
+	}
+
+	if (rec->getCurrentInstance().empty()) {
+		if (rec->getStart() == RECORD_RETURN_FAILURE) {
+			return SDCARD_STORAGE_FAILURE;
+		}
+	}
+
+	if (rec->getStorage(std::move(frame)) != RECORD_RETURN_SUCCESS) {
+		return SDCARD_STORAGE_FAILURE;
+	}
+
+	return SDCARD_RETURN_SUCCESS;
+}
+
 int SDCard::storageSamples(std::shared_ptr<Recorder> rec, uint8_t *sample, size_t totalSample) {
-	std::string currentInstance = rec->getCurrentInstance();
+	const std::string &currentInstance = rec->getCurrentInstance();
 
 	if (currentInstance.empty()) {
 		if (rec->getStart() == RECORD_RETURN_FAILURE) {
@@ -466,13 +1579,10 @@ int SDCard::storageSamples(std::shared_ptr<Recorder> rec, uint8_t *sample, size_
 		}
 	}
 
+	/* Recorder splits records on its own, at a boundary of the track */
 	if (rec->getStorage(sample, totalSample) != RECORD_RETURN_SUCCESS) {
 		return SDCARD_STORAGE_FAILURE;
 	}
 
-	if (rec->isCompleted()) {
-		rec->getStop();
-	}
-
 	return SDCARD_RETURN_SUCCESS;
 }
\ No newline at end of file
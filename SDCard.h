@@ -7,14 +7,25 @@
 #include <memory>
 #include <mutex>
 #include <string>
+#include <map>
 
 #include "recorder.h"
+#include "segindex.h"
+#include "scrub.h"
+#include "fatformat.h"
+#include "iosched.h"
+#include "playback.h"
+#include "thumbtrack.h"
+#include "motionbmp.h"
+#include "framepool.h"
+#include "cardprofile.h"
+#include "timefmt.h"
+#include "storagesummary.h"
 
 #define SDCARD_HARD_DRIVE	    		"/dev/mmcblk0"
 #define SDCARD_MOUNT_POINT     			"/tmp/sd"
 
 #define SDCARD_FORMAT_TYPE				"vfat"
-#define SDCARD_FORMAT_COMMAND			"mkfs.vfat"
 
 #define SDCARD_RETURN_SUCCESS			(0)
 #define SDCARD_MOUNT_FAILURE			(-1)
@@ -22,19 +33,17 @@
 #define SDCARD_FORMAT_FAILURE			(-3)
 #define SDCARD_STORAGE_FAILURE			(-4)
 
-typedef struct {
-	uint8_t nbOrder;
-	uint8_t type;
-	uint32_t durationInSecs = 0;
-	std::string fileName;
-	std::string beginTime;
-	std::string endTime;
-
-	/* This structure support sorting */
-	struct {
-		uint8_t hou, min, sec;
-	} sortTime;
-} RecordDesc;
+#define SDCARD_STAGING_CAPACITY			(64 * 1024 * 1024)
+#define SDCARD_STAGING_RESERVE			(16 * 1024 * 1024) /* Room needed to start a record in staging tier */
+
+#define SDCARD_PLAYLIST_NO_CURSOR		(UINT32_MAX)
+#define SDCARD_PLAYLIST_NO_LIMIT		(SIZE_MAX)
+
+#define SDCARD_DURATION_AUTO			(0)		/* Record duration of the card write policy */
+
+#define SDCARD_RESUME_MAX_GAP			(30)	/* Longest interruption a record is resumed after */
+
+#define SDCARD_DAY_FOLDERS				(4)		/* Day folders kept opened, least recently used one is closed first */
 
 typedef struct {
 	uint64_t total;
@@ -59,8 +68,8 @@ public:
 
 	enum class eQryPlaylist {
 		All,
-		Full,
-		Motion,
+		Full = RECORD_TYPE_FULL,
+		Motion = RECORD_TYPE_MOTION,
 	};
 
 	SDCard(std::string hardDrive);
@@ -72,9 +81,86 @@ public:
 	bool hasMountPoint();
 	bool isVFatFmt();
 	void updateCapacity();
+	int getFormatProgress();
 	int getTotalSessionRecords();
 	void eraseOldestRecords(std::string dateTime = "");
+	void eraseRecordDay(std::string dateTime);
+	void enableStaging(std::string pathToStaging = STAGING_DEFAULT_ROOT, 
+					   uint64_t capacityInBytes = SDCARD_STAGING_CAPACITY, 
+					   uint64_t reserveInBytes = SDCARD_STAGING_RESERVE);
+	std::string locateRecord(std::string pathOnSDCard);
+	std::vector<std::string> getRecordDays();
+
+	/*  Card is profiled on its first mount (see cardprofile.h), recorders of next session
+		write with the policy derived from it. Bitrate of the configured streams is checked
+		against what the card sustains, a warning is printed if it can't keep up.
+	*/
+	const CardProfile &getCardProfile();
+	const WritePolicy &getWritePolicy();
+	void setStreamBitrate(uint32_t bitsPerSec);
+	bool isBitrateSustained();
+
+	/*  Verify chunk CRC32C of a day (or whole card if dateTime is empty) and flag corrupted
+		ranges to segment index. It takes the POSIX mutex only while touching the catalog,
+		so it MUST-NOT be called in ENTRY_ATOMIC().
+	*/
+	int scrub(std::string dateTime, ScrubReport &report, unsigned nbThreads = SCRUB_DEFAULT_THREADS);
+
+	/*  Read-only scrub for offline tools: journals are loaded as they are on card, nothing
+		is rebuilt, renamed, truncated nor flagged. Corrupted chunks are only reported in jobs.
+	*/
+	int verify(std::string dateTime, ScrubReport &report, std::vector<ScrubJob> &jobs, unsigned nbThreads = SCRUB_DEFAULT_THREADS);
+	std::vector<TrackChunk> getCorruptedRanges(std::string dateTime, uint32_t startTimestamp);
+
+	/*  Open the video + audio pair of a record for playback, nullptr if it can't be read.
+		The reader is independent of the catalog, it MUST-BE released before unmount.
+	*/
+	std::shared_ptr<SegmentReader> openSegmentReader(std::string dateTime, const RecordDesc &desc);
+
+	/*  Keyframe-only track of a day for timeline scrubbing. It takes effect from the next session,
+		thumbnails are selected at least "stepInSecs" apart so a day overview reads only a few MB.
+	*/
+	void enableThumbnails(uint32_t intervalInSecs = THUMBNAIL_DEFAULT_INTERVAL);
+
+	/* Audio recorder skips silent G.711 spans from the next session, playback fills them back */
+	void enableSilenceSkip(SilenceDetector::eLaw law, uint8_t threshold = SILENCE_DEFAULT_THRESHOLD);
+
+	/*  Next session appends to the newest record of today a restart (watchdog, OTA, crash) left
+		interrupted, if it's of the same kind and was written less than "maxGapInSecs" ago.
+		Its tracks are trimmed to their last complete frame first, see Recorder::trimInterrupted().
+	*/
+	void enableResume(uint32_t maxGapInSecs = SDCARD_RESUME_MAX_GAP);
+
+	/*  Records of the next session are encrypted with AES-128-CTR (nullptr to stop), playback
+		and resume decrypt them with the same key. Scrub checks them without the key, chunk CRCs
+		are of the bytes on the card. Keyframes aren't copied to the thumbnail track meanwhile.
+	*/
+	void enableEncryption(const uint8_t key[AESCTR_KEY_SIZE]);
+	std::vector<ThumbnailDesc> getThumbnails(std::string dateTime, uint32_t stepInSecs = 0);
+	int readThumbnail(std::string dateTime, const ThumbnailDesc &desc, std::vector<uint8_t> &data);
+
+	/*  Bytes, segments, recorded and motion seconds per day and track, read from the summary
+		kept up to date by recorders and retention (see storagesummary.h). Only a day without
+		summary yet (card of a previous version, torn slot) is scanned, once.
+	*/
+	std::vector<DaySummary> getDaySummaries();
+
+	/*  Motion events from per-day bitmaps, neither record files nor directories are read.
+		Bitmaps already loaded are looked up in a snapshot, without the POSIX mutex.
+	*/
+	std::vector<MotionInterval> getMotionIntervals(uint32_t fromTimestamp, uint32_t toTimestamp);
+	uint32_t findNextMotion(uint32_t timestamp);
+
+	/*  Playlist queries read an immutable snapshot of the day catalog, they don't take the
+		POSIX mutex unless the day has to be loaded or rebuilt from a directory scan. They may
+		be called from any thread, in or out of ENTRY_ATOMIC().
+	*/
 	std::vector<RecordDesc> getAllPlaylists(std::string dateTime, eQryPlaylist type);
+	size_t getPlaylistPage(std::vector<RecordDesc> &page,
+						   std::string dateTime,
+						   eQryPlaylist type,
+						   uint32_t beforeTimestamp = SDCARD_PLAYLIST_NO_CURSOR,
+						   size_t maxRecords = SDCARD_PLAYLIST_NO_LIMIT);
 
 	void lockPOSIXMutex();
 	void unLockPOSIXMutex();
@@ -83,10 +169,65 @@ private:
 	pthread_mutex_t mPOSIXMutex;
 	eState mState = eState::Removed;
 	MemMang_t mCapacity;
+	typedef std::map<std::string, std::shared_ptr<SegmentIndex>> SegmentIndexMap;
+	typedef std::map<std::string, std::shared_ptr<MotionBitmap>> MotionBitmapMap;
+
+	/* Replaced as a whole (atomic_store) on every change, readers atomic_load it without the POSIX mutex */
+	std::shared_ptr<const SegmentIndexMap> mSegmentIndexes = std::make_shared<const SegmentIndexMap>();
+	std::shared_ptr<const MotionBitmapMap> mMotionBitmaps = std::make_shared<const MotionBitmapMap>();	/* Same as mSegmentIndexes */
+	std::shared_ptr<StorageSummary> mStorageSummary;	/* Loaded on first use after mount */
+	std::shared_ptr<StagingTier> mStagingTier;
+	FatFormatter mFormatter;
+	uint32_t mThumbnailInterval = 0;	/* Disabled */
+	bool mIsSilenceSkipped = false;
+	SilenceDetector::eLaw mSilenceLaw = SilenceDetector::eLaw::ALaw;
+	uint8_t mSilenceThreshold = SILENCE_DEFAULT_THRESHOLD;
+	uint32_t mResumeMaxGap = 0;		/* Disabled */
+	std::shared_ptr<AesCtr> mCipher;	/* Disabled if null */
+	CardProfile mCardProfile;
+	WritePolicy mWritePolicy = CardProfiler::getDefaultPolicy();
+	uint32_t mStreamBitrate = 0;		/* Unknown */
+
+	/*  Directories of the mounted card stay opened, files are created, renamed, removed
+		and listed relative to them (openat, renameat, ...) so the kernel doesn't walk
+		"<MountPoint>/video/<Day>" again for every operation. -1 when it's not opened.
+	*/
+	typedef struct {
+		char dateTime[TIMEFMT_DATE_LENGTH + 1];
+		int videoFd;
+		int audioFd;
+		uint32_t lastUsed;
+	} DayFolder;
 
-	void qryPlayList(std::vector<RecordDesc> &listRecords, std::string dateTime, eQryPlaylist type);
-	void eraseRecord(std::string dateTime, std::string videoDesc);
-	void eraseFolder(std::string dateTime);
+	int mRootFd = -1;
+	int mVideoFd = -1;
+	int mAudioFd = -1;
+	DayFolder mDayFolders[SDCARD_DAY_FOLDERS];
+	uint32_t mDayFolderTick = 0;
+
+	std::shared_ptr<SegmentIndex> findSegmentIndex(std::string dateTime);
+	std::shared_ptr<SegmentIndex> getSegmentIndex(std::string dateTime);
+	void clearSegmentIndexes();
+	std::shared_ptr<MotionBitmap> getMotionBitmap(std::string dateTime);
+	void eraseMotionBitmap(std::string dateTime);
+	void clearMotionBitmaps();
+	std::shared_ptr<StorageSummary> getStorageSummary();
+	void loadSegmentIndexes();
+	void loadCardProfile();
+	bool ensureSegmentIndex(std::string dateTime);	/* False if the day was never recorded, nothing is created */
+	void collectScrubJobs(std::string dateTime, SegmentIndex &index, std::vector<ScrubJob> &jobs);
+	bool findResumableRecord(Recorder::eOption option, int durationInSecs, RecordDesc &desc, uint32_t chunkOffsets[2],
+							 uint64_t nonces[2], ChunkDesc &lastKeyframe);
+	void scanPlayList(std::vector<RecordDesc> &listRecords, std::vector<RecordDesc> &trackRecords, std::string dateTime);
+	void scanPlayList(std::vector<RecordDesc> &listRecords, std::vector<RecordDesc> &trackRecords, int videoFd, int audioFd, int otherAudioFd, bool isStaged);
+	void summarizeDay(std::string dateTime, std::vector<RecordDesc> &trackRecords);
+	void qryPlayList(std::vector<RecordDesc> &listRecords, std::string dateTime, eQryPlaylist type, uint32_t beforeTimestamp, size_t maxRecords);
+	void eraseRecord(const char *dateTime, const char *videoDesc);
+	void eraseFolder(const char *dateTime);
+	int openDirectories(bool isCreated);
+	void closeDirectories();
+	DayFolder *getDayFolder(const char *dateTime, bool isCreated);
+	void dropDayFolder(const char *dateTime);
 
 public:
 	std::string hardDrive;
@@ -98,10 +239,18 @@ public:
 	std::shared_ptr<Recorder> videoRecorder;
 	std::shared_ptr<Recorder> audioRecorder;
 
+	/* Every disk operation on the card goes through it, playback readers take Playback tickets */
+	std::shared_ptr<IOScheduler> ioScheduler;
+
 	uint64_t &totalCapacity = mCapacity.total;
 	uint64_t &usedCapacity = mCapacity.used;
 	uint64_t &freeCapacity = mCapacity.free;
 
+	/* Formatting of compact record descriptions, call only at the API boundary */
+	static std::string formatRecordName(const RecordDesc &desc);
+	static void formatRecordName(const RecordDesc &desc, char *name, size_t len);
+	static std::string formatRecordTime(uint32_t timestamp);
+
 	/* Function protect safe accesss to SDCard */
 	static void ENTRY_ATOMIC(SDCard &sdCard);
 	static void EXIT_ATOMIC(SDCard &sdCard);
@@ -110,9 +259,14 @@ public:
 		and EXIT_ATOMIC() to protect operations.
 	*/
 	static bool isSDCardMounted(SDCard &sdCard);
-	static void openSessionRecord(SDCard &sdCard, Recorder::eOption option);
+	static void openSessionRecord(SDCard &sdCard, Recorder::eOption option, int durationInSecs = SDCARD_DURATION_AUTO);
 	static void closeCurrentSession(SDCard &sdCard);
 	static int storageSamples(std::shared_ptr<Recorder> rec, uint8_t *sample, size_t totalSample);
+	/*  Takes ownership of the frame, its pts (milliseconds since epoch) is the record end timestamp.
+		The recorder holds the frame until it's written (see WritePolicy::flushSize), the slab goes
+		back to the pool after that write.
+	*/
+	static int storageSamples(std::shared_ptr<Recorder> rec, FrameRef frame);
 };
 
 #endif /* __SDCARD_H */
\ No newline at end of file
@@ -0,0 +1,387 @@
+#include <string.h>
+#include <algorithm>
+#include <random>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <wmmintrin.h>
+#include <emmintrin.h>
+#define AESCTR_HW_X86
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define AESCTR_HW_ARM64
+#endif
+
+#include "aesctr.h"
+
+#define AESCTR_SLICED_BLOCKS				(4)		/* Blocks per bit plane of 64 bits */
+#define AESCTR_SLICED_SIZE					(AESCTR_SLICED_BLOCKS * AESCTR_BLOCK_SIZE)
+#define AESCTR_HW_BLOCKS					(4)		/* Blocks in flight, hides latency of AES instructions */
+
+/* Bit planes: bit (16 * block + byte) of plane j is bit j of that byte of the state */
+#define PLANE_ROW0							(0x1111111111111111ULL)
+
+static void makeCounter(uint64_t nonce, uint64_t block, uint8_t counter[AESCTR_BLOCK_SIZE]) {
+	for (int id = 0; id < 8; ++id) {
+		counter[id] 	= (uint8_t)(nonce >> (56 - 8 * id));
+		counter[8 + id] = (uint8_t)(block >> (56 - 8 * id));
+	}
+}
+
+static void xorStream(uint8_t *data, const uint8_t *stream, size_t len) {
+	for (size_t id = 0; id < len; ++id) {
+		data[id] ^= stream[id];
+	}
+}
+
+static void slice(const uint8_t *bytes, size_t len, uint64_t planes[8]) {
+	memset(planes, 0, 8 * sizeof(uint64_t));
+	for (size_t pos = 0; pos < len; ++pos) {
+		for (int bit = 0; bit < 8; ++bit) {
+			planes[bit] |= (uint64_t)((bytes[pos] >> bit) & 1) << pos;
+		}
+	}
+}
+
+static void unslice(const uint64_t planes[8], uint8_t *bytes, size_t len) {
+	for (size_t pos = 0; pos < len; ++pos) {
+		uint8_t byte = 0;
+		for (int bit = 0; bit < 8; ++bit) {
+			byte |= (uint8_t)((planes[bit] >> pos) & 1) << bit;
+		}
+		bytes[pos] = byte;
+	}
+}
+
+/* Reduction modulo x^8 + x^4 + x^3 + x + 1 */
+static void gfReduce(uint64_t c[15], uint64_t r[8]) {
+	for (int k = 14; k >= 8; --k) {
+		c[k - 4] ^= c[k];
+		c[k - 5] ^= c[k];
+		c[k - 7] ^= c[k];
+		c[k - 8] ^= c[k];
+	}
+	memcpy(r, c, 8 * sizeof(uint64_t));
+}
+
+static void gfMultiply(const uint64_t a[8], const uint64_t b[8], uint64_t r[8]) {
+	uint64_t c[15] = { 0 };
+
+	for (int i = 0; i < 8; ++i) {
+		for (int j = 0; j < 8; ++j) {
+			c[i + j] ^= a[i] & b[j];
+		}
+	}
+	gfReduce(c, r);
+}
+
+static void gfSquare(const uint64_t a[8], uint64_t r[8]) {
+	uint64_t c[15] = { 0 };
+
+	/* Linear in GF(2^8) */
+	for (int i = 0; i < 8; ++i) {
+		c[2 * i] = a[i];
+	}
+	gfReduce(c, r);
+}
+
+/* S-box of every byte: a^254 (inverse, 0 for 0), then affine transform */
+static void subBytes(uint64_t s[8]) {
+	uint64_t a2[8], a3[8], a12[8], a14[8], a15[8], x[8];
+
+	gfSquare(s, a2);
+	gfMultiply(a2, s, a3);
+	gfSquare(a3, x);
+	gfSquare(x, a12);
+	gfMultiply(a12, a2, a14);
+	gfMultiply(a12, a3, a15);
+	gfSquare(a15, x);		/* a^30 */
+	gfSquare(x, a2);		/* a^60 */
+	gfSquare(a2, x);		/* a^120 */
+	gfSquare(x, a2);		/* a^240 */
+	gfMultiply(a2, a14, x);	/* a^254 */
+
+	for (int i = 0; i < 8; ++i) {
+		s[i] = x[i] ^ x[(i + 4) % 8] ^ x[(i + 5) % 8] ^ x[(i + 6) % 8] ^ x[(i + 7) % 8];
+	}
+	/* 0x63 */
+	s[0] = ~s[0];
+	s[1] = ~s[1];
+	s[5] = ~s[5];
+	s[6] = ~s[6];
+}
+
+/* Row r of every block rotates left by r columns, i.e. its bits by 4 * r in the lane of the block */
+static uint64_t shiftRows(uint64_t x) {
+	static const uint64_t lower[4] = { 0, 0x0FFF0FFF0FFF0FFFULL, 0x00FF00FF00FF00FFULL, 0x000F000F000F000FULL };
+	uint64_t ret = x & PLANE_ROW0;
+
+	for (int row = 1; row < 4; ++row) {
+		uint64_t bits = x & (PLANE_ROW0 << row);
+		int shift = 4 * row;
+		ret |= ((bits >> shift) & lower[row]) | ((bits << (16 - shift)) & ~lower[row]);
+	}
+
+	return ret;
+}
+
+/* Row r + n of the same column */
+static uint64_t rotateColumn(uint64_t x, int n) {
+	static const uint64_t lower[4] = { 0, 0x7777777777777777ULL, 0x3333333333333333ULL, 0x1111111111111111ULL };
+
+	return ((x >> n) & lower[n]) | ((x << (4 - n)) & ~lower[n]);
+}
+
+/* b(r) = 2 * (a(r) ^ a(r + 1)) ^ a(r + 1) ^ a(r + 2) ^ a(r + 3) */
+static void mixColumns(uint64_t s[8]) {
+	uint64_t t[8], others[8];
+
+	for (int i = 0; i < 8; ++i) {
+		uint64_t next = rotateColumn(s[i], 1);
+		t[i] = s[i] ^ next;
+		others[i] = next ^ rotateColumn(s[i], 2) ^ rotateColumn(s[i], 3);
+	}
+
+	s[0] = t[7] ^ others[0];
+	s[1] = t[0] ^ t[7] ^ others[1];
+	s[2] = t[1] ^ others[2];
+	s[3] = t[2] ^ t[7] ^ others[3];
+	s[4] = t[3] ^ t[7] ^ others[4];
+	s[5] = t[4] ^ others[5];
+	s[6] = t[5] ^ others[6];
+	s[7] = t[6] ^ others[7];
+}
+
+static void addRoundKey(uint64_t s[8], const uint64_t key[8]) {
+	for (int i = 0; i < 8; ++i) {
+		s[i] ^= key[i];
+	}
+}
+
+static void encryptSliced(uint64_t s[8], const uint64_t keys[AESCTR_ROUNDS + 1][8]) {
+	addRoundKey(s, keys[0]);
+	for (int round = 1; round <= AESCTR_ROUNDS; ++round) {
+		subBytes(s);
+		for (int i = 0; i < 8; ++i) {
+			s[i] = shiftRows(s[i]);
+		}
+		if (round != AESCTR_ROUNDS) {
+			mixColumns(s);
+		}
+		addRoundKey(s, keys[round]);
+	}
+}
+
+void AesCtr::ctrSoftware(const AesCtr &aes, uint64_t nonce, uint64_t block, uint8_t *data, size_t len) {
+	uint8_t stream[AESCTR_SLICED_SIZE];
+	uint64_t planes[8];
+
+	while (len > 0) {
+		for (int id = 0; id < AESCTR_SLICED_BLOCKS; ++id) {
+			makeCounter(nonce, block + id, stream + id * AESCTR_BLOCK_SIZE);
+		}
+		slice(stream, sizeof(stream), planes);
+		encryptSliced(planes, aes.mSlicedKeys);
+		unslice(planes, stream, sizeof(stream));
+
+		size_t nbBytes = std::min(len, sizeof(stream));
+		xorStream(data, stream, nbBytes);
+		data += nbBytes;
+		len -= nbBytes;
+		block += AESCTR_SLICED_BLOCKS;
+	}
+}
+
+#if defined(AESCTR_HW_X86)
+__attribute__((target("aes,sse2")))
+void AesCtr::ctrHardware(const AesCtr &aes, uint64_t nonce, uint64_t block, uint8_t *data, size_t len) {
+	alignas(16) uint8_t counter[AESCTR_HW_BLOCKS * AESCTR_BLOCK_SIZE];
+	__m128i keys[AESCTR_ROUNDS + 1];
+	__m128i s[AESCTR_HW_BLOCKS];
+
+	for (int round = 0; round <= AESCTR_ROUNDS; ++round) {
+		keys[round] = _mm_load_si128((const __m128i *)(aes.mRoundKeys + round * AESCTR_BLOCK_SIZE));
+	}
+
+	while (len > 0) {
+		for (int id = 0; id < AESCTR_HW_BLOCKS; ++id) {
+			makeCounter(nonce, block + id, counter + id * AESCTR_BLOCK_SIZE);
+			s[id] = _mm_xor_si128(_mm_load_si128((const __m128i *)(counter + id * AESCTR_BLOCK_SIZE)), keys[0]);
+		}
+		for (int round = 1; round < AESCTR_ROUNDS; ++round) {
+			for (int id = 0; id < AESCTR_HW_BLOCKS; ++id) {
+				s[id] = _mm_aesenc_si128(s[id], keys[round]);
+			}
+		}
+		for (int id = 0; id < AESCTR_HW_BLOCKS; ++id) {
+			s[id] = _mm_aesenclast_si128(s[id], keys[AESCTR_ROUNDS]);
+		}
+
+		if (len >= sizeof(counter)) {
+			for (int id = 0; id < AESCTR_HW_BLOCKS; ++id) {
+				__m128i *p = (__m128i *)(data + id * AESCTR_BLOCK_SIZE);
+				_mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), s[id]));
+			}
+			data += sizeof(counter);
+			len -= sizeof(counter);
+		}
+		else {
+			/* Tail, key stream goes through the counter buffer */
+			for (int id = 0; id < AESCTR_HW_BLOCKS; ++id) {
+				_mm_store_si128((__m128i *)(counter + id * AESCTR_BLOCK_SIZE), s[id]);
+			}
+			xorStream(data, counter, len);
+			len = 0;
+		}
+		block += AESCTR_HW_BLOCKS;
+	}
+}
+
+static bool hasHardwareAes() {
+	return __builtin_cpu_supports("aes");
+}
+
+static const char *hardwareName = "AES-NI";
+#elif defined(AESCTR_HW_ARM64)
+__attribute__((target("+crypto")))
+void AesCtr::ctrHardware(const AesCtr &aes, uint64_t nonce, uint64_t block, uint8_t *data, size_t len) {
+	uint8_t counter[AESCTR_HW_BLOCKS * AESCTR_BLOCK_SIZE];
+	uint8x16_t keys[AESCTR_ROUNDS + 1];
+	uint8x16_t s[AESCTR_HW_BLOCKS];
+
+	for (int round = 0; round <= AESCTR_ROUNDS; ++round) {
+		keys[round] = vld1q_u8(aes.mRoundKeys + round * AESCTR_BLOCK_SIZE);
+	}
+
+	while (len > 0) {
+		for (int id = 0; id < AESCTR_HW_BLOCKS; ++id) {
+			makeCounter(nonce, block + id, counter + id * AESCTR_BLOCK_SIZE);
+			s[id] = vld1q_u8(counter + id * AESCTR_BLOCK_SIZE);
+		}
+		/* AESE is AddRoundKey + SubBytes + ShiftRows */
+		for (int round = 0; round < AESCTR_ROUNDS - 1; ++round) {
+			for (int id = 0; id < AESCTR_HW_BLOCKS; ++id) {
+				s[id] = vaesmcq_u8(vaeseq_u8(s[id], keys[round]));
+			}
+		}
+		for (int id = 0; id < AESCTR_HW_BLOCKS; ++id) {
+			s[id] = veorq_u8(vaeseq_u8(s[id], keys[AESCTR_ROUNDS - 1]), keys[AESCTR_ROUNDS]);
+		}
+
+		if (len >= sizeof(counter)) {
+			for (int id = 0; id < AESCTR_HW_BLOCKS; ++id) {
+				uint8_t *p = data + id * AESCTR_BLOCK_SIZE;
+				vst1q_u8(p, veorq_u8(vld1q_u8(p), s[id]));
+			}
+			data += sizeof(counter);
+			len -= sizeof(counter);
+		}
+		else {
+			for (int id = 0; id < AESCTR_HW_BLOCKS; ++id) {
+				vst1q_u8(counter + id * AESCTR_BLOCK_SIZE, s[id]);
+			}
+			xorStream(data, counter, len);
+			len = 0;
+		}
+		block += AESCTR_HW_BLOCKS;
+	}
+}
+
+static bool hasHardwareAes() {
+	return (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+}
+
+static const char *hardwareName = "ARMv8 Crypto";
+#else
+void AesCtr::ctrHardware(const AesCtr &aes, uint64_t nonce, uint64_t block, uint8_t *data, size_t len) {
+	ctrSoftware(aes, nonce, block, data, len);
+}
+
+static bool hasHardwareAes() {
+	return false;
+}
+
+static const char *hardwareName = "";
+#endif
+
+AesCtr::AesCtr(const uint8_t key[AESCTR_KEY_SIZE], bool isHardwareAllowed) {
+	static const uint8_t rcon[AESCTR_ROUNDS] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1B, 0x36 };
+	uint8_t *w = mRoundKeys;
+
+	/* Key expansion, SubWord() on bit planes as well */
+	memcpy(w, key, AESCTR_KEY_SIZE);
+	for (int id = AESCTR_KEY_SIZE; id < (int)sizeof(mRoundKeys); id += 4) {
+		uint8_t word[4] = { w[id - 4], w[id - 3], w[id - 2], w[id - 1] };
+
+		if (id % AESCTR_KEY_SIZE == 0) {
+			uint8_t rotated[4] = { word[1], word[2], word[3], word[0] };
+			uint64_t planes[8];
+
+			slice(rotated, sizeof(rotated), planes);
+			subBytes(planes);
+			unslice(planes, word, sizeof(word));
+			word[0] ^= rcon[id / AESCTR_KEY_SIZE - 1];
+		}
+		for (int k = 0; k < 4; ++k) {
+			w[id + k] = w[id + k - AESCTR_KEY_SIZE] ^ word[k];
+		}
+	}
+
+	/* Same round key in every block of a plane */
+	for (int round = 0; round <= AESCTR_ROUNDS; ++round) {
+		uint8_t replicated[AESCTR_SLICED_SIZE];
+		for (int id = 0; id < AESCTR_SLICED_BLOCKS; ++id) {
+			memcpy(replicated + id * AESCTR_BLOCK_SIZE, mRoundKeys + round * AESCTR_BLOCK_SIZE, AESCTR_BLOCK_SIZE);
+		}
+		slice(replicated, sizeof(replicated), mSlicedKeys[round]);
+		explicit_bzero(replicated, sizeof(replicated));
+	}
+
+	mCtr = (isHardwareAllowed && hasHardwareAes()) ? ctrHardware : ctrSoftware;
+}
+
+AesCtr::~AesCtr() {
+	explicit_bzero(mRoundKeys, sizeof(mRoundKeys));
+	explicit_bzero(mSlicedKeys, sizeof(mSlicedKeys));
+}
+
+void AesCtr::apply(uint64_t nonce, uint64_t offset, uint8_t *data, size_t len) const {
+	uint64_t block = offset / AESCTR_BLOCK_SIZE;
+	size_t skip = (size_t)(offset % AESCTR_BLOCK_SIZE);
+
+	/* Range starting inside a block */
+	if (skip != 0 && len > 0) {
+		uint8_t stream[AESCTR_BLOCK_SIZE] = { 0 };
+		size_t nbBytes = std::min(len, (size_t)AESCTR_BLOCK_SIZE - skip);
+
+		mCtr(*this, nonce, block, stream, sizeof(stream));
+		xorStream(data, stream + skip, nbBytes);
+		data += nbBytes;
+		len -= nbBytes;
+		++block;
+	}
+
+	if (len > 0) {
+		mCtr(*this, nonce, block, data, len);
+	}
+}
+
+bool AesCtr::isHardwareAccelerated() const {
+	return mCtr == ctrHardware && hasHardwareAes();
+}
+
+uint64_t AesCtr::makeNonce() {
+	std::random_device random;
+	uint64_t nonce = 0;
+
+	while (nonce == 0) {
+		nonce = ((uint64_t)random() << 32) | random();
+	}
+
+	return nonce;
+}
+
+const char *AesCtr::getImplementation(bool isHardwareAllowed) {
+	return (isHardwareAllowed && hasHardwareAes()) ? hardwareName : "Software (bitsliced)";
+}
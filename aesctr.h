@@ -0,0 +1,52 @@
+/*
+    AES-128 in counter mode (CTR) for records at rest.
+
+    The key stream of a record is addressed by file offset:
+        counter block = nonce (64 bits, big endian) | offset / 16 (64 bits, big endian)
+    so any range of a record is encrypted or decrypted on its own, encryption and
+    decryption are the same XOR. Data is processed in place, without copy.
+
+    The nonce of a track record is drawn at random when it opens and journaled next to
+    its Open entry (SegmentIndex Nonce entry), playback and restart recovery read it back
+    from there, a record whose journal is lost can't be decrypted any more. A tail cut
+    off by restart recovery is written again with the same key stream.
+
+    AES-NI (x86) or ARMv8 Crypto Extension is used when CPU supports it. The software
+    fallback is bitsliced (4 blocks at a time, S-box computed as inversion in GF(2^8)),
+    it uses no lookup table so its timing doesn't depend on key or data.
+*/
+#ifndef __AESCTR_H
+#define __AESCTR_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define AESCTR_KEY_SIZE                     (16)
+#define AESCTR_BLOCK_SIZE                   (16)
+#define AESCTR_ROUNDS                       (10)
+
+class AesCtr {
+public:
+    /* "isHardwareAllowed" false forces the software fallback, e.g. to benchmark it */
+    AesCtr(const uint8_t key[AESCTR_KEY_SIZE], bool isHardwareAllowed = true);
+    ~AesCtr();
+
+    /* XOR key stream of "nonce" from "offset" of the record into "data" */
+    void apply(uint64_t nonce, uint64_t offset, uint8_t *data, size_t len) const;
+    bool isHardwareAccelerated() const;
+
+    static uint64_t makeNonce();                    /* Random, never 0 */
+    static const char *getImplementation(bool isHardwareAllowed = true);
+
+private:
+    typedef void (*CtrFunc)(const AesCtr &, uint64_t, uint64_t, uint8_t *, size_t);
+
+    alignas(16) uint8_t mRoundKeys[(AESCTR_ROUNDS + 1) * AESCTR_BLOCK_SIZE];
+    uint64_t mSlicedKeys[AESCTR_ROUNDS + 1][8];     /* Bit planes of round keys, for software fallback */
+    CtrFunc mCtr;
+
+    static void ctrSoftware(const AesCtr &aes, uint64_t nonce, uint64_t block, uint8_t *data, size_t len);
+    static void ctrHardware(const AesCtr &aes, uint64_t nonce, uint64_t block, uint8_t *data, size_t len);
+};
+
+#endif /* __AESCTR_H */
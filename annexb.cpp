@@ -0,0 +1,38 @@
+#include <string.h>
+
+#include "annexb.h"
+
+bool findNextNal(const uint8_t *data, size_t size, size_t from, AnnexBNal &nal) {
+	size_t i = (from < 2) ? 2 : from;
+
+	while (i + 1 < size) {
+		const uint8_t *p = (const uint8_t *)memchr(data + i, 0x01, size - 1 - i);
+		if (p == nullptr) {
+			return false;
+		}
+
+		i = p - data;
+		if (data[i - 1] == 0 && data[i - 2] == 0) {
+			nal.offset = (i >= 3 && data[i - 3] == 0) ? i - 3 : i - 2;
+			nal.header = i + 1;
+			nal.type = data[i + 1] & 0x1F;
+			return true;
+		}
+		++i;
+	}
+
+	return false;
+}
+
+bool isFirstSliceOfPicture(const uint8_t *data, size_t size, const AnnexBNal &nal) {
+	/* ue(v) of first_mb_in_slice is 0 when its first bit is set */
+	return NAL_IS_SLICE(nal.type) && (nal.header + 1 < size) && (data[nal.header + 1] & 0x80);
+}
+
+bool hasStartCode(const uint8_t *data, size_t size) {
+	if (size < 3 || data[0] != 0 || data[1] != 0) {
+		return false;
+	}
+
+	return data[2] == 1 || (size >= 4 && data[2] == 0 && data[3] == 1);
+}
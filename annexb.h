@@ -0,0 +1,35 @@
+/*
+    Minimal H.264 Annex-B stream helpers, shared by playback reader and thumbnail track.
+    They only locate NAL units, nothing is decoded nor allocated.
+*/
+#ifndef __ANNEXB_H
+#define __ANNEXB_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define NAL_TYPE_SLICE                      (1)
+#define NAL_TYPE_IDR                        (5)
+#define NAL_TYPE_SEI                        (6)
+#define NAL_TYPE_SPS                        (7)
+#define NAL_TYPE_PPS                        (8)
+#define NAL_TYPE_AUD                        (9)
+
+#define NAL_IS_SLICE(type)                  ((type) == NAL_TYPE_SLICE || (type) == NAL_TYPE_IDR)
+
+typedef struct {
+    size_t offset;      /* Start code (3 or 4 bytes) */
+    size_t header;      /* NAL header byte */
+    uint8_t type;
+} AnnexBNal;
+
+/* Find first NAL unit whose start code ends at or after "from", false if there's none */
+bool findNextNal(const uint8_t *data, size_t size, size_t from, AnnexBNal &nal);
+
+/* Stream begins with a start code, e.g. a record file that isn't encrypted */
+bool hasStartCode(const uint8_t *data, size_t size);
+
+/* Slice with first_mb_in_slice = 0, it begins a new picture */
+bool isFirstSliceOfPicture(const uint8_t *data, size_t size, const AnnexBNal &nal);
+
+#endif /* __ANNEXB_H */
@@ -0,0 +1,235 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+#include "cardprofile.h"
+#include "crc32c.h"
+#include "utils.hpp"
+#include "vfs.h"
+
+#define LOCAL_DBG_EN			(0)
+
+#if (LOCAL_DBG_EN == 1)
+#define LOCAL_DBG(fmt, ...) 	printf("\x1B[35m" fmt "\x1B[0m", ##__VA_ARGS__)
+#else
+#define LOCAL_DBG(fmt, ...)
+#endif
+
+static uint32_t profileCrc(const CardProfile &profile) {
+	return crc32c(CRC32C_INIT, &profile, offsetof(CardProfile, crc));
+}
+
+static std::string readSysfsString(const std::string &path) {
+	char value[64] = { 0 };
+
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd == -1) {
+		return "";
+	}
+	ssize_t nbBytes = read(fd, value, sizeof(value) - 1);
+	close(fd);
+
+	std::string ret(value, nbBytes > 0 ? nbBytes : 0);
+	while (!ret.empty() && (ret.back() == '\n' || ret.back() == ' ')) {
+		ret.pop_back();
+	}
+
+	return ret;
+}
+
+static uint64_t elapsedInUs(std::chrono::steady_clock::time_point begin) {
+	auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count();
+	return std::max((uint64_t)us, (uint64_t)1);
+}
+
+std::string CardProfiler::readCardId(const std::string &hardDrive, uint64_t fsid) {
+	/* CID of SD/MMC card, e.g. /sys/class/block/mmcblk0p1/../device/cid */
+	std::string name = hardDrive.substr(hardDrive.rfind('/') + 1);
+	std::string pathToSysfs = "/sys/class/block/" + name;
+	std::string cid = readSysfsString(pathToSysfs + "/device/cid");
+	if (cid.empty()) {
+		cid = readSysfsString(pathToSysfs + "/../device/cid");
+	}
+
+	if (!cid.empty()) {
+		return cid.substr(0, CARDPROFILE_ID_LENGTH - 1);
+	}
+
+	/* USB storage and images: volume id, changes when the card is formatted */
+	char id[CARDPROFILE_ID_LENGTH];
+	snprintf(id, sizeof(id), "fsid-%016llx", (unsigned long long)fsid);
+	return std::string(id);
+}
+
+int CardProfiler::load(const std::string &pathToIndexes, const std::string &id, CardProfile &profile) {
+	std::string path = pathToIndexes + "/" CARDPROFILE_FILE_NAME;
+
+	int fd = getFileSystem().open(path.c_str(), O_RDONLY);
+	if (fd == -1) {
+		return CARDPROFILE_RETURN_MISSING;
+	}
+	ssize_t nbBytes = getFileSystem().read(fd, &profile, sizeof(profile));
+	getFileSystem().close(fd);
+
+	if (nbBytes != sizeof(profile) ||
+		profile.magic != CARDPROFILE_MAGIC ||
+		profile.version != CARDPROFILE_VERSION ||
+		profile.crc != profileCrc(profile))
+	{
+		return CARDPROFILE_RETURN_MISSING;
+	}
+
+	profile.id[CARDPROFILE_ID_LENGTH - 1] = '\0';
+	if (id != profile.id) {
+		return CARDPROFILE_RETURN_MISMATCHED;
+	}
+
+	return CARDPROFILE_RETURN_SUCCESS;
+}
+
+int CardProfiler::save(const std::string &pathToIndexes, const CardProfile &profile) {
+	std::string path = pathToIndexes + "/" CARDPROFILE_FILE_NAME;
+	std::string tmpPath = path + ".new";
+	CardProfile stored = profile;
+
+	stored.magic 	= CARDPROFILE_MAGIC;
+	stored.version 	= CARDPROFILE_VERSION;
+	stored.crc 		= profileCrc(stored);
+
+	createDirectory(pathToIndexes.c_str());
+	int fd = getFileSystem().open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd == -1) {
+		return CARDPROFILE_RETURN_IO_FAILURE;
+	}
+	bool isWritten = (getFileSystem().write(fd, &stored, sizeof(stored)) == sizeof(stored));
+	getFileSystem().fsync(fd);
+	getFileSystem().close(fd);
+
+	if (!isWritten || getFileSystem().rename(tmpPath.c_str(), path.c_str()) != 0) {
+		getFileSystem().unlink(tmpPath.c_str());
+		return CARDPROFILE_RETURN_IO_FAILURE;
+	}
+
+	return CARDPROFILE_RETURN_SUCCESS;
+}
+
+int CardProfiler::measure(const std::string &pathToIndexes, const std::string &id, CardProfile &profile) {
+	std::string path = pathToIndexes + "/" CARDPROFILE_SCRATCH_NAME;
+	std::vector<uint8_t> block(CARDPROFILE_MAX_BLOCK_SIZE, 0xA5);
+	std::vector<std::pair<uint32_t, uint64_t>> rates;	/* Block size, bytes per second */
+	std::vector<uint64_t> latencies;
+	bool isFailed = false;
+
+	memset(&profile, 0, sizeof(profile));
+	strncpy(profile.id, id.c_str(), CARDPROFILE_ID_LENGTH - 1);
+	profile.profiledTimestamp = getCurrentEpochTimestamp();
+
+	createDirectory(pathToIndexes.c_str());
+	int fd = getFileSystem().open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+	if (fd == -1) {
+		return CARDPROFILE_RETURN_IO_FAILURE;
+	}
+
+	/* Blocks of growing size, each one synced, the scratch file never exceeds the largest block */
+	for (uint32_t blockSize = CARDPROFILE_MIN_BLOCK_SIZE; blockSize <= CARDPROFILE_MAX_BLOCK_SIZE && !isFailed; blockSize *= 4) {
+		uint64_t total = std::max((uint64_t)CARDPROFILE_PROBE_SIZE, (uint64_t)blockSize);
+		auto begin = std::chrono::steady_clock::now();
+
+		for (uint64_t offset = 0; offset + blockSize <= total; offset += blockSize) {
+			off_t at = (off_t)(offset % CARDPROFILE_MAX_BLOCK_SIZE);
+			if (getFileSystem().pwrite(fd, block.data(), blockSize, at) != (ssize_t)blockSize || getFileSystem().fdatasync(fd) != 0) {
+				isFailed = true;
+				break;
+			}
+		}
+		rates.push_back({ blockSize, total * 1000000 / elapsedInUs(begin) });
+	}
+
+	for (int round = 0; round < CARDPROFILE_SYNC_ROUNDS && !isFailed; ++round) {
+		auto begin = std::chrono::steady_clock::now();
+		if (getFileSystem().pwrite(fd, block.data(), CARDPROFILE_SYNC_WRITE_SIZE, round * CARDPROFILE_SYNC_WRITE_SIZE) != CARDPROFILE_SYNC_WRITE_SIZE ||
+			getFileSystem().fdatasync(fd) != 0)
+		{
+			isFailed = true;
+			break;
+		}
+		latencies.push_back(elapsedInUs(begin));
+	}
+
+	if (!isFailed && getFileSystem().fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, 2 * CARDPROFILE_MAX_BLOCK_SIZE) == 0) {
+		profile.flags |= CARDPROFILE_FLAG_FALLOCATE;
+	}
+
+	getFileSystem().close(fd);
+	getFileSystem().unlink(path.c_str());
+
+	if (isFailed) {
+		return CARDPROFILE_RETURN_IO_FAILURE;
+	}
+
+	uint64_t best = 0;
+	for (auto &rate : rates) {
+		best = std::max(best, rate.second);
+	}
+	for (auto &rate : rates) {
+		if (rate.second * 100 >= best * CARDPROFILE_SATURATION_PERCENT) {
+			profile.allocUnitSize = rate.first;
+			break;
+		}
+	}
+
+	/* Throughput of the writes recorders will issue, the largest block measured that fits a flush */
+	uint32_t flushSize = toWritePolicy(profile).flushSize;
+	uint64_t writeBytesPerSec = rates.front().second;
+	for (auto &rate : rates) {
+		if (rate.first <= flushSize) {
+			writeBytesPerSec = rate.second;
+		}
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+	profile.writeBytesPerSec = (uint32_t)std::min(writeBytesPerSec, (uint64_t)UINT32_MAX);
+	profile.syncLatencyInUs = (uint32_t)std::min(latencies[latencies.size() / 2], (uint64_t)UINT32_MAX);
+
+	LOCAL_DBG("[PROFILE] %s: %u B/s, sync %u us, AU %u, flags 0x%x\n", profile.id, profile.writeBytesPerSec,
+			  profile.syncLatencyInUs, profile.allocUnitSize, profile.flags);
+
+	return CARDPROFILE_RETURN_SUCCESS;
+}
+
+WritePolicy CardProfiler::toWritePolicy(const CardProfile &profile) {
+	WritePolicy policy = getDefaultPolicy();
+
+	/* Whole AUs per write, bounded so a flush stays short */
+	policy.flushSize = std::min(std::max(profile.allocUnitSize, (uint32_t)CARDPROFILE_MIN_BLOCK_SIZE), (uint32_t)CARDPROFILE_MAX_FLUSH_SIZE);
+
+	/* Slow fdatasync -> sync less often */
+	uint64_t syncInterval = ((uint64_t)profile.syncLatencyInUs * 100 / CARDPROFILE_SYNC_OVERHEAD_PERCENT + 999999) / 1000000;
+	policy.syncIntervalInSecs = (uint32_t)std::min(std::max(syncInterval, (uint64_t)1), (uint64_t)CARDPROFILE_MAX_SYNC_INTERVAL);
+
+	if (profile.flags & CARDPROFILE_FLAG_FALLOCATE) {
+		policy.preallocSize = std::max(profile.allocUnitSize, policy.flushSize);
+	}
+
+	uint64_t maxBitrate = (uint64_t)profile.writeBytesPerSec * 8 * CARDPROFILE_LOAD_PERCENT / 100;
+	policy.maxBitrate = (uint32_t)std::min(maxBitrate, (uint64_t)UINT32_MAX);
+
+	/* Records long enough that opening, renaming and journaling them stays negligible */
+	uint64_t duration = (uint64_t)profile.syncLatencyInUs * CARDPROFILE_SEGMENT_SYNCS * 1000 / CARDPROFILE_SEGMENT_OVERHEAD_PERMILLE / 1000000;
+	policy.durationInSecs = (int)std::min(std::max(duration, (uint64_t)CARDPROFILE_MIN_DURATION), (uint64_t)CARDPROFILE_MAX_DURATION);
+
+	return policy;
+}
+
+WritePolicy CardProfiler::getDefaultPolicy() {
+	WritePolicy policy;
+
+	memset(&policy, 0, sizeof(policy));
+	policy.durationInSecs = CARDPROFILE_MIN_DURATION;
+
+	return policy;
+}
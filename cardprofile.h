@@ -0,0 +1,94 @@
+/*
+    Write profile of a card and the write policy derived from it.
+
+    On first mount of a card a short profiling pass runs in a scratch file of the
+    index directory, nothing else on the card is touched:
+        - Write throughput with an fdatasync after blocks of growing size, the
+          allocation unit (AU) is the smallest block size reaching
+          CARDPROFILE_SATURATION_PERCENT of the best throughput
+        - Sustained throughput is the one of the block size recorders flush with
+          (see toWritePolicy()), larger blocks would overstate it
+        - Latency of fdatasync after a small write (median of CARDPROFILE_SYNC_ROUNDS)
+        - Whether fallocate() is supported
+
+    The profile is kept on the card itself:
+        <MountPoint>/index/card.prof
+    with the identity of the card (CID of SD/MMC, volume id otherwise), a card
+    moved to another camera isn't profiled again, a card swapped in is.
+*/
+#ifndef __CARDPROFILE_H
+#define __CARDPROFILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+#define CARDPROFILE_FILE_NAME               "card.prof"
+#define CARDPROFILE_SCRATCH_NAME            ".profile.tmp"
+#define CARDPROFILE_MAGIC                   (0x46525043) /* "CPRF" */
+#define CARDPROFILE_VERSION                 (2)     /* 1 measured throughput with the largest block */
+#define CARDPROFILE_ID_LENGTH               (40)
+
+#define CARDPROFILE_MIN_BLOCK_SIZE          (16 * 1024)
+#define CARDPROFILE_MAX_BLOCK_SIZE          (4 * 1024 * 1024)
+#define CARDPROFILE_PROBE_SIZE              (1024 * 1024)   /* Written per block size, at least one block */
+#define CARDPROFILE_SYNC_ROUNDS             (8)
+#define CARDPROFILE_SYNC_WRITE_SIZE         (4096)
+#define CARDPROFILE_SATURATION_PERCENT      (90)
+
+/* Derived write policy */
+#define CARDPROFILE_MAX_FLUSH_SIZE          (1024 * 1024)
+#define CARDPROFILE_SYNC_OVERHEAD_PERCENT   (5)     /* Time spent in fdatasync the sync interval allows */
+#define CARDPROFILE_MAX_SYNC_INTERVAL       (10)
+#define CARDPROFILE_SEGMENT_SYNCS           (16)    /* fdatasync a record costs to open, rename and journal */
+#define CARDPROFILE_SEGMENT_OVERHEAD_PERMILLE (1)   /* Time spent in them the record duration allows */
+#define CARDPROFILE_MIN_DURATION            (300)
+#define CARDPROFILE_MAX_DURATION            (600)
+#define CARDPROFILE_LOAD_PERCENT            (50)    /* Bandwidth left to playback, eviction and metadata */
+
+#define CARDPROFILE_FLAG_FALLOCATE          (1 << 0)
+
+#define CARDPROFILE_RETURN_SUCCESS          (0)
+#define CARDPROFILE_RETURN_MISSING          (-1)
+#define CARDPROFILE_RETURN_MISMATCHED       (-2)    /* Profile of another card */
+#define CARDPROFILE_RETURN_IO_FAILURE       (-3)
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;                     /* CARDPROFILE_FLAG_* */
+    char id[CARDPROFILE_ID_LENGTH];     /* NUL-terminated */
+    uint32_t profiledTimestamp;
+    uint32_t writeBytesPerSec;          /* At the flush size of the derived policy */
+    uint32_t syncLatencyInUs;           /* Median */
+    uint32_t allocUnitSize;
+    uint32_t crc;
+} CardProfile;
+
+/*  How recorders write to the card. The default (all zero) writes and fsync every
+    sample as it comes, without preallocation.
+*/
+typedef struct {
+    uint32_t flushSize;             /* Samples are coalesced into writes of this size, 0 to write each sample */
+    uint32_t syncIntervalInSecs;    /* Longest time data stays unsynced (also unwritten), 0 to fsync every write */
+    uint32_t preallocSize;          /* Clusters reserved ahead of the end of record, 0 to disable */
+    uint32_t maxBitrate;            /* Bits per second of all tracks the card sustains, 0 if unknown */
+    int durationInSecs;             /* Record duration */
+} WritePolicy;
+
+class CardProfiler {
+public:
+    /* Identity of the card behind a block device, "fsid" is the fallback for cards without CID */
+    static std::string readCardId(const std::string &hardDrive, uint64_t fsid);
+
+    static int load(const std::string &pathToIndexes, const std::string &id, CardProfile &profile);
+    static int save(const std::string &pathToIndexes, const CardProfile &profile);
+
+    /* Profiling pass in a scratch file of "pathToIndexes", it's removed afterwards */
+    static int measure(const std::string &pathToIndexes, const std::string &id, CardProfile &profile);
+
+    static WritePolicy toWritePolicy(const CardProfile &profile);
+    static WritePolicy getDefaultPolicy();
+};
+
+#endif /* __CARDPROFILE_H */
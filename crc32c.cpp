@@ -0,0 +1,111 @@
+#include <array>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC32C_HW_X86
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define CRC32C_HW_ARM64
+#endif
+
+#include "crc32c.h"
+
+#define CRC32C_POLY_REFLECTED				(0x82F63B78)
+
+static constexpr std::array<uint32_t, 256> makeTable() {
+	std::array<uint32_t, 256> table = {};
+
+	for (uint32_t i = 0; i < 256; ++i) {
+		uint32_t crc = i;
+		for (int k = 0; k < 8; ++k) {
+			crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY_REFLECTED : (crc >> 1);
+		}
+		table[i] = crc;
+	}
+
+	return table;
+}
+
+static constexpr std::array<uint32_t, 256> crcTable = makeTable();
+
+static uint32_t crc32cSoftware(uint32_t crc, const uint8_t *p, size_t len) {
+	while (len--) {
+		crc = crcTable[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+	}
+
+	return crc;
+}
+
+#if defined(CRC32C_HW_X86)
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHardware(uint32_t crc, const uint8_t *p, size_t len) {
+#if defined(__x86_64__)
+	uint64_t crc64 = crc;
+	for (; len >= 8; len -= 8, p += 8) {
+		uint64_t u64;
+		memcpy(&u64, p, sizeof(u64));
+		crc64 = _mm_crc32_u64(crc64, u64);
+	}
+	crc = (uint32_t)crc64;
+#endif
+	for (; len >= 4; len -= 4, p += 4) {
+		uint32_t u32;
+		memcpy(&u32, p, sizeof(u32));
+		crc = _mm_crc32_u32(crc, u32);
+	}
+	while (len--) {
+		crc = _mm_crc32_u8(crc, *p++);
+	}
+
+	return crc;
+}
+
+static bool hasHardwareCrc() {
+	return __builtin_cpu_supports("sse4.2");
+}
+#elif defined(CRC32C_HW_ARM64)
+__attribute__((target("+crc")))
+static uint32_t crc32cHardware(uint32_t crc, const uint8_t *p, size_t len) {
+	for (; len >= 8; len -= 8, p += 8) {
+		uint64_t u64;
+		memcpy(&u64, p, sizeof(u64));
+		crc = __crc32cd(crc, u64);
+	}
+	while (len--) {
+		crc = __crc32cb(crc, *p++);
+	}
+
+	return crc;
+}
+
+static bool hasHardwareCrc() {
+	return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+#else
+static uint32_t crc32cHardware(uint32_t crc, const uint8_t *p, size_t len) {
+	return crc32cSoftware(crc, p, len);
+}
+
+static bool hasHardwareCrc() {
+	return false;
+}
+#endif
+
+typedef uint32_t (*Crc32cFunc)(uint32_t, const uint8_t *, size_t);
+
+static Crc32cFunc resolveCrc32c() {
+	return hasHardwareCrc() ? crc32cHardware : crc32cSoftware;
+}
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len) {
+	static const Crc32cFunc func = resolveCrc32c();
+
+	return ~func(~crc, (const uint8_t *)data, len);
+}
+
+bool crc32cIsHardwareAccelerated() {
+	return hasHardwareCrc();
+}
@@ -0,0 +1,18 @@
+#ifndef __CRC32C_H
+#define __CRC32C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CRC32C_INIT							(0)
+
+/*  CRC32C (Castagnoli), chainable:
+		crc = crc32c(CRC32C_INIT, buf1, len1);
+		crc = crc32c(crc, buf2, len2);
+*/
+extern uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+/* SSE4.2 (x86) or ARMv8 CRC extension is used when CPU supports it */
+extern bool crc32cIsHardwareAccelerated();
+
+#endif /* __CRC32C_H */
@@ -0,0 +1,336 @@
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <ctime>
+#include <vector>
+#include <algorithm>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#include "fatformat.h"
+
+#define LOCAL_DBG_EN			(0)
+
+#if (LOCAL_DBG_EN == 1)
+#define LOCAL_DBG(fmt, ...) 	printf("\x1B[36m" fmt "\x1B[0m", ##__VA_ARGS__)
+#else
+#define LOCAL_DBG(fmt, ...)
+#endif
+
+#define FAT32_MEDIA_DESCRIPTOR		(0xF8)
+#define FAT32_ROOT_CLUSTER			(2)
+#define FAT32_FSINFO_SECTOR			(1)
+#define FAT32_BACKUP_BOOT_SECTOR	(6)
+#define FAT32_END_OF_CHAIN			(0x0FFFFFFF)
+
+static void putU16(uint8_t *p, uint16_t v) {
+	p[0] = v & 0xFF;
+	p[1] = (v >> 8) & 0xFF;
+}
+
+static void putU32(uint8_t *p, uint32_t v) {
+	putU16(p, v & 0xFFFF);
+	putU16(p + 2, (v >> 16) & 0xFFFF);
+}
+
+static uint64_t readSysfsU64(const std::string &path) {
+	char value[32] = { 0 };
+	uint64_t ret = 0;
+
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd != -1) {
+		if (read(fd, value, sizeof(value) - 1) > 0) {
+			ret = strtoull(value, nullptr, 10);
+		}
+		close(fd);
+	}
+
+	return ret;
+}
+
+FatFormatter::FatFormatter() : mRunning(false), mProgress(0), mResult(FATFORMAT_RETURN_SUCCESS) {
+
+}
+
+FatFormatter::~FatFormatter() {
+	wait();
+}
+
+int FatFormatter::computeGeometry(uint64_t deviceSize, uint32_t auSize, uint32_t hiddenSectors, FatGeometry &geometry) {
+	uint32_t bytesPerSector = FATFORMAT_SECTOR_SIZE;
+	uint64_t totalSectors = std::min(deviceSize / bytesPerSector, (uint64_t)UINT32_MAX);
+	uint32_t clusterSize = (deviceSize < (1ULL << 30)) ? 4096 : (deviceSize < (4ULL << 30)) ? 16384 : 32768;
+	uint32_t auSectors = std::max(auSize / bytesPerSector, 1u);
+
+	memset(&geometry, 0, sizeof(geometry));
+
+	for (uint32_t spc = clusterSize / bytesPerSector; spc >= 1; spc /= 2) {
+		uint32_t reserved = FATFORMAT_MIN_RESERVED_SECTORS;
+		if (totalSectors <= reserved) {
+			break;
+		}
+
+		/* Upper bound of FAT size, a few spare entries are harmless */
+		uint64_t maxClusters = (totalSectors - reserved) / spc;
+		uint32_t fatSectors = (uint32_t)(((maxClusters + 2) * 4 + bytesPerSector - 1) / bytesPerSector);
+
+		/* Pad reserved region so that data region (cluster 2) starts on an AU boundary of the card */
+		uint64_t dataStart = (uint64_t)hiddenSectors + reserved + 2ULL * fatSectors;
+		uint64_t alignedStart = (dataStart + auSectors - 1) / auSectors * auSectors;
+		if (reserved + (alignedStart - dataStart) <= UINT16_MAX) {
+			reserved += (uint32_t)(alignedStart - dataStart);
+		}
+
+		if (totalSectors <= reserved + 2ULL * fatSectors) {
+			continue;
+		}
+
+		uint64_t clusters = (totalSectors - reserved - 2ULL * fatSectors) / spc;
+		if (clusters < FATFORMAT_MIN_CLUSTERS) {
+			continue;
+		}
+
+		geometry.deviceSize 		= deviceSize;
+		geometry.bytesPerSector 	= bytesPerSector;
+		geometry.sectorsPerCluster 	= spc;
+		geometry.reservedSectors 	= reserved;
+		geometry.fatSectors 		= fatSectors;
+		geometry.totalSectors 		= (uint32_t)totalSectors;
+		geometry.clusters 			= (uint32_t)std::min(clusters, (uint64_t)FATFORMAT_MAX_CLUSTERS);
+		geometry.hiddenSectors 		= hiddenSectors;
+		geometry.auSize 			= auSize;
+
+		return FATFORMAT_RETURN_SUCCESS;
+	}
+
+	return FATFORMAT_RETURN_TOO_SMALL;
+}
+
+int FatFormatter::probeGeometry(const std::string &device, FatGeometry &geometry) {
+	struct stat fStat;
+	uint64_t deviceSize = 0;
+	uint32_t auSize = FATFORMAT_DEFAULT_AU_SIZE;
+	uint32_t hiddenSectors = 0;
+
+	int fd = open(device.c_str(), O_RDONLY);
+	if (fd == -1 || fstat(fd, &fStat) != 0) {
+		if (fd != -1) {
+			close(fd);
+		}
+		return FATFORMAT_RETURN_OPEN_FAILURE;
+	}
+
+	if (S_ISBLK(fStat.st_mode)) {
+		ioctl(fd, BLKGETSIZE64, &deviceSize);
+
+		/* Partition offset and erase block size of the card, e.g. /sys/class/block/mmcblk0p1 */
+		std::string name = device.substr(device.rfind('/') + 1);
+		std::string pathToSysfs = "/sys/class/block/" + name;
+		hiddenSectors = (uint32_t)readSysfsU64(pathToSysfs + "/start");
+
+		uint64_t eraseSize = readSysfsU64(pathToSysfs + "/device/preferred_erase_size");
+		if (eraseSize == 0) {
+			eraseSize = readSysfsU64(pathToSysfs + "/../device/preferred_erase_size");
+		}
+		if (eraseSize >= FATFORMAT_SECTOR_SIZE && eraseSize <= 64 * 1024 * 1024) {
+			auSize = (uint32_t)eraseSize;
+		}
+	}
+	else {
+		deviceSize = (uint64_t)fStat.st_size; /* Image file */
+	}
+	close(fd);
+
+	/* Small cards have small AU */
+	if (deviceSize < (1ULL << 30)) {
+		auSize = std::min(auSize, (uint32_t)(1024 * 1024));
+	}
+
+	return computeGeometry(deviceSize, auSize, hiddenSectors, geometry);
+}
+
+int FatFormatter::start(std::string device, ProgressCallback onProgress, DoneCallback onDone) {
+	if (mRunning) {
+		return FATFORMAT_RETURN_BUSY;
+	}
+
+	wait();
+
+	/* Device is opened here, so a card still in use is reported to the caller at once */
+	int fd = -1;
+	int ret = openDevice(device, fd);
+	if (ret != FATFORMAT_RETURN_SUCCESS) {
+		return ret;
+	}
+
+	mRunning = true;
+	mProgress = 0;
+	mOnProgress = onProgress;
+	mWorker = std::thread([this, device, fd, onDone] {
+		int ret = format(device, fd);
+		mResult = ret;
+		mRunning = false;
+
+		if (onDone) {
+			onDone(ret);
+		}
+	});
+
+	return FATFORMAT_RETURN_SUCCESS;
+}
+
+int FatFormatter::wait() {
+	if (mWorker.joinable()) {
+		mWorker.join();
+	}
+
+	return mResult;
+}
+
+bool FatFormatter::isRunning() {
+	return mRunning;
+}
+
+int FatFormatter::getProgress() {
+	return mProgress;
+}
+
+void FatFormatter::reportProgress(uint64_t written, uint64_t total) {
+	int progress = total ? (int)(written * 100 / total) : 100;
+
+	if (progress != mProgress) {
+		mProgress = progress;
+		if (mOnProgress) {
+			mOnProgress(progress);
+		}
+	}
+}
+
+int FatFormatter::openDevice(const std::string &device, int &fd) {
+	/*  O_EXCL on a block device fails with EBUSY while it's mounted (a lazily detached mount
+		included) or opened exclusively elsewhere, writing the layout then would corrupt it
+	*/
+	int flags = O_WRONLY;
+	struct stat st;
+	if (stat(device.c_str(), &st) == 0 && S_ISBLK(st.st_mode)) {
+		flags |= O_EXCL;
+	}
+
+	fd = open(device.c_str(), flags);
+	if (fd == -1) {
+		LOCAL_DBG("[FORMAT] Can't open %s: %s\n", device.c_str(), strerror(errno));
+		return (errno == EBUSY) ? FATFORMAT_RETURN_BUSY : FATFORMAT_RETURN_OPEN_FAILURE;
+	}
+
+	return FATFORMAT_RETURN_SUCCESS;
+}
+
+int FatFormatter::format(std::string device) {
+	int fd = -1;
+	int ret = openDevice(device, fd);
+	if (ret != FATFORMAT_RETURN_SUCCESS) {
+		return ret;
+	}
+
+	return format(device, fd);
+}
+
+int FatFormatter::format(const std::string &device, int fd) {
+	FatGeometry geometry;
+
+	int ret = probeGeometry(device, geometry);
+	if (ret != FATFORMAT_RETURN_SUCCESS) {
+		close(fd);
+		return ret;
+	}
+
+	LOCAL_DBG("[FORMAT] %s: %u clusters of %u bytes, %u reserved sectors, FAT %u sectors\n", 
+				device.c_str(), geometry.clusters, geometry.sectorsPerCluster * geometry.bytesPerSector, 
+				geometry.reservedSectors, geometry.fatSectors);
+
+	ret = writeLayout(fd, geometry);
+	if (fsync(fd) != 0 && ret == FATFORMAT_RETURN_SUCCESS) {
+		ret = FATFORMAT_RETURN_WRITE_FAILURE;
+	}
+	close(fd);
+
+	return ret;
+}
+
+int FatFormatter::writeLayout(int fd, const FatGeometry &geometry) {
+	const uint32_t bps = geometry.bytesPerSector;
+	const uint64_t fatOffset = (uint64_t)geometry.reservedSectors * bps;
+	const uint64_t fatBytes = (uint64_t)geometry.fatSectors * bps;
+	const uint64_t rootOffset = fatOffset + 2 * fatBytes;
+	const uint64_t total = rootOffset + (uint64_t)geometry.sectorsPerCluster * bps;
+
+	/* 1. Zero reserved region, both FATs and root directory cluster */
+	std::vector<uint8_t> zeros(FATFORMAT_WRITE_CHUNK_SIZE, 0);
+	for (uint64_t offset = 0; offset < total; ) {
+		size_t len = (size_t)std::min((uint64_t)zeros.size(), total - offset);
+		if (pwrite(fd, zeros.data(), len, offset) != (ssize_t)len) {
+			return FATFORMAT_RETURN_WRITE_FAILURE;
+		}
+		offset += len;
+		reportProgress(offset, total + 1);
+	}
+
+	/* 2. Boot sector */
+	uint8_t boot[FATFORMAT_SECTOR_SIZE];
+	memset(boot, 0, sizeof(boot));
+	boot[0] = 0xEB; boot[1] = 0x58; boot[2] = 0x90;
+	memcpy(boot + 3, "MSWIN4.1", 8);
+	putU16(boot + 11, bps);
+	boot[13] = (uint8_t)geometry.sectorsPerCluster;
+	putU16(boot + 14, (uint16_t)geometry.reservedSectors);
+	boot[16] = 2;								/* Number of FATs */
+	boot[21] = FAT32_MEDIA_DESCRIPTOR;
+	putU16(boot + 24, 63);						/* Sectors per track */
+	putU16(boot + 26, 255);						/* Number of heads */
+	putU32(boot + 28, geometry.hiddenSectors);
+	putU32(boot + 32, geometry.totalSectors);
+	putU32(boot + 36, geometry.fatSectors);
+	putU32(boot + 44, FAT32_ROOT_CLUSTER);
+	putU16(boot + 48, FAT32_FSINFO_SECTOR);
+	putU16(boot + 50, FAT32_BACKUP_BOOT_SECTOR);
+	boot[64] = 0x80;							/* Drive number */
+	boot[66] = 0x29;							/* Extended boot signature */
+	putU32(boot + 67, (uint32_t)time(NULL));	/* Volume ID */
+	memcpy(boot + 71, "NO NAME    ", 11);
+	memcpy(boot + 82, "FAT32   ", 8);
+	boot[510] = 0x55; boot[511] = 0xAA;
+
+	/* 3. FSInfo sector */
+	uint8_t fsInfo[FATFORMAT_SECTOR_SIZE];
+	memset(fsInfo, 0, sizeof(fsInfo));
+	putU32(fsInfo + 0, 0x41615252);
+	putU32(fsInfo + 484, 0x61417272);
+	putU32(fsInfo + 488, geometry.clusters - 1);	/* Root directory uses one cluster */
+	putU32(fsInfo + 492, FAT32_ROOT_CLUSTER + 1);
+	putU32(fsInfo + 508, 0xAA550000);
+
+	/* 4. First FAT entries: media, reserved, root directory end of chain */
+	uint8_t fatHead[12];
+	putU32(fatHead + 0, 0x0FFFFF00 | FAT32_MEDIA_DESCRIPTOR);
+	putU32(fatHead + 4, FAT32_END_OF_CHAIN);
+	putU32(fatHead + 8, FAT32_END_OF_CHAIN);
+
+	bool isWritten = 
+		pwrite(fd, boot, bps, 0) == (ssize_t)bps &&
+		pwrite(fd, fsInfo, bps, (uint64_t)FAT32_FSINFO_SECTOR * bps) == (ssize_t)bps &&
+		pwrite(fd, boot, bps, (uint64_t)FAT32_BACKUP_BOOT_SECTOR * bps) == (ssize_t)bps &&
+		pwrite(fd, fsInfo, bps, (uint64_t)(FAT32_BACKUP_BOOT_SECTOR + FAT32_FSINFO_SECTOR) * bps) == (ssize_t)bps &&
+		pwrite(fd, fatHead, sizeof(fatHead), fatOffset) == (ssize_t)sizeof(fatHead) &&
+		pwrite(fd, fatHead, sizeof(fatHead), fatOffset + fatBytes) == (ssize_t)sizeof(fatHead);
+
+	if (!isWritten) {
+		return FATFORMAT_RETURN_WRITE_FAILURE;
+	}
+	reportProgress(total + 1, total + 1);
+
+	return FATFORMAT_RETURN_SUCCESS;
+}
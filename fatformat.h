@@ -0,0 +1,78 @@
+/*
+    In-process FAT32 quick format, no mkfs binary is needed.
+
+    Layout is chosen from card geometry:
+        - Cluster size grows with capacity (large clusters for large video files)
+        - Data region starts on an allocation unit (AU) boundary of the card, so
+          clusters never straddle an erase block
+    Only the reserved region, both FATs and the root directory cluster are written.
+
+    Target can be a block device or a regular image file. A block device is opened exclusively,
+    it is never formatted while still mounted (FATFORMAT_RETURN_BUSY).
+*/
+#ifndef __FATFORMAT_H
+#define __FATFORMAT_H
+
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <functional>
+
+#define FATFORMAT_SECTOR_SIZE               (512)
+#define FATFORMAT_MIN_RESERVED_SECTORS      (32)
+#define FATFORMAT_MIN_CLUSTERS              (65525)     /* Below this a volume is FAT16 */
+#define FATFORMAT_MAX_CLUSTERS              (0x0FFFFFF5)
+#define FATFORMAT_DEFAULT_AU_SIZE           (4 * 1024 * 1024)
+#define FATFORMAT_WRITE_CHUNK_SIZE          (1024 * 1024)
+
+#define FATFORMAT_RETURN_SUCCESS            (0)
+#define FATFORMAT_RETURN_OPEN_FAILURE       (-1)
+#define FATFORMAT_RETURN_TOO_SMALL          (-2)
+#define FATFORMAT_RETURN_WRITE_FAILURE      (-3)
+#define FATFORMAT_RETURN_BUSY               (-4)
+
+typedef struct {
+    uint64_t deviceSize;
+    uint32_t bytesPerSector;
+    uint32_t sectorsPerCluster;
+    uint32_t reservedSectors;
+    uint32_t fatSectors;
+    uint32_t totalSectors;
+    uint32_t clusters;
+    uint32_t hiddenSectors;     /* Partition start on the card, in sectors */
+    uint32_t auSize;
+} FatGeometry;
+
+class FatFormatter {
+public:
+    typedef std::function<void(int progress)> ProgressCallback;
+    typedef std::function<void(int result)> DoneCallback;
+
+    FatFormatter();
+    ~FatFormatter();
+
+    static int computeGeometry(uint64_t deviceSize, uint32_t auSize, uint32_t hiddenSectors, FatGeometry &geometry);
+    static int probeGeometry(const std::string &device, FatGeometry &geometry);
+
+    int start(std::string device, ProgressCallback onProgress = nullptr, DoneCallback onDone = nullptr);
+    int format(std::string device);
+    int wait();
+
+    bool isRunning();
+    int getProgress();
+
+private:
+    std::thread mWorker;
+    std::atomic<bool> mRunning;
+    std::atomic<int> mProgress;
+    std::atomic<int> mResult;
+    ProgressCallback mOnProgress;
+
+    static int openDevice(const std::string &device, int &fd);  /* BUSY if a block device is still mounted or opened */
+    int format(const std::string &device, int fd);
+    int writeLayout(int fd, const FatGeometry &geometry);
+    void reportProgress(uint64_t written, uint64_t total);
+};
+
+#endif /* __FATFORMAT_H */
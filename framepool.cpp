@@ -0,0 +1,186 @@
+#include <string.h>
+#include <algorithm>
+
+#include "framepool.h"
+
+#define LOCAL_DBG_EN			(0)
+
+#if (LOCAL_DBG_EN == 1)
+#define LOCAL_DBG(fmt, ...) 	printf("\x1B[34m" fmt "\x1B[0m", ##__VA_ARGS__)
+#else
+#define LOCAL_DBG(fmt, ...)
+#endif
+
+FrameRef::FrameRef() {
+	mPool = nullptr;
+	mSlabClass = 0;
+	mSlot = 0;
+	mData = nullptr;
+	mSize = 0;
+	mCapacity = 0;
+	pts = 0;
+	flags = 0;
+}
+
+FrameRef::FrameRef(FrameRef &&other) noexcept : FrameRef() {
+	*this = std::move(other);
+}
+
+FrameRef &FrameRef::operator=(FrameRef &&other) noexcept {
+	if (this != &other) {
+		release();
+
+		mPool 		= other.mPool;
+		mSlabClass 	= other.mSlabClass;
+		mSlot 		= other.mSlot;
+		mData 		= other.mData;
+		mSize 		= other.mSize;
+		mCapacity 	= other.mCapacity;
+		pts 		= other.pts;
+		flags 		= other.flags;
+
+		other.mPool = nullptr;
+		other.mData = nullptr;
+		other.mSize = other.mCapacity = 0;
+	}
+
+	return *this;
+}
+
+FrameRef::~FrameRef() {
+	release();
+}
+
+FrameRef::operator bool() const {
+	return mData != nullptr;
+}
+
+uint8_t *FrameRef::getData() {
+	return mData;
+}
+
+size_t FrameRef::getSize() {
+	return mSize;
+}
+
+size_t FrameRef::getCapacity() {
+	return mCapacity;
+}
+
+void FrameRef::setSize(size_t size) {
+	mSize = std::min(size, mCapacity);
+}
+
+void FrameRef::release() {
+	if (mPool != nullptr) {
+		mPool->release(mSlabClass, mSlot);
+	}
+
+	mPool = nullptr;
+	mData = nullptr;
+	mSize = mCapacity = 0;
+}
+
+FramePool::FramePool(std::vector<FrameSlabConfig> slabs) {
+	std::sort(slabs.begin(), slabs.end(), [](const FrameSlabConfig &s1, const FrameSlabConfig &s2) {
+		return s1.slabSize < s2.slabSize;
+	});
+
+	mClasses.resize(slabs.size());
+	for (size_t id = 0; id < slabs.size(); ++id) {
+		SlabClass &slabClass = mClasses[id];
+
+		slabClass.slabSize = slabs[id].slabSize;
+		slabClass.memory.reset(new uint8_t[slabs[id].slabSize * slabs[id].nbSlabs]);
+		slabClass.freeSlots.reserve(slabs[id].nbSlabs);
+		for (uint32_t slot = slabs[id].nbSlabs; slot > 0; --slot) {
+			slabClass.freeSlots.push_back(slot - 1);
+		}
+
+		memset(&slabClass.stats, 0, sizeof(slabClass.stats));
+		slabClass.stats.slabSize = slabs[id].slabSize;
+		slabClass.stats.total = slabs[id].nbSlabs;
+	}
+}
+
+FramePool::~FramePool() {
+
+}
+
+FrameRef FramePool::acquire(size_t size) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	FrameRef frame;
+
+	auto fit = std::find_if(mClasses.begin(), mClasses.end(), [size](const SlabClass &slabClass) {
+		return slabClass.slabSize >= size;
+	});
+
+	/* Borrow a larger slab if every slab of the fitting size is in use */
+	for (auto it = fit; it != mClasses.end(); ++it) {
+		if (it->freeSlots.empty()) {
+			continue;
+		}
+
+		frame.mPool 		= this;
+		frame.mSlabClass 	= (uint32_t)(it - mClasses.begin());
+		frame.mSlot 		= it->freeSlots.back();
+		frame.mData 		= it->memory.get() + frame.mSlot * it->slabSize;
+		frame.mCapacity 	= it->slabSize;
+		frame.mSize 		= size;
+		it->freeSlots.pop_back();
+
+		it->stats.inUse++;
+		it->stats.peak = std::max(it->stats.peak, it->stats.inUse);
+		return frame;
+	}
+
+	LOCAL_DBG("[FRAMEPOOL] No free slab for %zu bytes\n", size);
+	if (!mClasses.empty()) {
+		(fit != mClasses.end() ? fit : mClasses.end() - 1)->stats.exhausted++;
+	}
+
+	return frame;
+}
+
+FrameRef FramePool::copyFrom(const uint8_t *data, size_t size, uint64_t pts, uint32_t flags) {
+	FrameRef frame = acquire(size);
+
+	if (frame) {
+		memcpy(frame.getData(), data, size);
+		frame.pts = pts;
+		frame.flags = flags;
+	}
+
+	return frame;
+}
+
+void FramePool::release(uint32_t slabClass, uint32_t slot) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	SlabClass &it = mClasses[slabClass];
+
+	it.freeSlots.push_back(slot);
+	it.stats.inUse--;
+}
+
+std::vector<FramePool::Stats> FramePool::getStats() {
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::vector<Stats> stats;
+
+	for (auto &slabClass : mClasses) {
+		stats.push_back(slabClass.stats);
+	}
+
+	return stats;
+}
+
+uint32_t FramePool::getOccupancy() {
+	std::lock_guard<std::mutex> lock(mMutex);
+	uint32_t total = 0, inUse = 0;
+
+	for (auto &slabClass : mClasses) {
+		total += slabClass.stats.total;
+		inUse += slabClass.stats.inUse;
+	}
+
+	return (total == 0) ? 0 : inUse * 100 / total;
+}
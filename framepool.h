@@ -0,0 +1,100 @@
+/*
+    Pool of sample buffers in fixed slab sizes, all allocated once when the pool is
+    created. Encoders fill a FrameRef and move it to the storage pipeline, which
+    releases the slab once the sample is written, so steady state does no allocation
+    per frame. A recorder holds up to RECORD_HELD_FRAMES frames to write them in one go.
+
+    A FrameRef is move-only and returns its slab to the pool when it's destroyed,
+    the pool MUST outlive every FrameRef it has handed out.
+*/
+#ifndef __FRAMEPOOL_H
+#define __FRAMEPOOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <mutex>
+#include <memory>
+
+#define FRAME_FLAG_KEYFRAME                 (1 << 0)
+#define FRAME_FLAG_AUDIO                    (1 << 1)
+
+typedef struct {
+    size_t slabSize;
+    uint32_t nbSlabs;
+} FrameSlabConfig;
+
+/* Audio frames, P frames and IDR frames */
+#define FRAMEPOOL_DEFAULT_SLABS             { { 4 * 1024, 64 }, { 64 * 1024, 32 }, { 512 * 1024, 4 } }
+
+class FramePool;
+
+class FrameRef {
+public:
+    FrameRef();
+    FrameRef(FrameRef &&other) noexcept;
+    FrameRef &operator=(FrameRef &&other) noexcept;
+    ~FrameRef();
+
+    FrameRef(const FrameRef &) = delete;
+    FrameRef &operator=(const FrameRef &) = delete;
+
+    explicit operator bool() const;
+    uint8_t *getData();
+    size_t getSize();
+    size_t getCapacity();
+    void setSize(size_t size);
+    void release();
+
+private:
+    friend class FramePool;
+
+    FramePool *mPool;
+    uint32_t mSlabClass;
+    uint32_t mSlot;
+    uint8_t *mData;
+    size_t mSize;
+    size_t mCapacity;
+
+public:
+    uint64_t pts;       /* Milliseconds */
+    uint32_t flags;
+};
+
+class FramePool {
+public:
+    typedef struct {
+        size_t slabSize;
+        uint32_t total;
+        uint32_t inUse;
+        uint32_t peak;
+        uint64_t exhausted;     /* Acquire failures for this slab size */
+    } Stats;
+
+    FramePool(std::vector<FrameSlabConfig> slabs = FRAMEPOOL_DEFAULT_SLABS);
+    ~FramePool();
+
+    /* Empty FrameRef if no free slab fits, the caller drops the frame */
+    FrameRef acquire(size_t size);
+    FrameRef copyFrom(const uint8_t *data, size_t size, uint64_t pts = 0, uint32_t flags = 0);
+
+    std::vector<Stats> getStats();
+    uint32_t getOccupancy();    /* Percent of slabs in use */
+
+private:
+    friend class FrameRef;
+
+    typedef struct {
+        size_t slabSize;
+        std::unique_ptr<uint8_t[]> memory;
+        std::vector<uint32_t> freeSlots;    /* Reserved to total, never reallocated */
+        Stats stats;
+    } SlabClass;
+
+    std::mutex mMutex;
+    std::vector<SlabClass> mClasses;        /* Sorted by slab size */
+
+    void release(uint32_t slabClass, uint32_t slot);
+};
+
+#endif /* __FRAMEPOOL_H */
@@ -0,0 +1,132 @@
+#include <string.h>
+#include <algorithm>
+
+#include "iosched.h"
+
+IOScheduler::Ticket::Ticket(IOScheduler *scheduler, eClass ioClass, size_t bytes) {
+	mScheduler = scheduler;
+	mClass = ioClass;
+
+	if (mScheduler) {
+		mScheduler->acquire(mClass, bytes);
+	}
+}
+
+IOScheduler::Ticket::~Ticket() {
+	if (mScheduler) {
+		mScheduler->release(mClass);
+	}
+}
+
+IOScheduler::IOScheduler() {
+	Clock::time_point now = Clock::now();
+
+	for (auto &state : mClasses) {
+		state.rate 			= IOSCHED_UNLIMITED;
+		state.burst 		= 0;
+		state.tokens 		= 0;
+		state.lastRefill 	= now;
+		state.waiting 		= 0;
+		state.inFlight 		= 0;
+		memset(&state.stats, 0, sizeof(state.stats));
+	}
+
+	setBudget(eClass::Playback, IOSCHED_PLAYBACK_RATE, IOSCHED_PLAYBACK_BURST);
+	setBudget(eClass::Background, IOSCHED_BACKGROUND_RATE, IOSCHED_BACKGROUND_BURST);
+}
+
+IOScheduler::~IOScheduler() {
+
+}
+
+void IOScheduler::setBudget(eClass ioClass, uint64_t bytesPerSec, uint64_t burstBytes) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	ClassState &state = mClasses[(int)ioClass];
+
+	state.rate 			= bytesPerSec;
+	state.burst 		= std::max(burstBytes, (uint64_t)1);
+	state.tokens 		= (double)state.burst;
+	state.lastRefill 	= Clock::now();
+
+	mCondVar.notify_all();
+}
+
+void IOScheduler::refill(ClassState &state, Clock::time_point now) {
+	double elapsed = std::chrono::duration<double>(now - state.lastRefill).count();
+
+	state.tokens = std::min((double)state.burst, state.tokens + elapsed * state.rate);
+	state.lastRefill = now;
+}
+
+bool IOScheduler::hasHigherActive(eClass ioClass) {
+	for (int id = 0; id < (int)ioClass; ++id) {
+		if (mClasses[id].waiting || mClasses[id].inFlight) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void IOScheduler::acquire(eClass ioClass, size_t bytes) {
+	std::unique_lock<std::mutex> lock(mMutex);
+	ClassState &state = mClasses[(int)ioClass];
+	Clock::time_point begin = Clock::now();
+	Clock::time_point deadline = begin + std::chrono::milliseconds(IOSCHED_MAX_WAIT_MS);
+
+	state.waiting++;
+
+	while (1) {
+		Clock::time_point now = Clock::now();
+		bool isPriorityOk = (now >= deadline) || !hasHigherActive(ioClass);
+
+		/* Budget may go in debt for a large request, next requests pay it back */
+		bool isBudgetOk = true;
+		Clock::time_point refillAt = now;
+		if (state.rate != IOSCHED_UNLIMITED) {
+			refill(state, now);
+			isBudgetOk = (state.tokens > 0);
+			if (!isBudgetOk) {
+				refillAt = now + std::chrono::microseconds((uint64_t)(-state.tokens * 1e6 / state.rate) + 1);
+			}
+		}
+
+		if (isPriorityOk && isBudgetOk) {
+			break;
+		}
+
+		if (!isPriorityOk) {
+			mCondVar.wait_until(lock, isBudgetOk ? deadline : std::min(deadline, refillAt));
+		}
+		else {
+			mCondVar.wait_until(lock, refillAt);
+		}
+	}
+
+	state.waiting--;
+	state.inFlight++;
+	mCondVar.notify_all();
+
+	if (state.rate != IOSCHED_UNLIMITED) {
+		state.tokens -= (double)bytes;
+	}
+
+	uint64_t waitedUs = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - begin).count();
+	state.stats.operations++;
+	state.stats.bytes += bytes;
+	state.stats.waitedUs += waitedUs;
+	state.stats.maxWaitUs = std::max(state.stats.maxWaitUs, waitedUs);
+}
+
+void IOScheduler::release(eClass ioClass) {
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mClasses[(int)ioClass].inFlight--;
+	}
+	mCondVar.notify_all();
+}
+
+IOScheduler::Stats IOScheduler::getStats(eClass ioClass) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mClasses[(int)ioClass].stats;
+}
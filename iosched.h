@@ -0,0 +1,92 @@
+/*
+    Storage I/O scheduler of one card. Every disk operation takes a Ticket of its
+    priority class before touching the card:
+
+        LiveWrite   >   Metadata    >   Playback    >   Background
+        (recording)     (index)         (read/export)   (delete/scrub)
+
+    - An operation waits while any operation of a higher class is waiting or in
+      flight, so recording never queues behind playback or retention.
+    - Each class may have a token bucket budget (bytes/s + burst), lower classes
+      are rate limited so they can't saturate the card.
+    - A waiter older than IOSCHED_MAX_WAIT_MS ignores priority (no starvation),
+      it still respects its budget.
+*/
+#ifndef __IOSCHED_H
+#define __IOSCHED_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#define IOSCHED_UNLIMITED                   (0)
+#define IOSCHED_MAX_WAIT_MS                 (500)
+
+#define IOSCHED_PLAYBACK_RATE               (8 * 1024 * 1024)
+#define IOSCHED_PLAYBACK_BURST              (2 * 1024 * 1024)
+#define IOSCHED_BACKGROUND_RATE             (2 * 1024 * 1024)
+#define IOSCHED_BACKGROUND_BURST            (1024 * 1024)
+
+class IOScheduler {
+public:
+    enum class eClass : uint8_t {
+        LiveWrite = 0,
+        Metadata,
+        Playback,
+        Background,
+        Count,
+    };
+
+    typedef struct {
+        uint64_t operations;
+        uint64_t bytes;
+        uint64_t waitedUs;
+        uint64_t maxWaitUs;
+    } Stats;
+
+    /* RAII ticket, a null scheduler makes it a no-op */
+    class Ticket {
+    public:
+        Ticket(IOScheduler *scheduler, eClass ioClass, size_t bytes = 0);
+        ~Ticket();
+
+        Ticket(const Ticket &) = delete;
+        Ticket &operator=(const Ticket &) = delete;
+
+    private:
+        IOScheduler *mScheduler;
+        eClass mClass;
+    };
+
+    IOScheduler();
+    ~IOScheduler();
+
+    void setBudget(eClass ioClass, uint64_t bytesPerSec, uint64_t burstBytes);
+    void acquire(eClass ioClass, size_t bytes);
+    void release(eClass ioClass);
+    Stats getStats(eClass ioClass);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    typedef struct {
+        uint64_t rate;
+        uint64_t burst;
+        double tokens;
+        Clock::time_point lastRefill;
+        uint32_t waiting;
+        uint32_t inFlight;
+        Stats stats;
+    } ClassState;
+
+    std::mutex mMutex;
+    std::condition_variable mCondVar;
+    ClassState mClasses[(int)eClass::Count];
+
+    bool hasHigherActive(eClass ioClass);
+    void refill(ClassState &state, Clock::time_point now);
+};
+
+#endif /* __IOSCHED_H */
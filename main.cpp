@@ -5,27 +5,37 @@
 
 #include "SDCard.h"
 #include "recorder.h"
+#include "reactor.h"
 #include "utils.hpp"
 
+#define MAINTENANCE_INTERVAL_SECS   (60)
+#define MAX_PENDING_FRAMES          (64)
+
 static SDCard SDCARD("/dev/sdb1");
+static Reactor REACTOR;
+static FramePool FRAMEPOOL;
 
-static uint8_t samplesH264 = 0;
-static uint8_t samplesG711 = 0;
-static pthread_t threadPollingDateTimeId;
-static pthread_t threadStorageH264SamplesId;
-static pthread_t threadStorageG711SamplesId;
+/* Capacity is reserved once, swapping keeps it so hand-over doesn't allocate */
+static std::mutex samplesMutex;
+static std::vector<FrameRef> pendingH264Samples;
+static std::vector<FrameRef> pendingG711Samples;
+static std::atomic<bool> isEncoderRunning(false);
+static pthread_t threadEncoderId;
+static int midnightAlarmId = -1;
+static int h264ArrivalId = -1;
+static int g711ArrivalId = -1;
 
 
-static void signalHandler(int signal);
+static void shutdownSession(int signal);
 static void setupBeforeOpenSession();
-static void* pollingDateTime(void *arg);
-static void* storageH264Samples(void *arg);
-static void* storageG711Samples(void *arg);
+static void rolloverDateTime();
+static void maintainSession();
+static void storageH264Samples();
+static void storageG711Samples();
+static void* simulateEncoders(void *arg);
 
 
 int main() {
-    std::signal(SIGINT, signalHandler);
-
     char pwd[256];
     assert(getcwd(pwd, sizeof(pwd)) != NULL);
     std::string pathToRecords(pwd, strlen(pwd));
@@ -34,19 +44,32 @@ int main() {
     std::cout << "Path to records : " << pathToRecords << std::endl;
 
 #if 0
+    /* Signals are only delivered through the reactor, block them before any thread is created */
+    Reactor::blockSignals({ SIGINT, SIGTERM });
+
     SDCARD.assignMountPoint(pathToRecords);
+    SDCARD.enableResume();
     SDCARD.eStatus = SDCard::eState::Mounted;
 
     setupBeforeOpenSession();
 
     if (!SDCARD.currentSession.empty()) {
-        pthread_create(&threadPollingDateTimeId,    NULL, pollingDateTime,      NULL);
-        pthread_create(&threadStorageH264SamplesId, NULL, storageH264Samples,   NULL);
-        pthread_create(&threadStorageG711SamplesId, NULL, storageG711Samples,   NULL);
+        REACTOR.addSignals({ SIGINT, SIGTERM }, shutdownSession);
+        REACTOR.addPeriodicTimer(MAINTENANCE_INTERVAL_SECS, maintainSession);
+        midnightAlarmId = REACTOR.addAlarm(getNextMidnightTimestamp(), rolloverDateTime);
+        h264ArrivalId   = REACTOR.addEvent(storageH264Samples);
+        g711ArrivalId   = REACTOR.addEvent(storageG711Samples);
+
+        pendingH264Samples.reserve(MAX_PENDING_FRAMES);
+        pendingG711Samples.reserve(MAX_PENDING_FRAMES);
+
+        isEncoderRunning = true;
+        pthread_create(&threadEncoderId, NULL, simulateEncoders, NULL);
 
-        pthread_join(threadPollingDateTimeId,    NULL);
-        pthread_join(threadStorageH264SamplesId, NULL);
-        pthread_join(threadStorageG711SamplesId, NULL);
+        REACTOR.run();
+
+        isEncoderRunning = false;
+        pthread_join(threadEncoderId, NULL);
     }
     else {
         std::cout << "[OPEN] Session Record Opening Failed" << std::endl;
@@ -72,48 +95,46 @@ int main() {
     return 0;
 }
 
-void signalHandler(int signal) {
+void shutdownSession(int signal) {
     (void)signal;
 
     SDCard::ENTRY_ATOMIC(SDCARD);
+    if (SDCARD.currentSession.empty() == false) {
+        SDCard::closeCurrentSession(SDCARD);
+    }
+    SDCard::EXIT_ATOMIC(SDCARD);
+
+    /* Listings read catalog snapshots, they don't need the SD Card lock */
     {
-        if (SDCARD.currentSession.empty() == false) {
-            SDCARD.videoRecorder->getStop();
-            SDCARD.audioRecorder->getStop();
-            SDCard::closeCurrentSession(SDCARD);
-        }
-        
         std::string today = getTodayDateString();
         auto listRecords = SDCARD.getAllPlaylists(today, SDCard::eQryPlaylist::Full);
 
         printf("Total full records : %ld\n", listRecords.size());
         if (listRecords.size()) {   
-            for (auto it : listRecords) {
+            for (auto &it : listRecords) {
                 printf("%s, [%s - %s]\n", 
-                                    it.fileName.c_str(), 
-                                it.beginTime.c_str(), 
-                                it.endTime.c_str());
+                                SDCard::formatRecordName(it).c_str(), 
+                                SDCard::formatRecordTime(it.startTimestamp).c_str(), 
+                                SDCard::formatRecordTime(it.endTimestamp).c_str());
             }
         }
 
-        listRecords = SDCARD.getAllPlaylists(today, SDCard::eQryPlaylist::All);
+        listRecords = SDCARD.getAllPlaylists(today, SDCard::eQryPlaylist::Motion);
         printf("Total motion records : %ld\n", listRecords.size());
         if (listRecords.size()) {   
-            for (auto it : listRecords) {
+            for (auto &it : listRecords) {
                 printf("%s, [%s - %s]\n", 
-                                it.fileName.c_str(), 
-                                it.beginTime.c_str(), 
-                                it.endTime.c_str());
+                                SDCard::formatRecordName(it).c_str(), 
+                                SDCard::formatRecordTime(it.startTimestamp).c_str(), 
+                                SDCard::formatRecordTime(it.endTimestamp).c_str());
             }
         }
     }
 
-    SDCard::EXIT_ATOMIC(SDCARD);
-
     std::cout << std::endl;
     std::cout << "Application exit !!!" << std::endl;
 
-    std::exit(EXIT_SUCCESS);
+    REACTOR.stop();
 }
 
 void setupBeforeOpenSession() {
@@ -128,11 +149,7 @@ void setupBeforeOpenSession() {
         SDCARD.eStatus = SDCard::eState::Mounted;
     #endif
 
-        if (!isMounted) {
-            return;
-        }
-
-        if (SDCARD.currentSession.empty()) {
+        if (isMounted && SDCARD.currentSession.empty()) {
             SDCard::openSessionRecord(SDCARD, Recorder::eOption::Full);
             std::cout << "[START] Record Session " << SDCARD.currentSession << std::endl;
         }
@@ -140,56 +157,35 @@ void setupBeforeOpenSession() {
     SDCard::EXIT_ATOMIC(SDCARD);
 }
 
-void* pollingDateTime(void *arg) {
-    (void)arg;
-
-    while (1) {
-        std::cout << "[QUERY] Datetime Session Record" << std::endl;
+void rolloverDateTime() {
+    std::cout << "[QUERY] Datetime Session Record" << std::endl;
 
-        if (getTodayDateString() != SDCARD.currentSession) {
-            SDCard::closeCurrentSession(SDCARD);
-            setupBeforeOpenSession();
-        }
+    if (getTodayDateString() != SDCARD.currentSession) {
+        SDCard::ENTRY_ATOMIC(SDCARD);
+        SDCard::closeCurrentSession(SDCARD);
+        SDCard::EXIT_ATOMIC(SDCARD);
 
-        sleep(60);
+        setupBeforeOpenSession();
     }
 
-    return NULL;
+    /* Also fired when wall clock has been set, re-arm for the (new) next midnight */
+    REACTOR.rearmAlarm(midnightAlarmId, getNextMidnightTimestamp());
 }
 
-void* storageH264Samples(void *arg) {
-    (void)arg;
+void maintainSession() {
+    /* Safety net if midnight alarm was missed */
+    if (getTodayDateString() != SDCARD.currentSession) {
+        rolloverDateTime();
+    }
 
-    while (1) {
-        SDCard::ENTRY_ATOMIC(SDCARD);
-        {
-        #if 0
-            bool isMounted = SDCard::isSDCardMounted(SDCARD);
-        #else
-            bool isMounted = true;
-        #endif
-            if (isMounted && SDCARD.currentSession.empty() == false) {
-                samplesH264 += 1;
-
-                {
-                    /* 
-                        TODO: 
-                        Code segment check capacity of SD Card (Clear oldest directory or file oldest)
-                    */
-                }
-
-                int ret = SDCard::storageSamples(SDCARD.videoRecorder, (uint8_t*)&samplesH264, sizeof(samplesH264));
-                if (ret == SDCARD_RETURN_SUCCESS) {
-                    std::cout << "[STORAGE] " << SDCARD.videoRecorder->getCurrentInstance() << std::endl;
-                }
-            }
-        }
-        SDCard::EXIT_ATOMIC(SDCARD);
+    std::cout << "[MAINTAIN] Frame pool occupancy " << FRAMEPOOL.getOccupancy() << "%" << std::endl;
 
-        sleep(1);
+    {
+        /* 
+            TODO: 
+            Code segment check capacity of SD Card (Clear oldest directory or file oldest)
+        */
     }
-
-    return NULL;
 }
 
 static void updateEndTimestamp() {
@@ -199,34 +195,98 @@ static void updateEndTimestamp() {
     }
 }
 
-void* storageG711Samples(void *arg) {
+void storageH264Samples() {
+    static std::vector<FrameRef> samples;
+    samples.reserve(MAX_PENDING_FRAMES);
+    {
+        std::lock_guard<std::mutex> lock(samplesMutex);
+        samples.swap(pendingH264Samples);
+    }
+
+    SDCard::ENTRY_ATOMIC(SDCARD);
+    {
+    #if 0
+        bool isMounted = SDCard::isSDCardMounted(SDCARD);
+    #else
+        bool isMounted = true;
+    #endif
+        for (auto &sample : samples) {
+            if (!isMounted || SDCARD.currentSession.empty()) {
+                break;
+            }
+
+            int ret = SDCard::storageSamples(SDCARD.videoRecorder, std::move(sample));
+            if (ret == SDCARD_RETURN_SUCCESS) {
+                std::cout << "[STORAGE] " << SDCARD.videoRecorder->getCurrentInstance() << std::endl;
+            }
+        }
+    }
+    SDCard::EXIT_ATOMIC(SDCARD);
+
+    /* Frames not stored (card removed) go back to the pool */
+    samples.clear();
+}
+
+void storageG711Samples() {
+    static std::vector<FrameRef> samples;
+    samples.reserve(MAX_PENDING_FRAMES);
+    {
+        std::lock_guard<std::mutex> lock(samplesMutex);
+        samples.swap(pendingG711Samples);
+    }
+
+    SDCard::ENTRY_ATOMIC(SDCARD);
+    {
+    #if 0
+        bool isMounted = SDCard::isSDCardMounted(SDCARD);
+    #else
+        bool isMounted = true;
+    #endif
+        for (auto &sample : samples) {
+            if (!isMounted || SDCARD.currentSession.empty()) {
+                break;
+            }
+
+            updateEndTimestamp();
+
+            int ret = SDCard::storageSamples(SDCARD.audioRecorder, std::move(sample));
+            if (ret == SDCARD_RETURN_SUCCESS) {
+                std::cout << "[STORAGE] " << SDCARD.audioRecorder->getCurrentInstance() << std::endl;
+            }
+        }
+    }
+    SDCard::EXIT_ATOMIC(SDCARD);
+
+    samples.clear();
+}
+
+/* Stand-in for encoder callbacks: hand samples over and wake up the reactor */
+void* simulateEncoders(void *arg) {
     (void)arg;
+    uint8_t samplesH264 = 0;
+    uint8_t samplesG711 = 0;
 
-    while (1) {
-        SDCard::ENTRY_ATOMIC(SDCARD);
+    while (isEncoderRunning) {
+        samplesH264 += 1;
+        samplesG711 += 2;
+
+        /* Ownership moves to the storage pipeline, a frame is dropped if pool or queue is full */
+        FrameRef h264 = FRAMEPOOL.copyFrom(&samplesH264, sizeof(samplesH264), getCurrentEpochTimestamp() * 1000ULL, FRAME_FLAG_KEYFRAME);
+        FrameRef g711 = FRAMEPOOL.copyFrom(&samplesG711, sizeof(samplesG711), getCurrentEpochTimestamp() * 1000ULL, FRAME_FLAG_AUDIO);
         {
-            
-
-        #if 0
-            bool isMounted = SDCard::isSDCardMounted(SDCARD);
-        #else
-            bool isMounted = true;
-        #endif
-    
-            if (isMounted && SDCARD.currentSession.empty() == false) {
-                updateEndTimestamp();
-
-                samplesG711 += 2;
-                int ret = SDCard::storageSamples(SDCARD.audioRecorder, (uint8_t*)&samplesG711, sizeof(samplesG711));
-                if (ret == SDCARD_RETURN_SUCCESS) {
-                    std::cout << "[STORAGE] " << SDCARD.audioRecorder->getCurrentInstance() << std::endl;
-                }
+            std::lock_guard<std::mutex> lock(samplesMutex);
+            if (h264 && pendingH264Samples.size() < MAX_PENDING_FRAMES) {
+                pendingH264Samples.push_back(std::move(h264));
+            }
+            if (g711 && pendingG711Samples.size() < MAX_PENDING_FRAMES) {
+                pendingG711Samples.push_back(std::move(g711));
             }
         }
-        SDCard::EXIT_ATOMIC(SDCARD);
+        REACTOR.notify(h264ArrivalId);
+        REACTOR.notify(g711ArrivalId);
 
         sleep(1);
     }
 
     return NULL;
-}
\ No newline at end of file
+}
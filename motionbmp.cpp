@@ -0,0 +1,226 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <algorithm>
+
+#include "motionbmp.h"
+#include "vfs.h"
+
+#define LOCAL_DBG_EN			(0)
+
+#if (LOCAL_DBG_EN == 1)
+#define LOCAL_DBG(fmt, ...) 	printf("\x1B[33m" fmt "\x1B[0m", ##__VA_ARGS__)
+#else
+#define LOCAL_DBG(fmt, ...)
+#endif
+
+/* Bits of a word in [from, to) */
+static uint64_t maskOf(uint32_t from, uint32_t to) {
+	uint64_t high = (to >= 64) ? ~0ULL : ((1ULL << to) - 1);
+	return high & (~0ULL << from);
+}
+
+MotionBitmap::MotionBitmap(std::string pathToIndex, uint32_t midnightTimestamp) {
+	mMidnight = midnightTimestamp;
+	memset(mWords, 0, sizeof(mWords));
+
+	this->pathToBitmap.assign(pathToIndex + MOTION_BITMAP_NAME);
+}
+
+MotionBitmap::~MotionBitmap() {
+	flush();
+}
+
+bool MotionBitmap::toSecond(uint32_t timestamp, uint32_t &second) {
+	if (timestamp < mMidnight) {
+		return false;
+	}
+
+	second = std::min(timestamp - mMidnight, (uint32_t)MOTION_SECONDS_PER_DAY - 1);
+	return (timestamp - mMidnight) < MOTION_SECONDS_PER_DAY + 3600;
+}
+
+int MotionBitmap::load() {
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::Metadata, sizeof(mWords));
+
+	int fd = getFileSystem().open(pathToBitmap.c_str(), O_RDONLY);
+	if (fd == -1) {
+		return MOTION_RETURN_MISSING;
+	}
+
+	ssize_t nbRead = getFileSystem().pread(fd, mWords, sizeof(mWords), 0);
+	getFileSystem().close(fd);
+
+	/* A short bitmap was cut during its creation, missing words are no motion */
+	if (nbRead < 0) {
+		memset(mWords, 0, sizeof(mWords));
+		return MOTION_RETURN_IO_FAILURE;
+	}
+	memset((uint8_t *)mWords + nbRead, 0, sizeof(mWords) - nbRead);
+
+	return MOTION_RETURN_SUCCESS;
+}
+
+int MotionBitmap::rebuild(const std::vector<RecordDesc> &records) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	uint32_t first, last;
+
+	memset(mWords, 0, sizeof(mWords));
+	for (auto &desc : records) {
+		if (!(desc.flags & RECORD_FLAG_MOTION) || desc.endTimestamp < desc.startTimestamp) {
+			continue;
+		}
+		if (!toSecond(std::max(desc.startTimestamp, mMidnight), first) || !toSecond(desc.endTimestamp, last)) {
+			continue;
+		}
+
+		for (uint32_t word = first / 64; word <= last / 64; ++word) {
+			uint32_t from = (word == first / 64) ? first % 64 : 0;
+			uint32_t to = (word == last / 64) ? last % 64 + 1 : 64;
+			mWords[word] |= maskOf(from, to);
+		}
+	}
+
+	mDirtyWord = -1;
+	return writeWords(0, MOTION_WORDS_PER_DAY);
+}
+
+void MotionBitmap::mark(uint32_t timestamp) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	uint32_t second;
+
+	if (!toSecond(timestamp, second)) {
+		return;
+	}
+
+	uint64_t bit = 1ULL << (second % 64);
+	int word = (int)(second / 64);
+	if (mWords[word] & bit) {
+		return;
+	}
+
+	/* Write the previous word once the recorder moves to another one */
+	if (mDirtyWord != -1 && mDirtyWord != word) {
+		writeWords(mDirtyWord, 1);
+	}
+
+	mWords[word] |= bit;
+	mDirtyWord = word;
+}
+
+int MotionBitmap::flush() {
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	if (mDirtyWord == -1) {
+		return MOTION_RETURN_SUCCESS;
+	}
+
+	int ret = writeWords(mDirtyWord, 1);
+	mDirtyWord = -1;
+	return ret;
+}
+
+int MotionBitmap::writeWords(int firstWord, int nbWords) {
+	size_t length = nbWords * sizeof(uint64_t);
+	off_t offset = firstWord * sizeof(uint64_t);
+
+	IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::Metadata, length);
+
+	int fd = getFileSystem().open(pathToBitmap.c_str(), O_WRONLY | O_CREAT, 0666);
+	if (fd == -1) {
+		return MOTION_RETURN_IO_FAILURE;
+	}
+
+	bool isWritten = (getFileSystem().pwrite(fd, &mWords[firstWord], length, offset) == (ssize_t)length);
+	getFileSystem().close(fd);
+
+	LOCAL_DBG("[MOTION] Write words [%d, %d) of %s\n", firstWord, firstWord + nbWords, pathToBitmap.c_str());
+
+	return isWritten ? MOTION_RETURN_SUCCESS : MOTION_RETURN_IO_FAILURE;
+}
+
+std::vector<MotionInterval> MotionBitmap::getIntervals(uint32_t fromTimestamp, uint32_t toTimestamp) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::vector<MotionInterval> intervals;
+	uint32_t first, last;
+
+	if (toTimestamp <= fromTimestamp || toTimestamp <= mMidnight) {
+		return intervals;
+	}
+	toSecond(std::max(fromTimestamp, mMidnight), first);
+	toSecond(toTimestamp - 1, last);
+
+	bool isActive = false;
+	uint32_t start = 0;
+
+	for (uint32_t word = first / 64; word <= last / 64; ++word) {
+		uint32_t from = (word == first / 64) ? first % 64 : 0;
+		uint32_t to = (word == last / 64) ? last % 64 + 1 : 64;
+		uint64_t mask = maskOf(from, to);
+		uint32_t pos = from;
+
+		/* Alternate between runs of set and clear bits with ctz */
+		while (pos < to) {
+			uint64_t bits = (isActive ? ~mWords[word] : mWords[word]) & mask & (~0ULL << pos);
+			if (bits == 0) {
+				break;
+			}
+
+			pos = __builtin_ctzll(bits);
+			if (isActive) {
+				intervals.push_back({mMidnight + start, mMidnight + word * 64 + pos});
+			}
+			else {
+				start = word * 64 + pos;
+			}
+			isActive = !isActive;
+		}
+	}
+
+	if (isActive) {
+		intervals.push_back({mMidnight + start, mMidnight + last + 1});
+	}
+
+	return intervals;
+}
+
+uint32_t MotionBitmap::findNext(uint32_t timestamp) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	uint32_t second;
+
+	if (!toSecond(std::max(timestamp, mMidnight), second)) {
+		return MOTION_NO_EVENT;
+	}
+
+	uint32_t word = second / 64;
+	uint64_t bits = mWords[word] & (~0ULL << (second % 64));
+	while (bits == 0) {
+		if (++word >= MOTION_WORDS_PER_DAY) {
+			return MOTION_NO_EVENT;
+		}
+		bits = mWords[word];
+	}
+
+	return mMidnight + word * 64 + __builtin_ctzll(bits);
+}
+
+uint32_t MotionBitmap::countSeconds(uint32_t fromTimestamp, uint32_t toTimestamp) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	uint32_t first, last, total = 0;
+
+	if (toTimestamp <= fromTimestamp || toTimestamp <= mMidnight) {
+		return 0;
+	}
+	toSecond(std::max(fromTimestamp, mMidnight), first);
+	toSecond(toTimestamp - 1, last);
+
+	for (uint32_t word = first / 64; word <= last / 64; ++word) {
+		uint32_t from = (word == first / 64) ? first % 64 : 0;
+		uint32_t to = (word == last / 64) ? last % 64 + 1 : 64;
+		total += __builtin_popcountll(mWords[word] & maskOf(from, to));
+	}
+
+	return total;
+}
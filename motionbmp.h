@@ -0,0 +1,64 @@
+/*
+    Motion activity of a day, one bit per second since local midnight (10.8 KB/day),
+    stored as "<mount>/index/<date>/motion.bmp" and updated by the motion recorder.
+
+    Queries scan 64-bit words with popcount/ctz, no record file nor directory is read.
+    Bits are flushed per word, so at most the last 64 seconds are lost on power cut.
+    A missing bitmap is rebuilt from motion records of the segment index.
+    Seconds beyond 24h (DST fall back) are folded into the last second of the day.
+*/
+#ifndef __MOTIONBMP_H
+#define __MOTIONBMP_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <memory>
+
+#include "segindex.h"
+#include "iosched.h"
+
+#define MOTION_BITMAP_NAME                  "/motion.bmp"
+#define MOTION_SECONDS_PER_DAY              (86400)
+#define MOTION_WORDS_PER_DAY                (MOTION_SECONDS_PER_DAY / 64)
+#define MOTION_NO_EVENT                     (0)
+
+#define MOTION_RETURN_SUCCESS               (0)
+#define MOTION_RETURN_MISSING               (-1)
+#define MOTION_RETURN_IO_FAILURE            (-2)
+
+typedef struct {
+    uint32_t startTimestamp;
+    uint32_t endTimestamp;      /* Exclusive */
+} MotionInterval;
+
+class MotionBitmap {
+public:
+    MotionBitmap(std::string pathToIndex, uint32_t midnightTimestamp);
+    ~MotionBitmap();
+
+    int load();
+    int rebuild(const std::vector<RecordDesc> &records);
+    void mark(uint32_t timestamp);
+    int flush();
+
+    std::vector<MotionInterval> getIntervals(uint32_t fromTimestamp, uint32_t toTimestamp);
+    uint32_t findNext(uint32_t timestamp);
+    uint32_t countSeconds(uint32_t fromTimestamp, uint32_t toTimestamp);
+
+private:
+    std::mutex mMutex;
+    uint64_t mWords[MOTION_WORDS_PER_DAY];
+    uint32_t mMidnight;
+    int mDirtyWord = -1;
+
+    bool toSecond(uint32_t timestamp, uint32_t &second);
+    int writeWords(int firstWord, int nbWords);
+
+public:
+    std::string pathToBitmap;
+    std::shared_ptr<IOScheduler> ioScheduler;
+};
+
+#endif /* __MOTIONBMP_H */
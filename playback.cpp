@@ -0,0 +1,668 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#include "playback.h"
+#include "annexb.h"
+
+#define LOCAL_DBG_EN			(0)
+
+#if (LOCAL_DBG_EN == 1)
+#define LOCAL_DBG(fmt, ...) 	printf("\x1B[32m" fmt "\x1B[0m", ##__VA_ARGS__)
+#else
+#define LOCAL_DBG(fmt, ...)
+#endif
+
+static size_t alignDown(size_t offset) {
+	return offset & ~((size_t)PLAYBACK_READAHEAD_SIZE - 1);
+}
+
+static bool isAnnexBFile(const std::string &path) {
+	uint8_t head[4];
+
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd == -1) {
+		return false;
+	}
+	bool ret = (pread(fd, head, sizeof(head), 0) == (ssize_t)sizeof(head) && hasStartCode(head, sizeof(head)));
+	::close(fd);
+
+	return ret;
+}
+
+SegmentReader::SegmentReader(const RecordDesc &desc, std::string pathToVideo, std::string pathToAudio, std::shared_ptr<IOScheduler> ioScheduler) {
+	mDesc = desc;
+	mScheduler = ioScheduler;
+
+	this->pathToVideo.assign(pathToVideo);
+	this->pathToAudio.assign(pathToAudio);
+}
+
+SegmentReader::~SegmentReader() {
+	close();
+}
+
+int SegmentReader::open() {
+	/* Records rebuilt from a directory scan lost their flag, plaintext video begins with a start code */
+	mIsEncrypted = (mDesc.flags & RECORD_FLAG_ENCRYPTED) != 0 || (cipher && !isAnnexBFile(pathToVideo));
+	if (mIsEncrypted && !cipher) {
+		LOCAL_DBG("[PLAYBACK] No key for %s\n", pathToVideo.c_str());
+		return PLAYBACK_RETURN_FAILURE;
+	}
+
+	if (mapTrack(pathToVideo, mVideo, RECORD_TRACK_VIDEO) != PLAYBACK_RETURN_SUCCESS) {
+		return PLAYBACK_RETURN_FAILURE;
+	}
+
+	/* Playback without audio is still possible */
+	if (mapTrack(pathToAudio, mAudio, RECORD_TRACK_AUDIO) != PLAYBACK_RETURN_SUCCESS) {
+		LOCAL_DBG("[PLAYBACK] No audio track %s\n", pathToAudio.c_str());
+	}
+
+	mCorrupted = corruptedRanges;
+	std::sort(mCorrupted.begin(), mCorrupted.end(), [](const ChunkDesc &r1, const ChunkDesc &r2) {
+		return r1.offset < r2.offset;
+	});
+
+	buildKeyframeIndex();
+	buildAudioGaps();
+	if (seek(getStartMs()) != PLAYBACK_RETURN_SUCCESS) {
+		close();
+		return PLAYBACK_RETURN_FAILURE;
+	}
+
+	LOCAL_DBG("[PLAYBACK] Open %s, %u frames, %zu keyframes\n", pathToVideo.c_str(), mTotalFrames, mKeyframes.size());
+
+	return PLAYBACK_RETURN_SUCCESS;
+}
+
+void SegmentReader::close() {
+	unmapTrack(mVideo);
+	unmapTrack(mAudio);
+	mFrames.clear();
+	mKeyframes.clear();
+	mCorrupted.clear();
+	mAudioGaps.clear();
+	mCursor = 0;
+	mRunEnd = 0;
+	mIsRunEndKeyframe = false;
+	mTotalFrames = 0;
+	mAudioSize = 0;
+}
+
+int SegmentReader::mapTrack(const std::string &path, Track &track, uint8_t trackMask) {
+	struct stat fStat;
+	uint64_t nonce = (trackMask == RECORD_TRACK_VIDEO) ? videoNonce : audioNonce;
+
+	/* Key stream can't be rebuilt without the journaled nonce */
+	if (mIsEncrypted && nonce == 0) {
+		LOCAL_DBG("[PLAYBACK] No nonce for %s\n", path.c_str());
+		return PLAYBACK_RETURN_FAILURE;
+	}
+
+	IOScheduler::Ticket ticket(mScheduler.get(), IOScheduler::eClass::Playback);
+
+	track.fd = ::open(path.c_str(), O_RDONLY);
+	if (track.fd == -1) {
+		return PLAYBACK_RETURN_FAILURE;
+	}
+
+	if (fstat(track.fd, &fStat) != 0 || fStat.st_size <= 0) {
+		unmapTrack(track);
+		return PLAYBACK_RETURN_FAILURE;
+	}
+
+	/* A record still growing is served as it was when the reader opened */
+	track.size = (size_t)fStat.st_size;
+	int prot = PROT_READ, flags = MAP_SHARED;
+	if (mIsEncrypted) {
+		/* Decrypted in place, the file is never written */
+		prot |= PROT_WRITE;
+		flags = MAP_PRIVATE;
+		track.nonce = nonce;
+		track.decrypted.assign((track.size + PLAYBACK_DECRYPT_UNIT - 1) / PLAYBACK_DECRYPT_UNIT, false);
+	}
+	void *base = mmap(nullptr, track.size, prot, flags, track.fd, 0);
+	if (base == MAP_FAILED) {
+		unmapTrack(track);
+		return PLAYBACK_RETURN_FAILURE;
+	}
+
+	track.base = (uint8_t *)base;
+	posix_fadvise(track.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	madvise(track.base, track.size, MADV_SEQUENTIAL);
+
+	return PLAYBACK_RETURN_SUCCESS;
+}
+
+void SegmentReader::unmapTrack(Track &track) {
+	if (track.base != nullptr) {
+		munmap(track.base, track.size);
+	}
+	if (track.fd != -1) {
+		posix_fadvise(track.fd, 0, 0, POSIX_FADV_DONTNEED);
+		::close(track.fd);
+	}
+
+	track = Track();
+}
+
+void SegmentReader::readahead(Track &track, size_t offset, size_t length) {
+	size_t end = std::min(track.size, offset + length);
+
+	if (track.base == nullptr || end <= track.readaheadEnd) {
+		return;
+	}
+
+	/* Advise whole windows, the request is issued once per window */
+	while (track.readaheadEnd < end) {
+		size_t window = std::min((size_t)PLAYBACK_READAHEAD_SIZE, track.size - track.readaheadEnd);
+
+		IOScheduler::Ticket ticket(mScheduler.get(), IOScheduler::eClass::Playback, window);
+		posix_fadvise(track.fd, track.readaheadEnd, window, POSIX_FADV_WILLNEED);
+		track.readaheadEnd += window;
+	}
+}
+
+void SegmentReader::dropBehind(Track &track, size_t offset) {
+	if (track.base == nullptr || offset < PLAYBACK_READAHEAD_SIZE) {
+		return;
+	}
+
+	/* Keep one window behind the cursor for short rewinds */
+	size_t end = alignDown(offset) - PLAYBACK_READAHEAD_SIZE;
+	if (end <= track.droppedEnd) {
+		return;
+	}
+
+	/* Mapped pages are never dropped from page cache, unmap them first */
+	madvise(track.base + track.droppedEnd, end - track.droppedEnd, MADV_DONTNEED);
+	posix_fadvise(track.fd, track.droppedEnd, end - track.droppedEnd, POSIX_FADV_DONTNEED);
+
+	/* Private pages are gone, they read as ciphertext again */
+	if (mIsEncrypted) {
+		std::fill(track.decrypted.begin() + track.droppedEnd / PLAYBACK_DECRYPT_UNIT,
+				  track.decrypted.begin() + end / PLAYBACK_DECRYPT_UNIT, false);
+	}
+	track.droppedEnd = end;
+}
+
+/* Decrypt [offset, offset + length) once, returns end of plaintext from "offset" */
+size_t SegmentReader::decrypt(Track &track, size_t offset, size_t length) {
+	if (!mIsEncrypted || track.base == nullptr) {
+		return track.size;
+	}
+
+	size_t end = std::min(track.size, offset + length);
+	for (size_t unit = offset / PLAYBACK_DECRYPT_UNIT; unit * PLAYBACK_DECRYPT_UNIT < end; ++unit) {
+		if (track.decrypted[unit]) {
+			continue;
+		}
+		size_t from = unit * PLAYBACK_DECRYPT_UNIT;
+		cipher->apply(track.nonce, from, track.base + from, std::min((size_t)PLAYBACK_DECRYPT_UNIT, track.size - from));
+		track.decrypted[unit] = true;
+	}
+
+	return end;
+}
+
+void SegmentReader::resetWindow(Track &track, size_t offset) {
+	track.readaheadEnd = alignDown(offset);
+	track.droppedEnd = (track.readaheadEnd >= PLAYBACK_READAHEAD_SIZE) ? track.readaheadEnd - PLAYBACK_READAHEAD_SIZE : 0;
+	readahead(track, offset, PLAYBACK_READAHEAD_SIZE);
+}
+
+/* Journaled keyframes inside the mapped video, frames past the last one are counted once */
+void SegmentReader::buildKeyframeIndex() {
+	mKeyframes.clear();
+	mTotalFrames = 0;
+
+	/* Entries come in journal order, a resumed record overwrites the tail lost by the interruption
+	   so a keyframe drops every earlier entry at or beyond its offset */
+	for (auto &keyframe : keyframes) {
+		while (!mKeyframes.empty() && mKeyframes.back().offset >= keyframe.offset) {
+			mKeyframes.pop_back();
+		}
+		mKeyframes.push_back({keyframe.offset, keyframe.length});
+	}
+	while (!mKeyframes.empty() && mKeyframes.back().offset >= mVideo.size) {
+		mKeyframes.pop_back();
+	}
+
+	/* Frame numbers must count from the first access unit, otherwise the record is indexed lazily */
+	bool isValid = !mKeyframes.empty() && mKeyframes[0].offset == 0 && mKeyframes[0].frameNumber == 0;
+	for (size_t id = 1; isValid && id < mKeyframes.size(); ++id) {
+		isValid = mKeyframes[id].frameNumber > mKeyframes[id - 1].frameNumber;
+	}
+	if (!isValid) {
+		mKeyframes.clear();
+		return;
+	}
+
+	size_t from = mKeyframes.back().offset;
+	uint32_t frameNumber = mKeyframes.back().frameNumber;
+	do {
+		parseRun(from, frameNumber, SIZE_MAX);
+		frameNumber += (uint32_t)mFrames.size();
+		from = mRunEnd;
+	} while (!mFrames.empty() && mRunEnd < mVideo.size);
+
+	mTotalFrames = frameNumber;
+}
+
+/*  Split Annex-B stream into access units from "from" up to the next keyframe, or "maxFrames".
+	A new access unit begins at AUD/SPS/PPS/SEI or at a slice with first_mb_in_slice = 0, once
+	the current one already has a slice.
+*/
+void SegmentReader::parseRun(size_t from, uint32_t frameNumber, size_t maxFrames) {
+	const uint8_t *data = mVideo.base;
+	size_t size = mVideo.size;
+	size_t auOffset = SIZE_MAX;
+	bool hasSlice = false, isKeyframe = false, isDone = false;
+	AnnexBNal nal;
+
+	mFrames.clear();
+	mCursor = 0;
+	mRunFrame = frameNumber;
+	mRunEnd = size;
+	mIsRunEndKeyframe = false;
+
+	/* Next journaled keyframe ends the run without being split */
+	size_t stopAt = size;
+	auto next = std::upper_bound(mKeyframes.begin(), mKeyframes.end(), from, [](size_t offset, const KeyframeEntry &keyframe) {
+		return offset < keyframe.offset;
+	});
+	if (next != mKeyframes.end()) {
+		stopAt = next->offset;
+	}
+
+	auto closeAccessUnit = [&](size_t end) {
+		if (auOffset != SIZE_MAX && hasSlice) {
+			if (isKeyframe && !mFrames.empty()) {
+				/* It begins the next run */
+				mRunEnd = auOffset;
+				mIsRunEndKeyframe = true;
+				isDone = true;
+			}
+			else {
+				mFrames.push_back({(uint32_t)auOffset, (uint32_t)(end - auOffset), isKeyframe});
+				if (mFrames.size() >= maxFrames) {
+					mRunEnd = end;
+					isDone = true;
+				}
+			}
+		}
+		auOffset = SIZE_MAX;
+		hasSlice = false;
+		isKeyframe = false;
+	};
+
+	/* Stream is only parsed up to "plainEnd", an encrypted one is decrypted ahead of the parser */
+	size_t plainEnd = decrypt(mVideo, from, PLAYBACK_READAHEAD_SIZE);
+	size_t pos = from;
+	while (!isDone) {
+		bool isFound = findNextNal(data, plainEnd, pos, nal) && (nal.header + 1 < plainEnd || plainEnd >= size);
+		if (!isFound && plainEnd >= size) {
+			closeAccessUnit(size);
+			break;
+		}
+		if (!isFound) {
+			/* NAL unit longer than decrypted yet */
+			plainEnd = decrypt(mVideo, plainEnd, PLAYBACK_READAHEAD_SIZE);
+			continue;
+		}
+		if (nal.offset >= stopAt) {
+			closeAccessUnit(stopAt);
+			if (!isDone) {
+				mRunEnd = stopAt;
+				mIsRunEndKeyframe = true;
+			}
+			break;
+		}
+		plainEnd = std::max(plainEnd, decrypt(mVideo, nal.offset, PLAYBACK_READAHEAD_SIZE));
+
+		/* A single keyframe (fast-forward) doesn't read the frames after it */
+		if (maxFrames == SIZE_MAX) {
+			readahead(mVideo, nal.offset, PLAYBACK_READAHEAD_SIZE);
+		}
+
+		bool isSlice = NAL_IS_SLICE(nal.type);
+		bool beginsUnit = isSlice ? isFirstSliceOfPicture(data, plainEnd, nal) : 
+									(nal.type == NAL_TYPE_AUD || nal.type == NAL_TYPE_SPS ||
+									 nal.type == NAL_TYPE_PPS || nal.type == NAL_TYPE_SEI);
+
+		if (hasSlice && beginsUnit) {
+			closeAccessUnit(nal.offset);
+			if (isDone) {
+				break;
+			}
+		}
+		if (auOffset == SIZE_MAX) {
+			auOffset = nal.offset;
+		}
+
+		hasSlice = hasSlice || isSlice;
+		isKeyframe = isKeyframe || (nal.type == NAL_TYPE_IDR);
+		pos = nal.header + 1;
+	}
+}
+
+/*  Access unit with an IDR slice in [from, end), the first one or the last one. Parameter sets
+	before the slice belong to it, SIZE_MAX if there's none.
+*/
+size_t SegmentReader::findKeyframe(size_t from, size_t end, bool isLast) {
+	const uint8_t *data = mVideo.base;
+	size_t size = mVideo.size;
+	size_t unitStart = SIZE_MAX, keyframe = SIZE_MAX;
+	AnnexBNal nal;
+
+	size_t plainEnd = decrypt(mVideo, from, PLAYBACK_READAHEAD_SIZE);
+	size_t pos = from;
+	while (true) {
+		bool isFound = findNextNal(data, plainEnd, pos, nal) && (nal.header + 1 < plainEnd || plainEnd >= size);
+		if (!isFound && plainEnd >= size) {
+			break;
+		}
+		if (!isFound) {
+			plainEnd = decrypt(mVideo, plainEnd, PLAYBACK_READAHEAD_SIZE);
+			continue;
+		}
+		if (nal.offset >= end) {
+			break;
+		}
+		plainEnd = std::max(plainEnd, decrypt(mVideo, nal.offset, PLAYBACK_READAHEAD_SIZE));
+
+		if (nal.type == NAL_TYPE_IDR && isFirstSliceOfPicture(data, plainEnd, nal)) {
+			keyframe = (unitStart != SIZE_MAX) ? unitStart : nal.offset;
+			if (!isLast) {
+				break;
+			}
+		}
+
+		if (NAL_IS_SLICE(nal.type)) {
+			unitStart = SIZE_MAX;
+		}
+		else if (unitStart == SIZE_MAX && (nal.type == NAL_TYPE_AUD || nal.type == NAL_TYPE_SPS || 
+										   nal.type == NAL_TYPE_PPS || nal.type == NAL_TYPE_SEI)) {
+			unitStart = nal.offset;
+		}
+		pos = nal.header + 1;
+	}
+
+	return keyframe;
+}
+
+/* Keyframe at or before "offset" of a lazily indexed record, searched backward one window at a time */
+size_t SegmentReader::findKeyframeBefore(size_t offset) {
+	size_t end = std::min(offset + 1, mVideo.size);
+
+	while (end > 0) {
+		size_t from = (end > PLAYBACK_READAHEAD_SIZE) ? end - PLAYBACK_READAHEAD_SIZE : 0;
+
+		/* Parameter sets of an access unit across the window boundary are just before it */
+		size_t keyframe = findKeyframe((from > PLAYBACK_DECRYPT_UNIT) ? from - PLAYBACK_DECRYPT_UNIT : 0, end, true);
+		if (keyframe != SIZE_MAX) {
+			return keyframe;
+		}
+		end = from;
+	}
+
+	return SIZE_MAX;
+}
+
+/* Split the run of the first keyframe at or after "from" out of corrupted ranges */
+int SegmentReader::moveToKeyframe(size_t from, size_t maxFrames) {
+	while (from < mVideo.size) {
+		size_t offset = SIZE_MAX;
+		uint32_t frameNumber = 0;
+
+		if (!mKeyframes.empty()) {
+			auto it = std::lower_bound(mKeyframes.begin(), mKeyframes.end(), from, [](const KeyframeEntry &keyframe, size_t offset) {
+				return keyframe.offset < offset;
+			});
+			if (it != mKeyframes.end()) {
+				offset = it->offset;
+				frameNumber = it->frameNumber;
+			}
+		}
+		else {
+			offset = findKeyframe(from, mVideo.size, false);
+		}
+		if (offset == SIZE_MAX) {
+			break;
+		}
+
+		parseRun(offset, frameNumber, maxFrames);
+		if (mFrames.empty()) {
+			break;
+		}
+		if (!isCorrupted(mFrames[0])) {
+			return PLAYBACK_RETURN_SUCCESS;
+		}
+		from = (size_t)mFrames[0].offset + mFrames[0].size;
+	}
+
+	mFrames.clear();
+	mCursor = 0;
+	mRunEnd = mVideo.size;
+	mIsRunEndKeyframe = false;
+
+	return PLAYBACK_RETURN_END_OF_RECORD;
+}
+
+bool SegmentReader::isCorrupted(const FrameEntry &entry) {
+	size_t end = (size_t)entry.offset + entry.size;
+
+	auto it = std::lower_bound(mCorrupted.begin(), mCorrupted.end(), end, [](const ChunkDesc &range, size_t offset) {
+		return range.offset < offset;
+	});
+
+	return it != mCorrupted.begin() && (size_t)(it - 1)->offset + (it - 1)->length > entry.offset;
+}
+
+void SegmentReader::buildAudioGaps() {
+	size_t totalGaps = 0;
+
+	std::sort(audioGaps.begin(), audioGaps.end(), [](const ChunkDesc &g1, const ChunkDesc &g2) {
+		return g1.offset < g2.offset;
+	});
+
+	mAudioGaps.clear();
+	for (auto &gap : audioGaps) {
+		/* A gap beyond the mapped track belongs to a later snapshot of the record */
+		if (gap.offset > mAudio.size || gap.length == 0) {
+			continue;
+		}
+		mAudioGaps.push_back({gap.offset + totalGaps, gap.offset, gap.length, (uint8_t)gap.crc});
+		totalGaps += gap.length;
+	}
+
+	mAudioSize = mAudio.size + totalGaps;
+}
+
+size_t SegmentReader::toAudioFileOffset(size_t audioOffset) {
+	auto it = std::upper_bound(mAudioGaps.begin(), mAudioGaps.end(), audioOffset, [](size_t offset, const AudioGap &gap) {
+		return offset < gap.virtualOffset;
+	});
+	if (it == mAudioGaps.begin()) {
+		return audioOffset;
+	}
+
+	--it;
+	size_t gapEnd = it->virtualOffset + it->length;
+	return (audioOffset < gapEnd) ? it->fileOffset : audioOffset - (gapEnd - it->fileOffset);
+}
+
+uint64_t SegmentReader::toTimestampMs(size_t frameIndex) {
+	/* Without frame numbers, time is spread over the record by offset */
+	if (mTotalFrames == 0) {
+		return getStartMs() + (uint64_t)mFrames[frameIndex].offset * getDurationMs() / mVideo.size;
+	}
+
+	return getStartMs() + (uint64_t)(mRunFrame + frameIndex) * getDurationMs() / mTotalFrames;
+}
+
+int SegmentReader::seek(uint64_t timestampMs) {
+	if (mVideo.base == nullptr) {
+		return PLAYBACK_RETURN_FAILURE;
+	}
+
+	timestampMs = std::max(timestampMs, getStartMs());
+	uint64_t offsetMs = timestampMs - getStartMs();
+	if (offsetMs >= getDurationMs()) {
+		return PLAYBACK_RETURN_END_OF_RECORD;
+	}
+
+	/* Decoding must start from a keyframe */
+	size_t from = 0;
+	if (!mKeyframes.empty()) {
+		uint32_t target = (uint32_t)(offsetMs * mTotalFrames / getDurationMs());
+		auto it = std::upper_bound(mKeyframes.begin(), mKeyframes.end(), target, [](uint32_t frameNumber, const KeyframeEntry &keyframe) {
+			return frameNumber < keyframe.frameNumber;
+		});
+		from = (it == mKeyframes.begin()) ? 0 : (it - 1)->offset;
+	}
+	else {
+		size_t keyframe = findKeyframeBefore((size_t)(offsetMs * mVideo.size / getDurationMs()));
+		from = (keyframe != SIZE_MAX) ? keyframe : 0;
+	}
+
+	int ret = moveToKeyframe(from, SIZE_MAX);
+	if (ret != PLAYBACK_RETURN_SUCCESS) {
+		return ret;
+	}
+	resetWindow(mVideo, mFrames[mCursor].offset);
+
+	uint64_t cursorMs = toTimestampMs(mCursor) - getStartMs();
+	mAudioCursor = std::min(mAudioSize, (size_t)(cursorMs * PLAYBACK_G711_BYTES_PER_MS));
+	resetWindow(mAudio, toAudioFileOffset(mAudioCursor));
+
+	return PLAYBACK_RETURN_SUCCESS;
+}
+
+int SegmentReader::readVideo(MediaFrame &frame) {
+	if (mCursor >= mFrames.size()) {
+		if (mRunEnd >= mVideo.size) {
+			return PLAYBACK_RETURN_END_OF_RECORD;
+		}
+		parseRun(mRunEnd, mRunFrame + (uint32_t)mFrames.size(), SIZE_MAX);
+		if (mFrames.empty()) {
+			return PLAYBACK_RETURN_END_OF_RECORD;
+		}
+	}
+
+	/* Pictures of a corrupted range can't be decoded, nor those referencing them up to the next keyframe */
+	if (isCorrupted(mFrames[mCursor])) {
+		size_t from = (size_t)mFrames[mCursor].offset + mFrames[mCursor].size;
+		if (moveToKeyframe(from, SIZE_MAX) != PLAYBACK_RETURN_SUCCESS) {
+			return PLAYBACK_RETURN_END_OF_RECORD;
+		}
+	}
+
+	FrameEntry &entry = mFrames[mCursor];
+	readahead(mVideo, entry.offset, entry.size + PLAYBACK_READAHEAD_SIZE);
+	dropBehind(mVideo, entry.offset);
+	decrypt(mVideo, entry.offset, entry.size);
+
+	frame.data = mVideo.base + entry.offset;
+	frame.size = entry.size;
+	frame.timestampMs = toTimestampMs(mCursor);
+	frame.isKeyframe = entry.isKeyframe;
+	++mCursor;
+
+	return PLAYBACK_RETURN_SUCCESS;
+}
+
+int SegmentReader::readKeyframe(MediaFrame &frame) {
+	/* Only the first frame of a run is a keyframe, the next one ends the run */
+	size_t from = mRunEnd;
+	if (mCursor < mFrames.size() && (mFrames[mCursor].isKeyframe || !mIsRunEndKeyframe)) {
+		from = mFrames[mCursor].offset;
+	}
+	if (moveToKeyframe(from, 1) != PLAYBACK_RETURN_SUCCESS) {
+		return PLAYBACK_RETURN_END_OF_RECORD;
+	}
+
+	/* Skipped frames aren't read, only the keyframe itself is advised */
+	FrameEntry &entry = mFrames[0];
+	{
+		IOScheduler::Ticket ticket(mScheduler.get(), IOScheduler::eClass::Playback, entry.size);
+		posix_fadvise(mVideo.fd, entry.offset, entry.size, POSIX_FADV_WILLNEED);
+	}
+	dropBehind(mVideo, entry.offset);
+	decrypt(mVideo, entry.offset, entry.size);
+	mVideo.readaheadEnd = std::max(mVideo.readaheadEnd, alignDown(entry.offset));
+
+	frame.data = mVideo.base + entry.offset;
+	frame.size = entry.size;
+	frame.timestampMs = toTimestampMs(0);
+	frame.isKeyframe = true;
+	mCursor = 1;
+
+	uint64_t offsetMs = frame.timestampMs - getStartMs();
+	mAudioCursor = std::min(mAudioSize, (size_t)(offsetMs * PLAYBACK_G711_BYTES_PER_MS));
+
+	return PLAYBACK_RETURN_SUCCESS;
+}
+
+int SegmentReader::readAudio(MediaFrame &frame, uint32_t durationMs) {
+	if (mAudioSize == 0) {
+		return PLAYBACK_RETURN_FAILURE;
+	}
+	if (mAudioCursor >= mAudioSize) {
+		return PLAYBACK_RETURN_END_OF_RECORD;
+	}
+
+	size_t length = std::min(mAudioSize - mAudioCursor, (size_t)durationMs * PLAYBACK_G711_BYTES_PER_MS);
+	auto next = std::upper_bound(mAudioGaps.begin(), mAudioGaps.end(), mAudioCursor, [](size_t offset, const AudioGap &gap) {
+		return offset < gap.virtualOffset;
+	});
+	auto prev = (next == mAudioGaps.begin()) ? mAudioGaps.end() : next - 1;
+
+	if (prev != mAudioGaps.end() && mAudioCursor < prev->virtualOffset + prev->length) {
+		/* Regenerate silence, a frame never spans a gap boundary */
+		length = std::min(length, prev->virtualOffset + prev->length - mAudioCursor);
+		if (mSilence.size() < length || (!mSilence.empty() && mSilence[0] != prev->silenceByte)) {
+			mSilence.assign(std::max(length, mSilence.size()), prev->silenceByte);
+		}
+		frame.data = mSilence.data();
+	}
+	else {
+		size_t fileOffset = toAudioFileOffset(mAudioCursor);
+		if (next != mAudioGaps.end()) {
+			length = std::min(length, next->virtualOffset - mAudioCursor);
+		}
+
+		readahead(mAudio, fileOffset, length + PLAYBACK_READAHEAD_SIZE);
+		dropBehind(mAudio, fileOffset);
+		decrypt(mAudio, fileOffset, length);
+		frame.data = mAudio.base + fileOffset;
+	}
+
+	frame.size = length;
+	frame.timestampMs = getStartMs() + mAudioCursor / PLAYBACK_G711_BYTES_PER_MS;
+	frame.isKeyframe = false;
+	mAudioCursor += length;
+
+	return PLAYBACK_RETURN_SUCCESS;
+}
+
+size_t SegmentReader::getTotalFrames() {
+	return mTotalFrames;
+}
+
+size_t SegmentReader::getTotalKeyframes() {
+	return mKeyframes.size();
+}
+
+uint64_t SegmentReader::getStartMs() {
+	return (uint64_t)mDesc.startTimestamp * 1000;
+}
+
+uint64_t SegmentReader::getDurationMs() {
+	uint32_t start = mDesc.startTimestamp, end = mDesc.endTimestamp;
+	return (uint64_t)std::max(1u, (end > start) ? end - start : 0u) * 1000;
+}
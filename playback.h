@@ -0,0 +1,151 @@
+/*
+    Playback reader of one record (video + audio pair).
+
+    Track files are mapped read-only and served without copy. The recorder journals the
+    offset and frame number of every keyframe (access unit with an IDR slice), frames are
+    only split from H.264 Annex-B stream one run at a time: from a keyframe (or the cursor)
+    up to the next keyframe. Seek and fast-forward go straight to journaled keyframes,
+    frames in between are never read. Record files carry no per-frame timestamp, frames
+    are spread evenly over [start, end] of the record by frame number.
+
+    A record without journaled keyframes (rebuilt by a directory scan, resumed without
+    them) is indexed lazily: keyframes are searched around the seek point and frame
+    timestamps are spread over the record by file offset instead.
+
+    Forward play advises readahead (WILLNEED) one window ahead of the cursor and drops
+    pages (DONTNEED) one window behind it, so a long playback doesn't evict page cache
+    of the recorder. Every readahead takes a Playback ticket of the card scheduler.
+
+    Silent spans skipped by the audio recorder (Gap entries) are served back as silence
+    frames, so audio stays aligned with the record time. Access units in video ranges
+    flagged corrupted by scrub are skipped, up to the next keyframe out of them.
+
+    An encrypted record (see aesctr.h) is mapped private and decrypted in place, unit by
+    unit as a run is split, so frames read next are already plaintext. Units dropped
+    behind the cursor are decrypted again if they're read again.
+
+    Frame data points into the mapping, it's valid until the reader is closed, or for an
+    encrypted record until the cursor is one window past it. Data of a silence frame is
+    valid until the next readAudio().
+*/
+#ifndef __PLAYBACK_H
+#define __PLAYBACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "segindex.h"
+#include "iosched.h"
+#include "aesctr.h"
+
+#define PLAYBACK_READAHEAD_SIZE             (1024 * 1024)
+#define PLAYBACK_G711_BYTES_PER_MS          (8)     /* 8 kHz, 8 bits/sample */
+#define PLAYBACK_DECRYPT_UNIT               (4096)  /* Divides PLAYBACK_READAHEAD_SIZE */
+
+#define PLAYBACK_RETURN_SUCCESS             (0)
+#define PLAYBACK_RETURN_FAILURE             (-1)
+#define PLAYBACK_RETURN_END_OF_RECORD       (-2)
+
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    uint64_t timestampMs;
+    bool isKeyframe;
+} MediaFrame;
+
+class SegmentReader {
+public:
+    SegmentReader(const RecordDesc &desc, std::string pathToVideo, std::string pathToAudio, std::shared_ptr<IOScheduler> ioScheduler);
+    ~SegmentReader();
+
+    int open();
+    void close();
+
+    int seek(uint64_t timestampMs);             /* Move to keyframe at or before timestamp */
+    int readVideo(MediaFrame &frame);           /* Next frame, forward play */
+    int readKeyframe(MediaFrame &frame);        /* Next keyframe, fast-forward */
+    int readAudio(MediaFrame &frame, uint32_t durationMs);
+
+    size_t getTotalFrames();                    /* 0 if the record has no journaled keyframes */
+    size_t getTotalKeyframes();                 /* Journaled keyframes */
+    uint64_t getStartMs();
+    uint64_t getDurationMs();
+
+private:
+    typedef struct {
+        uint32_t offset;
+        uint32_t size;
+        bool isKeyframe;
+    } FrameEntry;
+
+    typedef struct {
+        uint32_t offset;
+        uint32_t frameNumber;
+    } KeyframeEntry;
+
+    typedef struct {
+        size_t virtualOffset;   /* In audio stream with silence */
+        size_t fileOffset;
+        size_t length;
+        uint8_t silenceByte;
+    } AudioGap;
+
+    typedef struct {
+        int fd = -1;
+        uint8_t *base = nullptr;
+        size_t size = 0;
+        size_t readaheadEnd = 0;    /* Advised WILLNEED up to */
+        size_t droppedEnd = 0;      /* Advised DONTNEED up to */
+        uint64_t nonce = 0;
+        std::vector<bool> decrypted;    /* Per PLAYBACK_DECRYPT_UNIT, encrypted record only */
+    } Track;
+
+    RecordDesc mDesc;
+    std::shared_ptr<IOScheduler> mScheduler;
+    Track mVideo;
+    Track mAudio;
+    std::vector<KeyframeEntry> mKeyframes;      /* Journaled, sorted by offset, empty if lazily indexed */
+    std::vector<FrameEntry> mFrames;            /* Run around the cursor */
+    uint32_t mRunFrame = 0;                     /* Frame number of mFrames[0] */
+    size_t mRunEnd = 0;                         /* Offset past the run */
+    bool mIsRunEndKeyframe = false;             /* Run stopped at the next keyframe */
+    size_t mCursor = 0;                         /* Next frame in mFrames */
+    uint32_t mTotalFrames = 0;
+    std::vector<ChunkDesc> mCorrupted;          /* Sorted by offset */
+    std::vector<AudioGap> mAudioGaps;           /* Sorted by offset */
+    std::vector<uint8_t> mSilence;
+    size_t mAudioCursor = 0;                    /* Next byte of audio stream with silence */
+    size_t mAudioSize = 0;
+    bool mIsEncrypted = false;
+
+    int mapTrack(const std::string &path, Track &track, uint8_t trackMask);
+    void unmapTrack(Track &track);
+    void buildKeyframeIndex();
+    void parseRun(size_t from, uint32_t frameNumber, size_t maxFrames);
+    size_t findKeyframe(size_t from, size_t end, bool isLast);
+    size_t findKeyframeBefore(size_t offset);
+    int moveToKeyframe(size_t from, size_t maxFrames);
+    bool isCorrupted(const FrameEntry &entry);
+    void buildAudioGaps();
+    size_t toAudioFileOffset(size_t audioOffset);
+    void readahead(Track &track, size_t offset, size_t length);
+    void dropBehind(Track &track, size_t offset);
+    void resetWindow(Track &track, size_t offset);
+    size_t decrypt(Track &track, size_t offset, size_t length);
+    uint64_t toTimestampMs(size_t frameIndex);
+
+public:
+    std::string pathToVideo;
+    std::string pathToAudio;
+    std::vector<ChunkDesc> audioGaps;           /* Gap entries of the record, set before open() */
+    std::vector<ChunkDesc> keyframes;           /* Keyframe entries of the record in journal order, set before open() */
+    std::vector<ChunkDesc> corruptedRanges;     /* Corrupted ranges of the video track, set before open() */
+    std::shared_ptr<AesCtr> cipher;             /* Key of encrypted records, set before open() */
+    uint64_t videoNonce = 0;                    /* Journaled nonces of encrypted records, set before open() */
+    uint64_t audioNonce = 0;
+};
+
+#endif /* __PLAYBACK_H */
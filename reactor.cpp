@@ -0,0 +1,199 @@
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+
+#include "reactor.h"
+
+#define LOCAL_DBG_EN			(0)
+
+#if (LOCAL_DBG_EN == 1)
+#define LOCAL_DBG(fmt, ...) 	printf("\x1B[36m" fmt "\x1B[0m", ##__VA_ARGS__)
+#else
+#define LOCAL_DBG(fmt, ...)
+#endif
+
+Reactor::Reactor() {
+	mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+	mStopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = mStopFd;
+	epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mStopFd, &ev);
+}
+
+Reactor::~Reactor() {
+	for (auto &it : mSources) {
+		close(it.first);
+	}
+	close(mStopFd);
+	close(mEpollFd);
+}
+
+void Reactor::blockSignals(std::initializer_list<int> signals) {
+	sigset_t mask;
+
+	sigemptyset(&mask);
+	for (int sig : signals) {
+		sigaddset(&mask, sig);
+	}
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+}
+
+int Reactor::addSource(int fd, Source source) {
+	if (fd == -1) {
+		return REACTOR_RETURN_FAILURE;
+	}
+
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+
+	if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+		close(fd);
+		return REACTOR_RETURN_FAILURE;
+	}
+	mSources[fd] = source;
+
+	return fd;
+}
+
+int Reactor::addPeriodicTimer(uint32_t intervalInSecs, Handler handler) {
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd == -1) {
+		return REACTOR_RETURN_FAILURE;
+	}
+
+	struct itimerspec spec;
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_sec = intervalInSecs;
+	spec.it_interval.tv_sec = intervalInSecs;
+	timerfd_settime(fd, 0, &spec, NULL);
+
+	return addSource(fd, { eSource::Timer, handler, nullptr });
+}
+
+int Reactor::addAlarm(time_t epochTimestamp, Handler handler) {
+	int fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd == -1) {
+		return REACTOR_RETURN_FAILURE;
+	}
+
+	int id = addSource(fd, { eSource::Alarm, handler, nullptr });
+	if (id != REACTOR_RETURN_FAILURE) {
+		rearmAlarm(id, epochTimestamp);
+	}
+
+	return id;
+}
+
+int Reactor::rearmAlarm(int id, time_t epochTimestamp) {
+	struct itimerspec spec;
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_sec = epochTimestamp;
+
+	/* Alarm also fires (ECANCELED) if wall clock is set, e.g. first NTP sync, so owner can re-evaluate it */
+	return timerfd_settime(id, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &spec, NULL) == 0 ? REACTOR_RETURN_SUCCESS : REACTOR_RETURN_FAILURE;
+}
+
+int Reactor::addEvent(Handler handler) {
+	return addSource(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), { eSource::Event, handler, nullptr });
+}
+
+int Reactor::addSignals(std::initializer_list<int> signals, SignalHandler handler) {
+	sigset_t mask;
+
+	sigemptyset(&mask);
+	for (int sig : signals) {
+		sigaddset(&mask, sig);
+	}
+
+	return addSource(signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC), { eSource::Signal, nullptr, handler });
+}
+
+void Reactor::remove(int id) {
+	if (mSources.erase(id)) {
+		epoll_ctl(mEpollFd, EPOLL_CTL_DEL, id, NULL);
+		close(id);
+	}
+}
+
+void Reactor::notify(int id) {
+	uint64_t u64 = 1;
+	ssize_t ret = write(id, &u64, sizeof(u64));
+	(void)ret;
+}
+
+void Reactor::stop() {
+	notify(mStopFd);
+}
+
+void Reactor::dispatch(int fd) {
+	auto it = mSources.find(fd);
+	if (it == mSources.end()) {
+		return;
+	}
+
+	/* Copy, handler is allowed to remove its own source */
+	Source source = it->second;
+
+	switch (source.type) {
+	case eSource::Timer:
+	case eSource::Alarm:
+	case eSource::Event: {
+		uint64_t u64;
+		ssize_t ret = read(fd, &u64, sizeof(u64));
+		if (ret < 0 && errno == EAGAIN) {
+			return;
+		}
+		source.handler();
+	}
+	break;
+
+	case eSource::Signal: {
+		struct signalfd_siginfo info;
+		while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+			source.signalHandler((int)info.ssi_signo);
+		}
+	}
+	break;
+
+	default:
+	break;
+	}
+}
+
+int Reactor::run() {
+	struct epoll_event events[REACTOR_MAX_EVENTS];
+
+	while (1) {
+		int nbEvents = epoll_wait(mEpollFd, events, REACTOR_MAX_EVENTS, -1);
+		if (nbEvents < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return REACTOR_RETURN_FAILURE;
+		}
+
+		for (int id = 0; id < nbEvents; ++id) {
+			if (events[id].data.fd == mStopFd) {
+				LOCAL_DBG("[REACTOR] Stop\n");
+				uint64_t u64;
+				ssize_t ret = read(mStopFd, &u64, sizeof(u64));
+				(void)ret;
+				return REACTOR_RETURN_SUCCESS;
+			}
+			dispatch(events[id].data.fd);
+		}
+	}
+
+	return REACTOR_RETURN_SUCCESS;
+}
@@ -0,0 +1,68 @@
+/*
+    Single threaded epoll reactor:
+        - timerfd   : periodic timers (CLOCK_MONOTONIC) and wall-clock alarms (CLOCK_REALTIME)
+        - eventfd   : wake-up from other threads (e.g. encoder sample arrival)
+        - signalfd  : synchronous signal handling, no code runs in signal context
+
+    All handlers run in the thread calling run(). Only notify() and stop() may be
+    called from other threads.
+*/
+#ifndef __REACTOR_H
+#define __REACTOR_H
+
+#include <stdint.h>
+#include <time.h>
+#include <map>
+#include <functional>
+#include <initializer_list>
+
+#define REACTOR_MAX_EVENTS                  (16)
+
+#define REACTOR_RETURN_SUCCESS              (0)
+#define REACTOR_RETURN_FAILURE              (-1)
+
+class Reactor {
+public:
+    typedef std::function<void()> Handler;
+    typedef std::function<void(int)> SignalHandler;
+
+    Reactor();
+    ~Reactor();
+
+    int addPeriodicTimer(uint32_t intervalInSecs, Handler handler);
+    int addAlarm(time_t epochTimestamp, Handler handler);
+    int rearmAlarm(int id, time_t epochTimestamp);
+    int addEvent(Handler handler);
+    int addSignals(std::initializer_list<int> signals, SignalHandler handler);
+    void remove(int id);
+
+    void notify(int id);
+    int run();
+    void stop();
+
+    /* MUST-BE called before any thread is created, so that signals are only delivered by signalfd */
+    static void blockSignals(std::initializer_list<int> signals);
+
+private:
+    enum class eSource {
+        Timer,
+        Alarm,
+        Event,
+        Signal,
+    };
+
+    typedef struct {
+        eSource type;
+        Handler handler;
+        SignalHandler signalHandler;
+    } Source;
+
+    int mEpollFd = -1;
+    int mStopFd = -1;
+    std::map<int, Source> mSources;
+
+    int addSource(int fd, Source source);
+    void dispatch(int fd);
+};
+
+#endif /* __REACTOR_H */
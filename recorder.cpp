@@ -2,9 +2,15 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/statfs.h>
+#include <string.h>
 #include <iostream>
+#include <algorithm>
 
 #include "recorder.h"
+#include "recordercore.h"
+#include "annexb.h"
+#include "vfs.h"
+#include "crc32c.h"
 #include "utils.hpp"
 
 
@@ -19,150 +25,685 @@
 uint32_t Recorder::startTimestamp = 0;
 uint32_t Recorder::endTimestamp = 0;
 
-Recorder::Recorder(std::string pathToRecords,
-                   eType type, 
-                   eOption option,
-                   int durationInSecs)
+std::shared_ptr<Recorder> Recorder::create(std::string pathToRecords,
+                                           eType type, 
+                                           eOption option,
+                                           int durationInSecs)
 {
+    if (type == eType::Video) {
+        if (option == eOption::Motion) {
+            return std::make_shared<RecorderCore<H264Track, MotionSegment>>(pathToRecords, durationInSecs);
+        }
+        return std::make_shared<RecorderCore<H264Track, FullSegment>>(pathToRecords, durationInSecs);
+    }
+
+    if (option == eOption::Motion) {
+        return std::make_shared<RecorderCore<G711Track, MotionSegment>>(pathToRecords, durationInSecs);
+    }
+    return std::make_shared<RecorderCore<G711Track, FullSegment>>(pathToRecords, durationInSecs);
+}
+
+Recorder::Recorder(std::string pathToRecords, uint8_t trackMask, int durationInSecs) : mTrackMask(trackMask) {
     this->pathToRecords.assign(pathToRecords);
-    this->mType = type;
-    this->mOption = option;
     this->mDurationInSecs = durationInSecs;
-
-    this->mExtension += (mOption == eOption::Motion) ? "_mdt" : "";
-    this->mExtension += (mType == eType::Video)      ? FILE_VIDEO_RECORD_TEMPORARY : FILE_AUDIO_RECORD_TEMPORARY;
+    this->writePolicy = CardProfiler::getDefaultPolicy();
+    this->mPolicy = this->writePolicy;
+    memset(&mResumed, 0, sizeof(mResumed));
+    memset(&mResumedKeyframe, 0, sizeof(mResumedKeyframe));
+    mResumedKeyframe.offset = UINT32_MAX;
 }
 
 Recorder::~Recorder() {
+    closeTarget();
+    clearTarget();
+}
+
+size_t H264Track::findSplitOffset(const uint8_t *sample, size_t totalSample, uint64_t) {
+    AnnexBNal nal;
+    size_t from = 0;
+    size_t unitStart = RECORD_NO_SPLIT;
+
+    while (findNextNal(sample, totalSample, from, nal)) {
+        if (nal.type == NAL_TYPE_IDR) {
+            return (unitStart != RECORD_NO_SPLIT) ? unitStart : nal.offset;
+        }
+
+        if (NAL_IS_SLICE(nal.type)) {
+            unitStart = RECORD_NO_SPLIT;
+        }
+        else if (unitStart == RECORD_NO_SPLIT && (nal.type == NAL_TYPE_AUD || nal.type == NAL_TYPE_SPS || 
+                                                  nal.type == NAL_TYPE_PPS || nal.type == NAL_TYPE_SEI)) {
+            unitStart = nal.offset;
+        }
+        from = nal.header + 1;
+    }
 
+    return RECORD_NO_SPLIT;
 }
 
-int Recorder::getStart() {
-    int fd = -1;
-    std::tm tm;
-    std::string fmt = FILE_RECORD_STRING_FORMAT + mExtension;
+size_t H264Track::findTailOffset(const uint8_t *tail, size_t totalTail, uint64_t) {
+    AnnexBNal nal;
+    size_t from = 0;
+    size_t unitStart = RECORD_NO_SPLIT;
+    size_t lastUnit = RECORD_NO_SPLIT;
 
-    if (Recorder::startTimestamp == 0) {
-        Recorder::startTimestamp = getCurrentEpochTimestamp();
-        Recorder::endTimestamp = mLastTimestampUpdated = Recorder::startTimestamp;
+    while (findNextNal(tail, totalTail, from, nal)) {
+        if (NAL_IS_SLICE(nal.type)) {
+            if (isFirstSliceOfPicture(tail, totalTail, nal)) {
+                lastUnit = (unitStart != RECORD_NO_SPLIT) ? unitStart : nal.offset;
+            }
+            unitStart = RECORD_NO_SPLIT;
+        }
+        else if (unitStart == RECORD_NO_SPLIT && (nal.type == NAL_TYPE_AUD || nal.type == NAL_TYPE_SPS || 
+                                                  nal.type == NAL_TYPE_PPS || nal.type == NAL_TYPE_SEI)) {
+            unitStart = nal.offset;
+        }
+        from = nal.header + 1;
     }
-	epochToUTCTime(startTimestamp, tm);
 
-    fmt = sprintfString(fmt, 
-                        tm.tm_year, tm.tm_mon, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
-                        Recorder::startTimestamp, 
-                        Recorder::endTimestamp);
+    /* Access unit whose slices never came is cut as well */
+    return (unitStart != RECORD_NO_SPLIT) ? unitStart : lastUnit;
+}
 
-    mTarget.assign(pathToRecords + "/" + fmt);
+int Recorder::trimInterrupted(int dirFd, const char *name, eType type, const ChunkDesc *lastChunk,
+                              const AesCtr *cipher, uint64_t nonce)
+{
+    size_t tailScanSize = (type == eType::Video) ? H264Track::tailScanSize : G711Track::tailScanSize;
+    std::vector<uint8_t> buffer;
+    struct stat fStat;
+    int ret = RECORD_RETURN_FAILURE;
 
+    int fd = getFileSystem().openat(dirFd, name, O_RDWR);
+    if (fd == -1) {
+        return ret;
+    }
 
-    try {
-        fd = open(mTarget.c_str(), O_RDWR | O_CREAT | O_APPEND, 0666);
-        if (fd == -1) {
-            mTarget.clear();
-            return RECORD_RETURN_FAILURE;
+    uint64_t chunkEnd = lastChunk ? (uint64_t)lastChunk->offset + lastChunk->length : 0;
+    if (getFileSystem().fstat(fd, &fStat) != 0 || (uint64_t)fStat.st_size < chunkEnd) {
+        getFileSystem().close(fd);
+        return ret;
+    }
+    uint64_t size = (uint64_t)fStat.st_size;
+
+    /* Plaintext video begins with a start code, ciphertext doesn't: record is resumed the way it was written */
+    if (type == eType::Video) {
+        uint8_t head[4];
+        if (getFileSystem().pread(fd, head, sizeof(head), 0) != (ssize_t)sizeof(head)) {
+            getFileSystem().close(fd);
+            return ret;
+        }
+        if (cipher) {
+            cipher->apply(nonce, 0, head, sizeof(head));
+        }
+        if (!hasStartCode(head, sizeof(head))) {
+            LOCAL_DBG("[RESUME] %s: encryption mismatched\n", name);
+            getFileSystem().close(fd);
+            return ret;
         }
     }
-    catch (const std::exception &e) {
-        std::cout << e.what() << std::endl;
-	}
 
-    close(fd);
+    /* Journal is written after the data, the last chunk it knows must be intact */
+    if (lastChunk) {
+        buffer.resize(lastChunk->length);
+        if (getFileSystem().pread(fd, buffer.data(), buffer.size(), lastChunk->offset) != (ssize_t)buffer.size() ||
+            crc32c(CRC32C_INIT, buffer.data(), buffer.size()) != lastChunk->crc)
+        {
+            LOCAL_DBG("[RESUME] %s: chunk at %u mismatched\n", name, lastChunk->offset);
+            getFileSystem().close(fd);
+            return ret;
+        }
+    }
+
+    /* Complete frames are only looked for past the journaled chunks */
+    uint64_t tailOffset = std::max(size > tailScanSize ? size - tailScanSize : 0, chunkEnd);
+    buffer.resize((size_t)(size - tailOffset));
+    if (getFileSystem().pread(fd, buffer.data(), buffer.size(), (off_t)tailOffset) == (ssize_t)buffer.size()) {
+        if (cipher) {
+            cipher->apply(nonce, tailOffset, buffer.data(), buffer.size());
+        }
+        size_t length = (type == eType::Video) ? H264Track::findTailOffset(buffer.data(), buffer.size(), tailOffset) : 
+                                                 G711Track::findTailOffset(buffer.data(), buffer.size(), tailOffset);
+        uint64_t trimmedSize = tailOffset + length;
+
+        if (length != RECORD_NO_SPLIT && trimmedSize > 0 &&
+            (trimmedSize == size || getFileSystem().ftruncate(fd, (off_t)trimmedSize) == 0))
+        {
+            LOCAL_DBG("[RESUME] %s: %lu bytes trimmed\n", name, (unsigned long)(size - trimmedSize));
+            getFileSystem().fsync(fd);
+            ret = RECORD_RETURN_SUCCESS;
+        }
+    }
+    getFileSystem().close(fd);
+
+    return ret;
+}
+
+void Recorder::resumeRecord(const RecordDesc &desc, uint32_t chunkOffset, uint64_t nonce, const ChunkDesc *lastKeyframe) {
+    mResumed = desc;
+    mResumedChunkOffset = chunkOffset;
+    mResumedNonce = nonce;
+    mResumedKeyframe.offset = UINT32_MAX;
+    if (lastKeyframe != nullptr) {
+        mResumedKeyframe = *lastKeyframe;
+    }
+}
+
+int Recorder::openRecord(const char *fileName, const RecordDesc &desc, bool isResumed) {
+    /* Write into RAM staging tier if it can absorb one more record, a resumed one is already on SD Card */
+    std::string directory = pathToRecords;
+    mStaged = false;
+    if (stagingTier && stagingTier->hasRoom() && !isResumed) {
+        directory = stagingTier->toStagingPath(pathToRecords);
+        mStaged = (directory != pathToRecords);
+        createDirectories(directory.c_str());
+    }
+
+    setTarget(directory, fileName);
+    mPolicy = writePolicy;
+    mCipher = cipher;
+    mNonce = isResumed ? mResumedNonce : AesCtr::makeNonce();
+
+    if (openTarget() != RECORD_RETURN_SUCCESS) {
+        clearTarget();
+        return RECORD_RETURN_FAILURE;
+    }
+
+    struct stat fStat;
+    uint32_t size = (getFileSystem().fstat(mFd, &fStat) == 0) ? (uint32_t)fStat.st_size : 0;
+    mChunkOffset = size;
+    mChunkLength = 0;
+    mChunkCrc = CRC32C_INIT;
+    mGapLength = 0;
+    mStreamBytes = 0;
+    mPending.clear();
+    releaseHeldFrames();
+    mPreallocEnd = size;
+
+    /* Resumed record continues its last chunk, bytes written after the journal are read back once */
+    if (isResumed && mResumedChunkOffset <= size) {
+        std::vector<uint8_t> tail(size - mResumedChunkOffset);
+
+        if (getFileSystem().pread(mFd, tail.data(), tail.size(), mResumedChunkOffset) == (ssize_t)tail.size()) {
+            mChunkOffset = mResumedChunkOffset;
+            updateChunkCrc(tail.data(), tail.size());
+            mStreamBytes = size;
+        }
+    }
+
+    /* Frame numbers of a resumed video go on from its last keyframe, pictures after it are counted again */
+    mFrameCount = 0;
+    mUnitStart = UINT32_MAX;
+    mIsKeyframeIndexed = !isResumed;
+    if (isResumed && mTrackMask == RECORD_TRACK_VIDEO && mResumedKeyframe.offset < size) {
+        std::vector<uint8_t> tail(size - mResumedKeyframe.offset);
+
+        if (getFileSystem().pread(mFd, tail.data(), tail.size(), mResumedKeyframe.offset) == (ssize_t)tail.size()) {
+            if (mCipher) {
+                mCipher->apply(mNonce, mResumedKeyframe.offset, tail.data(), tail.size());
+            }
+            mFrameCount = mResumedKeyframe.length;
+            indexPictures(tail.data(), tail.size(), false);
+            mUnitStart = UINT32_MAX;
+            mIsKeyframeIndexed = true;
+        }
+    }
+    mResumedKeyframe.offset = UINT32_MAX;
+
+    mLastSyncTimestamp = getCurrentEpochTimestamp();
+    if (silenceDetector) {
+        silenceDetector->reset();
+    }
+
+    if (segmentIndex) {
+        RecordDesc openDesc = desc;
+        openDesc.sizeInBytes = size;
+        openDesc.flags = mCipher ? (desc.flags | RECORD_FLAG_ENCRYPTED) : (desc.flags & ~RECORD_FLAG_ENCRYPTED);
+        segmentIndex->append(SegmentIndex::eEntry::Open, openDesc);
+
+        /* A resumed record goes on with the nonce already journaled */
+        if (mCipher && !isResumed) {
+            ChunkDesc nonce = { desc.startTimestamp, (uint32_t)(mNonce >> 32), (uint32_t)mNonce, 0 };
+            segmentIndex->appendChunk(SegmentIndex::eEntry::Nonce, mTrackMask, nonce);
+        }
+    }
 
     LOCAL_DBG("[START] Instance: %s\n", mTarget.c_str());
 
     return RECORD_RETURN_SUCCESS;
 }
 
-int Recorder::getStop() {
+int Recorder::closeRecord(const RecordDesc &desc) {
     int ret = RECORD_RETURN_FAILURE;
-    const std::string stSearch = std::string(".tmp");
-    std::string targetRename = mTarget;
-
-    if (!targetRename.empty()) {
-        size_t pos = targetRename.find(stSearch);
-        if (pos != std::string::npos) {
-            targetRename.erase(pos, stSearch.length());
-
-            try {
-                if (rename(mTarget.c_str(), targetRename.c_str()) == 0) {
-                    LOCAL_DBG("[STOP] Rename %s to %s\n", mTarget.c_str(), targetRename.c_str());
-                    ret = RECORD_RETURN_SUCCESS;
-                }
-            }
-            catch (const std::exception &e) {
-                std::cout << e.what() << std::endl;
-            }
-            
-            mTarget.clear();
+    char completedName[NAME_MAX + 1];
+
+    /* Coalesced samples go first, the record may move out of staging tier on the way */
+    flushPending();
+    closeTarget();
+
+    /* "desc" was described before coalesced samples were written */
+    RecordDesc closed = desc;
+    closed.sizeInBytes = mChunkOffset + mChunkLength;
+
+    const char *name = mTarget.c_str() + mNamePos;
+    size_t nameLength = strlen(name), suffixLength = strlen(RECORD_TEMPORARY_SUFFIX);
+    if (nameLength <= suffixLength || strcmp(name + nameLength - suffixLength, RECORD_TEMPORARY_SUFFIX) != 0) {
+        clearTarget();
+        return ret;
+    }
+    snprintf(completedName, sizeof(completedName), "%.*s", (int)(nameLength - suffixLength), name);
+
+    flushChunkCrc();
+    flushGap();
+
+    try {
+        IOScheduler::Ticket ticket(getCardScheduler(), IOScheduler::eClass::LiveWrite);
+        if (getFileSystem().renameat(mDirFd, name, mDirFd, completedName) == 0) {
+            LOCAL_DBG("[STOP] Rename %s to %s\n", mTarget.c_str(), completedName);
+            ret = RECORD_RETURN_SUCCESS;
         }
     }
+    catch (const std::exception &e) {
+        std::cout << e.what() << std::endl;
+    }
+
+    if (ret == RECORD_RETURN_SUCCESS && segmentIndex) {
+        segmentIndex->append(SegmentIndex::eEntry::Close, closed);
+    }
 
-    Recorder::startTimestamp = 0;
+    /* Day folder is the last component of pathToRecords */
+    if (ret == RECORD_RETURN_SUCCESS && storageSummary) {
+        storageSummary->addRecord(pathToRecords.substr(pathToRecords.rfind('/') + 1), closed);
+    }
+
+    if (ret == RECORD_RETURN_SUCCESS && mStaged) {
+        stagingTier->submit(mTarget.substr(0, mNamePos) + completedName, pathToRecords + "/" + completedName);
+    }
+
+    clearTarget();
 
     return ret;
 }
 
-int Recorder::getStorage(uint8_t *sample, size_t totalSample) {
-	int ret = RECORD_RETURN_FAILURE, fd = -1;
-    ssize_t nbBytes = 0;
+void Recorder::renameRecord(const char *fileName) {
+    IOScheduler::Ticket ticket(getCardScheduler(), IOScheduler::eClass::LiveWrite);
+
+    /* Once per second, neither path walk nor allocation (capacity of mTarget is reserved) */
+    getFileSystem().renameat(mDirFd, mTarget.c_str() + mNamePos, mDirFd, fileName);
+    mTarget.replace(mNamePos, std::string::npos, fileName);
+}
+
+void Recorder::setTarget(const std::string &directory, const char *fileName) {
+    clearTarget();
+
+    mDirFd = getFileSystem().open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    mTarget.reserve(directory.size() + 1 + NAME_MAX);
+    mTarget.assign(directory).append("/").append(fileName);
+    mNamePos = directory.size() + 1;
+}
+
+void Recorder::clearTarget() {
+    if (mDirFd != -1) {
+        getFileSystem().close(mDirFd);
+        mDirFd = -1;
+    }
+
+    mTarget.clear();
+    mNamePos = 0;
+}
+
+int Recorder::openTarget() {
+    try {
+        IOScheduler::Ticket ticket(getCardScheduler(), IOScheduler::eClass::LiveWrite);
+        mFd = getFileSystem().openat(mDirFd, mTarget.c_str() + mNamePos, O_RDWR | O_CREAT | O_APPEND, 0666);
+    }
+    catch (const std::exception &e) {
+        std::cout << e.what() << std::endl;
+    }
+
+    if (mFd == -1) {
+        LOCAL_DBG("[STORAGE] Open : %s\n", mTarget.c_str());
+        return RECORD_RETURN_FAILURE;
+    }
+
+    return RECORD_RETURN_SUCCESS;
+}
+
+void Recorder::closeTarget() {
+    if (mFd == -1) {
+        return;
+    }
+
+    try {
+        IOScheduler::Ticket ticket(getCardScheduler(), IOScheduler::eClass::LiveWrite);
+
+        /* Give back clusters preallocated past the end of record */
+        uint64_t size = (uint64_t)mChunkOffset + mChunkLength;
+        if (mPreallocEnd > size) {
+            getFileSystem().ftruncate(mFd, (off_t)size);
+        }
+        getFileSystem().fsync(mFd);
+    }
+    catch (const std::exception &e) {
+        std::cout << e.what() << std::endl;
+    }
+
+    getFileSystem().close(mFd);
+    mFd = -1;
+    mPreallocEnd = 0;
+}
+
+bool Recorder::isSyncDue() {
+    return getCurrentEpochTimestamp() - mLastSyncTimestamp >= mPolicy.syncIntervalInSecs;
+}
+
+ssize_t Recorder::writeSample(const struct iovec *iov, int iovcnt, size_t totalSample) {
+    ssize_t nbBytes = -1;
+
+    if (mFd == -1 && openTarget() != RECORD_RETURN_SUCCESS) {
+        return -1;
+    }
 
     try {
-        fd = open(mTarget.c_str(), O_RDWR | O_APPEND, 0666);
-        if (fd == -1) {
-            LOCAL_DBG("[STORAGE] Open : %s\n", mTarget.c_str());
-            return RECORD_RETURN_FAILURE;
+        IOScheduler::Ticket ticket(getCardScheduler(), IOScheduler::eClass::LiveWrite, totalSample);
+
+        /* Clusters are reserved ahead in one go rather than allocated per write */
+        uint64_t size = (uint64_t)mChunkOffset + mChunkLength;
+        if (mPolicy.preallocSize > 0 && size + totalSample > mPreallocEnd) {
+            off_t len = (off_t)(totalSample + mPolicy.preallocSize);
+            if (getFileSystem().fallocate(mFd, FALLOC_FL_KEEP_SIZE, (off_t)size, len) == 0) {
+                mPreallocEnd = size + len;
+            }
+            else {
+                mPolicy.preallocSize = 0;
+            }
         }
 
-        nbBytes = write(fd, sample, totalSample);
-        fsync(fd);
+        nbBytes = getFileSystem().writev(mFd, iov, iovcnt);
+        if (mPolicy.syncIntervalInSecs == 0) {
+            getFileSystem().fsync(mFd);
+        }
+        else if (isSyncDue()) {
+            getFileSystem().fdatasync(mFd);
+            mLastSyncTimestamp = getCurrentEpochTimestamp();
+        }
     }
     catch (const std::exception &e) {
         std::cout << e.what() << std::endl;
 	}
 
-    close(fd);
+    /* Reopen on next write, e.g. card has been remounted */
+    if (nbBytes <= 0) {
+        closeTarget();
+    }
 
-	if (nbBytes > 0) {
-        updateLastTimestampRecord();
-		ret = RECORD_RETURN_SUCCESS;
-	}
+    return nbBytes;
+}
 
-    return ret;
+ssize_t Recorder::writeRecord(uint8_t *sample, size_t totalSample) {
+    /* Gap is journaled at the end of written bytes, held frames go before the sample */
+    if (mGapLength > 0 || mNbHeldFrames > 0) {
+        if (flushPending() < 0) {
+            return -1;
+        }
+        flushGap();
+    }
+
+    /* Samples of the encoder aren't touched, encryption is done in the write buffer */
+    if (mPolicy.flushSize == 0 && !mCipher) {
+        struct iovec iov = { sample, totalSample };
+        return writeThrough(&iov, 1, totalSample);
+    }
+
+    mPending.insert(mPending.end(), sample, sample + totalSample);
+    if (mPending.size() >= mPolicy.flushSize || isSyncDue()) {
+        if (flushPending() < 0) {
+            return -1;
+        }
+    }
+
+    return (ssize_t)totalSample;
 }
 
-void Recorder::updateLastTimestampRecord() {
-	std::string replacementString = std::to_string(endTimestamp);
-    auto strings = splitString(mTarget, '_');
-   
-    if (!IS_FORMAT_PARSED_VALID(strings.size())) {
-        return;
+ssize_t Recorder::writeFrame(FrameRef &&frame, size_t offset) {
+    size_t totalSample = frame.getSize() - offset;
+
+    if (mGapLength > 0) {
+        if (flushPending() < 0) {
+            return -1;
+        }
+        flushGap();
+    }
+
+    /* Slab is owned, it's encrypted in place with key stream at the offset it's written to */
+    if (mCipher) {
+        uint64_t position = (uint64_t)mChunkOffset + mChunkLength + mPending.size() + mHeldBytes;
+        mCipher->apply(mNonce, position, frame.getData() + offset, totalSample);
     }
 
-    if (mLastTimestampUpdated != Recorder::endTimestamp) {
-        mLastTimestampUpdated = Recorder::endTimestamp;
-        strings[2].assign(std::to_string(mLastTimestampUpdated));
-        
-        std::string targetRename = strings[0] + "_" + strings[1] + "_" + strings[2] + mExtension;
-        rename(mTarget.c_str(), targetRename.c_str());
-        mTarget.assign(targetRename);
+    mHeldFrames[mNbHeldFrames].frame = std::move(frame);
+    mHeldFrames[mNbHeldFrames].offset = offset;
+    ++mNbHeldFrames;
+    mHeldBytes += totalSample;
+
+    /* Held frames are written in one go, the slabs go back to the pool right after */
+    if (mNbHeldFrames == RECORD_HELD_FRAMES || mPending.size() + mHeldBytes >= mPolicy.flushSize || isSyncDue()) {
+        if (flushPending() < 0) {
+            return -1;
+        }
     }
+
+    return (ssize_t)totalSample;
 }
 
-std::string Recorder::getCurrentInstance() {
-    return mTarget;
+int Recorder::flushPending() {
+    if (mPending.empty() && mNbHeldFrames == 0) {
+        return 0;
+    }
+
+    struct iovec iov[1 + RECORD_HELD_FRAMES];
+    int iovcnt = 0;
+
+    /* In place, key stream at end of written bytes */
+    if (!mPending.empty()) {
+        if (mCipher) {
+            mCipher->apply(mNonce, (uint64_t)mChunkOffset + mChunkLength, mPending.data(), mPending.size());
+        }
+        iov[iovcnt].iov_base = mPending.data();
+        iov[iovcnt].iov_len = mPending.size();
+        ++iovcnt;
+    }
+
+    for (uint32_t id = 0; id < mNbHeldFrames; ++id) {
+        iov[iovcnt].iov_base = mHeldFrames[id].frame.getData() + mHeldFrames[id].offset;
+        iov[iovcnt].iov_len = mHeldFrames[id].frame.getSize() - mHeldFrames[id].offset;
+        ++iovcnt;
+    }
+
+    ssize_t nbBytes = writeThrough(iov, iovcnt, mPending.size() + mHeldBytes);
+    mPending.clear();
+    releaseHeldFrames();
+
+    return (nbBytes > 0) ? 0 : -1;
+}
+
+void Recorder::releaseHeldFrames() {
+    for (uint32_t id = 0; id < mNbHeldFrames; ++id) {
+        mHeldFrames[id].frame.release();
+    }
+    mNbHeldFrames = 0;
+    mHeldBytes = 0;
 }
 
-bool Recorder::isCompleted() {
-    bool ret = false;
-    auto strings = splitString(mTarget, '_');
-    auto startTimestamp = (uint32_t)stoi(strings[1]);
-    auto stopTimestamp = (uint32_t)stoi(strings[2]);
-    auto durationInSecs = (int)(stopTimestamp - startTimestamp);
+/* Drops the first nbBytes of the buffers */
+static void consumeIov(std::vector<struct iovec> &iov, size_t nbBytes) {
+    size_t id = 0;
+    while (id < iov.size() && nbBytes >= iov[id].iov_len) {
+        nbBytes -= iov[id].iov_len;
+        ++id;
+    }
+    iov.erase(iov.begin(), iov.begin() + id);
 
-    if (durationInSecs >= mDurationInSecs && stopTimestamp == Recorder::endTimestamp) {
-        ret = true;
+    if (!iov.empty()) {
+        iov[0].iov_base = (uint8_t *)iov[0].iov_base + nbBytes;
+        iov[0].iov_len -= nbBytes;
     }
+}
 
-    return ret;
+ssize_t Recorder::writeThrough(const struct iovec *iov, int iovcnt, size_t totalSample) {
+    if (!mStaged) {
+        ssize_t nbBytes = writeSample(iov, iovcnt, totalSample);
+        if (nbBytes > 0) {
+            updateChunkCrc(iov, iovcnt, nbBytes);
+        }
+        return nbBytes;
+    }
+
+    /* Arena is reserved before the write, tmpfs itself is as large as RAM */
+    size_t written = 0;
+    if (stagingTier->reserve(totalSample)) {
+        ssize_t nbBytes = writeSample(iov, iovcnt, totalSample);
+        written = (nbBytes > 0) ? (size_t)nbBytes : 0;
+        stagingTier->account((int64_t)written - (int64_t)totalSample);
+        updateChunkCrc(iov, iovcnt, written);
+    }
+    if (written == totalSample) {
+        return (ssize_t)written;
+    }
+
+    /* RAM staging tier is full -> Continue on SD Card past the staged part, which
+       is written in place by the background flusher */
+    std::string stagedPath = mTarget;
+    std::string fileName = mTarget.substr(mNamePos);
+    off_t stagedSize = (off_t)mChunkOffset + mChunkLength;
+    closeTarget();
+    setTarget(pathToRecords, fileName.c_str());
+    mStaged = false;
+
+    if (openTarget() == RECORD_RETURN_SUCCESS &&
+        getFileSystem().ftruncate(mFd, stagedSize) == 0 &&
+        stagingTier->handOver(stagedPath, mTarget) == STAGING_RETURN_SUCCESS)
+    {
+        LOCAL_DBG("[STORAGE] Staging full, continue on %s\n", mTarget.c_str());
+        std::vector<struct iovec> rest(iov, iov + iovcnt);
+        consumeIov(rest, written);
+        ssize_t nbBytes = writeSample(rest.data(), (int)rest.size(), totalSample - written);
+        if (nbBytes > 0) {
+            updateChunkCrc(rest.data(), (int)rest.size(), nbBytes);
+            written += nbBytes;
+        }
+    }
+    else {
+        /* Staged part stays the record, the rest of the sample is lost */
+        closeTarget();
+        getFileSystem().unlinkat(mDirFd, fileName.c_str(), 0);
+        setTarget(stagedPath.substr(0, mNamePos - 1), fileName.c_str());
+        mStaged = true;
+        stagingTier->setOverflow();
+    }
+
+    return (written > 0) ? (ssize_t)written : -1;
+}
+
+void Recorder::skipRecord(size_t totalSample) {
+    mGapLength += totalSample;
+}
+
+/*  Pictures are counted the way the playback reader splits access units. The access unit
+    with an IDR slice is journaled with its frame number, so the reader seeks from the
+    journal rather than parsing the whole record.
+*/
+void Recorder::indexPictures(const uint8_t *sample, size_t totalSample, bool isJournaled) {
+    uint32_t sampleOffset = mChunkOffset + mChunkLength + (uint32_t)(mPending.size() + mHeldBytes);
+    AnnexBNal nal;
+    size_t from = 0;
+
+    while (findNextNal(sample, totalSample, from, nal)) {
+        if (NAL_IS_SLICE(nal.type)) {
+            if (isFirstSliceOfPicture(sample, totalSample, nal)) {
+                if (nal.type == NAL_TYPE_IDR && isJournaled) {
+                    ChunkDesc keyframe;
+                    keyframe.startTimestamp = mRecordStartTimestamp;
+                    keyframe.offset         = (mUnitStart != UINT32_MAX) ? mUnitStart : sampleOffset + (uint32_t)nal.offset;
+                    keyframe.length         = mFrameCount;
+                    keyframe.crc            = 0;
+                    segmentIndex->appendChunk(SegmentIndex::eEntry::Keyframe, mTrackMask, keyframe);
+                }
+                ++mFrameCount;
+            }
+            mUnitStart = UINT32_MAX;
+        }
+        else if (mUnitStart == UINT32_MAX && (nal.type == NAL_TYPE_AUD || nal.type == NAL_TYPE_SPS || 
+                                              nal.type == NAL_TYPE_PPS || nal.type == NAL_TYPE_SEI)) {
+            mUnitStart = sampleOffset + (uint32_t)nal.offset;
+        }
+        from = nal.header + 1;
+    }
+}
+
+IOScheduler *Recorder::getCardScheduler() {
+    /* Records in RAM staging tier don't touch SD Card */
+    return mStaged ? nullptr : ioScheduler.get();
+}
+
+void Recorder::updateChunkCrc(const uint8_t *sample, size_t totalSample) {
+    while (totalSample > 0) {
+        size_t len = std::min(totalSample, (size_t)(RECORD_CHUNK_SIZE - mChunkLength));
+
+        mChunkCrc = crc32c(mChunkCrc, sample, len);
+        mChunkLength += len;
+        sample += len;
+        totalSample -= len;
+
+        if (mChunkLength == RECORD_CHUNK_SIZE) {
+            flushChunkCrc();
+        }
+    }
+}
+
+void Recorder::updateChunkCrc(const struct iovec *iov, int iovcnt, size_t totalSample) {
+    for (int id = 0; id < iovcnt && totalSample > 0; ++id) {
+        size_t len = std::min(totalSample, iov[id].iov_len);
+        updateChunkCrc((const uint8_t *)iov[id].iov_base, len);
+        totalSample -= len;
+    }
+}
+
+void Recorder::flushChunkCrc() {
+    if (mChunkLength == 0) {
+        return;
+    }
+
+    if (segmentIndex) {
+        ChunkDesc chunk;
+        chunk.startTimestamp    = mRecordStartTimestamp;
+        chunk.offset            = mChunkOffset;
+        chunk.length            = mChunkLength;
+        chunk.crc               = mChunkCrc;
+        segmentIndex->appendChunk(SegmentIndex::eEntry::Chunk, mTrackMask, chunk);
+    }
+
+    mChunkOffset += mChunkLength;
+    mChunkLength = 0;
+    mChunkCrc = CRC32C_INIT;
+}
+
+void Recorder::flushGap() {
+    if (mGapLength == 0) {
+        return;
+    }
+
+    if (segmentIndex && silenceDetector) {
+        ChunkDesc gap;
+        gap.startTimestamp      = mRecordStartTimestamp;
+        gap.offset              = mChunkOffset + mChunkLength;
+        gap.length              = mGapLength;
+        gap.crc                 = silenceDetector->getSilenceByte();
+        segmentIndex->appendChunk(SegmentIndex::eEntry::Gap, RECORD_TRACK_AUDIO, gap);
+    }
+
+    mGapLength = 0;
+}
+
+const std::string &Recorder::getCurrentInstance() {
+    return mTarget;
 }
@@ -13,23 +13,43 @@
 
 #include <stdint.h>
 #include <string>
-
-#define FILE_RECORD_STRING_FORMAT           "%d%02d%02d%02d%02d%02d_%d_%d"
+#include <memory>
+#include <vector>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "segindex.h"
+#include "staging.h"
+#include "iosched.h"
+#include "thumbtrack.h"
+#include "motionbmp.h"
+#include "silence.h"
+#include "cardprofile.h"
+#include "aesctr.h"
+#include "storagesummary.h"
+#include "framepool.h"
 
 #define RECORD_TEMPORARY_SUFFIX             ".tmp"
 #define FILE_VIDEO_RECORD_EXTENSION         ".h264"
 #define FILE_AUDIO_RECORD_EXTENSION         ".g711"
 
-#define FILE_VIDEO_RECORD_TEMPORARY         FILE_VIDEO_RECORD_EXTENSION RECORD_TEMPORARY_SUFFIX
-#define FILE_AUDIO_RECORD_TEMPORARY         FILE_AUDIO_RECORD_EXTENSION RECORD_TEMPORARY_SUFFIX
+/* Every chunk of a record file is protected by a CRC32C stored in segment index */
+#define RECORD_CHUNK_SIZE                   (1024 * 1024)
+
+#define RECORD_DEFAULT_DURATION             (300)
+
+#define RECORD_NO_SPLIT                     ((size_t)-1)
+
+/* Frames a recorder holds until they're written, the pool MUST have slabs left for the encoder */
+#define RECORD_HELD_FRAMES                  (16)
 
 #define RECORD_RETURN_SUCCESS               (1)
 #define RECORD_RETURN_FAILURE               (-1)
 
-#define IS_FORMAT_PARSED_VALID(nbParsed)    (nbParsed >= 3 ? true : false)
-#define IS_MOTION_RECORD(nbParsed)          (nbParsed == 5 ? true : false)
-#define IS_FULL_RECORD(nbParsed)            (nbParsed == 4 ? true : false)
-
+/*  Runtime facade of a track recorder. The work is done by RecorderCore<Track, Segment>
+    (see recordercore.h), specialized at compile time per codec and segmentation, and
+    created by Recorder::create() from the runtime type and option.
+*/
 class Recorder {
 public:
     enum class eType {
@@ -42,31 +62,108 @@ public:
         Full,
 	};
 
-    Recorder(std::string pathToRecords,
-             eType type, 
-             eOption option, 
-             int durationInSecs = 300);
-    ~Recorder();
-
-    int getStart();
-    int getStop();
-    int getStorage(uint8_t *sample, size_t totalSample);
-    bool isCompleted();
-    std::string getCurrentInstance();
-
-private:
-	eType mType;
-    eOption mOption;
+    static std::shared_ptr<Recorder> create(std::string pathToRecords,
+                                            eType type, 
+                                            eOption option, 
+                                            int durationInSecs = RECORD_DEFAULT_DURATION);
+    virtual ~Recorder();
+
+    virtual int getStart() = 0;
+    virtual int getStop() = 0;
+    virtual int getStorage(uint8_t *sample, size_t totalSample) = 0;
+    virtual int getStorage(FrameRef frame) = 0;     /* Frame is held until it's written, no copy */
+    virtual bool isCompleted() = 0;     /* Duration reached, record splits at next boundary */
+    /* Offset in sample where getStorage() would begin the next record, RECORD_NO_SPLIT if it wouldn't */
+    virtual size_t getSplitOffset(const uint8_t *sample, size_t totalSample) = 0;
+    const std::string &getCurrentInstance();
+
+    /*  Restart recovery. trimInterrupted() checks one track of a record left interrupted
+        (".tmp") by a previous run: its last journaled chunk must still match its CRC, the
+        tail past the last complete frame is cut off. A record is only resumed with the
+        cipher and journaled nonce it was written with ("cipher" null for plaintext). After
+        resumeRecord() the next getStart() appends to that record rather than opening a new
+        one, frame numbers of its video go on from "lastKeyframe" (keyframes aren't journaled
+        any more if null).
+    */
+    static int trimInterrupted(int dirFd, const char *name, eType type, const ChunkDesc *lastChunk,
+                               const AesCtr *cipher = nullptr, uint64_t nonce = 0);
+    void resumeRecord(const RecordDesc &desc, uint32_t chunkOffset, uint64_t nonce = 0, const ChunkDesc *lastKeyframe = nullptr);
+
+protected:
+    Recorder(std::string pathToRecords, uint8_t trackMask, int durationInSecs);
+
+    const uint8_t mTrackMask;
     int mDurationInSecs;
-	std::string mExtension;
-    uint32_t mLastTimestampUpdated;
+    uint32_t mLastTimestampUpdated = 0;
 
     std::string mTarget;
+    bool mStaged = false;
+
+    uint32_t mRecordStartTimestamp = 0;
+    uint32_t mChunkOffset = 0;
+    uint32_t mChunkLength = 0;
+    uint32_t mChunkCrc = 0;
+    uint32_t mGapLength = 0;
+    uint64_t mStreamBytes = 0;          /* Written and skipped bytes of current record */
+    std::vector<uint8_t> mPending;      /* Samples not written yet, see WritePolicy::flushSize */
+    struct {
+        FrameRef frame;
+        size_t offset;                  /* Bytes of the frame before it aren't part of this record */
+    } mHeldFrames[RECORD_HELD_FRAMES];  /* Frames not written yet (already encrypted), they follow mPending */
+    uint32_t mNbHeldFrames = 0;
+    size_t mHeldBytes = 0;
+    RecordDesc mResumed;                /* Record next getStart() resumes, start timestamp 0 if none */
+    uint32_t mResumedChunkOffset = 0;   /* End of its last journaled chunk */
+    uint64_t mResumedNonce = 0;         /* Its journaled nonce, encrypted record only */
+    ChunkDesc mResumedKeyframe;         /* Its last journaled keyframe, offset UINT32_MAX if none */
+    uint32_t mFrameCount = 0;           /* Pictures of current video record */
+    uint32_t mUnitStart = UINT32_MAX;   /* Offset of access unit whose first slice hasn't come yet */
+    bool mIsKeyframeIndexed = false;    /* Frame numbers are known, keyframes are journaled */
+    std::shared_ptr<AesCtr> mCipher;    /* cipher when record was opened */
+    uint64_t mNonce = 0;                /* Key stream nonce of current record, journaled when it opens */
+
+    int openRecord(const char *fileName, const RecordDesc &desc, bool isResumed = false);
+    int closeRecord(const RecordDesc &desc);
+    void renameRecord(const char *fileName);
+    ssize_t writeRecord(uint8_t *sample, size_t totalSample);
+    ssize_t writeFrame(FrameRef &&frame, size_t offset);
+    void skipRecord(size_t totalSample);
+    void indexPictures(const uint8_t *sample, size_t totalSample, bool isJournaled);
 
-    void updateLastTimestampRecord();
+private:
+    int mFd = -1;                       /* Record stays opened until it's closed */
+    int mDirFd = -1;                    /* Directory of mTarget, renames are relative to it */
+    size_t mNamePos = 0;                /* File name in mTarget */
+    WritePolicy mPolicy;                /* writePolicy when record was opened */
+    uint32_t mLastSyncTimestamp = 0;
+    uint64_t mPreallocEnd = 0;
+
+    void setTarget(const std::string &directory, const char *fileName);
+    void clearTarget();
+    int openTarget();
+    void closeTarget();
+    bool isSyncDue();
+    ssize_t writeSample(const struct iovec *iov, int iovcnt, size_t totalSample);
+    ssize_t writeThrough(const struct iovec *iov, int iovcnt, size_t totalSample);
+    int flushPending();
+    void releaseHeldFrames();
+    IOScheduler *getCardScheduler();
+    void updateChunkCrc(const uint8_t *sample, size_t totalSample);
+    void updateChunkCrc(const struct iovec *iov, int iovcnt, size_t totalSample);
+    void flushChunkCrc();
+    void flushGap();
 
 public:
     std::string pathToRecords;
+    std::shared_ptr<SegmentIndex> segmentIndex;
+    std::shared_ptr<StagingTier> stagingTier;   /* Optional, records are written directly to SD Card if null */
+    std::shared_ptr<IOScheduler> ioScheduler;   /* Optional, I/O on SD Card is scheduled as live writes */
+    std::shared_ptr<ThumbnailTrack> thumbnailTrack; /* Optional, only for video recorder */
+    std::shared_ptr<MotionBitmap> motionBitmap;     /* Optional, only for video recorder of motion session */
+    std::shared_ptr<SilenceDetector> silenceDetector; /* Optional, only for audio recorder, needs segment index */
+    WritePolicy writePolicy;                        /* Takes effect from next record */
+    std::shared_ptr<AesCtr> cipher;                 /* Optional, records are encrypted if set, takes effect from next record */
+    std::shared_ptr<StorageSummary> storageSummary; /* Optional, totals of the day folder are updated when a record is closed */
 
     /* This variables used to synchronize timestamp between audio and video records */
     static uint32_t startTimestamp;
@@ -0,0 +1,287 @@
+/*
+    Compile-time specialized recorder core.
+
+    RecorderCore<Track, Segment> is instantiated once per codec and segmentation, names,
+    limits and record description are constants of the policies, so nothing is decided
+    per sample at runtime.
+
+    Track policy:
+        extension           Record file extension
+        trackMask           RECORD_TRACK_*
+        leadsSplit          Track splits at its own duration, others follow its segment
+        splitGraceInSecs    Longest wait for a boundary past the duration, then split anyway
+        findSplitOffset()   Offset in sample where next record may begin, RECORD_NO_SPLIT if none
+        tailScanSize        Bytes read back from the end of an interrupted record
+        findTailOffset()    Length of the complete frames in that tail, RECORD_NO_SPLIT if none
+
+    Segment policy:
+        suffix, type, flags Name suffix and record description of the session kind
+
+    Video (H.264) is the leader, it splits on the first keyframe access unit past the
+    duration, so every record begins decodable. Audio (G.711) follows the segment the
+    video opened, it cuts on a fixed-frame boundary, the sample is split if needed.
+    A resumed video record goes on at a keyframe too, samples before it are dropped.
+*/
+#ifndef __RECORDERCORE_H
+#define __RECORDERCORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <ctime>
+
+#include "recorder.h"
+#include "utils.hpp"
+#include "timefmt.h"
+
+#define RECORD_VIDEO_SPLIT_GRACE            (10)    /* Longest GOP waited for */
+#define RECORD_AUDIO_SPLIT_GRACE            (15)    /* Split on its own when there's no video */
+#define RECORD_G711_FRAME_SIZE              (160)   /* 20ms at 8 kHz */
+#define RECORD_H264_TAIL_SCAN_SIZE          (512 * 1024)    /* Largest access unit expected */
+
+struct H264Track {
+    static constexpr const char *extension      = FILE_VIDEO_RECORD_EXTENSION;
+    static constexpr uint8_t trackMask          = RECORD_TRACK_VIDEO;
+    static constexpr bool leadsSplit            = true;
+    static constexpr uint32_t splitGraceInSecs  = RECORD_VIDEO_SPLIT_GRACE;
+    static constexpr size_t tailScanSize        = RECORD_H264_TAIL_SCAN_SIZE;
+
+    /* First NAL (AUD/SPS/PPS/SEI or the slice itself) of the access unit with an IDR slice */
+    static size_t findSplitOffset(const uint8_t *sample, size_t totalSample, uint64_t bytesInRecord);
+
+    /* First NAL of the last access unit, it may have been cut by the interruption */
+    static size_t findTailOffset(const uint8_t *tail, size_t totalTail, uint64_t tailOffset);
+};
+
+struct G711Track {
+    static constexpr const char *extension      = FILE_AUDIO_RECORD_EXTENSION;
+    static constexpr uint8_t trackMask          = RECORD_TRACK_AUDIO;
+    static constexpr bool leadsSplit            = false;
+    static constexpr uint32_t splitGraceInSecs  = RECORD_AUDIO_SPLIT_GRACE;
+    static constexpr size_t frameSize           = RECORD_G711_FRAME_SIZE;
+    static constexpr size_t tailScanSize        = RECORD_G711_FRAME_SIZE;
+
+    static size_t findSplitOffset(const uint8_t *, size_t totalSample, uint64_t bytesInRecord) {
+        size_t offset = (frameSize - (size_t)(bytesInRecord % frameSize)) % frameSize;
+        return (offset <= totalSample) ? offset : RECORD_NO_SPLIT;
+    }
+
+    static size_t findTailOffset(const uint8_t *, size_t totalTail, uint64_t tailOffset) {
+        size_t partial = (size_t)((tailOffset + totalTail) % frameSize);
+        return (partial <= totalTail) ? totalTail - partial : RECORD_NO_SPLIT;
+    }
+};
+
+struct FullSegment {
+    static constexpr const char *suffix         = "";
+    static constexpr uint8_t type               = RECORD_TYPE_FULL;
+    static constexpr uint8_t flags              = 0;
+};
+
+struct MotionSegment {
+    static constexpr const char *suffix         = "_mdt";
+    static constexpr uint8_t type               = RECORD_TYPE_MOTION;
+    static constexpr uint8_t flags              = RECORD_FLAG_MOTION;
+};
+
+template <typename Track, typename Segment>
+class RecorderCore : public Recorder {
+public:
+    RecorderCore(std::string pathToRecords, int durationInSecs)
+        : Recorder(pathToRecords, Track::trackMask, durationInSecs) { }
+
+    int getStart() override {
+        /* Resumed record is the shared segment, the other track resumes it too */
+        bool isResumed = (mResumed.startTimestamp != 0 && mResumed.startTimestamp == Recorder::startTimestamp);
+        uint32_t resumedEndTimestamp = mResumed.endTimestamp;
+        mResumed.startTimestamp = 0;
+
+        if (Recorder::startTimestamp == 0) {
+            Recorder::startTimestamp = getCurrentEpochTimestamp();
+            Recorder::endTimestamp = Recorder::startTimestamp;
+        }
+        formatCompact(Recorder::startTimestamp, mDatePrefix, sizeof(mDatePrefix));
+
+        mRecordStartTimestamp = Recorder::startTimestamp;
+        mLastTimestampUpdated = isResumed ? resumedEndTimestamp : Recorder::endTimestamp;
+        mIsAwaitingKeyframe = isResumed && Track::trackMask == RECORD_TRACK_VIDEO;
+        formatFileName(mLastTimestampUpdated);
+
+        RecordDesc desc;
+        describeRecord(desc);
+        return openRecord(mFileName, desc, isResumed);
+    }
+
+    int getStop() override {
+        int ret = RECORD_RETURN_FAILURE;
+
+        if (!mTarget.empty()) {
+            RecordDesc desc;
+            describeRecord(desc);
+            ret = closeRecord(desc);
+
+            if constexpr (Track::trackMask == RECORD_TRACK_VIDEO) {
+                if (motionBitmap) {
+                    motionBitmap->flush();
+                }
+            }
+
+            /* Leave the shared segment alone if the other track already opened the next one */
+            if (Recorder::startTimestamp == mRecordStartTimestamp) {
+                Recorder::startTimestamp = 0;
+            }
+        }
+
+        return ret;
+    }
+
+    int getStorage(uint8_t *sample, size_t totalSample) override {
+        return storeSplit(sample, totalSample, nullptr);
+    }
+
+    int getStorage(FrameRef frame) override {
+        return storeSplit(frame.getData(), frame.getSize(), &frame);
+    }
+
+    size_t getSplitOffset(const uint8_t *sample, size_t totalSample) override {
+        if (!isCompleted()) {
+            return RECORD_NO_SPLIT;
+        }
+
+        size_t offset = Track::findSplitOffset(sample, totalSample, mStreamBytes);
+        return (offset == RECORD_NO_SPLIT && isOverdue()) ? 0 : offset;
+    }
+
+    bool isCompleted() override {
+        if (mTarget.empty()) {
+            return false;
+        }
+
+        /* The other track opened the next segment */
+        if (Recorder::startTimestamp != 0 && Recorder::startTimestamp != mRecordStartTimestamp) {
+            return true;
+        }
+
+        uint32_t elapsed = Recorder::endTimestamp - mRecordStartTimestamp;
+        return Track::leadsSplit ? (elapsed >= (uint32_t)mDurationInSecs) : isOverdue();
+    }
+
+private:
+    char mDatePrefix[TIMEFMT_COMPACT_LENGTH + 1];
+    char mFileName[NAME_MAX + 1];
+    bool mIsAwaitingKeyframe = false;
+
+    bool isOverdue() {
+        return (Recorder::endTimestamp - mRecordStartTimestamp) >= (uint32_t)mDurationInSecs + Track::splitGraceInSecs;
+    }
+
+    /* "frame" (null for an encoder buffer) owns the sample, it's held from the offset the sample begins at */
+    int storeSplit(uint8_t *sample, size_t totalSample, FrameRef *frame) {
+        /* Pictures the encoder referenced before the restart are gone */
+        if (mIsAwaitingKeyframe) {
+            size_t offset = Track::findSplitOffset(sample, totalSample, mStreamBytes);
+            if (offset == RECORD_NO_SPLIT) {
+                return RECORD_RETURN_SUCCESS;
+            }
+
+            mIsAwaitingKeyframe = false;
+            sample += offset;
+            totalSample -= offset;
+        }
+
+        size_t splitOffset = getSplitOffset(sample, totalSample);
+        if (splitOffset != RECORD_NO_SPLIT) {
+            /* Head of sample completes the current record, the frame goes on with the rest */
+            if (splitOffset > 0 && storeSample(sample, splitOffset) != RECORD_RETURN_SUCCESS) {
+                return RECORD_RETURN_FAILURE;
+            }
+            getStop();
+            if (getStart() != RECORD_RETURN_SUCCESS) {
+                return RECORD_RETURN_FAILURE;
+            }
+
+            sample += splitOffset;
+            totalSample -= splitOffset;
+            if (totalSample == 0) {
+                return RECORD_RETURN_SUCCESS;
+            }
+        }
+
+        return storeSample(sample, totalSample, frame);
+    }
+
+    int storeSample(uint8_t *sample, size_t totalSample, FrameRef *frame = nullptr) {
+        mStreamBytes += totalSample;
+
+        if constexpr (Track::trackMask == RECORD_TRACK_AUDIO) {
+            /* Silence isn't written, it's journaled as a gap the playback reader fills back */
+            if (silenceDetector && segmentIndex && silenceDetector->isSilent(sample, totalSample)) {
+                skipRecord(totalSample);
+                updateLastTimestampRecord();
+                return RECORD_RETURN_SUCCESS;
+            }
+        }
+
+        /* Keyframes are journaled at the offset the sample is written to */
+        if constexpr (Track::trackMask == RECORD_TRACK_VIDEO) {
+            if (segmentIndex && mIsKeyframeIndexed) {
+                indexPictures(sample, totalSample, true);
+            }
+        }
+
+        /* A frame may be written and back in the pool once it's handed over, its thumbnail is taken first */
+        if constexpr (Track::trackMask == RECORD_TRACK_VIDEO) {
+            if (frame && thumbnailTrack) {
+                thumbnailTrack->append(Recorder::endTimestamp, sample, totalSample);
+            }
+        }
+
+        ssize_t nbBytes = frame ? writeFrame(std::move(*frame), (size_t)(sample - frame->getData())) : 
+                                  writeRecord(sample, totalSample);
+        if (nbBytes <= 0) {
+            return RECORD_RETURN_FAILURE;
+        }
+
+        updateLastTimestampRecord();
+        if constexpr (Track::trackMask == RECORD_TRACK_VIDEO) {
+            if (!frame && thumbnailTrack) {
+                thumbnailTrack->append(Recorder::endTimestamp, sample, nbBytes);
+            }
+            if (motionBitmap) {
+                motionBitmap->mark(Recorder::endTimestamp);
+            }
+        }
+
+        return RECORD_RETURN_SUCCESS;
+    }
+
+    void updateLastTimestampRecord() {
+        /* Name changes once per second, not per sample */
+        if (mLastTimestampUpdated == Recorder::endTimestamp) {
+            return;
+        }
+
+        mLastTimestampUpdated = Recorder::endTimestamp;
+        formatFileName(mLastTimestampUpdated);
+        renameRecord(mFileName);
+    }
+
+    void formatFileName(uint32_t endTimestamp) {
+        snprintf(mFileName, sizeof(mFileName), "%s_%u_%u%s%s" RECORD_TEMPORARY_SUFFIX,
+                 mDatePrefix, mRecordStartTimestamp, endTimestamp, Segment::suffix, Track::extension);
+    }
+
+    void describeRecord(RecordDesc &desc) {
+        memset(&desc, 0, sizeof(desc));
+        desc.startTimestamp = mRecordStartTimestamp;
+        desc.endTimestamp   = mLastTimestampUpdated;
+        desc.sizeInBytes    = mChunkOffset + mChunkLength;
+        desc.type           = Segment::type;
+        desc.flags          = Segment::flags | (mCipher ? RECORD_FLAG_ENCRYPTED : 0);
+        desc.trackMask      = Track::trackMask;
+    }
+};
+
+#endif /* __RECORDERCORE_H */
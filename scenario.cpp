@@ -0,0 +1,235 @@
+/*
+    Usage: scenario [-d Days] [-c CapacityMB] [-b VideoKbps] [-r RecordSecs] [-e 0|1]
+        Replay whole recording days on a simulated clock and an in-memory card, then
+        report write throughput, rollovers, retention, catalog query latency and day summaries.
+        With "-e 1" records are encrypted, the cipher is also measured alone (hardware
+        and software fallback) as the share of one core it takes per Mbps recorded.
+
+    Encoders are synthetic: H.264 access units with an IDR every SCENARIO_GOP_SECS,
+    G.711 in SCENARIO_AUDIO_CHUNK_MS chunks. The card is kept under SCENARIO_RESERVE_PERCENT
+    free space by erasing the oldest day (or the oldest record of today), as the
+    maintenance of the application would.
+*/
+#include <bits/stdc++.h>
+#include <fcntl.h>
+
+#include "SDCard.h"
+#include "vfs.h"
+#include "utils.hpp"
+
+#define SCENARIO_HARD_DRIVE             "/dev/simcard0"
+#define SCENARIO_MOUNT_POINT            "/sim/sd"
+#define SCENARIO_START_DATE             "2024.01.01"
+
+#define SCENARIO_FPS                    (15)
+#define SCENARIO_GOP_SECS               (2)
+#define SCENARIO_AUDIO_CHUNK_MS         (100)
+#define SCENARIO_MAINTENANCE_SECS       (60)
+#define SCENARIO_QUERY_SECS             (3600)
+#define SCENARIO_RESERVE_PERCENT        (10)
+#define SCENARIO_CIPHER_BENCH_SIZE      (16 * 1024 * 1024)
+
+typedef struct {
+    uint64_t samples;
+    uint64_t failures;
+    uint32_t rollovers;
+    uint32_t erasedDays;
+    uint32_t erasedRecords;
+    uint32_t queries;
+    double queryTotalUs;
+    double queryMaxUs;
+} ScenarioStats;
+
+/* Access unit of "size" bytes, keyframes carry SPS + PPS + IDR slice */
+static void makeAccessUnit(std::vector<uint8_t> &unit, size_t size, bool isKeyframe) {
+    static const uint8_t keyHeader[] = { 0, 0, 0, 1, 0x67, 0x42, 0xC0, 0x1E, 0, 0, 0, 1, 0x68, 0xCE, 0x3C, 0x80, 0, 0, 0, 1, 0x65, 0x88 };
+    static const uint8_t sliceHeader[] = { 0, 0, 0, 1, 0x41, 0x9A };
+    const uint8_t *header = isKeyframe ? keyHeader : sliceHeader;
+    size_t headerSize = isKeyframe ? sizeof(keyHeader) : sizeof(sliceHeader);
+
+    unit.assign(std::max(size, headerSize), 0xA5);  /* No start code emulation */
+    memcpy(unit.data(), header, headerSize);
+}
+
+static void eraseUntilReserve(SDCard &sdCard, ScenarioStats &stats) {
+    sdCard.updateCapacity();
+
+    while (sdCard.freeCapacity * 100 < sdCard.totalCapacity * SCENARIO_RESERVE_PERCENT) {
+        auto days = sdCard.getRecordDays();
+        uint64_t freeBefore = sdCard.freeCapacity;
+
+        if (days.size() > 1) {
+            sdCard.eraseOldestRecords();
+            ++stats.erasedDays;
+        }
+        else {
+            sdCard.eraseOldestRecords(sdCard.currentSession);
+            ++stats.erasedRecords;
+        }
+
+        sdCard.updateCapacity();
+        if (sdCard.freeCapacity <= freeBefore) {
+            break;  /* Nothing left to erase but the record in progress */
+        }
+    }
+}
+
+static void queryCatalog(SDCard &sdCard, ScenarioStats &stats) {
+    std::vector<RecordDesc> page;
+
+    auto begin = std::chrono::steady_clock::now();
+    sdCard.getPlaylistPage(page, sdCard.currentSession, SDCard::eQryPlaylist::All, SDCARD_PLAYLIST_NO_CURSOR, 20);
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count();
+
+    stats.queryTotalUs += us;
+    stats.queryMaxUs = std::max(stats.queryMaxUs, us);
+    ++stats.queries;
+}
+
+static void benchmarkCipher(const uint8_t key[AESCTR_KEY_SIZE]) {
+    std::vector<uint8_t> buffer(SCENARIO_CIPHER_BENCH_SIZE, 0x5A);
+
+    for (bool isHardwareAllowed : { true, false }) {
+        AesCtr aes(key, isHardwareAllowed);
+        if (isHardwareAllowed && !aes.isHardwareAccelerated()) {
+            continue;
+        }
+
+        auto begin = std::chrono::steady_clock::now();
+        aes.apply(0, 0, buffer.data(), buffer.size());
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        double bytesPerSec = buffer.size() / std::max(secs, 1e-9);
+
+        printf("Cipher            : %s, %.1f MB/s, %.3f %% of a core per Mbps\n",
+               AesCtr::getImplementation(isHardwareAllowed), bytesPerSec / 1e6, 1e6 / 8 / bytesPerSec * 100);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    unsigned days = 1, capacityInMB = 256, videoKbps = 256, recordSecs = RECORD_DEFAULT_DURATION;
+    bool isEncrypted = false;
+    const uint8_t key[AESCTR_KEY_SIZE] = { 0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6, 0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C };
+
+    for (int id = 1; id + 1 < argc; id += 2) {
+        if (strcmp(argv[id], "-d") == 0) {
+            days = (unsigned)atoi(argv[id + 1]);
+        }
+        else if (strcmp(argv[id], "-c") == 0) {
+            capacityInMB = (unsigned)atoi(argv[id + 1]);
+        }
+        else if (strcmp(argv[id], "-b") == 0) {
+            videoKbps = (unsigned)atoi(argv[id + 1]);
+        }
+        else if (strcmp(argv[id], "-r") == 0) {
+            recordSecs = (unsigned)atoi(argv[id + 1]);
+        }
+        else if (strcmp(argv[id], "-e") == 0) {
+            isEncrypted = (atoi(argv[id + 1]) != 0);
+        }
+        else {
+            printf("Usage: %s [-d Days] [-c CapacityMB] [-b VideoKbps] [-r RecordSecs] [-e 0|1]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    auto clock = std::make_shared<SimulatedClock>(getMidnightTimestamp(SCENARIO_START_DATE));
+    auto fileSystem = std::make_shared<MemFileSystem>((uint64_t)capacityInMB * 1024 * 1024);
+    setClock(clock);
+    setFileSystem(fileSystem);
+
+    /* Card "inserted" and "mounted" in the in-memory filesystem */
+    createDirectories(SCENARIO_MOUNT_POINT);
+    createDirectory("/dev");
+    getFileSystem().close(getFileSystem().open(SCENARIO_HARD_DRIVE, O_WRONLY | O_CREAT, 0666));
+
+    SDCard sdCard(SCENARIO_HARD_DRIVE);
+    sdCard.mountPoint = SCENARIO_MOUNT_POINT;
+    if (!SDCard::isSDCardMounted(sdCard)) {
+        printf("Simulated card isn't mounted\n");
+        return EXIT_FAILURE;
+    }
+    if (isEncrypted) {
+        sdCard.enableEncryption(key);
+    }
+
+    ScenarioStats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    size_t frameSize = videoKbps * 1000 / 8 / SCENARIO_FPS;
+    std::vector<uint8_t> keyframe, frame;
+    makeAccessUnit(keyframe, frameSize * 4, true);
+    makeAccessUnit(frame, frameSize, false);
+    std::vector<uint8_t> audio(SCENARIO_AUDIO_CHUNK_MS * 8, 0x55);
+
+    uint64_t totalSecs = (uint64_t)days * 24 * 3600;
+    auto begin = std::chrono::steady_clock::now();
+
+    for (uint64_t sec = 0; sec < totalSecs; ++sec, clock->advance(1)) {
+        SDCard::ENTRY_ATOMIC(sdCard);
+
+        if (getTodayDateString() != sdCard.currentSession) {
+            stats.rollovers += sdCard.currentSession.empty() ? 0 : 1;
+            SDCard::closeCurrentSession(sdCard);
+            SDCard::openSessionRecord(sdCard, Recorder::eOption::Full, (int)recordSecs);
+        }
+        Recorder::endTimestamp = getCurrentEpochTimestamp();
+
+        for (unsigned id = 0; id < SCENARIO_FPS; ++id) {
+            bool isKeyframe = (id == 0) && (sec % SCENARIO_GOP_SECS == 0);
+            auto &unit = isKeyframe ? keyframe : frame;
+            stats.failures += (SDCard::storageSamples(sdCard.videoRecorder, unit.data(), unit.size()) != SDCARD_RETURN_SUCCESS);
+            ++stats.samples;
+        }
+
+        for (unsigned id = 0; id < 1000 / SCENARIO_AUDIO_CHUNK_MS; ++id) {
+            stats.failures += (SDCard::storageSamples(sdCard.audioRecorder, audio.data(), audio.size()) != SDCARD_RETURN_SUCCESS);
+            ++stats.samples;
+        }
+
+        if (sec % SCENARIO_MAINTENANCE_SECS == 0) {
+            eraseUntilReserve(sdCard, stats);
+        }
+        if (sec % SCENARIO_QUERY_SECS == SCENARIO_QUERY_SECS - 1) {
+            queryCatalog(sdCard, stats);
+        }
+
+        SDCard::EXIT_ATOMIC(sdCard);
+    }
+
+    SDCard::ENTRY_ATOMIC(sdCard);
+    SDCard::closeCurrentSession(sdCard);
+    SDCard::EXIT_ATOMIC(sdCard);
+
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    uint64_t written = fileSystem->getTotalWritten();
+
+    printf("Simulated         : %u day(s) in %.2f s (x%.0f)\n", days, secs, secs > 0 ? totalSecs / secs : 0.0);
+    printf("Samples stored    : %lu (%lu failed, %.0f samples/s)\n", (unsigned long)stats.samples, (unsigned long)stats.failures, secs > 0 ? stats.samples / secs : 0.0);
+    printf("Bytes written     : %lu (%.1f MB/s)\n", (unsigned long)written, secs > 0 ? written / secs / 1e6 : 0.0);
+    printf("Rollovers         : %u\n", stats.rollovers);
+    printf("Retention         : %u day(s), %u record(s) erased\n", stats.erasedDays, stats.erasedRecords);
+    printf("Catalog query     : %u queries, avg %.1f us, max %.1f us\n", stats.queries, stats.queries ? stats.queryTotalUs / stats.queries : 0.0, stats.queryMaxUs);
+    printf("Card usage        : %lu / %lu bytes\n", (unsigned long)fileSystem->getUsedBytes(), (unsigned long)sdCard.totalCapacity);
+    auto &policy = sdCard.getWritePolicy();
+    printf("Write policy      : flush %u B, sync %u s, prealloc %u B, duration %d s\n", policy.flushSize, policy.syncIntervalInSecs, policy.preallocSize, policy.durationInSecs);
+
+    auto summaryBegin = std::chrono::steady_clock::now();
+    auto summaries = sdCard.getDaySummaries();
+    double summaryUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - summaryBegin).count();
+
+    printf("Day summaries     : %lu day(s) in %.1f us\n", summaries.size(), summaryUs);
+    for (auto &day : summaries) {
+        const TrackSummary &video = day.tracks[STORAGESUMMARY_VIDEO];
+        const TrackSummary &audio = day.tracks[STORAGESUMMARY_AUDIO];
+        printf("  %s      : %u records, %u s recorded, %lu + %lu bytes\n", day.dateTime, video.segments, video.recordedSecs,
+               (unsigned long)video.sizeInBytes, (unsigned long)audio.sizeInBytes);
+    }
+    if (isEncrypted) {
+        benchmarkCipher(key);
+    }
+
+    /* Card isn't mounted by this tool, don't unmount it on exit */
+    sdCard.eStatus = SDCard::eState::Removed;
+
+    return stats.failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
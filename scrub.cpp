@@ -0,0 +1,96 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+
+#include "scrub.h"
+#include "crc32c.h"
+
+#define LOCAL_DBG_EN			(0)
+
+#if (LOCAL_DBG_EN == 1)
+#define LOCAL_DBG(fmt, ...) 	printf("\x1B[36m" fmt "\x1B[0m", ##__VA_ARGS__)
+#else
+#define LOCAL_DBG(fmt, ...)
+#endif
+
+void Scrubber::verify(std::vector<ScrubJob> &jobs, ScrubReport &report, unsigned nbThreads, IOScheduler *scheduler) {
+	std::atomic<size_t> nextJob(0);
+	std::mutex reportMutex;
+	std::vector<std::thread> workers;
+
+	memset(&report, 0, sizeof(report));
+	nbThreads = std::max(1u, std::min(nbThreads, (unsigned)jobs.size()));
+
+	for (unsigned id = 0; id < nbThreads; ++id) {
+		workers.emplace_back([&] {
+			ScrubReport local;
+			memset(&local, 0, sizeof(local));
+
+			for (size_t job = nextJob++; job < jobs.size(); job = nextJob++) {
+				verifyFile(jobs[job], local, scheduler);
+			}
+
+			std::lock_guard<std::mutex> lock(reportMutex);
+			report.files 			+= local.files;
+			report.missingFiles 	+= local.missingFiles;
+			report.chunks 			+= local.chunks;
+			report.corruptedChunks 	+= local.corruptedChunks;
+			report.bytes 			+= local.bytes;
+		});
+	}
+
+	for (auto &worker : workers) {
+		worker.join();
+	}
+}
+
+void Scrubber::verifyFile(ScrubJob &job, ScrubReport &report, IOScheduler *scheduler) {
+	job.corrupted.clear();
+	report.files++;
+	report.chunks += job.chunks.size();
+
+	int fd = open(job.path.c_str(), O_RDONLY);
+	if (fd == -1) {
+		LOCAL_DBG("[SCRUB] Missing %s\n", job.path.c_str());
+		report.missingFiles++;
+		report.corruptedChunks += job.chunks.size();
+		job.corrupted = job.chunks;
+		return;
+	}
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	uint32_t bufferSize = 0;
+	for (auto &chunk : job.chunks) {
+		bufferSize = std::max(bufferSize, chunk.length);
+	}
+	std::vector<uint8_t> buffer(bufferSize);
+
+	for (auto &chunk : job.chunks) {
+		IOScheduler::Ticket ticket(scheduler, IOScheduler::eClass::Background, chunk.length);
+		size_t total = 0;
+		while (total < chunk.length) {
+			ssize_t nbBytes = pread(fd, buffer.data() + total, chunk.length - total, chunk.offset + total);
+			if (nbBytes <= 0) {
+				break;
+			}
+			total += nbBytes;
+		}
+		report.bytes += total;
+
+		if (total != chunk.length || crc32c(CRC32C_INIT, buffer.data(), total) != chunk.crc) {
+			LOCAL_DBG("[SCRUB] Corrupted %s [%u, %u)\n", job.path.c_str(), chunk.offset, chunk.offset + chunk.length);
+			report.corruptedChunks++;
+			job.corrupted.push_back(chunk);
+		}
+
+		/* Verified range isn't needed anymore, keep page cache for recording */
+		posix_fadvise(fd, chunk.offset, chunk.length, POSIX_FADV_DONTNEED);
+	}
+
+	close(fd);
+}
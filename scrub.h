@@ -0,0 +1,43 @@
+/*
+    Verification of record files against chunk CRC32C stored in segment index.
+    Files are verified in parallel, each file is read sequentially with large reads
+    and dropped from page cache behind the cursor so recording isn't evicted.
+*/
+#ifndef __SCRUB_H
+#define __SCRUB_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "segindex.h"
+#include "iosched.h"
+
+#define SCRUB_DEFAULT_THREADS               (2)
+
+typedef struct {
+    std::string dateTime;
+    std::string path;
+    uint8_t trackMask;
+    uint32_t startTimestamp;
+    std::vector<ChunkDesc> chunks;      /* Sorted by offset */
+    std::vector<ChunkDesc> corrupted;   /* Output */
+} ScrubJob;
+
+typedef struct {
+    uint32_t files;
+    uint32_t missingFiles;
+    uint32_t chunks;
+    uint32_t corruptedChunks;
+    uint64_t bytes;
+} ScrubReport;
+
+class Scrubber {
+public:
+    static void verify(std::vector<ScrubJob> &jobs, ScrubReport &report, unsigned nbThreads = SCRUB_DEFAULT_THREADS, IOScheduler *scheduler = nullptr);
+
+private:
+    static void verifyFile(ScrubJob &job, ScrubReport &report, IOScheduler *scheduler);
+};
+
+#endif /* __SCRUB_H */
@@ -0,0 +1,63 @@
+/*
+    Usage: scrub <MountPoint> [Date] [-j Threads]
+        Verify record files of a day (format YYYY.MM.DD) or whole card if date is omitted.
+        The card is only read, corrupted ranges are reported but not flagged to segment index.
+*/
+#include <bits/stdc++.h>
+
+#include "SDCard.h"
+#include "crc32c.h"
+#include "utils.hpp"
+
+int main(int argc, char *argv[]) {
+    std::string mountPoint, dateTime;
+    unsigned nbThreads = SCRUB_DEFAULT_THREADS;
+
+    for (int id = 1; id < argc; ++id) {
+        if (strcmp(argv[id], "-j") == 0 && id + 1 < argc) {
+            nbThreads = (unsigned)atoi(argv[++id]);
+        }
+        else if (mountPoint.empty()) {
+            mountPoint = argv[id];
+        }
+        else {
+            dateTime = argv[id];
+        }
+    }
+
+    if (mountPoint.empty()) {
+        printf("Usage: %s <MountPoint> [Date] [-j Threads]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    SDCard sdCard("");
+    sdCard.mountPoint = mountPoint;
+    sdCard.eStatus = SDCard::eState::Mounted;
+
+    auto begin = std::chrono::steady_clock::now();
+    ScrubReport report;
+    std::vector<ScrubJob> jobs;
+    sdCard.verify(dateTime, report, jobs, nbThreads);
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    printf("CRC32C hardware   : %s\n", crc32cIsHardwareAccelerated() ? "yes" : "no");
+    printf("Files verified    : %u (%u missing)\n", report.files, report.missingFiles);
+    printf("Chunks verified   : %u (%u corrupted)\n", report.chunks, report.corruptedChunks);
+    printf("Bytes read        : %lu (%.1f MB/s)\n", (unsigned long)report.bytes, secs > 0 ? report.bytes / secs / 1e6 : 0.0);
+
+    for (auto &job : jobs) {
+        for (auto &chunk : job.corrupted) {
+            printf("CORRUPTED %s/%s %s [%u, %u)\n", 
+                        job.dateTime.c_str(), 
+                        job.path.substr(job.path.rfind('/') + 1).c_str(),
+                        (job.trackMask & RECORD_TRACK_VIDEO) ? "video" : "audio",
+                        chunk.offset, 
+                        chunk.offset + chunk.length);
+        }
+    }
+
+    /* Card isn't mounted by this tool, don't unmount it on exit */
+    sdCard.eStatus = SDCard::eState::Removed;
+
+    return report.corruptedChunks ? EXIT_FAILURE : EXIT_SUCCESS;
+}
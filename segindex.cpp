@@ -0,0 +1,563 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#include "segindex.h"
+#include "crc32c.h"
+#include "utils.hpp"
+#include "vfs.h"
+
+#define LOCAL_DBG_EN			(0)
+
+#if (LOCAL_DBG_EN == 1)
+#define LOCAL_DBG(fmt, ...) 	printf("\x1B[36m" fmt "\x1B[0m", ##__VA_ARGS__)
+#else
+#define LOCAL_DBG(fmt, ...)
+#endif
+
+static uint32_t headerCrc(const SegIndexHeader &header) {
+	return crc32c(CRC32C_INIT, &header, offsetof(SegIndexHeader, crc));
+}
+
+static uint32_t entryCrc(const SegIndexEntry &entry) {
+	return crc32c(CRC32C_INIT, &entry, offsetof(SegIndexEntry, crc));
+}
+
+static SegIndexHeader makeHeader() {
+	SegIndexHeader header;
+
+	memset(&header, 0, sizeof(header));
+	header.magic 		= SEGINDEX_MAGIC;
+	header.version 		= SEGINDEX_VERSION;
+	header.entrySize 	= sizeof(SegIndexEntry);
+	header.crc 			= headerCrc(header);
+
+	return header;
+}
+
+static SegIndexEntry makeEntry(SegmentIndex::eEntry kind, const RecordDesc &desc) {
+	SegIndexEntry entry;
+
+	memset(&entry, 0, sizeof(entry));
+	entry.kind 	= (uint8_t)kind;
+	entry.desc 	= desc;
+	entry.crc 	= entryCrc(entry);
+
+	return entry;
+}
+
+static SegIndexEntry makeEntry(SegmentIndex::eEntry kind, uint8_t trackMask, const ChunkDesc &chunk) {
+	SegIndexEntry entry;
+
+	memset(&entry, 0, sizeof(entry));
+	entry.kind 		= (uint8_t)kind;
+	entry.trackMask = trackMask;
+	entry.chunk 	= chunk;
+	entry.crc 		= entryCrc(entry);
+
+	return entry;
+}
+
+/* Entries kept on card only, they don't change the catalog */
+static bool isChunkEntry(uint8_t kind) {
+	return kind == (uint8_t)SegmentIndex::eEntry::Chunk || 
+		   kind == (uint8_t)SegmentIndex::eEntry::Gap || 
+		   kind == (uint8_t)SegmentIndex::eEntry::Keyframe || 
+		   kind == (uint8_t)SegmentIndex::eEntry::Nonce;
+}
+
+static bool sortByStartTimestamp(const RecordDesc &t1, const RecordDesc &t2) {
+	return t1.startTimestamp < t2.startTimestamp;
+}
+
+static bool writeAll(int fd, const void *data, size_t len) {
+	const uint8_t *p = (const uint8_t *)data;
+
+	while (len > 0) {
+		ssize_t nbBytes = getFileSystem().write(fd, p, len);
+		if (nbBytes <= 0) {
+			return false;
+		}
+		p += nbBytes;
+		len -= nbBytes;
+	}
+
+	return true;
+}
+
+SegmentIndex::SegmentIndex(std::string pathToIndex) {
+	this->pathToIndex.assign(pathToIndex);
+	this->pathToJournal = pathToIndex + "/" SEGINDEX_JOURNAL_NAME;
+	publish();
+}
+
+SegmentIndex::~SegmentIndex() {
+
+}
+
+int SegmentIndex::readJournal(std::vector<SegIndexEntry> &entries, size_t *validSize) {
+	entries.clear();
+
+	IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::Metadata);
+	int fd = getFileSystem().open(pathToJournal.c_str(), O_RDONLY);
+	if (fd == -1) {
+		return SEGINDEX_RETURN_MISSING;
+	}
+
+	struct stat fStat;
+	if (getFileSystem().fstat(fd, &fStat) != 0 || (size_t)fStat.st_size < sizeof(SegIndexHeader)) {
+		getFileSystem().close(fd);
+		return SEGINDEX_RETURN_CORRUPTED;
+	}
+
+	/* One sequential read of the whole journal */
+	std::vector<uint8_t> journal(fStat.st_size);
+	size_t total = 0;
+	while (total < journal.size()) {
+		ssize_t nbBytes = getFileSystem().read(fd, journal.data() + total, journal.size() - total);
+		if (nbBytes <= 0) {
+			break;
+		}
+		total += nbBytes;
+	}
+	getFileSystem().close(fd);
+
+	if (total != journal.size()) {
+		return SEGINDEX_RETURN_IO_FAILURE;
+	}
+
+	SegIndexHeader header;
+	memcpy(&header, journal.data(), sizeof(header));
+	if (header.magic != SEGINDEX_MAGIC || 
+		header.version != SEGINDEX_VERSION ||
+		header.entrySize != sizeof(SegIndexEntry) ||
+		header.crc != headerCrc(header)) 
+	{
+		return SEGINDEX_RETURN_CORRUPTED;
+	}
+
+	/*  An entry cut by power loss (short or CRC mismatched) ends the journal, entries before
+		it are kept. Also a reader racing an append stops at the entry being written.
+	*/
+	size_t nbEntries = (journal.size() - sizeof(header)) / sizeof(SegIndexEntry);
+	entries.resize(nbEntries);
+	memcpy(entries.data(), journal.data() + sizeof(header), nbEntries * sizeof(SegIndexEntry));
+
+	for (size_t id = 0; id < nbEntries; ++id) {
+		if (entries[id].crc != entryCrc(entries[id])) {
+			LOCAL_DBG("[SEGINDEX] Entry %ld CRC mismatched in %s, journal ends there\n", id, pathToJournal.c_str());
+			entries.resize(id);
+			break;
+		}
+	}
+
+	if (validSize != nullptr) {
+		*validSize = sizeof(header) + entries.size() * sizeof(SegIndexEntry);
+	}
+	if (sizeof(header) + entries.size() * sizeof(SegIndexEntry) != journal.size()) {
+		LOCAL_DBG("[SEGINDEX] Torn tail in %s\n", pathToJournal.c_str());
+		return SEGINDEX_RETURN_TORN;
+	}
+
+	return SEGINDEX_RETURN_SUCCESS;
+}
+
+int SegmentIndex::load(bool isReadOnly) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::vector<SegIndexEntry> entries;
+
+	mValid = false;
+	mTotalEntries = 0;
+	mChunkEntries = 0;
+	mRecords.clear();
+	mOpenedRecords.clear();
+	mInterruptedRecords.clear();
+	mCorrupted.clear();
+
+	size_t validSize = 0;
+	int ret = readJournal(entries, &validSize);
+	if (ret == SEGINDEX_RETURN_TORN) {
+		ret = isReadOnly ? SEGINDEX_RETURN_SUCCESS : truncateJournal(validSize);
+	}
+	if (ret != SEGINDEX_RETURN_SUCCESS) {
+		publish();
+		return ret;
+	}
+
+	mRecords.reserve(entries.size());
+	for (auto &entry : entries) {
+		replay(entry);
+	}
+
+	/* Nobody of this run will close them */
+	mInterruptedRecords = mOpenedRecords;
+	mTotalEntries = entries.size();
+	mValid = true;
+	publish();
+
+	LOCAL_DBG("[SEGINDEX] Loaded %ld records from %s\n", mRecords.size(), pathToJournal.c_str());
+
+	return SEGINDEX_RETURN_SUCCESS;
+}
+
+/* Next entries are appended right after the last complete one */
+int SegmentIndex::truncateJournal(size_t validSize) {
+	IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::Metadata);
+
+	int fd = getFileSystem().open(pathToJournal.c_str(), O_WRONLY);
+	if (fd == -1) {
+		return SEGINDEX_RETURN_IO_FAILURE;
+	}
+
+	bool isTruncated = (getFileSystem().ftruncate(fd, (off_t)validSize) == 0);
+	getFileSystem().fdatasync(fd);
+	getFileSystem().close(fd);
+
+	return isTruncated ? SEGINDEX_RETURN_SUCCESS : SEGINDEX_RETURN_IO_FAILURE;
+}
+
+bool SegmentIndex::isLive(uint32_t startTimestamp) {
+	RecordDesc key;
+	key.startTimestamp = startTimestamp;
+
+	auto it = std::lower_bound(mRecords.begin(), mRecords.end(), key, sortByStartTimestamp);
+	if (it != mRecords.end() && it->startTimestamp == startTimestamp) {
+		return true;
+	}
+
+	return std::find(mOpenedRecords.begin(), mOpenedRecords.end(), startTimestamp) != mOpenedRecords.end();
+}
+
+void SegmentIndex::replay(const SegIndexEntry &entry) {
+	eEntry kind = (eEntry)entry.kind;
+
+	/* Chunk CRCs, gaps, keyframes and nonces are kept on card only, see loadChunks() */
+	if (isChunkEntry(entry.kind)) {
+		++mChunkEntries;
+		return;
+	}
+
+	const RecordDesc &desc = entry.desc;
+	uint32_t startTimestamp = (kind == eEntry::Corrupted) ? entry.chunk.startTimestamp : desc.startTimestamp;
+
+	auto opened = std::find(mOpenedRecords.begin(), mOpenedRecords.end(), startTimestamp);
+	RecordDesc key;
+	key.startTimestamp = startTimestamp;
+	auto it = std::lower_bound(mRecords.begin(), mRecords.end(), key, sortByStartTimestamp);
+	bool isFound = (it != mRecords.end() && it->startTimestamp == startTimestamp);
+
+	switch (kind) {
+	case eEntry::Open: {
+		if (opened == mOpenedRecords.end()) {
+			mOpenedRecords.push_back(desc.startTimestamp);
+		}
+
+		/* Opened again by a recorder, interrupted record is resumed */
+		mInterruptedRecords.erase(std::remove(mInterruptedRecords.begin(), mInterruptedRecords.end(), startTimestamp), mInterruptedRecords.end());
+	}
+	break;
+
+	case eEntry::Close: {
+		if (opened != mOpenedRecords.end()) {
+			mOpenedRecords.erase(opened);
+		}
+		mInterruptedRecords.erase(std::remove(mInterruptedRecords.begin(), mInterruptedRecords.end(), startTimestamp), mInterruptedRecords.end());
+
+		if (isFound) {
+			it->endTimestamp 	= std::max(it->endTimestamp, desc.endTimestamp);
+			it->sizeInBytes 	+= desc.sizeInBytes;
+			it->trackMask 		|= desc.trackMask;
+			it->flags 			|= desc.flags;
+		}
+		else {
+			mRecords.insert(it, desc);
+		}
+	}
+	break;
+
+	case eEntry::Remove: {
+		if (opened != mOpenedRecords.end()) {
+			mOpenedRecords.erase(opened);
+		}
+		mInterruptedRecords.erase(std::remove(mInterruptedRecords.begin(), mInterruptedRecords.end(), startTimestamp), mInterruptedRecords.end());
+
+		if (isFound) {
+			mRecords.erase(it);
+		}
+
+		mCorrupted.erase(std::remove_if(mCorrupted.begin(), mCorrupted.end(), [startTimestamp](const TrackChunk &range) {
+			return range.chunk.startTimestamp == startTimestamp;
+		}), mCorrupted.end());
+	}
+	break;
+
+	case eEntry::Corrupted: {
+		if (isFound) {
+			it->flags |= RECORD_FLAG_CORRUPTED;
+		}
+		mCorrupted.push_back({ entry.trackMask, entry.chunk });
+	}
+	break;
+	
+	default:
+	break;
+	}
+}
+
+int SegmentIndex::writeEntry(const SegIndexEntry &entry) {
+	/* Journal doesn't cover the whole day, owner must rebuild it first */
+	if (!mValid) {
+		return SEGINDEX_RETURN_MISSING;
+	}
+
+	bool isWritten = false;
+	{
+		IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::Metadata, sizeof(entry));
+
+		int fd = getFileSystem().open(pathToJournal.c_str(), O_WRONLY | O_APPEND);
+		if (fd == -1) {
+			mValid = false;
+			return SEGINDEX_RETURN_IO_FAILURE;
+		}
+
+		isWritten = writeAll(fd, &entry, sizeof(entry));
+		getFileSystem().fdatasync(fd);
+		getFileSystem().close(fd);
+	}
+
+	if (!isWritten) {
+		mValid = false;
+		return SEGINDEX_RETURN_IO_FAILURE;
+	}
+
+	++mTotalEntries;
+
+	/* Chunk CRCs and gaps live as long as their record, only record entries are outdated */
+	size_t recordEntries = mTotalEntries - std::min(mTotalEntries, mChunkEntries);
+	size_t liveEntries = mRecords.size() + mOpenedRecords.size() + mCorrupted.size();
+	size_t deadEntries = recordEntries - std::min(recordEntries, liveEntries);
+	if (deadEntries > SEGINDEX_COMPACT_THRESHOLD && deadEntries > liveEntries) {
+		LOCAL_DBG("[SEGINDEX] Compact %s (%ld dead entries)\n", pathToJournal.c_str(), deadEntries);
+		std::string tmpJournal = pathToJournal + ".new";
+		if (writeJournal(tmpJournal) == SEGINDEX_RETURN_SUCCESS) {
+			IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::Metadata);
+			getFileSystem().rename(tmpJournal.c_str(), pathToJournal.c_str());
+		}
+	}
+
+	return SEGINDEX_RETURN_SUCCESS;
+}
+
+int SegmentIndex::append(eEntry kind, const RecordDesc &desc) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	SegIndexEntry entry = makeEntry(kind, desc);
+	bool wasValid = mValid;
+	size_t nbInterrupted = mInterruptedRecords.size();
+
+	replay(entry);
+
+	int ret = writeEntry(entry);
+	if (kind != eEntry::Open || mValid != wasValid || mInterruptedRecords.size() != nbInterrupted) {
+		publish();
+	}
+
+	return ret;
+}
+
+int SegmentIndex::appendChunk(eEntry kind, uint8_t trackMask, const ChunkDesc &chunk) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	SegIndexEntry entry = makeEntry(kind, trackMask, chunk);
+	bool wasValid = mValid;
+
+	replay(entry);
+
+	/* Chunk CRCs and gaps don't change the catalog, no need to copy it per chunk */
+	int ret = writeEntry(entry);
+	if (kind == eEntry::Corrupted || mValid != wasValid) {
+		publish();
+	}
+
+	return ret;
+}
+
+/*  The journal is read without the lock, appends and compaction go on meanwhile: a reader
+	racing an append stops at the entry being written, compaction renames a complete journal
+	over the old one. Only liveness of records is checked under the lock.
+*/
+int SegmentIndex::loadChunks(std::vector<TrackChunk> &chunks, eEntry kind) {
+	std::vector<SegIndexEntry> entries;
+
+	chunks.clear();
+
+	int ret = readJournal(entries);
+	if (ret != SEGINDEX_RETURN_SUCCESS && ret != SEGINDEX_RETURN_TORN) {
+		return ret;
+	}
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	for (auto &entry : entries) {
+		if ((eEntry)entry.kind == kind && isLive(entry.chunk.startTimestamp)) {
+			chunks.push_back({ entry.trackMask, entry.chunk });
+		}
+	}
+
+	return SEGINDEX_RETURN_SUCCESS;
+}
+
+int SegmentIndex::loadChunks(std::vector<SegIndexEntry> &entries, uint32_t startTimestamp) {
+	int ret = readJournal(entries);
+	if (ret != SEGINDEX_RETURN_SUCCESS && ret != SEGINDEX_RETURN_TORN) {
+		entries.clear();
+		return ret;
+	}
+
+	entries.erase(std::remove_if(entries.begin(), entries.end(), [&](const SegIndexEntry &entry) {
+		return !isChunkEntry(entry.kind) || entry.chunk.startTimestamp != startTimestamp;
+	}), entries.end());
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (!isLive(startTimestamp)) {
+		entries.clear();
+	}
+
+	return SEGINDEX_RETURN_SUCCESS;
+}
+
+std::vector<TrackChunk> SegmentIndex::getCorruptedRanges(uint32_t startTimestamp) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::vector<TrackChunk> ranges;
+
+	for (auto &range : mCorrupted) {
+		if (range.chunk.startTimestamp == startTimestamp) {
+			ranges.push_back(range);
+		}
+	}
+
+	return ranges;
+}
+
+int SegmentIndex::writeJournal(const std::string &path) {
+	std::vector<SegIndexEntry> entries, oldEntries;
+
+	/* Chunk CRCs, gaps and keyframes aren't kept in memory, carry over those of live records */
+	readJournal(oldEntries);
+	entries.reserve(mRecords.size() + mOpenedRecords.size() + mCorrupted.size() + mChunkEntries);
+
+	for (auto &it : mRecords) {
+		entries.push_back(makeEntry(eEntry::Close, it));
+	}
+
+	for (auto &range : mCorrupted) {
+		entries.push_back(makeEntry(eEntry::Corrupted, range.trackMask, range.chunk));
+	}
+
+	for (auto &entry : oldEntries) {
+		if (isChunkEntry(entry.kind) && isLive(entry.chunk.startTimestamp)) {
+			entries.push_back(entry);
+		}
+	}
+
+	for (auto startTimestamp : mOpenedRecords) {
+		RecordDesc desc;
+		memset(&desc, 0, sizeof(desc));
+		desc.startTimestamp = startTimestamp;
+		entries.push_back(makeEntry(eEntry::Open, desc));
+	}
+
+	IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::Metadata, (entries.size() + 1) * sizeof(SegIndexEntry));
+	int fd = getFileSystem().open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd == -1) {
+		return SEGINDEX_RETURN_IO_FAILURE;
+	}
+
+	SegIndexHeader header = makeHeader();
+	bool isWritten = writeAll(fd, &header, sizeof(header)) && 
+					 writeAll(fd, entries.data(), entries.size() * sizeof(SegIndexEntry));
+	getFileSystem().fsync(fd);
+	getFileSystem().close(fd);
+
+	if (!isWritten) {
+		return SEGINDEX_RETURN_IO_FAILURE;
+	}
+
+	mTotalEntries = entries.size();
+	mChunkEntries = 0;
+	for (auto &entry : entries) {
+		mChunkEntries += isChunkEntry(entry.kind) ? 1 : 0;
+	}
+
+	return SEGINDEX_RETURN_SUCCESS;
+}
+
+int SegmentIndex::compact() {
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::string tmpJournal = pathToJournal + ".new";
+
+	createDirectory(pathToIndex.c_str());
+
+	int ret = writeJournal(tmpJournal);
+	if (ret == SEGINDEX_RETURN_SUCCESS) {
+		IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::Metadata);
+		ret = (getFileSystem().rename(tmpJournal.c_str(), pathToJournal.c_str()) == 0) ? SEGINDEX_RETURN_SUCCESS : SEGINDEX_RETURN_IO_FAILURE;
+	}
+	mValid = (ret == SEGINDEX_RETURN_SUCCESS);
+	publish();
+
+	return ret;
+}
+
+int SegmentIndex::rebuild(const std::vector<RecordDesc> &records) {
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		mRecords = records;
+		mOpenedRecords.clear();
+		mInterruptedRecords.clear();
+		mCorrupted.clear();
+		std::sort(mRecords.begin(), mRecords.end(), sortByStartTimestamp);
+	}
+
+	return compact();
+}
+
+bool SegmentIndex::isValid() {
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mValid;
+}
+
+bool SegmentIndex::isInterrupted(uint32_t startTimestamp) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	return std::find(mInterruptedRecords.begin(), mInterruptedRecords.end(), startTimestamp) != mInterruptedRecords.end();
+}
+
+bool SegmentIndex::hasInterruptedRecords(uint32_t exceptTimestamp) {
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	for (auto startTimestamp : mInterruptedRecords) {
+		if (startTimestamp != exceptTimestamp) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+std::vector<RecordDesc> SegmentIndex::getRecords() {
+	return getSnapshot()->records;
+}
+
+std::shared_ptr<const SegIndexSnapshot> SegmentIndex::getSnapshot() {
+	return std::atomic_load(&mSnapshot);
+}
+
+/* MUST-BE called with mMutex held, or before the index is shared */
+void SegmentIndex::publish() {
+	auto snapshot = std::make_shared<SegIndexSnapshot>();
+
+	snapshot->records = mRecords;
+	snapshot->isValid = mValid;
+	snapshot->hasInterruptedRecords = !mInterruptedRecords.empty();
+	std::atomic_store(&mSnapshot, std::shared_ptr<const SegIndexSnapshot>(snapshot));
+}
@@ -0,0 +1,171 @@
+/*
+    On-card segment index, one append-only journal per day:
+        <MountPoint>/index/<Date>/segments.idx
+
+    Journal layout:
+        SegIndexHeader | SegIndexEntry | SegIndexEntry | ...
+
+    Every entry is protected by CRC32C. Besides record entries, the journal holds
+    the CRC32C of every chunk written to track files, silent gaps, keyframes and
+    nonces of records, they're only read back by loadChunks() (scrub, playback,
+    resume) so mount stays cheap. The journal is loaded with one sequential read,
+    entries are replayed in order to rebuild the in-memory catalog of the day.
+    A tail entry cut by power loss (short, or CRC mismatched) ends the journal, it's
+    truncated there on load and entries before it are kept. Only when the journal is
+    missing or its header is corrupted the owner must fall back to a directory scan
+    and call rebuild().
+
+    Writers (recorders, eviction, scrub) hold mMutex. Every change of the catalog
+    publishes a new immutable SegIndexSnapshot with an atomic shared pointer swap,
+    getSnapshot() and getRecords() never wait for a writer. A reader keeps the
+    snapshot it got alive until it drops it.
+*/
+#ifndef __SEGINDEX_H
+#define __SEGINDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <memory>
+
+#include "iosched.h"
+
+#define SEGINDEX_DIRECTORY                  "/index"
+#define SEGINDEX_JOURNAL_NAME               "segments.idx"
+#define SEGINDEX_MAGIC                      (0x58444953) /* "SIDX" */
+#define SEGINDEX_VERSION                    (1)
+
+/* Compact journal when dead entries exceed both live records and this threshold */
+#define SEGINDEX_COMPACT_THRESHOLD          (64)
+
+#define SEGINDEX_RETURN_SUCCESS             (0)
+#define SEGINDEX_RETURN_MISSING             (-1)
+#define SEGINDEX_RETURN_CORRUPTED           (-2)
+#define SEGINDEX_RETURN_IO_FAILURE          (-3)
+#define SEGINDEX_RETURN_TORN                (-4) /* Entries past the last complete one were dropped */
+
+/* RecordDesc::type, same values as SDCard::eQryPlaylist */
+#define RECORD_TYPE_FULL                    (1)
+#define RECORD_TYPE_MOTION                  (2)
+
+/* RecordDesc::trackMask */
+#define RECORD_TRACK_VIDEO                  (1 << 0)
+#define RECORD_TRACK_AUDIO                  (1 << 1)
+
+/* RecordDesc::flags */
+#define RECORD_FLAG_MOTION                  (1 << 0)
+#define RECORD_FLAG_RECOVERED               (1 << 1) /* Temporary record has been renamed by playlist query */
+#define RECORD_FLAG_CORRUPTED               (1 << 2) /* Scrub found corrupted ranges, see SegmentIndex::getCorruptedRanges() */
+#define RECORD_FLAG_ENCRYPTED               (1 << 3) /* Track files are AES-CTR encrypted, see aesctr.h */
+
+/*  Compact description of one audio & video record pair. It never holds text,
+    use SDCard::formatRecordName() and SDCard::formatRecordTime() at the API
+    boundary to get strings.
+*/
+typedef struct __attribute__((packed)) {
+    uint32_t startTimestamp;
+    uint32_t endTimestamp;
+    uint32_t sizeInBytes;   /* Video + audio */
+    uint8_t type;           /* RECORD_TYPE_FULL or RECORD_TYPE_MOTION */
+    uint8_t flags;
+    uint8_t trackMask;
+    uint8_t reserved;
+} RecordDesc;
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entrySize;
+    uint32_t reserved;
+    uint32_t crc;
+} SegIndexHeader;
+
+/* Integrity of one chunk of a track file */
+typedef struct __attribute__((packed)) {
+    uint32_t startTimestamp;    /* Record key */
+    uint32_t offset;
+    uint32_t length;
+    uint32_t crc;               /* CRC32C of bytes on disk */
+} ChunkDesc;
+
+typedef struct __attribute__((packed)) {
+    uint8_t kind;               /* SegmentIndex::eEntry */
+    uint8_t trackMask;          /* Only for Chunk and Corrupted entries */
+    uint8_t reserved[2];
+    union {
+        RecordDesc desc;        /* Open, Close, Remove */
+        ChunkDesc chunk;        /* Chunk, Corrupted */
+    };
+    uint32_t crc;
+} SegIndexEntry;
+
+typedef struct {
+    uint8_t trackMask;
+    ChunkDesc chunk;
+} TrackChunk;
+
+typedef struct {
+    std::vector<RecordDesc> records;    /* Sorted by start timestamp */
+    bool isValid;
+    bool hasInterruptedRecords;         /* Records left opened by a previous run */
+} SegIndexSnapshot;
+
+class SegmentIndex {
+public:
+    enum class eEntry : uint8_t {
+        Open = 1,   /* Track record has started, it must be followed by Close */
+        Close,      /* Track record has completed, merged with other tracks by start timestamp */
+        Remove,     /* Record (all tracks) has been erased */
+        Chunk,      /* CRC32C of a chunk written to a track file */
+        Corrupted,  /* Range of a track file failed verification */
+        Gap,        /* Silence not written at offset of a track file, chunk.crc holds the silence byte */
+        Keyframe,   /* Access unit with an IDR slice at offset of a video track, chunk.length holds its frame number */
+        Nonce,      /* Key stream nonce of an encrypted track, chunk.offset and chunk.length hold its high and low 32 bits */
+    };
+
+    SegmentIndex(std::string pathToIndex);
+    ~SegmentIndex();
+
+    int load(bool isReadOnly = false);  /* Read-only (tools) keeps a torn tail on card */
+    int rebuild(const std::vector<RecordDesc> &records);
+    int append(eEntry kind, const RecordDesc &desc);
+    int appendChunk(eEntry kind, uint8_t trackMask, const ChunkDesc &chunk);
+    int compact();
+
+    bool isValid();
+    bool hasInterruptedRecords(uint32_t exceptTimestamp);
+    bool isInterrupted(uint32_t startTimestamp);
+    std::vector<RecordDesc> getRecords();
+    std::shared_ptr<const SegIndexSnapshot> getSnapshot();
+    std::vector<TrackChunk> getCorruptedRanges(uint32_t startTimestamp);
+    int loadChunks(std::vector<TrackChunk> &chunks, eEntry kind = eEntry::Chunk);
+    int loadChunks(std::vector<SegIndexEntry> &entries, uint32_t startTimestamp);  /* Chunk-level entries of one record */
+
+private:
+    std::mutex mMutex;
+    bool mValid = false;
+    size_t mTotalEntries = 0;
+    size_t mChunkEntries = 0;
+    std::vector<RecordDesc> mRecords;      /* Sorted by start timestamp */
+    std::vector<uint32_t> mOpenedRecords;  /* Start timestamps of records not closed yet */
+    std::vector<uint32_t> mInterruptedRecords; /* Those of mOpenedRecords found by load() */
+    std::vector<TrackChunk> mCorrupted;
+    std::shared_ptr<const SegIndexSnapshot> mSnapshot;
+
+    bool isLive(uint32_t startTimestamp);
+    void replay(const SegIndexEntry &entry);
+    int readJournal(std::vector<SegIndexEntry> &entries, size_t *validSize = nullptr);
+    int truncateJournal(size_t validSize);
+    int writeEntry(const SegIndexEntry &entry);
+    int writeJournal(const std::string &path);
+    void publish();
+
+public:
+    std::string pathToIndex;
+    std::string pathToJournal;
+    std::shared_ptr<IOScheduler> ioScheduler;
+};
+
+#endif /* __SEGINDEX_H */
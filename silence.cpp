@@ -0,0 +1,74 @@
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "silence.h"
+
+#define ALAW_XOR_MASK			(0x55)
+#define ULAW_XOR_MASK			(0xFF)
+
+SilenceDetector::SilenceDetector(eLaw law, uint8_t threshold) {
+	mLaw = law;
+	mThreshold = threshold & 0x7F;
+	mQuietMs = 0;
+}
+
+SilenceDetector::~SilenceDetector() {
+
+}
+
+size_t SilenceDetector::countLoudSamples(const uint8_t *sample, size_t totalSample, eLaw law, uint8_t threshold) {
+	uint8_t mask = (law == eLaw::ALaw) ? ALAW_XOR_MASK : ULAW_XOR_MASK;
+	size_t loud = 0, i = 0;
+
+#if defined(__SSE2__)
+	const __m128i vMask = _mm_set1_epi8((char)mask);
+	const __m128i vMagnitude = _mm_set1_epi8(0x7F);
+	const __m128i vThreshold = _mm_set1_epi8((char)threshold);
+
+	/* Magnitude codes are 0..127, signed compare is exact */
+	for (; i + 16 <= totalSample; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(sample + i));
+		v = _mm_and_si128(_mm_xor_si128(v, vMask), vMagnitude);
+		loud += __builtin_popcount(_mm_movemask_epi8(_mm_cmpgt_epi8(v, vThreshold)));
+	}
+#elif defined(__aarch64__)
+	const uint8x16_t vMask = vdupq_n_u8(mask);
+	const uint8x16_t vMagnitude = vdupq_n_u8(0x7F);
+	const uint8x16_t vThreshold = vdupq_n_u8(threshold);
+	const uint8x16_t vOne = vdupq_n_u8(1);
+
+	for (; i + 16 <= totalSample; i += 16) {
+		uint8x16_t v = vandq_u8(veorq_u8(vld1q_u8(sample + i), vMask), vMagnitude);
+		loud += vaddlvq_u8(vandq_u8(vcgtq_u8(v, vThreshold), vOne));
+	}
+#endif
+
+	for (; i < totalSample; ++i) {
+		loud += (((sample[i] ^ mask) & 0x7F) > threshold) ? 1 : 0;
+	}
+
+	return loud;
+}
+
+bool SilenceDetector::isSilent(const uint8_t *sample, size_t totalSample) {
+	size_t loud = countLoudSamples(sample, totalSample, mLaw, mThreshold);
+
+	if (loud * SILENCE_LOUD_RATIO > totalSample) {
+		mQuietMs = 0;
+		return false;
+	}
+
+	mQuietMs += totalSample / SILENCE_G711_BYTES_PER_MS;
+	return mQuietMs > SILENCE_HANGOVER_MS;
+}
+
+void SilenceDetector::reset() {
+	mQuietMs = 0;
+}
+
+uint8_t SilenceDetector::getSilenceByte() {
+	return (mLaw == eLaw::ALaw) ? SILENCE_ALAW_BYTE : SILENCE_ULAW_BYTE;
+}
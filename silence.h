@@ -0,0 +1,49 @@
+/*
+    Silence detection on G.711 frames, without decoding to linear PCM.
+
+    A-law (x ^ 0x55) and u-law (~x) codes are sign + 7 bits of log magnitude, so the
+    7-bit code is compared to a threshold directly, 16 samples at a time (SSE2/AArch64 NEON).
+    A frame is quiet when few samples are loud, silence starts after a hangover so
+    tails of speech are kept.
+
+    Silent spans aren't written, the audio recorder journals them as Gap entries of
+    segment index and the playback reader regenerates the silence byte.
+*/
+#ifndef __SILENCE_H
+#define __SILENCE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SILENCE_DEFAULT_THRESHOLD           (0x1F)  /* Segments 0 and 1, below ~-36 dBFS */
+#define SILENCE_LOUD_RATIO                  (64)    /* Quiet if at most 1/64 samples are loud */
+#define SILENCE_HANGOVER_MS                 (500)
+#define SILENCE_G711_BYTES_PER_MS           (8)
+
+#define SILENCE_ALAW_BYTE                   (0xD5)
+#define SILENCE_ULAW_BYTE                   (0xFF)
+
+class SilenceDetector {
+public:
+    enum class eLaw {
+        ALaw,
+        MuLaw,
+    };
+
+    SilenceDetector(eLaw law, uint8_t threshold = SILENCE_DEFAULT_THRESHOLD);
+    ~SilenceDetector();
+
+    bool isSilent(const uint8_t *sample, size_t totalSample);
+    void reset();
+    uint8_t getSilenceByte();
+
+    /* Samples whose magnitude code is above threshold */
+    static size_t countLoudSamples(const uint8_t *sample, size_t totalSample, eLaw law, uint8_t threshold);
+
+private:
+    eLaw mLaw;
+    uint8_t mThreshold;
+    uint32_t mQuietMs;
+};
+
+#endif /* __SILENCE_H */
@@ -0,0 +1,449 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include "staging.h"
+#include "utils.hpp"
+
+#define LOCAL_DBG_EN			(0)
+
+#if (LOCAL_DBG_EN == 1)
+#define LOCAL_DBG(fmt, ...) 	printf("\x1B[36m" fmt "\x1B[0m", ##__VA_ARGS__)
+#else
+#define LOCAL_DBG(fmt, ...)
+#endif
+
+StagingTier::StagingTier(std::string pathToStaging, std::string mountPoint, uint64_t capacityInBytes, uint64_t reserveInBytes) {
+	this->pathToStaging.assign(pathToStaging);
+	this->mountPoint.assign(mountPoint);
+	this->mCapacity = capacityInBytes;
+	this->mReserve = reserveInBytes;
+
+	createDirectories(pathToStaging.c_str());
+	mFlusher = std::thread(&StagingTier::flusherLoop, this);
+}
+
+StagingTier::~StagingTier() {
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mExit = true;
+	}
+	mCondVar.notify_all();
+
+	if (mFlusher.joinable()) {
+		mFlusher.join();
+	}
+
+	/* Heads left behind are written in place by recover() on next start */
+	for (auto &job : mJobs) {
+		if (job.fdOnSDCard != -1) {
+			close(job.fdOnSDCard);
+		}
+	}
+}
+
+bool StagingTier::hasRoom() {
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	/* After an overflow, wait until half of the arena has been drained */
+	if (mOverflow) {
+		if (mUsage > mCapacity / 2) {
+			return false;
+		}
+		mOverflow = false;
+	}
+
+	return mUsage + mReserve <= mCapacity;
+}
+
+bool StagingTier::reserve(uint64_t nbBytes) {
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	if (mUsage + nbBytes > mCapacity) {
+		return false;
+	}
+	mUsage += nbBytes;
+
+	return true;
+}
+
+void StagingTier::account(int64_t nbBytes) {
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	if (nbBytes < 0 && (uint64_t)(-nbBytes) > mUsage) {
+		mUsage = 0;
+	}
+	else {
+		mUsage += nbBytes;
+	}
+}
+
+void StagingTier::setOverflow() {
+	std::lock_guard<std::mutex> lock(mMutex);
+	mOverflow = true;
+}
+
+std::string StagingTier::toStagingPath(const std::string &pathToRecords) {
+	if (pathToRecords.compare(0, mountPoint.size(), mountPoint) != 0) {
+		return pathToRecords;
+	}
+
+	return pathToStaging + pathToRecords.substr(mountPoint.size());
+}
+
+std::string StagingTier::locate(const std::string &pathOnSDCard) {
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	/* A head is only a part of the record, the SD Card file is the one to read */
+	for (auto &job : mJobs) {
+		if (job.pathOnSDCard == pathOnSDCard && !job.isHead) {
+			return job.stagedPath;
+		}
+	}
+
+	return pathOnSDCard;
+}
+
+void StagingTier::submit(const std::string &stagedPath, const std::string &pathOnSDCard) {
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mJobs.push_back({stagedPath, pathOnSDCard, false, -1});
+	}
+	mCondVar.notify_one();
+
+	LOCAL_DBG("[STAGING] Submit %s -> %s\n", stagedPath.c_str(), pathOnSDCard.c_str());
+}
+
+int StagingTier::handOver(const std::string &stagedPath, const std::string &pathOnSDCard) {
+	std::string headPath = stagedPath + STAGING_HEAD_SUFFIX;
+	int fdOnSDCard = -1;
+
+	setOverflow();
+
+	{
+		IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::Metadata);
+		fdOnSDCard = open(pathOnSDCard.c_str(), O_WRONLY);
+	}
+	if (fdOnSDCard == -1 || rename(stagedPath.c_str(), headPath.c_str()) != 0) {
+		if (fdOnSDCard != -1) {
+			close(fdOnSDCard);
+		}
+		return STAGING_RETURN_FAILURE;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mJobs.push_back({headPath, pathOnSDCard, true, fdOnSDCard});
+	}
+	mCondVar.notify_one();
+
+	LOCAL_DBG("[STAGING] Hand over %s -> %s\n", headPath.c_str(), pathOnSDCard.c_str());
+
+	return STAGING_RETURN_SUCCESS;
+}
+
+void StagingTier::discard(const std::string &pathOnSDCard) {
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	for (size_t id = 0; id < mJobs.size(); ++id) {
+		if (mJobs[id].pathOnSDCard != pathOnSDCard) {
+			continue;
+		}
+
+		/* The front job may be migrating now -> The flusher drops it instead of renaming */
+		if (id == 0) {
+			mCancelled = true;
+		}
+		else {
+			drop(mJobs[id]);
+			mJobs.erase(mJobs.begin() + id);
+		}
+		break;
+	}
+}
+
+void StagingTier::discardAll() {
+	std::unique_lock<std::mutex> lock(mMutex);
+
+	while (mJobs.size() > 1) {
+		drop(mJobs.back());
+		mJobs.pop_back();
+	}
+	if (!mJobs.empty()) {
+		mCancelled = true;
+		mCondVar.notify_all();
+		mCondVar.wait(lock, [this] { return mJobs.empty(); });
+	}
+}
+
+void StagingTier::drop(const MigrateJob &job) {
+	struct stat fStat;
+
+	if (stat(job.stagedPath.c_str(), &fStat) == 0) {
+		mUsage -= std::min(mUsage, (uint64_t)fStat.st_size);
+	}
+	unlink(job.stagedPath.c_str());
+
+	if (job.fdOnSDCard != -1) {
+		close(job.fdOnSDCard);
+	}
+}
+
+void StagingTier::recover() {
+	static const char *tracks[] = { "/video", "/audio" };
+
+	for (auto track : tracks) {
+		std::string pathToTrack = pathToStaging + track;
+
+		DIR *dirTrack = opendir(pathToTrack.c_str());
+		if (dirTrack == nullptr) {
+			continue;
+		}
+
+		struct dirent *entDate;
+		while ((entDate = readdir(dirTrack)) != NULL) {
+			if (entDate->d_type != DT_DIR || entDate->d_name[0] == '.') {
+				continue;
+			}
+
+			std::string relativeDate = std::string(track) + "/" + entDate->d_name;
+			DIR *dirDate = opendir(std::string(pathToStaging + relativeDate).c_str());
+			if (dirDate == nullptr) {
+				continue;
+			}
+
+			struct dirent *ent;
+			while ((ent = readdir(dirDate)) != NULL) {
+				if (ent->d_type != DT_REG) {
+					continue;
+				}
+
+				std::string name(ent->d_name);
+				std::string stagedPath = pathToStaging + relativeDate + "/" + name;
+				struct stat fStat;
+				if (stat(stagedPath.c_str(), &fStat) == 0) {
+					account(fStat.st_size);
+				}
+
+				size_t headPos = name.size() - std::min(name.size(), strlen(STAGING_HEAD_SUFFIX));
+				LOCAL_DBG("[STAGING] Recover %s\n", stagedPath.c_str());
+
+				if (name.compare(headPos, std::string::npos, STAGING_HEAD_SUFFIX) != 0) {
+					submit(stagedPath, mountPoint + relativeDate + "/" + name);
+					continue;
+				}
+
+				/* Staged part of a record continued on SD Card, the SD Card file is opened when migrating */
+				{
+					std::lock_guard<std::mutex> lock(mMutex);
+					mJobs.push_back({stagedPath, mountPoint + relativeDate + "/" + name.substr(0, headPos), true, -1});
+				}
+				mCondVar.notify_one();
+			}
+			closedir(dirDate);
+		}
+		closedir(dirTrack);
+	}
+}
+
+uint64_t StagingTier::getUsage() {
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mUsage;
+}
+
+size_t StagingTier::getPendingJobs() {
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mJobs.size();
+}
+
+void StagingTier::flusherLoop() {
+	std::unique_lock<std::mutex> lock(mMutex);
+
+	while (1) {
+		mCondVar.wait(lock, [this] { return mExit || !mJobs.empty(); });
+
+		if (mJobs.empty()) {
+			break; /* Exit requested and everything has been flushed */
+		}
+
+		MigrateJob job = mJobs.front();
+		int ret = STAGING_RETURN_SUCCESS;
+		if (!mCancelled) {
+			lock.unlock();
+			ret = job.isHead ? migrateHead(job) : migrate(job);
+			lock.lock();
+		}
+
+		if (ret == STAGING_RETURN_SUCCESS || mCancelled) {
+			if (mCancelled) {
+				drop(job);
+			}
+			else if (job.fdOnSDCard != -1) {
+				close(job.fdOnSDCard);
+			}
+			mJobs.pop_front();
+			mCancelled = false;
+			mCondVar.notify_all();
+		}
+		else if (mExit) {
+			break; /* Staged files are kept, they're migrated by recover() on next start */
+		}
+		else {
+			mCondVar.wait_for(lock, std::chrono::seconds(STAGING_RETRY_INTERVAL_SECS), [this] { return mExit || mCancelled; });
+		}
+	}
+}
+
+int StagingTier::migrate(const MigrateJob &job) {
+	std::string pathToMigrate = job.pathOnSDCard + STAGING_MIGRATE_SUFFIX;
+	struct stat fStat;
+
+	int fdIn = open(job.stagedPath.c_str(), O_RDONLY);
+	if (fdIn == -1) {
+		/* Already migrated (or discarded) */
+		return (errno == ENOENT) ? STAGING_RETURN_SUCCESS : STAGING_RETURN_FAILURE;
+	}
+	fstat(fdIn, &fStat);
+
+	int fdOut = -1;
+	{
+		IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::LiveWrite);
+		fdOut = open(pathToMigrate.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	}
+	if (fdOut == -1) {
+		close(fdIn);
+		return STAGING_RETURN_FAILURE;
+	}
+
+	std::vector<uint8_t> buffer(STAGING_FLUSH_CHUNK_SIZE);
+	bool isCompleted = true;
+	ssize_t nbRead;
+
+	while ((nbRead = read(fdIn, buffer.data(), buffer.size())) > 0) {
+		IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::LiveWrite, nbRead);
+		ssize_t nbWritten = 0;
+		while (nbWritten < nbRead) {
+			ssize_t n = write(fdOut, buffer.data() + nbWritten, nbRead - nbWritten);
+			if (n <= 0) {
+				isCompleted = false;
+				break;
+			}
+			nbWritten += n;
+		}
+		if (!isCompleted) {
+			break;
+		}
+	}
+	IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::LiveWrite);
+	isCompleted = isCompleted && (nbRead == 0) && (fsync(fdOut) == 0);
+
+	close(fdOut);
+	close(fdIn);
+
+	/* Record discarded while copying must not come back on SD Card, its copy is dropped */
+	bool isCancelled = false;
+	if (isCompleted) {
+		std::lock_guard<std::mutex> lock(mMutex);
+		isCancelled = mCancelled;
+		isCompleted = !isCancelled && rename(pathToMigrate.c_str(), job.pathOnSDCard.c_str()) == 0;
+	}
+	if (!isCompleted) {
+		unlink(pathToMigrate.c_str());
+		return isCancelled ? STAGING_RETURN_SUCCESS : STAGING_RETURN_FAILURE;
+	}
+
+	/* Make the rename durable before the staged copy disappears */
+	std::string parentDirectory = job.pathOnSDCard.substr(0, job.pathOnSDCard.rfind('/'));
+	int fdDir = open(parentDirectory.c_str(), O_RDONLY | O_DIRECTORY);
+	if (fdDir != -1) {
+		fsync(fdDir);
+		close(fdDir);
+	}
+
+	unlink(job.stagedPath.c_str());
+	account(-(int64_t)fStat.st_size);
+
+	LOCAL_DBG("[STAGING] Migrated %s (%ld bytes)\n", job.pathOnSDCard.c_str(), (long)fStat.st_size);
+
+	return STAGING_RETURN_SUCCESS;
+}
+
+int StagingTier::migrateHead(const MigrateJob &job) {
+	struct stat fStat;
+
+	int fdIn = open(job.stagedPath.c_str(), O_RDONLY);
+	if (fdIn == -1) {
+		return (errno == ENOENT) ? STAGING_RETURN_SUCCESS : STAGING_RETURN_FAILURE;
+	}
+	fstat(fdIn, &fStat);
+
+	/* Recovered head: the record may have been completed (renamed without its temporary suffix) */
+	int fdOut = job.fdOnSDCard;
+	if (fdOut == -1) {
+		IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::Metadata);
+		std::string completedPath = job.pathOnSDCard.substr(0, job.pathOnSDCard.rfind('.'));
+		fdOut = open(job.pathOnSDCard.c_str(), O_WRONLY);
+		if (fdOut == -1) {
+			fdOut = open(completedPath.c_str(), O_WRONLY);
+		}
+	}
+	if (fdOut == -1) {
+		/* Day folder still there -> Record has been erased meanwhile, its head goes with it */
+		struct stat dirStat;
+		std::string parentDirectory = job.pathOnSDCard.substr(0, job.pathOnSDCard.rfind('/'));
+		bool isErased = (errno == ENOENT) && stat(parentDirectory.c_str(), &dirStat) == 0;
+		close(fdIn);
+		if (isErased) {
+			unlink(job.stagedPath.c_str());
+			account(-(int64_t)fStat.st_size);
+			return STAGING_RETURN_SUCCESS;
+		}
+		return STAGING_RETURN_FAILURE;
+	}
+
+	/* The SD Card file has been sized past the head by the recorder, it's written in place */
+	std::vector<uint8_t> buffer(STAGING_FLUSH_CHUNK_SIZE);
+	bool isCompleted = true;
+	off_t offset = 0;
+	ssize_t nbRead;
+
+	while ((nbRead = pread(fdIn, buffer.data(), buffer.size(), offset)) > 0) {
+		IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::LiveWrite, nbRead);
+		ssize_t nbWritten = 0;
+		while (nbWritten < nbRead) {
+			ssize_t n = pwrite(fdOut, buffer.data() + nbWritten, nbRead - nbWritten, offset + nbWritten);
+			if (n <= 0) {
+				isCompleted = false;
+				break;
+			}
+			nbWritten += n;
+		}
+		if (!isCompleted) {
+			break;
+		}
+		offset += nbRead;
+	}
+	IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::LiveWrite);
+	isCompleted = isCompleted && (nbRead == 0) && (fdatasync(fdOut) == 0);
+
+	if (fdOut != job.fdOnSDCard) {
+		close(fdOut);
+	}
+	close(fdIn);
+
+	if (!isCompleted) {
+		return STAGING_RETURN_FAILURE;
+	}
+
+	unlink(job.stagedPath.c_str());
+	account(-(int64_t)fStat.st_size);
+
+	LOCAL_DBG("[STAGING] Head of %s written (%ld bytes)\n", job.pathOnSDCard.c_str(), (long)fStat.st_size);
+
+	return STAGING_RETURN_SUCCESS;
+}
@@ -0,0 +1,96 @@
+/*
+    Optional RAM staging tier (tmpfs) in front of the SD Card.
+
+    Records are written into a mirror of the SD Card layout under the staging root:
+        <StagingRoot>/video/<Date>/<Record>.h264.tmp
+        <StagingRoot>/audio/<Date>/<Record>.g711.tmp
+
+    When a record is completed it's submitted to a background flusher which migrates
+    it to the SD Card with large sequential writes:
+        1. Copy staged file to <SDPath>.mig, fsync
+        2. Rename <SDPath>.mig to <SDPath>, fsync parent directory
+        3. Unlink staged file
+
+    A crash in any step leaves the staged file in place, it's migrated again by
+    recover() on next start.
+
+    Every write into the arena is reserved first. When a write wouldn't fit (or the
+    tmpfs returns short) under a live record, the recorder continues on SD Card past
+    the staged size and hands the staged part over as <Record>.head: the flusher
+    writes it in place at the start of the SD Card file, then unlinks it.
+*/
+#ifndef __STAGING_H
+#define __STAGING_H
+
+#include <stdint.h>
+#include <string>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <memory>
+
+#include "iosched.h"
+
+#define STAGING_DEFAULT_ROOT                "/tmp/sd_staging"
+#define STAGING_MIGRATE_SUFFIX              ".mig"
+#define STAGING_HEAD_SUFFIX                 ".head"
+#define STAGING_FLUSH_CHUNK_SIZE            (1024 * 1024)
+#define STAGING_RETRY_INTERVAL_SECS         (5)
+
+#define STAGING_RETURN_SUCCESS              (0)
+#define STAGING_RETURN_FAILURE              (-1)
+
+class StagingTier {
+public:
+    StagingTier(std::string pathToStaging, std::string mountPoint, uint64_t capacityInBytes, uint64_t reserveInBytes);
+    ~StagingTier();
+
+    bool hasRoom();
+    bool reserve(uint64_t nbBytes);     /* Fails if the arena would exceed its capacity */
+    void account(int64_t nbBytes);
+    void setOverflow();
+
+    std::string toStagingPath(const std::string &pathToRecords);
+    std::string locate(const std::string &pathOnSDCard);
+
+    void submit(const std::string &stagedPath, const std::string &pathOnSDCard);
+    int handOver(const std::string &stagedPath, const std::string &pathOnSDCard);
+    void discard(const std::string &pathOnSDCard);
+    void discardAll();      /* Every staged record is dropped, returns once no migration is running */
+    void recover();
+
+    uint64_t getUsage();
+    size_t getPendingJobs();
+
+private:
+    typedef struct {
+        std::string stagedPath;
+        std::string pathOnSDCard;
+        bool isHead;        /* Staged part of a record continued on SD Card */
+        int fdOnSDCard;     /* Opened at hand over, the record may be renamed meanwhile */
+    } MigrateJob;
+
+    std::mutex mMutex;
+    std::condition_variable mCondVar;
+    std::deque<MigrateJob> mJobs;
+    std::thread mFlusher;
+    bool mExit = false;
+    bool mOverflow = false;
+    bool mCancelled = false;    /* Front job has been discarded while migrating */
+    uint64_t mUsage = 0;
+    uint64_t mCapacity;
+    uint64_t mReserve;
+
+    void flusherLoop();
+    int migrate(const MigrateJob &job);
+    int migrateHead(const MigrateJob &job);
+    void drop(const MigrateJob &job);
+
+public:
+    std::string pathToStaging;
+    std::string mountPoint;
+    std::shared_ptr<IOScheduler> ioScheduler;   /* Migration is the live write path of SD Card */
+};
+
+#endif /* __STAGING_H */
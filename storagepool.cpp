@@ -0,0 +1,362 @@
+#include <string.h>
+#include <algorithm>
+
+#include "storagepool.h"
+#include "utils.hpp"
+
+#define LOCAL_DBG_EN			(0)
+
+#if (LOCAL_DBG_EN == 1)
+#define LOCAL_DBG(fmt, ...) 	printf("\x1B[36m" fmt "\x1B[0m", ##__VA_ARGS__)
+#else
+#define LOCAL_DBG(fmt, ...)
+#endif
+
+static bool sortListByTime(const RecordDesc &t1, const RecordDesc &t2) {
+	return t1.startTimestamp > t2.startTimestamp; /* Newest first */
+}
+
+void StoragePool::addDevice(std::shared_ptr<SDCard> sdCard) {
+	mDevices.push_back(sdCard);
+	mCredits.push_back(0);
+	mSegments.push_back(0);
+}
+
+const std::vector<std::shared_ptr<SDCard>> &StoragePool::getDevices() {
+	return mDevices;
+}
+
+std::shared_ptr<SDCard> StoragePool::getActiveDevice() {
+	return (mActive == -1) ? nullptr : mDevices[mActive];
+}
+
+uint32_t StoragePool::getPlacedSegments(size_t device) {
+	return (device < mSegments.size()) ? mSegments[device] : 0;
+}
+
+MemMang_t StoragePool::getCapacity() {
+	MemMang_t capacity;
+
+	memset(&capacity, 0, sizeof(capacity));
+	for (auto &sdCard : mDevices) {
+		if (sdCard->eStatus != SDCard::eState::Mounted) {
+			continue;
+		}
+		capacity.total	+= sdCard->totalCapacity;
+		capacity.used	+= sdCard->usedCapacity;
+		capacity.free	+= sdCard->freeCapacity;
+	}
+
+	return capacity;
+}
+
+void StoragePool::setStreamBitrate(uint32_t bitsPerSec) {
+	for (auto &sdCard : mDevices) {
+		sdCard->setStreamBitrate(bitsPerSec);
+	}
+}
+
+std::vector<std::string> StoragePool::getRecordDays() {
+	std::vector<std::string> ret;
+
+	for (auto &sdCard : mDevices) {
+		std::vector<std::string> days = sdCard->getRecordDays();
+		ret.insert(ret.end(), days.begin(), days.end());
+	}
+	std::sort(ret.begin(), ret.end());
+	ret.erase(std::unique(ret.begin(), ret.end()), ret.end());
+
+	return ret;
+}
+
+std::vector<RecordDesc> StoragePool::getAllPlaylists(std::string dateTime, SDCard::eQryPlaylist type) {
+	std::vector<RecordDesc> ret;
+
+	getPlaylistPage(ret, dateTime, type);
+	return ret;
+}
+
+size_t StoragePool::getPlaylistPage(std::vector<RecordDesc> &page,
+									std::string dateTime,
+									SDCard::eQryPlaylist type,
+									uint32_t beforeTimestamp,
+									size_t maxRecords)
+{
+	std::vector<RecordDesc> devicePage;
+
+	/* Each device returns its newest "maxRecords", the pool page is among them */
+	page.clear();
+	for (auto &sdCard : mDevices) {
+		sdCard->getPlaylistPage(devicePage, dateTime, type, beforeTimestamp, maxRecords);
+		page.insert(page.end(), devicePage.begin(), devicePage.end());
+	}
+	std::sort(page.begin(), page.end(), sortListByTime);
+	if (page.size() > maxRecords) {
+		page.resize(maxRecords);
+	}
+
+	return page.size();
+}
+
+std::vector<MotionInterval> StoragePool::getMotionIntervals(uint32_t fromTimestamp, uint32_t toTimestamp) {
+	std::vector<MotionInterval> intervals;
+	std::vector<MotionInterval> ret;
+
+	for (auto &sdCard : mDevices) {
+		std::vector<MotionInterval> deviceIntervals = sdCard->getMotionIntervals(fromTimestamp, toTimestamp);
+		intervals.insert(intervals.end(), deviceIntervals.begin(), deviceIntervals.end());
+	}
+	std::sort(intervals.begin(), intervals.end(), [](const MotionInterval &t1, const MotionInterval &t2) {
+		return t1.startTimestamp < t2.startTimestamp;
+	});
+
+	/* An event spanning a device switch is split between both bitmaps */
+	for (auto &interval : intervals) {
+		if (!ret.empty() && interval.startTimestamp <= ret.back().endTimestamp) {
+			ret.back().endTimestamp = std::max(ret.back().endTimestamp, interval.endTimestamp);
+		}
+		else {
+			ret.push_back(interval);
+		}
+	}
+
+	return ret;
+}
+
+std::vector<DaySummary> StoragePool::getDaySummaries() {
+	std::vector<DaySummary> ret;
+
+	for (auto &sdCard : mDevices) {
+		std::vector<DaySummary> deviceDays = sdCard->getDaySummaries();
+		ret.insert(ret.end(), deviceDays.begin(), deviceDays.end());
+	}
+	std::stable_sort(ret.begin(), ret.end(), [](const DaySummary &t1, const DaySummary &t2) {
+		return strcmp(t1.dateTime, t2.dateTime) < 0;
+	});
+
+	/* Same day on several devices */
+	std::vector<DaySummary> merged;
+	for (auto &day : ret) {
+		if (merged.empty() || strcmp(merged.back().dateTime, day.dateTime) != 0) {
+			merged.push_back(day);
+			continue;
+		}
+
+		for (int track = 0; track < STORAGESUMMARY_TRACKS; ++track) {
+			merged.back().tracks[track].sizeInBytes 	+= day.tracks[track].sizeInBytes;
+			merged.back().tracks[track].segments 		+= day.tracks[track].segments;
+			merged.back().tracks[track].recordedSecs 	+= day.tracks[track].recordedSecs;
+			merged.back().tracks[track].motionSecs 		+= day.tracks[track].motionSecs;
+		}
+	}
+
+	return merged;
+}
+
+std::shared_ptr<SDCard> StoragePool::locateRecord(std::string dateTime, uint32_t startTimestamp) {
+	std::vector<RecordDesc> page;
+
+	for (auto &sdCard : mDevices) {
+		if (sdCard->getPlaylistPage(page, dateTime, SDCard::eQryPlaylist::All, startTimestamp + 1, 1) == 1 &&
+			page[0].startTimestamp == startTimestamp)
+		{
+			return sdCard;
+		}
+	}
+
+	return nullptr;
+}
+
+std::shared_ptr<SegmentReader> StoragePool::openSegmentReader(std::string dateTime, const RecordDesc &desc) {
+	std::shared_ptr<SDCard> sdCard = locateRecord(dateTime, desc.startTimestamp);
+
+	return sdCard ? sdCard->openSegmentReader(dateTime, desc) : nullptr;
+}
+
+void StoragePool::eraseOldestRecords(std::string dateTime) {
+	if (dateTime.empty()) {
+		std::vector<std::vector<std::string>> deviceDays;
+		std::string oldestDay;
+
+		for (auto &sdCard : mDevices) {
+			deviceDays.push_back(sdCard->getRecordDays());
+			if (!deviceDays.back().empty() && (oldestDay.empty() || deviceDays.back().front() < oldestDay)) {
+				oldestDay = deviceDays.back().front();
+			}
+		}
+		if (oldestDay.empty()) {
+			return;
+		}
+
+		for (size_t id = 0; id < mDevices.size(); ++id) {
+			if (std::binary_search(deviceDays[id].begin(), deviceDays[id].end(), oldestDay)) {
+				LOCAL_DBG("[POOL] Erase %s of device %zu\n", oldestDay.c_str(), id);
+				mDevices[id]->eraseRecordDay(oldestDay);
+			}
+		}
+		return;
+	}
+
+	std::shared_ptr<SDCard> oldestDevice;
+	uint32_t oldestTimestamp = 0;
+
+	for (auto &sdCard : mDevices) {
+		std::vector<RecordDesc> records = sdCard->getAllPlaylists(dateTime, SDCard::eQryPlaylist::All);
+		if (!records.empty() && (!oldestDevice || records.back().startTimestamp < oldestTimestamp)) {
+			oldestDevice = sdCard;
+			oldestTimestamp = records.back().startTimestamp;
+		}
+	}
+	if (oldestDevice) {
+		oldestDevice->eraseOldestRecords(dateTime);
+	}
+}
+
+void StoragePool::ENTRY_ATOMIC(StoragePool &pool) {
+	/* Always in the order devices were added */
+	for (auto &sdCard : pool.mDevices) {
+		SDCard::ENTRY_ATOMIC(*sdCard);
+	}
+}
+
+void StoragePool::EXIT_ATOMIC(StoragePool &pool) {
+	for (auto it = pool.mDevices.rbegin(); it != pool.mDevices.rend(); ++it) {
+		SDCard::EXIT_ATOMIC(**it);
+	}
+}
+
+bool StoragePool::isPoolMounted(StoragePool &pool) {
+	bool isMounted = false;
+
+	for (auto &sdCard : pool.mDevices) {
+		if (SDCard::isSDCardMounted(*sdCard)) {
+			isMounted = true;
+		}
+	}
+
+	/* Device of current segment was removed, the session goes on with another one */
+	if (pool.mActive != -1 && pool.mDevices[pool.mActive]->eStatus != SDCard::eState::Mounted) {
+		LOCAL_DBG("[POOL] Device %d is gone\n", pool.mActive);
+		SDCard::closeCurrentSession(*pool.mDevices[pool.mActive]);
+		pool.mActive = -1;
+		if (!pool.currentSession.empty()) {
+			pool.placeSegment(pool.selectDevice());
+		}
+	}
+
+	return isMounted;
+}
+
+int StoragePool::openSessionRecord(StoragePool &pool, Recorder::eOption option, int durationInSecs) {
+	/* Do nothing if current session record is existed */
+	if (pool.currentSession.empty() == false) {
+		return STORAGEPOOL_RETURN_SUCCESS;
+	}
+
+	pool.currentSession = getTodayDateString();
+	pool.mOption = option;
+	pool.mDurationInSecs = durationInSecs;
+
+	return pool.placeSegment(pool.selectDevice());
+}
+
+void StoragePool::closeCurrentSession(StoragePool &pool) {
+	/* Do nothing if current session record isn't existed */
+	if (pool.currentSession.empty() == true) {
+		return;
+	}
+
+	pool.currentSession.clear();
+	if (pool.mActive != -1) {
+		SDCard::closeCurrentSession(*pool.mDevices[pool.mActive]);
+		pool.mActive = -1;
+	}
+}
+
+int StoragePool::storageSamples(StoragePool &pool, Recorder::eType type, uint8_t *sample, size_t totalSample) {
+	if (pool.mActive == -1) {
+		return STORAGEPOOL_NO_DEVICE;
+	}
+
+	std::shared_ptr<SDCard> sdCard = pool.mDevices[pool.mActive];
+	if (type == Recorder::eType::Video) {
+		size_t splitOffset = sdCard->videoRecorder->getSplitOffset(sample, totalSample);
+
+		/*  Next segment is placed at the split point. It only moves to another device at the
+			start of a sample, a split inside it stays with the device of the head.
+		*/
+		if (splitOffset != RECORD_NO_SPLIT) {
+			int device = (splitOffset == 0) ? pool.selectDevice() : pool.mActive;
+			if (pool.placeSegment(device) != STORAGEPOOL_RETURN_SUCCESS) {
+				return STORAGEPOOL_NO_DEVICE;
+			}
+			sdCard = pool.mDevices[pool.mActive];
+		}
+	}
+
+	std::shared_ptr<Recorder> rec = (type == Recorder::eType::Video) ? sdCard->videoRecorder : sdCard->audioRecorder;
+	if (SDCard::storageSamples(rec, sample, totalSample) != SDCARD_RETURN_SUCCESS) {
+		return STORAGEPOOL_STORAGE_FAILURE;
+	}
+
+	return STORAGEPOOL_RETURN_SUCCESS;
+}
+
+int StoragePool::selectDevice() {
+	int selected = -1;
+	int fallback = -1;
+
+	mTotalWeight = 0;
+	for (size_t id = 0; id < mDevices.size(); ++id) {
+		std::shared_ptr<SDCard> sdCard = mDevices[id];
+		if (sdCard->eStatus != SDCard::eState::Mounted) {
+			continue;
+		}
+
+		sdCard->updateCapacity();
+		if (fallback == -1 || sdCard->freeCapacity > mDevices[fallback]->freeCapacity) {
+			fallback = (int)id;
+		}
+		if (sdCard->freeCapacity < STORAGEPOOL_SEGMENT_RESERVE || !sdCard->isBitrateSustained()) {
+			continue;
+		}
+
+		/* KB/s of the device scaled by its free space, in permille */
+		uint64_t throughput = sdCard->getCardProfile().writeBytesPerSec;
+		if (throughput == 0) {
+			throughput = STORAGEPOOL_DEFAULT_THROUGHPUT;
+		}
+		uint64_t freePermille = (sdCard->totalCapacity != 0) ? sdCard->freeCapacity * 1000 / sdCard->totalCapacity : 0;
+		int64_t weight = std::max((int64_t)(throughput / 1024 * freePermille / 1000), (int64_t)1);
+
+		mCredits[id] += weight;
+		mTotalWeight += weight;
+		if (selected == -1 || mCredits[id] > mCredits[selected]) {
+			selected = (int)id;
+		}
+	}
+
+	return (selected != -1) ? selected : fallback;
+}
+
+int StoragePool::placeSegment(int device) {
+	if (device == -1) {
+		LOCAL_DBG("[POOL] No device for the segment\n");
+		return STORAGEPOOL_NO_DEVICE;
+	}
+
+	mCredits[device] -= mTotalWeight;
+	mTotalWeight = 0;
+	++mSegments[device];
+
+	if (device != mActive) {
+		LOCAL_DBG("[POOL] Segment %u on device %d\n", mSegments[device], device);
+		if (mActive != -1) {
+			SDCard::closeCurrentSession(*mDevices[mActive]);
+		}
+		SDCard::openSessionRecord(*mDevices[device], mOption, mDurationInSecs);
+		mActive = device;
+	}
+
+	return STORAGEPOOL_RETURN_SUCCESS;
+}
@@ -0,0 +1,93 @@
+/*
+    Storage pool over several devices (SD slot, USB storage, ...), each one an SDCard.
+
+    Every device keeps its own layout, journal and catalog, a device pulled out of the
+    pool still reads alone. The unit of placement is the segment (video + audio record
+    pair): when the video track reaches a split point the pool picks the device of the
+    next segment and moves the session there. Devices are weighted by
+        write throughput of the card profile * free space / capacity
+    with a smooth weighted round robin, so each device takes a share of the stream it
+    sustains and fuller devices take less of it. A device with less than
+    STORAGEPOOL_SEGMENT_RESERVE free, or not sustaining the stream bitrate, only takes a
+    segment if no other device can.
+
+    Catalog, playlists, motion, day summaries and retention are the union of the devices,
+    merged by timestamp. Retention erases the oldest day (or record) of the pool on every device
+    holding it.
+
+    Devices are added before the pool is used. Session and samples functions MUST-BE
+    called in ENTRY_ATOMIC() and EXIT_ATOMIC(), it locks every device.
+*/
+#ifndef __STORAGEPOOL_H
+#define __STORAGEPOOL_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "SDCard.h"
+
+#define STORAGEPOOL_DEFAULT_THROUGHPUT      (1024 * 1024)           /* Bytes per second of a device not profiled */
+#define STORAGEPOOL_SEGMENT_RESERVE         (32 * 1024 * 1024)      /* Free space a device needs to take a segment */
+
+#define STORAGEPOOL_RETURN_SUCCESS          (0)
+#define STORAGEPOOL_NO_DEVICE               (-1)
+#define STORAGEPOOL_STORAGE_FAILURE         (-2)
+
+class StoragePool {
+public:
+    void addDevice(std::shared_ptr<SDCard> sdCard);
+    const std::vector<std::shared_ptr<SDCard>> &getDevices();
+    std::shared_ptr<SDCard> getActiveDevice();
+    uint32_t getPlacedSegments(size_t device);
+    MemMang_t getCapacity();
+    void setStreamBitrate(uint32_t bitsPerSec);
+
+    /* Union of the devices, newest record first */
+    std::vector<std::string> getRecordDays();
+    std::vector<RecordDesc> getAllPlaylists(std::string dateTime, SDCard::eQryPlaylist type);
+    size_t getPlaylistPage(std::vector<RecordDesc> &page,
+                           std::string dateTime,
+                           SDCard::eQryPlaylist type,
+                           uint32_t beforeTimestamp = SDCARD_PLAYLIST_NO_CURSOR,
+                           size_t maxRecords = SDCARD_PLAYLIST_NO_LIMIT);
+    std::vector<MotionInterval> getMotionIntervals(uint32_t fromTimestamp, uint32_t toTimestamp);
+    /* Totals of a day summed over the devices holding it */
+    std::vector<DaySummary> getDaySummaries();
+
+    /* Device holding a record, nullptr if none */
+    std::shared_ptr<SDCard> locateRecord(std::string dateTime, uint32_t startTimestamp);
+    std::shared_ptr<SegmentReader> openSegmentReader(std::string dateTime, const RecordDesc &desc);
+
+    /* Oldest day of the pool on every device holding it, or oldest record of "dateTime" */
+    void eraseOldestRecords(std::string dateTime = "");
+
+    static void ENTRY_ATOMIC(StoragePool &pool);
+    static void EXIT_ATOMIC(StoragePool &pool);
+
+    /*  All functions below MUST-BE called in ENTRY_ATOMIC()
+        and EXIT_ATOMIC() to protect operations.
+    */
+    static bool isPoolMounted(StoragePool &pool);
+    static int openSessionRecord(StoragePool &pool, Recorder::eOption option, int durationInSecs = SDCARD_DURATION_AUTO);
+    static void closeCurrentSession(StoragePool &pool);
+    static int storageSamples(StoragePool &pool, Recorder::eType type, uint8_t *sample, size_t totalSample);
+
+private:
+    std::vector<std::shared_ptr<SDCard>> mDevices;
+    std::vector<int64_t> mCredits;          /* Smooth weighted round robin, per device */
+    std::vector<uint32_t> mSegments;        /* Segments placed, per device */
+    int64_t mTotalWeight = 0;               /* Of last selection */
+    int mActive = -1;                       /* Device of current segment */
+    Recorder::eOption mOption = Recorder::eOption::Full;
+    int mDurationInSecs = SDCARD_DURATION_AUTO;
+
+    int selectDevice();
+    int placeSegment(int device);
+
+public:
+    std::string currentSession;
+};
+
+#endif /* __STORAGEPOOL_H */
@@ -0,0 +1,303 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#include "storagesummary.h"
+#include "crc32c.h"
+#include "utils.hpp"
+#include "vfs.h"
+
+#define LOCAL_DBG_EN			(0)
+
+#if (LOCAL_DBG_EN == 1)
+#define LOCAL_DBG(fmt, ...) 	printf("\x1B[36m" fmt "\x1B[0m", ##__VA_ARGS__)
+#else
+#define LOCAL_DBG(fmt, ...)
+#endif
+
+static uint32_t headerCrc(const SummaryHeader &header) {
+	return crc32c(CRC32C_INIT, &header, offsetof(SummaryHeader, crc));
+}
+
+static uint32_t summaryCrc(const DaySummary &summary) {
+	return crc32c(CRC32C_INIT, &summary, offsetof(DaySummary, crc));
+}
+
+static SummaryHeader makeHeader() {
+	SummaryHeader header;
+
+	memset(&header, 0, sizeof(header));
+	header.magic 		= STORAGESUMMARY_MAGIC;
+	header.version 		= STORAGESUMMARY_VERSION;
+	header.entrySize 	= sizeof(DaySummary);
+	header.crc 			= headerCrc(header);
+
+	return header;
+}
+
+static void clearSummary(DaySummary &summary, const std::string &dateTime) {
+	memset(&summary, 0, sizeof(summary));
+	snprintf(summary.dateTime, sizeof(summary.dateTime), "%s", dateTime.c_str());
+}
+
+static uint32_t subtractClamped(uint32_t value, uint32_t delta) {
+	return (value > delta) ? value - delta : 0;
+}
+
+StorageSummary::StorageSummary(std::string pathToIndexes) {
+	this->pathToIndexes.assign(pathToIndexes);
+	this->pathToSummary = pathToIndexes + "/" STORAGESUMMARY_FILE_NAME;
+}
+
+StorageSummary::~StorageSummary() {
+
+}
+
+int StorageSummary::load() {
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	mSlots.clear();
+	mIsFileValid = false;
+
+	IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::Metadata);
+	int fd = getFileSystem().open(pathToSummary.c_str(), O_RDONLY);
+	if (fd == -1) {
+		return STORAGESUMMARY_RETURN_MISSING;
+	}
+
+	struct stat fStat;
+	std::vector<uint8_t> file;
+	if (getFileSystem().fstat(fd, &fStat) == 0) {
+		file.resize(fStat.st_size);
+	}
+	bool isRead = (file.size() >= sizeof(SummaryHeader)) &&
+				  (getFileSystem().pread(fd, file.data(), file.size(), 0) == (ssize_t)file.size());
+	getFileSystem().close(fd);
+
+	SummaryHeader header;
+	if (isRead) {
+		memcpy(&header, file.data(), sizeof(header));
+	}
+	if (!isRead ||
+		header.magic != STORAGESUMMARY_MAGIC ||
+		header.version != STORAGESUMMARY_VERSION ||
+		header.entrySize != sizeof(DaySummary) ||
+		header.crc != headerCrc(header))
+	{
+		return STORAGESUMMARY_RETURN_CORRUPTED;
+	}
+
+	/* A slot torn by power cut is freed, its day is summed again by the owner */
+	size_t nbSlots = (file.size() - sizeof(header)) / sizeof(DaySummary);
+	mSlots.resize(nbSlots);
+	memcpy(mSlots.data(), file.data() + sizeof(header), nbSlots * sizeof(DaySummary));
+	for (auto &summary : mSlots) {
+		if (summary.crc != summaryCrc(summary) || summary.dateTime[sizeof(summary.dateTime) - 1] != '\0') {
+			LOCAL_DBG("[SUMMARY] Slot %ld CRC mismatched in %s\n", &summary - mSlots.data(), pathToSummary.c_str());
+			clearSummary(summary, "");
+		}
+	}
+	mIsFileValid = true;
+
+	LOCAL_DBG("[SUMMARY] Loaded %ld slots from %s\n", mSlots.size(), pathToSummary.c_str());
+
+	return STORAGESUMMARY_RETURN_SUCCESS;
+}
+
+bool StorageSummary::hasDay(const std::string &dateTime) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	return findSlot(dateTime, false) != -1;
+}
+
+void StorageSummary::addRecord(const std::string &dateTime, const RecordDesc &desc) {
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	int slot = findSlot(dateTime, true);
+	if (slot != -1) {
+		accumulate(mSlots[slot], desc, true);
+		writeSlot(slot);
+	}
+}
+
+void StorageSummary::removeRecord(const std::string &dateTime, const RecordDesc &desc) {
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	/* Day not summed yet, its scan won't find the record anymore */
+	int slot = findSlot(dateTime, false);
+	if (slot != -1) {
+		accumulate(mSlots[slot], desc, false);
+		writeSlot(slot);
+	}
+}
+
+int StorageSummary::rebuildDay(const std::string &dateTime, const std::vector<RecordDesc> &records) {
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	int slot = findSlot(dateTime, true);
+	if (slot == -1) {
+		return STORAGESUMMARY_RETURN_MISSING;
+	}
+
+	clearSummary(mSlots[slot], dateTime);
+	for (auto &desc : records) {
+		accumulate(mSlots[slot], desc, true);
+	}
+
+	LOCAL_DBG("[SUMMARY] Rebuild %s with %ld track records\n", dateTime.c_str(), records.size());
+
+	return writeSlot(slot);
+}
+
+void StorageSummary::eraseDay(const std::string &dateTime) {
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	int slot = findSlot(dateTime, false);
+	if (slot != -1) {
+		clearSummary(mSlots[slot], "");
+		writeSlot(slot);
+	}
+}
+
+std::vector<DaySummary> StorageSummary::getDays() {
+	std::vector<DaySummary> days;
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		for (auto &summary : mSlots) {
+			if (summary.dateTime[0] != '\0') {
+				days.push_back(summary);
+			}
+		}
+	}
+
+	/* Day strings sort in calendar order */
+	std::sort(days.begin(), days.end(), [](const DaySummary &t1, const DaySummary &t2) {
+		return strcmp(t1.dateTime, t2.dateTime) < 0;
+	});
+
+	return days;
+}
+
+int StorageSummary::findSlot(const std::string &dateTime, bool isCreated) {
+	int freeSlot = -1;
+
+	if (dateTime.empty() || dateTime.size() > TIMEFMT_DATE_LENGTH) {
+		return -1;
+	}
+
+	for (size_t slot = 0; slot < mSlots.size(); ++slot) {
+		if (mSlots[slot].dateTime[0] == '\0') {
+			freeSlot = (freeSlot == -1) ? (int)slot : freeSlot;
+		}
+		else if (dateTime == mSlots[slot].dateTime) {
+			return (int)slot;
+		}
+	}
+
+	if (!isCreated) {
+		return -1;
+	}
+
+	if (freeSlot == -1) {
+		freeSlot = (int)mSlots.size();
+		mSlots.emplace_back();
+	}
+	clearSummary(mSlots[freeSlot], dateTime);
+
+	return freeSlot;
+}
+
+void StorageSummary::accumulate(DaySummary &summary, const RecordDesc &desc, bool isAdded) {
+	static const struct {
+		uint8_t trackMask;
+		int track;
+	} tracks[] = {
+		{ RECORD_TRACK_VIDEO, STORAGESUMMARY_VIDEO },
+		{ RECORD_TRACK_AUDIO, STORAGESUMMARY_AUDIO },
+	};
+	uint32_t secs = (desc.endTimestamp > desc.startTimestamp) ? desc.endTimestamp - desc.startTimestamp : 0;
+	uint32_t motionSecs = (desc.flags & RECORD_FLAG_MOTION) ? secs : 0;
+
+	for (auto &it : tracks) {
+		if (!(desc.trackMask & it.trackMask)) {
+			continue;
+		}
+
+		TrackSummary &track = summary.tracks[it.track];
+		if (isAdded) {
+			track.sizeInBytes 	+= desc.sizeInBytes;
+			track.segments 		+= 1;
+			track.recordedSecs 	+= secs;
+			track.motionSecs 	+= motionSecs;
+		}
+		else {
+			track.sizeInBytes 	= (track.sizeInBytes > desc.sizeInBytes) ? track.sizeInBytes - desc.sizeInBytes : 0;
+			track.segments 		= subtractClamped(track.segments, 1);
+			track.recordedSecs 	= subtractClamped(track.recordedSecs, secs);
+			track.motionSecs 	= subtractClamped(track.motionSecs, motionSecs);
+		}
+	}
+}
+
+int StorageSummary::writeSlot(int slot) {
+	DaySummary &summary = mSlots[slot];
+
+	summary.crc = summaryCrc(summary);
+	if (!mIsFileValid) {
+		return writeFile();
+	}
+
+	IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::Metadata, sizeof(summary));
+
+	int fd = getFileSystem().open(pathToSummary.c_str(), O_WRONLY);
+	if (fd == -1) {
+		mIsFileValid = false;
+		return STORAGESUMMARY_RETURN_IO_FAILURE;
+	}
+
+	off_t offset = sizeof(SummaryHeader) + (off_t)slot * sizeof(DaySummary);
+	bool isWritten = (getFileSystem().pwrite(fd, &summary, sizeof(summary), offset) == (ssize_t)sizeof(summary));
+	getFileSystem().fdatasync(fd);
+	getFileSystem().close(fd);
+
+	if (!isWritten) {
+		mIsFileValid = false;
+		return STORAGESUMMARY_RETURN_IO_FAILURE;
+	}
+
+	return STORAGESUMMARY_RETURN_SUCCESS;
+}
+
+/* Missing or corrupted file is written again as a whole, then slots are rewritten in place */
+int StorageSummary::writeFile() {
+	std::string tmpSummary = pathToSummary + ".new";
+	std::vector<uint8_t> file(sizeof(SummaryHeader) + mSlots.size() * sizeof(DaySummary));
+	SummaryHeader header = makeHeader();
+
+	for (auto &summary : mSlots) {
+		summary.crc = summaryCrc(summary);
+	}
+	memcpy(file.data(), &header, sizeof(header));
+	memcpy(file.data() + sizeof(header), mSlots.data(), mSlots.size() * sizeof(DaySummary));
+
+	createDirectory(pathToIndexes.c_str());
+
+	IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::Metadata, file.size());
+	int fd = getFileSystem().open(tmpSummary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd == -1) {
+		return STORAGESUMMARY_RETURN_IO_FAILURE;
+	}
+	bool isWritten = (getFileSystem().write(fd, file.data(), file.size()) == (ssize_t)file.size());
+	getFileSystem().fsync(fd);
+	getFileSystem().close(fd);
+
+	if (!isWritten || getFileSystem().rename(tmpSummary.c_str(), pathToSummary.c_str()) != 0) {
+		getFileSystem().unlink(tmpSummary.c_str());
+		return STORAGESUMMARY_RETURN_IO_FAILURE;
+	}
+	mIsFileValid = true;
+
+	return STORAGESUMMARY_RETURN_SUCCESS;
+}
@@ -0,0 +1,99 @@
+/*
+    Per-day storage totals of a card for capacity and history pages, one fixed slot per day:
+        <MountPoint>/index/summary.dat
+
+    File layout:
+        SummaryHeader | DaySummary | DaySummary | ...
+
+    Totals are kept per track (bytes, segments, recorded seconds, seconds of motion records)
+    and updated incrementally: the recorder adds a track record when it closes it, retention
+    takes it off when it erases it. Only the slot of the day is rewritten (one pwrite),
+    a slot erased with its day is reused by the next one. Every slot is protected by CRC32C,
+    a day whose slot is missing or corrupted is summed again from a directory scan by the
+    owner (rebuildDay()), so a query reads one small file whatever the size of the card.
+*/
+#ifndef __STORAGESUMMARY_H
+#define __STORAGESUMMARY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <memory>
+
+#include "segindex.h"
+#include "iosched.h"
+#include "timefmt.h"
+
+#define STORAGESUMMARY_FILE_NAME            "summary.dat"
+#define STORAGESUMMARY_MAGIC                (0x4D555353) /* "SSUM" */
+#define STORAGESUMMARY_VERSION              (1)
+
+/* DaySummary::tracks */
+#define STORAGESUMMARY_VIDEO                (0)
+#define STORAGESUMMARY_AUDIO                (1)
+#define STORAGESUMMARY_TRACKS               (2)
+
+#define STORAGESUMMARY_RETURN_SUCCESS       (0)
+#define STORAGESUMMARY_RETURN_MISSING       (-1)
+#define STORAGESUMMARY_RETURN_CORRUPTED     (-2)
+#define STORAGESUMMARY_RETURN_IO_FAILURE    (-3)
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entrySize;
+    uint32_t reserved;
+    uint32_t crc;
+} SummaryHeader;
+
+typedef struct __attribute__((packed)) {
+    uint64_t sizeInBytes;
+    uint32_t segments;
+    uint32_t recordedSecs;
+    uint32_t motionSecs;        /* Of motion records */
+    uint32_t reserved;
+} TrackSummary;
+
+typedef struct __attribute__((packed)) {
+    char dateTime[TIMEFMT_DATE_LENGTH + 1];     /* NUL-terminated, empty for a free slot */
+    uint8_t reserved;
+    TrackSummary tracks[STORAGESUMMARY_TRACKS];
+    uint32_t crc;
+} DaySummary;
+
+class StorageSummary {
+public:
+    StorageSummary(std::string pathToIndexes);
+    ~StorageSummary();
+
+    int load();
+    bool hasDay(const std::string &dateTime);
+
+    /* "desc" describes one track record, as journaled by the recorder when it's closed */
+    void addRecord(const std::string &dateTime, const RecordDesc &desc);
+    void removeRecord(const std::string &dateTime, const RecordDesc &desc);
+    int rebuildDay(const std::string &dateTime, const std::vector<RecordDesc> &records);
+    void eraseDay(const std::string &dateTime);
+
+    /* Sorted by day */
+    std::vector<DaySummary> getDays();
+
+private:
+    std::mutex mMutex;
+    std::vector<DaySummary> mSlots;     /* Same order as in the file */
+    bool mIsFileValid = false;          /* Header written, slots can be rewritten in place */
+
+    int findSlot(const std::string &dateTime, bool isCreated);
+    void accumulate(DaySummary &summary, const RecordDesc &desc, bool isAdded);
+    int writeSlot(int slot);
+    int writeFile();
+
+public:
+    std::string pathToIndexes;
+    std::string pathToSummary;
+    std::shared_ptr<IOScheduler> ioScheduler;
+};
+
+#endif /* __STORAGESUMMARY_H */
@@ -0,0 +1,212 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "thumbtrack.h"
+#include "annexb.h"
+#include "crc32c.h"
+#include "vfs.h"
+
+#define LOCAL_DBG_EN			(0)
+
+#if (LOCAL_DBG_EN == 1)
+#define LOCAL_DBG(fmt, ...) 	printf("\x1B[35m" fmt "\x1B[0m", ##__VA_ARGS__)
+#else
+#define LOCAL_DBG(fmt, ...)
+#endif
+
+ThumbnailTrack::ThumbnailTrack(std::string pathToIndex, uint32_t intervalInSecs) {
+	mIntervalInSecs = intervalInSecs;
+
+	this->pathToData.assign(pathToIndex + THUMBNAIL_DATA_NAME);
+	this->pathToIndex.assign(pathToIndex + THUMBNAIL_INDEX_NAME);
+}
+
+ThumbnailTrack::~ThumbnailTrack() {
+
+}
+
+void ThumbnailTrack::resume() {
+	std::vector<ThumbnailDesc> thumbnails;
+
+	/* Keep the interval across restarts in the same day */
+	if (load(thumbnails) == THUMBNAIL_RETURN_SUCCESS) {
+		if (!thumbnails.empty()) {
+			mLastTimestamp = thumbnails.back().timestamp;
+		}
+
+		/* Next entries go right after the last intact one, a torn tail would hide them */
+		int fd = getFileSystem().open(pathToIndex.c_str(), O_WRONLY);
+		if (fd != -1) {
+			getFileSystem().ftruncate(fd, (off_t)(thumbnails.size() * sizeof(ThumbnailDesc)));
+			getFileSystem().close(fd);
+		}
+	}
+	mIsResumed = true;
+}
+
+int ThumbnailTrack::append(uint32_t timestamp, const uint8_t *sample, size_t totalSample) {
+	size_t idrOffset = SIZE_MAX, idrEnd = totalSample;
+	AnnexBNal nal, next;
+
+	if (!mIsResumed) {
+		resume();
+	}
+
+	for (size_t from = 0; findNextNal(sample, totalSample, from, nal); from = nal.header + 1) {
+		bool hasNext = findNextNal(sample, totalSample, nal.header + 1, next);
+		size_t end = hasNext ? next.offset : totalSample;
+
+		if (nal.type == NAL_TYPE_SPS || nal.type == NAL_TYPE_PPS) {
+			std::vector<uint8_t> &parameterSet = (nal.type == NAL_TYPE_SPS) ? mSPS : mPPS;
+			if (end - nal.offset <= THUMBNAIL_MAX_PARAMETER_SET) {
+				parameterSet.assign(sample + nal.offset, sample + end);
+			}
+		}
+		else if (nal.type == NAL_TYPE_IDR) {
+			if (idrOffset == SIZE_MAX) {
+				idrOffset = nal.offset;
+			}
+			idrEnd = end;
+		}
+		else if (idrOffset != SIZE_MAX) {
+			break;  /* IDR slices are contiguous */
+		}
+	}
+
+	if (idrOffset == SIZE_MAX || mSPS.empty() || mPPS.empty()) {
+		return THUMBNAIL_RETURN_SKIPPED;
+	}
+	if (mLastTimestamp != 0 && timestamp < mLastTimestamp + mIntervalInSecs) {
+		return THUMBNAIL_RETURN_SKIPPED;
+	}
+
+	return writeThumbnail(timestamp, sample + idrOffset, idrEnd - idrOffset);
+}
+
+int ThumbnailTrack::writeThumbnail(uint32_t timestamp, const uint8_t *idr, size_t totalIdr) {
+	struct stat fStat;
+	ThumbnailDesc desc;
+	struct iovec iov[3] = {
+		{ mSPS.data(), mSPS.size() },
+		{ mPPS.data(), mPPS.size() },
+		{ (void *)idr, totalIdr },
+	};
+
+	desc.timestamp = timestamp;
+	desc.length = (uint32_t)(mSPS.size() + mPPS.size() + totalIdr);
+	desc.crc = crc32c(CRC32C_INIT, mSPS.data(), mSPS.size());
+	desc.crc = crc32c(desc.crc, mPPS.data(), mPPS.size());
+	desc.crc = crc32c(desc.crc, idr, totalIdr);
+
+	IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::Metadata, desc.length + sizeof(desc));
+
+	int fd = getFileSystem().open(pathToData.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0666);
+	if (fd == -1) {
+		return THUMBNAIL_RETURN_FAILURE;
+	}
+
+	bool isWritten = (getFileSystem().fstat(fd, &fStat) == 0);
+	desc.offset = (uint32_t)fStat.st_size;
+	isWritten = isWritten && (getFileSystem().writev(fd, iov, 3) == (ssize_t)desc.length);
+	getFileSystem().close(fd);
+
+	if (!isWritten) {
+		return THUMBNAIL_RETURN_FAILURE;
+	}
+
+	fd = getFileSystem().open(pathToIndex.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0666);
+	if (fd == -1) {
+		return THUMBNAIL_RETURN_FAILURE;
+	}
+
+	isWritten = (getFileSystem().write(fd, &desc, sizeof(desc)) == sizeof(desc));
+	getFileSystem().close(fd);
+
+	if (!isWritten) {
+		return THUMBNAIL_RETURN_FAILURE;
+	}
+
+	mLastTimestamp = timestamp;
+	LOCAL_DBG("[THUMBNAIL] %u at %u, %u bytes\n", timestamp, desc.offset, desc.length);
+
+	return THUMBNAIL_RETURN_SUCCESS;
+}
+
+int ThumbnailTrack::load(std::vector<ThumbnailDesc> &thumbnails) {
+	struct stat fStat;
+	std::vector<uint8_t> data;
+
+	thumbnails.clear();
+
+	IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::Playback);
+
+	int dataFd = getFileSystem().open(pathToData.c_str(), O_RDONLY);
+	if (dataFd == -1) {
+		return THUMBNAIL_RETURN_FAILURE;
+	}
+	if (getFileSystem().fstat(dataFd, &fStat) != 0) {
+		getFileSystem().close(dataFd);
+		return THUMBNAIL_RETURN_FAILURE;
+	}
+
+	int fd = getFileSystem().open(pathToIndex.c_str(), O_RDONLY);
+	if (fd == -1) {
+		getFileSystem().close(dataFd);
+		return THUMBNAIL_RETURN_FAILURE;
+	}
+
+	ThumbnailDesc desc;
+	while (getFileSystem().read(fd, &desc, sizeof(desc)) == sizeof(desc)) {
+		/* Data of an entry is written before it, an entry out of data is torn */
+		if ((uint64_t)desc.offset + desc.length > (uint64_t)fStat.st_size) {
+			break;
+		}
+		thumbnails.push_back(desc);
+	}
+	getFileSystem().close(fd);
+
+	/*  Neither file is synced per thumbnail, an entry may reach the card before its data.
+		Only the tail can be torn, it's dropped until an entry matches its CRC32C.
+	*/
+	while (!thumbnails.empty()) {
+		const ThumbnailDesc &last = thumbnails.back();
+		data.resize(last.length);
+		if (getFileSystem().pread(dataFd, data.data(), data.size(), last.offset) == (ssize_t)data.size() &&
+			crc32c(CRC32C_INIT, data.data(), data.size()) == last.crc)
+		{
+			break;
+		}
+		thumbnails.pop_back();
+	}
+	getFileSystem().close(dataFd);
+
+	return THUMBNAIL_RETURN_SUCCESS;
+}
+
+int ThumbnailTrack::read(const ThumbnailDesc &desc, std::vector<uint8_t> &data) {
+	IOScheduler::Ticket ticket(ioScheduler.get(), IOScheduler::eClass::Playback, desc.length);
+
+	int fd = getFileSystem().open(pathToData.c_str(), O_RDONLY);
+	if (fd == -1) {
+		return THUMBNAIL_RETURN_FAILURE;
+	}
+
+	data.resize(desc.length);
+	ssize_t nbRead = getFileSystem().pread(fd, data.data(), desc.length, desc.offset);
+	getFileSystem().close(fd);
+
+	if (nbRead != (ssize_t)desc.length) {
+		data.clear();
+		return THUMBNAIL_RETURN_FAILURE;
+	}
+
+	if (crc32c(CRC32C_INIT, data.data(), data.size()) != desc.crc) {
+		data.clear();
+		return THUMBNAIL_RETURN_CORRUPTED;
+	}
+
+	return THUMBNAIL_RETURN_SUCCESS;
+}
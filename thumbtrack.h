@@ -0,0 +1,68 @@
+/*
+    Keyframe-only side track of a day, for timeline scrubbing without reading records.
+
+    Files in "<mount>/index/<date>/":
+        thumbs.h264     SPS + PPS + IDR, one decodable picture per thumbnail
+        thumbs.idx      ThumbnailDesc entries in time order
+
+    An IDR is kept only if it's at least "intervalInSecs" after the previous thumbnail.
+    Data is appended before its entry, a torn tail is dropped by length and CRC32C
+    when the track is loaded (and cut off before the next append), so no sync is
+    needed per thumbnail.
+*/
+#ifndef __THUMBTRACK_H
+#define __THUMBTRACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "iosched.h"
+
+#define THUMBNAIL_DATA_NAME                 "/thumbs.h264"
+#define THUMBNAIL_INDEX_NAME                "/thumbs.idx"
+#define THUMBNAIL_DEFAULT_INTERVAL          (10)
+#define THUMBNAIL_MAX_PARAMETER_SET         (256)
+
+#define THUMBNAIL_RETURN_SUCCESS            (0)
+#define THUMBNAIL_RETURN_SKIPPED            (1)
+#define THUMBNAIL_RETURN_FAILURE            (-1)
+#define THUMBNAIL_RETURN_CORRUPTED          (-2)
+
+typedef struct __attribute__((packed)) {
+    uint32_t timestamp;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t crc;       /* CRC32C of data */
+} ThumbnailDesc;
+
+class ThumbnailTrack {
+public:
+    ThumbnailTrack(std::string pathToIndex, uint32_t intervalInSecs = THUMBNAIL_DEFAULT_INTERVAL);
+    ~ThumbnailTrack();
+
+    /* Sample is one or more complete access units of H.264 Annex-B stream */
+    int append(uint32_t timestamp, const uint8_t *sample, size_t totalSample);
+
+    int load(std::vector<ThumbnailDesc> &thumbnails);
+    int read(const ThumbnailDesc &desc, std::vector<uint8_t> &data);
+
+private:
+    uint32_t mIntervalInSecs;
+    uint32_t mLastTimestamp = 0;
+    bool mIsResumed = false;
+    std::vector<uint8_t> mSPS;
+    std::vector<uint8_t> mPPS;
+
+    void resume();
+    int writeThumbnail(uint32_t timestamp, const uint8_t *idr, size_t totalIdr);
+
+public:
+    std::string pathToData;
+    std::string pathToIndex;
+    std::shared_ptr<IOScheduler> ioScheduler;
+};
+
+#endif /* __THUMBTRACK_H */
@@ -0,0 +1,170 @@
+#include <atomic>
+
+#include "timefmt.h"
+
+
+#define LOCAL_DBG_EN			(0)
+
+#if (LOCAL_DBG_EN == 1)
+#define LOCAL_DBG(fmt, ...) 	printf("\x1B[33m" fmt "\x1B[0m", ##__VA_ARGS__)
+#else
+#define LOCAL_DBG(fmt, ...)
+#endif
+
+#define TIMEFMT_OFFSET_UNSET				(INT32_MIN)
+
+typedef struct {
+	int64_t days;		/* Since 1970-01-01 in local time */
+	int year;
+	int month;
+	int day;
+} CachedDay;
+
+static std::atomic<int32_t> timezoneOffset(TIMEFMT_OFFSET_UNSET);
+static thread_local CachedDay cachedDay = { INT64_MIN, 0, 0, 0 };
+
+void setTimezoneOffset(int32_t offsetInSecs) {
+	timezoneOffset.store(offsetInSecs);
+}
+
+int32_t getTimezoneOffset() {
+	int32_t offset = timezoneOffset.load(std::memory_order_relaxed);
+
+	if (offset == TIMEFMT_OFFSET_UNSET) {
+		/* Zone of the system, only looked up once */
+		time_t t = time(NULL);
+		struct tm tm;
+		int32_t systemOffset = (localtime_r(&t, &tm) != NULL) ? (int32_t)tm.tm_gmtoff : 0;
+
+		timezoneOffset.compare_exchange_strong(offset, systemOffset);
+		offset = timezoneOffset.load();
+	}
+
+	return offset;
+}
+
+/* Civil date <-> days since epoch, proleptic Gregorian (REFERENCE http://howardhinnant.github.io/date_algorithms.html) */
+static int64_t daysFromCivil(int year, int month, int day) {
+	year -= (month <= 2);
+	int64_t era = (year >= 0 ? year : year - 399) / 400;
+	int64_t yoe = year - era * 400;
+	int64_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return era * 146097 + doe - 719468;
+}
+
+static void civilFromDays(int64_t days, CachedDay &civil) {
+	days += 719468;
+	int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+	int64_t doe = days - era * 146097;
+	int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	int64_t mp = (5 * doy + 2) / 153;
+
+	civil.day = (int)(doy - (153 * mp + 2) / 5 + 1);
+	civil.month = (int)(mp < 10 ? mp + 3 : mp - 9);
+	civil.year = (int)(yoe + era * 400 + (civil.month <= 2));
+}
+
+static int64_t floorDiv(int64_t value, int64_t divisor) {
+	return (value >= 0) ? value / divisor : -((-value + divisor - 1) / divisor);
+}
+
+void toDateTime(time_t timestamp, DateTime &dateTime) {
+	int64_t local = (int64_t)timestamp + getTimezoneOffset();
+	int64_t days = floorDiv(local, TIMEFMT_SECS_PER_DAY);
+	int64_t secsOfDay = local - days * TIMEFMT_SECS_PER_DAY;
+
+	if (cachedDay.days != days) {
+		civilFromDays(days, cachedDay);
+		cachedDay.days = days;
+	}
+
+	dateTime.year	= cachedDay.year;
+	dateTime.month	= cachedDay.month;
+	dateTime.day	= cachedDay.day;
+	dateTime.hour	= (int)(secsOfDay / 3600);
+	dateTime.minute	= (int)(secsOfDay / 60 % 60);
+	dateTime.second	= (int)(secsOfDay % 60);
+}
+
+time_t toMidnight(time_t timestamp) {
+	int64_t local = (int64_t)timestamp + getTimezoneOffset();
+
+	return (time_t)(floorDiv(local, TIMEFMT_SECS_PER_DAY) * TIMEFMT_SECS_PER_DAY - getTimezoneOffset());
+}
+
+time_t fromDate(int year, int month, int day) {
+	return (time_t)(daysFromCivil(year, month, day) * TIMEFMT_SECS_PER_DAY - getTimezoneOffset());
+}
+
+static char *putDigits(char *p, int value, int width) {
+	for (int id = width - 1; id >= 0; --id) {
+		p[id] = (char)('0' + value % 10);
+		value /= 10;
+	}
+
+	return p + width;
+}
+
+void formatDate(time_t timestamp, char *buffer, size_t len) {
+	DateTime dt;
+	char *p = buffer;
+
+	if (len <= TIMEFMT_DATE_LENGTH) {
+		buffer[0] = '\0';
+		return;
+	}
+
+	toDateTime(timestamp, dt);
+	p = putDigits(p, dt.year, 4);
+	*p++ = '.';
+	p = putDigits(p, dt.month, 2);
+	*p++ = '.';
+	p = putDigits(p, dt.day, 2);
+	*p = '\0';
+}
+
+void formatCompact(time_t timestamp, char *buffer, size_t len) {
+	DateTime dt;
+	char *p = buffer;
+
+	if (len <= TIMEFMT_COMPACT_LENGTH) {
+		buffer[0] = '\0';
+		return;
+	}
+
+	toDateTime(timestamp, dt);
+	p = putDigits(p, dt.year, 4);
+	p = putDigits(p, dt.month, 2);
+	p = putDigits(p, dt.day, 2);
+	p = putDigits(p, dt.hour, 2);
+	p = putDigits(p, dt.minute, 2);
+	p = putDigits(p, dt.second, 2);
+	*p = '\0';
+}
+
+void formatDateTime(time_t timestamp, char *buffer, size_t len) {
+	DateTime dt;
+	char *p = buffer;
+
+	if (len <= TIMEFMT_DATETIME_LENGTH) {
+		buffer[0] = '\0';
+		return;
+	}
+
+	toDateTime(timestamp, dt);
+	p = putDigits(p, dt.year, 4);
+	*p++ = '.';
+	p = putDigits(p, dt.month, 2);
+	*p++ = '.';
+	p = putDigits(p, dt.day, 2);
+	*p++ = ' ';
+	p = putDigits(p, dt.hour, 2);
+	*p++ = ':';
+	p = putDigits(p, dt.minute, 2);
+	*p++ = ':';
+	p = putDigits(p, dt.second, 2);
+	*p = '\0';
+}
@@ -0,0 +1,46 @@
+/*
+    Local time of record names, date folders and playlists.
+
+    Local time is UTC plus a fixed offset, by default the offset of the system zone when
+    it's first used (setTimezoneOffset() overrides it, e.g. from the camera settings).
+    Daylight saving isn't followed, a day is always 86400 seconds.
+
+    Conversions are integer arithmetic, neither gmtime/localtime nor mktime is called.
+    Each thread caches the day it converted last, so converting timestamps of the same
+    day only splits the seconds of day. Every function is reentrant.
+*/
+#ifndef __TIMEFMT_H
+#define __TIMEFMT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <ctime>
+
+#define TIMEFMT_SECS_PER_DAY                (86400)
+
+#define TIMEFMT_DATE_LENGTH                 (10)    /* YYYY.MM.DD */
+#define TIMEFMT_COMPACT_LENGTH              (14)    /* YYYYMMDDhhmmss */
+#define TIMEFMT_DATETIME_LENGTH             (19)    /* YYYY.MM.DD hh:mm:ss */
+
+typedef struct {
+    int year;
+    int month;      /* 1-12 */
+    int day;        /* 1-31 */
+    int hour;
+    int minute;
+    int second;
+} DateTime;
+
+extern void setTimezoneOffset(int32_t offsetInSecs);
+extern int32_t getTimezoneOffset();
+
+extern void toDateTime(time_t timestamp, DateTime &dateTime);
+extern time_t toMidnight(time_t timestamp);                 /* Local midnight of the day */
+extern time_t fromDate(int year, int month, int day);       /* Local midnight of a date */
+
+/* Formatters write a NUL-terminated string, "len" MUST-BE greater than its length */
+extern void formatDate(time_t timestamp, char *buffer, size_t len);
+extern void formatCompact(time_t timestamp, char *buffer, size_t len);
+extern void formatDateTime(time_t timestamp, char *buffer, size_t len);
+
+#endif /* __TIMEFMT_H */
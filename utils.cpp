@@ -2,6 +2,8 @@
 #include <sys/statfs.h>
 
 #include "utils.hpp"
+#include "vfs.h"
+#include "timefmt.h"
 
 
 template <typename... Args>
@@ -42,20 +44,8 @@ std::vector<std::string> splitString(std::string &s, char delimeter) {
     return stGroups;
 }
 
-void epochToUTCTime(time_t epochTime, std::tm &tm) {
-    tm = *(std::gmtime(&epochTime));
-    tm.tm_year  += 1900;  /* Years since 1900 */
-    tm.tm_mon   += 1;     /* Months are 0-11 */
-    tm.tm_hour  += 7;
-}
-
 std::string getTodayDateString() {
-	time_t t;
-	struct tm* tm = NULL;
-
-    time(&t);
-	tm = localtime(&t);
-	return sprintfString("%d.%02d.%02d", tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday);
+	return getDateString(getClock().now());
 }
 
 uint32_t getCurrentEpochTimestamp() {
@@ -63,24 +53,67 @@ uint32_t getCurrentEpochTimestamp() {
 
 #else
 
-	time_t t = time(NULL);
+	time_t t = getClock().now();
 
 	return (uint32_t)t;
 #endif
 }
 
+time_t getNextMidnightTimestamp() {
+	return toMidnight(getClock().now()) + TIMEFMT_SECS_PER_DAY;
+}
+
+/* Local midnight of a "YYYY.MM.DD" date, -1 if it's invalid */
+time_t getMidnightTimestamp(const std::string &dateString) {
+	int year, month, day;
+
+	if (sscanf(dateString.c_str(), "%d.%d.%d", &year, &month, &day) != 3 || 
+		month < 1 || month > 12 || day < 1 || day > 31) 
+	{
+		return -1;
+	}
+
+	return fromDate(year, month, day);
+}
+
+bool isDateString(const std::string &dateString) {
+	if (dateString.size() != TIMEFMT_DATE_LENGTH) {
+		return false;
+	}
+
+	/* Formatted back the same, e.g. "2024.02.30" or "../x" aren't */
+	time_t midnight = getMidnightTimestamp(dateString);
+	return midnight != -1 && getDateString(midnight) == dateString;
+}
+
+std::string getDateString(time_t timestamp) {
+	char date[TIMEFMT_DATE_LENGTH + 1];
+
+	formatDate(timestamp, date, sizeof(date));
+	return std::string(date, TIMEFMT_DATE_LENGTH);
+}
+
 void createDirectory(const char *directory) {
 	struct stat fStat;
 
-	if (stat(directory, &fStat) == -1) {
-		mkdir(directory, S_IRWXU | S_IRWXG | S_IRWXO);
+	if (getFileSystem().stat(directory, &fStat) == -1) {
+		getFileSystem().mkdir(directory, S_IRWXU | S_IRWXG | S_IRWXO);
+	}
+}
+
+void createDirectories(const char *directory) {
+	std::string path(directory);
+
+	for (size_t pos = path.find('/', 1); pos != std::string::npos; pos = path.find('/', pos + 1)) {
+		createDirectory(path.substr(0, pos).c_str());
 	}
+	createDirectory(path.c_str());
 }
 
 uint32_t getBirthTimestamp(const char *url) {
     struct stat fStat;
 
-    if (stat(url, &fStat) == 0) {
+    if (getFileSystem().stat(url, &fStat) == 0) {
         return (uint32_t)fStat.st_ctime;
     }
 
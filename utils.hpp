@@ -11,10 +11,14 @@ template <typename... Args>
 std::string sprintfString(std::string fmt, Args... args);
 
 extern std::vector<std::string> splitString(std::string &s, char delimiter);
-extern void epochToUTCTime(time_t epochTime, std::tm &tm);
 extern std::string getTodayDateString();
 extern uint32_t getCurrentEpochTimestamp();
+extern time_t getNextMidnightTimestamp();
+extern time_t getMidnightTimestamp(const std::string &dateString);
+extern bool isDateString(const std::string &dateString);   /* Exactly "YYYY.MM.DD" of a real date */
+extern std::string getDateString(time_t timestamp);
 extern void createDirectory(const char *);
+extern void createDirectories(const char *);
 extern uint32_t getBirthTimestamp(const char *);
 
 #endif /* __UTILITIE_SD_H */
\ No newline at end of file
@@ -0,0 +1,790 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <dirent.h>
+#include <cstdlib>
+#include <algorithm>
+#include <sys/statfs.h>
+#include <sys/statvfs.h>
+
+#include "vfs.h"
+
+
+#define LOCAL_DBG_EN			(0)
+
+#if (LOCAL_DBG_EN == 1)
+#define LOCAL_DBG(fmt, ...) 	printf("\x1B[37m" fmt "\x1B[0m", ##__VA_ARGS__)
+#else
+#define LOCAL_DBG(fmt, ...)
+#endif
+
+static std::shared_ptr<IClock> &getClockSlot() {
+	static std::shared_ptr<IClock> clock = std::make_shared<SystemClock>();
+	return clock;
+}
+
+static std::shared_ptr<IFileSystem> &getFileSystemSlot() {
+	static std::shared_ptr<IFileSystem> fileSystem = std::make_shared<PosixFileSystem>();
+	return fileSystem;
+}
+
+IClock &getClock() {
+	return *getClockSlot();
+}
+
+void setClock(std::shared_ptr<IClock> clock) {
+	getClockSlot() = clock ? clock : std::make_shared<SystemClock>();
+}
+
+IFileSystem &getFileSystem() {
+	return *getFileSystemSlot();
+}
+
+void setFileSystem(std::shared_ptr<IFileSystem> fileSystem) {
+	getFileSystemSlot() = fileSystem ? fileSystem : std::make_shared<PosixFileSystem>();
+}
+
+time_t SystemClock::now() {
+	return time(NULL);
+}
+
+SimulatedClock::SimulatedClock(time_t start) : mNow(start) {
+
+}
+
+time_t SimulatedClock::now() {
+	return (time_t)mNow.load();
+}
+
+void SimulatedClock::set(time_t timestamp) {
+	mNow.store(timestamp);
+}
+
+void SimulatedClock::advance(time_t secs) {
+	mNow.fetch_add(secs);
+}
+
+int PosixFileSystem::open(const char *path, int flags, mode_t mode) {
+	return ::open(path, flags, mode);
+}
+
+int PosixFileSystem::close(int fd) {
+	return ::close(fd);
+}
+
+ssize_t PosixFileSystem::read(int fd, void *buf, size_t count) {
+	return ::read(fd, buf, count);
+}
+
+ssize_t PosixFileSystem::write(int fd, const void *buf, size_t count) {
+	return ::write(fd, buf, count);
+}
+
+ssize_t PosixFileSystem::writev(int fd, const struct iovec *iov, int iovcnt) {
+	return ::writev(fd, iov, iovcnt);
+}
+
+ssize_t PosixFileSystem::pread(int fd, void *buf, size_t count, off_t offset) {
+	return ::pread(fd, buf, count, offset);
+}
+
+ssize_t PosixFileSystem::pwrite(int fd, const void *buf, size_t count, off_t offset) {
+	return ::pwrite(fd, buf, count, offset);
+}
+
+int PosixFileSystem::fsync(int fd) {
+	return ::fsync(fd);
+}
+
+int PosixFileSystem::fdatasync(int fd) {
+	return ::fdatasync(fd);
+}
+
+int PosixFileSystem::fstat(int fd, struct stat *st) {
+	return ::fstat(fd, st);
+}
+
+int PosixFileSystem::fallocate(int fd, int mode, off_t offset, off_t len) {
+	return ::fallocate(fd, mode, offset, len);
+}
+
+int PosixFileSystem::ftruncate(int fd, off_t length) {
+	return ::ftruncate(fd, length);
+}
+
+int PosixFileSystem::stat(const char *path, struct stat *st) {
+	return ::stat(path, st);
+}
+
+int PosixFileSystem::rename(const char *from, const char *to) {
+	return ::rename(from, to);
+}
+
+int PosixFileSystem::unlink(const char *path) {
+	return ::remove(path);
+}
+
+int PosixFileSystem::mkdir(const char *path, mode_t mode) {
+	return ::mkdir(path, mode);
+}
+
+int PosixFileSystem::removeAll(const char *path) {
+	std::string cmd = "rm -rf ";
+	return std::system(std::string(cmd + path).c_str());
+}
+
+int PosixFileSystem::listDirectory(const char *path, std::vector<DirEntry> &entries) {
+	DIR *dir = opendir(path);
+	if (dir == nullptr) {
+		return -1;
+	}
+
+	struct dirent *ent;
+	while ((ent = readdir(dir)) != NULL) {
+		if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0) {
+			entries.push_back({ ent->d_name, ent->d_type == DT_DIR });
+		}
+	}
+	closedir(dir);
+
+	return 0;
+}
+
+int PosixFileSystem::statfs(const char *path, FsInfo &info) {
+	struct statfs fStatfs;
+	struct statvfs statvFs;
+
+	memset(&info, 0, sizeof(info));
+	if (::statfs(path, &fStatfs) == -1) {
+		return -1;
+	}
+
+	info.total = (uint64_t)fStatfs.f_bsize * (uint64_t)fStatfs.f_blocks;
+	info.free  = (uint64_t)fStatfs.f_bsize * (uint64_t)fStatfs.f_bfree;
+	info.type  = (uint64_t)fStatfs.f_type;
+	if (statvfs(path, &statvFs) == 0) {
+		info.fsid = (uint64_t)statvFs.f_fsid;
+	}
+
+	return 0;
+}
+
+int PosixFileSystem::openat(int dirfd, const char *name, int flags, mode_t mode) {
+	return ::openat(dirfd, name, flags, mode);
+}
+
+int PosixFileSystem::fstatat(int dirfd, const char *name, struct stat *st) {
+	return ::fstatat(dirfd, name, st, 0);
+}
+
+int PosixFileSystem::renameat(int fromDirfd, const char *from, int toDirfd, const char *to) {
+	return ::renameat(fromDirfd, from, toDirfd, to);
+}
+
+int PosixFileSystem::unlinkat(int dirfd, const char *name, int flags) {
+	return ::unlinkat(dirfd, name, flags);
+}
+
+int PosixFileSystem::mkdirat(int dirfd, const char *name, mode_t mode) {
+	return ::mkdirat(dirfd, name, mode);
+}
+
+int PosixFileSystem::visitDirectoryAt(int dirfd, const DirVisitor &visitor) {
+	/* Own file description, listings of the same directory don't share the offset */
+	int fd = ::openat(dirfd, ".", O_RDONLY | O_DIRECTORY);
+	if (fd == -1) {
+		return -1;
+	}
+
+	DIR *dir = fdopendir(fd);
+	if (dir == nullptr) {
+		::close(fd);
+		return -1;
+	}
+
+	struct dirent *ent;
+	while ((ent = readdir(dir)) != NULL) {
+		if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0) {
+			visitor(ent->d_name, ent->d_type == DT_DIR);
+		}
+	}
+	closedir(dir);
+
+	return 0;
+}
+
+/* Absolute path without duplicated nor trailing '/' */
+static std::string normalizePath(const char *path) {
+	std::string normalized;
+
+	normalized.reserve(strlen(path));
+	for (const char *p = path; *p != '\0'; ++p) {
+		if (*p == '/' && !normalized.empty() && normalized.back() == '/') {
+			continue;
+		}
+		normalized.push_back(*p);
+	}
+
+	if (normalized.size() > 1 && normalized.back() == '/') {
+		normalized.pop_back();
+	}
+
+	return normalized;
+}
+
+MemFileSystem::MemFileSystem(uint64_t capacityInBytes, uint32_t clusterSize) {
+	mCapacity = capacityInBytes;
+	mClusterSize = clusterSize;
+
+	Node root;
+	root.isDirectory = true;
+	root.ctime = getClock().now();
+	mNodes["/"] = root;
+}
+
+uint64_t MemFileSystem::toClusters(size_t size) {
+	return ((uint64_t)size + mClusterSize - 1) / mClusterSize;
+}
+
+MemFileSystem::Node *MemFileSystem::findNode(const std::string &path) {
+	auto it = mNodes.find(path);
+	return (it != mNodes.end()) ? &it->second : nullptr;
+}
+
+MemFileSystem::Node *MemFileSystem::findParent(const std::string &path, std::string &name) {
+	size_t pos = path.rfind('/');
+	if (path.empty() || path[0] != '/' || pos == std::string::npos || pos + 1 == path.size()) {
+		return nullptr;
+	}
+
+	name = path.substr(pos + 1);
+	Node *parent = findNode((pos == 0) ? "/" : path.substr(0, pos));
+	return (parent != nullptr && parent->isDirectory) ? parent : nullptr;
+}
+
+MemFileSystem::OpenFile *MemFileSystem::findOpenFile(int fd) {
+	auto it = mOpenFiles.find(fd);
+	return (it != mOpenFiles.end()) ? &it->second : nullptr;
+}
+
+void MemFileSystem::fillStat(const Node &node, struct stat *st) {
+	memset(st, 0, sizeof(*st));
+	st->st_mode = node.isDirectory ? (S_IFDIR | 0777) : (S_IFREG | 0666);
+	st->st_nlink = 1;
+	st->st_ctime = node.ctime;
+	st->st_mtime = node.ctime;
+	st->st_blksize = mClusterSize;
+
+	if (node.file) {
+		st->st_size = (off_t)node.file->data.size();
+		st->st_mtime = node.file->mtime;
+		st->st_blocks = (blkcnt_t)(toClusters(node.file->data.size()) * mClusterSize / 512);
+	}
+}
+
+int MemFileSystem::open(const char *path, int flags, mode_t) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::string normalized = normalizePath(path);
+	std::string name;
+
+	Node *node = findNode(normalized);
+	if (node == nullptr) {
+		Node *parent = findParent(normalized, name);
+		if (!(flags & O_CREAT) || parent == nullptr) {
+			errno = ENOENT;
+			return -1;
+		}
+
+		Node file;
+		file.isDirectory = false;
+		file.ctime = getClock().now();
+		file.file = std::make_shared<File>();
+		file.file->ctime = file.file->mtime = file.ctime;
+		parent->children.insert(name);
+		node = &(mNodes[normalized] = file);
+	}
+	else if ((flags & O_DIRECTORY) && !node->isDirectory) {
+		errno = ENOTDIR;
+		return -1;
+	}
+	else if (node->isDirectory && (flags & O_ACCMODE) != O_RDONLY) {
+		errno = EISDIR;
+		return -1;
+	}
+
+	if (node->file && (flags & O_TRUNC) && (flags & O_ACCMODE) != O_RDONLY) {
+		mUsedBytes -= toClusters(node->file->data.size()) * mClusterSize;
+		node->file->data.clear();
+		node->file->mtime = getClock().now();
+	}
+
+	int fd = mNextFd++;
+	mOpenFiles[fd] = { node->file, 0, flags, normalized };
+
+	return fd;
+}
+
+int MemFileSystem::close(int fd) {
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	if (mOpenFiles.erase(fd) == 0) {
+		errno = EBADF;
+		return -1;
+	}
+
+	return 0;
+}
+
+ssize_t MemFileSystem::pread(int fd, void *buf, size_t count, off_t offset) {
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	OpenFile *openFile = findOpenFile(fd);
+	if (openFile == nullptr || !openFile->file || offset < 0) {
+		errno = EBADF;
+		return -1;
+	}
+
+	auto &data = openFile->file->data;
+	if ((size_t)offset >= data.size()) {
+		return 0;
+	}
+
+	size_t nbBytes = std::min(count, data.size() - (size_t)offset);
+	memcpy(buf, data.data() + offset, nbBytes);
+
+	return (ssize_t)nbBytes;
+}
+
+ssize_t MemFileSystem::read(int fd, void *buf, size_t count) {
+	off_t offset;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		OpenFile *openFile = findOpenFile(fd);
+		if (openFile == nullptr) {
+			errno = EBADF;
+			return -1;
+		}
+		offset = openFile->offset;
+	}
+
+	ssize_t nbBytes = pread(fd, buf, count, offset);
+	if (nbBytes > 0) {
+		std::lock_guard<std::mutex> lock(mMutex);
+		OpenFile *openFile = findOpenFile(fd);
+		if (openFile != nullptr) {
+			openFile->offset += nbBytes;
+		}
+	}
+
+	return nbBytes;
+}
+
+ssize_t MemFileSystem::writeAt(OpenFile &openFile, const void *buf, size_t count, off_t offset) {
+	if (!openFile.file || (openFile.flags & O_ACCMODE) == O_RDONLY) {
+		errno = EBADF;
+		return -1;
+	}
+
+	auto &data = openFile.file->data;
+	size_t newSize = std::max(data.size(), (size_t)offset + count);
+	uint64_t grownBytes = (toClusters(newSize) - toClusters(data.size())) * mClusterSize;
+
+	if (mUsedBytes + grownBytes > mCapacity) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	mUsedBytes += grownBytes;
+	mTotalWritten += count;
+	data.resize(newSize);
+	memcpy(data.data() + offset, buf, count);
+	openFile.file->mtime = getClock().now();
+
+	return (ssize_t)count;
+}
+
+int MemFileSystem::resize(OpenFile &openFile, size_t newSize) {
+	if (!openFile.file || (openFile.flags & O_ACCMODE) == O_RDONLY) {
+		errno = EBADF;
+		return -1;
+	}
+
+	auto &data = openFile.file->data;
+	uint64_t oldBytes = toClusters(data.size()) * mClusterSize;
+	uint64_t newBytes = toClusters(newSize) * mClusterSize;
+
+	if (newBytes > oldBytes && mUsedBytes + (newBytes - oldBytes) > mCapacity) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	mUsedBytes = mUsedBytes + newBytes - oldBytes;
+	data.resize(newSize, 0);
+	openFile.file->mtime = getClock().now();
+
+	return 0;
+}
+
+ssize_t MemFileSystem::write(int fd, const void *buf, size_t count) {
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	OpenFile *openFile = findOpenFile(fd);
+	if (openFile == nullptr) {
+		errno = EBADF;
+		return -1;
+	}
+
+	if ((openFile->flags & O_APPEND) && openFile->file) {
+		openFile->offset = (off_t)openFile->file->data.size();
+	}
+
+	ssize_t nbBytes = writeAt(*openFile, buf, count, openFile->offset);
+	if (nbBytes > 0) {
+		openFile->offset += nbBytes;
+	}
+
+	return nbBytes;
+}
+
+ssize_t MemFileSystem::writev(int fd, const struct iovec *iov, int iovcnt) {
+	ssize_t total = 0;
+
+	for (int id = 0; id < iovcnt; ++id) {
+		ssize_t nbBytes = write(fd, iov[id].iov_base, iov[id].iov_len);
+		if (nbBytes < 0) {
+			return (total > 0) ? total : nbBytes;
+		}
+		total += nbBytes;
+	}
+
+	return total;
+}
+
+ssize_t MemFileSystem::pwrite(int fd, const void *buf, size_t count, off_t offset) {
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	OpenFile *openFile = findOpenFile(fd);
+	if (openFile == nullptr || offset < 0) {
+		errno = EBADF;
+		return -1;
+	}
+
+	return writeAt(*openFile, buf, count, offset);
+}
+
+int MemFileSystem::fallocate(int fd, int mode, off_t offset, off_t len) {
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	OpenFile *openFile = findOpenFile(fd);
+	if (openFile == nullptr || !openFile->file || offset < 0 || len <= 0) {
+		errno = (openFile == nullptr) ? EBADF : EINVAL;
+		return -1;
+	}
+
+	size_t size = openFile->file->data.size();
+	size_t end = (size_t)(offset + len);
+	if (end <= size) {
+		return 0;
+	}
+
+	if (mode & FALLOC_FL_KEEP_SIZE) {
+		uint64_t grownBytes = (toClusters(end) - toClusters(size)) * mClusterSize;
+		if (mUsedBytes + grownBytes > mCapacity) {
+			errno = ENOSPC;
+			return -1;
+		}
+		return 0;
+	}
+
+	return resize(*openFile, end);
+}
+
+int MemFileSystem::ftruncate(int fd, off_t length) {
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	OpenFile *openFile = findOpenFile(fd);
+	if (openFile == nullptr || length < 0) {
+		errno = (openFile == nullptr) ? EBADF : EINVAL;
+		return -1;
+	}
+
+	return resize(*openFile, (size_t)length);
+}
+
+int MemFileSystem::fsync(int fd) {
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	return (findOpenFile(fd) != nullptr) ? 0 : -1;
+}
+
+int MemFileSystem::fdatasync(int fd) {
+	return fsync(fd);
+}
+
+int MemFileSystem::fstat(int fd, struct stat *st) {
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	OpenFile *openFile = findOpenFile(fd);
+	if (openFile == nullptr) {
+		errno = EBADF;
+		return -1;
+	}
+
+	Node node;
+	node.isDirectory = !openFile->file;
+	node.file = openFile->file;
+	node.ctime = openFile->file ? openFile->file->ctime : 0;
+	fillStat(node, st);
+
+	return 0;
+}
+
+int MemFileSystem::stat(const char *path, struct stat *st) {
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	Node *node = findNode(normalizePath(path));
+	if (node == nullptr) {
+		errno = ENOENT;
+		return -1;
+	}
+	fillStat(*node, st);
+
+	return 0;
+}
+
+int MemFileSystem::rename(const char *from, const char *to) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::string pathFrom = normalizePath(from), pathTo = normalizePath(to);
+	std::string nameFrom, nameTo;
+
+	Node *node = findNode(pathFrom);
+	Node *parentFrom = findParent(pathFrom, nameFrom);
+	Node *parentTo = findParent(pathTo, nameTo);
+	if (node == nullptr || parentFrom == nullptr || parentTo == nullptr) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	/* Only files are moved, directories are never renamed on the card */
+	if (node->isDirectory) {
+		errno = EXDEV;
+		return -1;
+	}
+	if (pathFrom == pathTo) {
+		return 0;
+	}
+
+	Node *target = findNode(pathTo);
+	if (target != nullptr) {
+		if (target->isDirectory) {
+			errno = EISDIR;
+			return -1;
+		}
+		mUsedBytes -= toClusters(target->file->data.size()) * mClusterSize;
+	}
+
+	Node moved = *node;
+	parentFrom->children.erase(nameFrom);
+	mNodes.erase(pathFrom);
+	findParent(pathTo, nameTo)->children.insert(nameTo);
+	mNodes[pathTo] = moved;
+
+	return 0;
+}
+
+void MemFileSystem::removeNode(const std::string &path) {
+	auto it = mNodes.find(path);
+	if (it == mNodes.end()) {
+		return;
+	}
+
+	for (auto &child : it->second.children) {
+		removeNode((path == "/" ? "" : path) + "/" + child);
+	}
+
+	if (it->second.file) {
+		mUsedBytes -= toClusters(it->second.file->data.size()) * mClusterSize;
+		it->second.file->data.clear();
+	}
+	mNodes.erase(it);
+}
+
+int MemFileSystem::unlink(const char *path) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::string normalized = normalizePath(path);
+	std::string name;
+
+	Node *node = findNode(normalized);
+	Node *parent = findParent(normalized, name);
+	if (node == nullptr || parent == nullptr) {
+		errno = ENOENT;
+		return -1;
+	}
+	if (node->isDirectory && !node->children.empty()) {
+		errno = ENOTEMPTY;
+		return -1;
+	}
+
+	parent->children.erase(name);
+	removeNode(normalized);
+
+	return 0;
+}
+
+int MemFileSystem::mkdir(const char *path, mode_t) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::string normalized = normalizePath(path);
+	std::string name;
+
+	if (findNode(normalized) != nullptr) {
+		errno = EEXIST;
+		return -1;
+	}
+
+	Node *parent = findParent(normalized, name);
+	if (parent == nullptr) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	Node directory;
+	directory.isDirectory = true;
+	directory.ctime = getClock().now();
+	parent->children.insert(name);
+	mNodes[normalized] = directory;
+
+	return 0;
+}
+
+int MemFileSystem::removeAll(const char *path) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::string normalized = normalizePath(path);
+	std::string name;
+
+	Node *parent = findParent(normalized, name);
+	if (parent != nullptr) {
+		parent->children.erase(name);
+	}
+	removeNode(normalized);
+
+	return 0;
+}
+
+int MemFileSystem::listDirectory(const char *path, std::vector<DirEntry> &entries) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::string normalized = normalizePath(path);
+
+	Node *node = findNode(normalized);
+	if (node == nullptr || !node->isDirectory) {
+		errno = ENOTDIR;
+		return -1;
+	}
+
+	for (auto &child : node->children) {
+		Node *childNode = findNode((normalized == "/" ? "" : normalized) + "/" + child);
+		entries.push_back({ child, childNode != nullptr && childNode->isDirectory });
+	}
+
+	return 0;
+}
+
+int MemFileSystem::statfs(const char *path, FsInfo &info) {
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	memset(&info, 0, sizeof(info));
+	if (findNode(normalizePath(path)) == nullptr) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	info.total = mCapacity;
+	info.free  = mCapacity - std::min(mCapacity, mUsedBytes);
+	info.fsid  = 1;
+	info.type  = VFS_MSDOS_SUPER_MAGIC;
+
+	return 0;
+}
+
+uint64_t MemFileSystem::getUsedBytes() {
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mUsedBytes;
+}
+
+uint64_t MemFileSystem::getTotalWritten() {
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mTotalWritten;
+}
+
+int MemFileSystem::resolveAt(int dirfd, const char *name, std::string &path) {
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	if (name[0] == '/' || dirfd == AT_FDCWD) {
+		path.assign(name);
+		return 0;
+	}
+
+	OpenFile *openFile = findOpenFile(dirfd);
+	if (openFile == nullptr || openFile->file) {
+		errno = (openFile == nullptr) ? EBADF : ENOTDIR;
+		return -1;
+	}
+
+	path = (strcmp(name, ".") == 0) ? openFile->path : openFile->path + "/" + name;
+	return 0;
+}
+
+int MemFileSystem::openat(int dirfd, const char *name, int flags, mode_t mode) {
+	std::string path;
+	return (resolveAt(dirfd, name, path) == 0) ? open(path.c_str(), flags, mode) : -1;
+}
+
+int MemFileSystem::fstatat(int dirfd, const char *name, struct stat *st) {
+	std::string path;
+	return (resolveAt(dirfd, name, path) == 0) ? stat(path.c_str(), st) : -1;
+}
+
+int MemFileSystem::renameat(int fromDirfd, const char *from, int toDirfd, const char *to) {
+	std::string pathFrom, pathTo;
+	if (resolveAt(fromDirfd, from, pathFrom) != 0 || resolveAt(toDirfd, to, pathTo) != 0) {
+		return -1;
+	}
+
+	return rename(pathFrom.c_str(), pathTo.c_str());
+}
+
+int MemFileSystem::unlinkat(int dirfd, const char *name, int flags) {
+	std::string path;
+	struct stat st;
+
+	if (resolveAt(dirfd, name, path) != 0 || stat(path.c_str(), &st) != 0) {
+		return -1;
+	}
+	if (S_ISDIR(st.st_mode) != ((flags & AT_REMOVEDIR) != 0)) {
+		errno = S_ISDIR(st.st_mode) ? EISDIR : ENOTDIR;
+		return -1;
+	}
+
+	return unlink(path.c_str());
+}
+
+int MemFileSystem::mkdirat(int dirfd, const char *name, mode_t mode) {
+	std::string path;
+	return (resolveAt(dirfd, name, path) == 0) ? mkdir(path.c_str(), mode) : -1;
+}
+
+int MemFileSystem::visitDirectoryAt(int dirfd, const DirVisitor &visitor) {
+	std::vector<DirEntry> entries;
+	std::string path;
+
+	if (resolveAt(dirfd, ".", path) != 0 || listDirectory(path.c_str(), entries) != 0) {
+		return -1;
+	}
+
+	/* Visitor may call back into the filesystem, it runs unlocked */
+	for (auto &ent : entries) {
+		visitor(ent.name.c_str(), ent.isDirectory);
+	}
+
+	return 0;
+}
@@ -0,0 +1,223 @@
+/*
+    Injectable clock and filesystem.
+
+    Wall clock reads and card I/O of utils, recorder, SD Card catalog, segment index,
+    motion bitmap and thumbnail track go through getClock() and getFileSystem(). They
+    default to the system clock and POSIX. A scenario run swaps in SimulatedClock and
+    MemFileSystem to replay days of recording in a few seconds (see scenario.cpp).
+
+    Mount/format, staging tier, scrubber and playback reader work on block devices, copy
+    or map real files, they stay on POSIX.
+
+    setClock()/setFileSystem() MUST-BE called before any thread touches the card.
+*/
+#ifndef __VFS_H
+#define __VFS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#define VFS_MSDOS_SUPER_MAGIC               (0x4D44)
+
+typedef struct {
+    uint64_t total;         /* Bytes */
+    uint64_t free;
+    uint64_t fsid;          /* 0 if nothing is mounted */
+    uint64_t type;          /* f_type of statfs() */
+} FsInfo;
+
+typedef struct {
+    std::string name;
+    bool isDirectory;
+} DirEntry;
+
+/* Called per entry of a directory, "name" is valid only during the call */
+typedef std::function<void(const char *name, bool isDirectory)> DirVisitor;
+
+class IClock {
+public:
+    virtual ~IClock() { }
+    virtual time_t now() = 0;
+};
+
+class IFileSystem {
+public:
+    virtual ~IFileSystem() { }
+
+    virtual int open(const char *path, int flags, mode_t mode = 0) = 0;
+    virtual int close(int fd) = 0;
+    virtual ssize_t read(int fd, void *buf, size_t count) = 0;
+    virtual ssize_t write(int fd, const void *buf, size_t count) = 0;
+    virtual ssize_t writev(int fd, const struct iovec *iov, int iovcnt) = 0;
+    virtual ssize_t pread(int fd, void *buf, size_t count, off_t offset) = 0;
+    virtual ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset) = 0;
+    virtual int fsync(int fd) = 0;
+    virtual int fdatasync(int fd) = 0;
+    virtual int fstat(int fd, struct stat *st) = 0;
+    virtual int fallocate(int fd, int mode, off_t offset, off_t len) = 0;
+    virtual int ftruncate(int fd, off_t length) = 0;
+
+    virtual int stat(const char *path, struct stat *st) = 0;
+    virtual int rename(const char *from, const char *to) = 0;
+    virtual int unlink(const char *path) = 0;
+    virtual int mkdir(const char *path, mode_t mode) = 0;
+    virtual int removeAll(const char *path) = 0;
+    virtual int listDirectory(const char *path, std::vector<DirEntry> &entries) = 0;
+    virtual int statfs(const char *path, FsInfo &info) = 0;
+
+    /* Relative to an opened directory, the kernel doesn't walk the path from the root again */
+    virtual int openat(int dirfd, const char *name, int flags, mode_t mode = 0) = 0;
+    virtual int fstatat(int dirfd, const char *name, struct stat *st) = 0;
+    virtual int renameat(int fromDirfd, const char *from, int toDirfd, const char *to) = 0;
+    virtual int unlinkat(int dirfd, const char *name, int flags) = 0;
+    virtual int mkdirat(int dirfd, const char *name, mode_t mode) = 0;
+    virtual int visitDirectoryAt(int dirfd, const DirVisitor &visitor) = 0;
+};
+
+class SystemClock : public IClock {
+public:
+    time_t now() override;
+};
+
+/* Time only moves when it's told to */
+class SimulatedClock : public IClock {
+public:
+    SimulatedClock(time_t start);
+
+    time_t now() override;
+    void set(time_t timestamp);
+    void advance(time_t secs);
+
+private:
+    std::atomic<int64_t> mNow;
+};
+
+class PosixFileSystem : public IFileSystem {
+public:
+    int open(const char *path, int flags, mode_t mode = 0) override;
+    int close(int fd) override;
+    ssize_t read(int fd, void *buf, size_t count) override;
+    ssize_t write(int fd, const void *buf, size_t count) override;
+    ssize_t writev(int fd, const struct iovec *iov, int iovcnt) override;
+    ssize_t pread(int fd, void *buf, size_t count, off_t offset) override;
+    ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset) override;
+    int fsync(int fd) override;
+    int fdatasync(int fd) override;
+    int fstat(int fd, struct stat *st) override;
+    int fallocate(int fd, int mode, off_t offset, off_t len) override;
+    int ftruncate(int fd, off_t length) override;
+
+    int stat(const char *path, struct stat *st) override;
+    int rename(const char *from, const char *to) override;
+    int unlink(const char *path) override;
+    int mkdir(const char *path, mode_t mode) override;
+    int removeAll(const char *path) override;
+    int listDirectory(const char *path, std::vector<DirEntry> &entries) override;
+    int statfs(const char *path, FsInfo &info) override;
+
+    int openat(int dirfd, const char *name, int flags, mode_t mode = 0) override;
+    int fstatat(int dirfd, const char *name, struct stat *st) override;
+    int renameat(int fromDirfd, const char *from, int toDirfd, const char *to) override;
+    int unlinkat(int dirfd, const char *name, int flags) override;
+    int mkdirat(int dirfd, const char *name, mode_t mode) override;
+    int visitDirectoryAt(int dirfd, const DirVisitor &visitor) override;
+};
+
+/*  Files live in RAM, time stamps come from getClock(). Capacity is accounted in whole
+    clusters like FAT, a write beyond it fails with ENOSPC. Paths MUST-BE absolute.
+    fallocate() with FALLOC_FL_KEEP_SIZE only checks there's room, nothing is reserved.
+*/
+class MemFileSystem : public IFileSystem {
+public:
+    MemFileSystem(uint64_t capacityInBytes, uint32_t clusterSize = 32 * 1024);
+
+    int open(const char *path, int flags, mode_t mode = 0) override;
+    int close(int fd) override;
+    ssize_t read(int fd, void *buf, size_t count) override;
+    ssize_t write(int fd, const void *buf, size_t count) override;
+    ssize_t writev(int fd, const struct iovec *iov, int iovcnt) override;
+    ssize_t pread(int fd, void *buf, size_t count, off_t offset) override;
+    ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset) override;
+    int fsync(int fd) override;
+    int fdatasync(int fd) override;
+    int fstat(int fd, struct stat *st) override;
+    int fallocate(int fd, int mode, off_t offset, off_t len) override;
+    int ftruncate(int fd, off_t length) override;
+
+    int stat(const char *path, struct stat *st) override;
+    int rename(const char *from, const char *to) override;
+    int unlink(const char *path) override;
+    int mkdir(const char *path, mode_t mode) override;
+    int removeAll(const char *path) override;
+    int listDirectory(const char *path, std::vector<DirEntry> &entries) override;
+    int statfs(const char *path, FsInfo &info) override;
+
+    int openat(int dirfd, const char *name, int flags, mode_t mode = 0) override;
+    int fstatat(int dirfd, const char *name, struct stat *st) override;
+    int renameat(int fromDirfd, const char *from, int toDirfd, const char *to) override;
+    int unlinkat(int dirfd, const char *name, int flags) override;
+    int mkdirat(int dirfd, const char *name, mode_t mode) override;
+    int visitDirectoryAt(int dirfd, const DirVisitor &visitor) override;
+
+    uint64_t getUsedBytes();
+    uint64_t getTotalWritten();
+
+private:
+    typedef struct {
+        std::vector<uint8_t> data;
+        time_t ctime;
+        time_t mtime;
+    } File;
+
+    typedef struct {
+        bool isDirectory;
+        std::shared_ptr<File> file;
+        std::set<std::string> children;
+        time_t ctime;
+    } Node;
+
+    typedef struct {
+        std::shared_ptr<File> file;     /* Null for a directory */
+        off_t offset;
+        int flags;
+        std::string path;
+    } OpenFile;
+
+    std::mutex mMutex;
+    uint64_t mCapacity;
+    uint32_t mClusterSize;
+    uint64_t mUsedBytes = 0;
+    uint64_t mTotalWritten = 0;
+    int mNextFd = 3;
+    std::map<std::string, Node> mNodes;
+    std::map<int, OpenFile> mOpenFiles;
+
+    uint64_t toClusters(size_t size);
+    Node *findNode(const std::string &path);
+    Node *findParent(const std::string &path, std::string &name);
+    OpenFile *findOpenFile(int fd);
+    ssize_t writeAt(OpenFile &openFile, const void *buf, size_t count, off_t offset);
+    int resize(OpenFile &openFile, size_t newSize);
+    void fillStat(const Node &node, struct stat *st);
+    void removeNode(const std::string &path);
+    int resolveAt(int dirfd, const char *name, std::string &path);
+};
+
+extern IClock &getClock();
+extern void setClock(std::shared_ptr<IClock> clock);
+extern IFileSystem &getFileSystem();
+extern void setFileSystem(std::shared_ptr<IFileSystem> fileSystem);
+
+#endif /* __VFS_H */